@@ -89,13 +89,48 @@ void sipe_backend_debug(sipe_debug_level level,
 			const gchar *format,
 			...) G_GNUC_PRINTF(2, 3);
 
+typedef enum {
+	SIPE_DEBUG_CATEGORY_CORE      = 1 << 0,
+	SIPE_DEBUG_CATEGORY_TRANSPORT = 1 << 1,
+	SIPE_DEBUG_CATEGORY_HTTP      = 1 << 2,
+	SIPE_DEBUG_CATEGORY_XML       = 1 << 3,
+	SIPE_DEBUG_CATEGORY_PRESENCE  = 1 << 4,
+	SIPE_DEBUG_CATEGORY_MEDIA     = 1 << 5,
+} sipe_debug_category;
+#define SIPE_DEBUG_CATEGORY_ALL     ((1 << 6) - 1)
+
+/**
+ * Enabled debug categories
+ *
+ * Bit mask of sipe_debug_category values, 0 when debugging is disabled.
+ * Defined by the backend, which must update it whenever its debugging
+ * status changes. The SIPE_DEBUG_xxx() macros test it before evaluating
+ * their arguments.
+ */
+extern guint sipe_backend_debug_categories;
+
+/*
+ * Debug category of the SIPE_DEBUG_INFO() messages in a source file.
+ * Define before including this header to override the default.
+ * Warnings and errors are shown for all categories.
+ */
+#ifndef SIPE_DEBUG_CATEGORY
+#define SIPE_DEBUG_CATEGORY SIPE_DEBUG_CATEGORY_CORE
+#endif
+
+#define SIPE_DEBUG_IS_ENABLED(category) G_UNLIKELY(sipe_backend_debug_categories & (category))
+
 /* Convenience macros */
-#define SIPE_DEBUG_INFO(fmt, ...)        sipe_backend_debug(SIPE_DEBUG_LEVEL_INFO,    fmt, __VA_ARGS__)
-#define SIPE_DEBUG_INFO_NOFORMAT(msg)    sipe_backend_debug_literal(SIPE_DEBUG_LEVEL_INFO,    msg)
-#define SIPE_DEBUG_WARNING(fmt, ...)     sipe_backend_debug(SIPE_DEBUG_LEVEL_WARNING, fmt, __VA_ARGS__)
-#define SIPE_DEBUG_WARNING_NOFORMAT(msg) sipe_backend_debug_literal(SIPE_DEBUG_LEVEL_WARNING, msg)
-#define SIPE_DEBUG_ERROR(fmt, ...)       sipe_backend_debug(SIPE_DEBUG_LEVEL_ERROR,   fmt, __VA_ARGS__)
-#define SIPE_DEBUG_ERROR_NOFORMAT(msg)   sipe_backend_debug_literal(SIPE_DEBUG_LEVEL_ERROR,   msg)
+#define SIPE_DEBUG_LOG(category, level, fmt, ...) \
+	do { if (SIPE_DEBUG_IS_ENABLED(category)) sipe_backend_debug(level, fmt, __VA_ARGS__); } while (0)
+#define SIPE_DEBUG_LOG_NOFORMAT(category, level, msg) \
+	do { if (SIPE_DEBUG_IS_ENABLED(category)) sipe_backend_debug_literal(level, msg); } while (0)
+#define SIPE_DEBUG_INFO(fmt, ...)        SIPE_DEBUG_LOG(SIPE_DEBUG_CATEGORY,              SIPE_DEBUG_LEVEL_INFO,    fmt, __VA_ARGS__)
+#define SIPE_DEBUG_INFO_NOFORMAT(msg)    SIPE_DEBUG_LOG_NOFORMAT(SIPE_DEBUG_CATEGORY,     SIPE_DEBUG_LEVEL_INFO,    msg)
+#define SIPE_DEBUG_WARNING(fmt, ...)     SIPE_DEBUG_LOG(SIPE_DEBUG_CATEGORY_ALL,          SIPE_DEBUG_LEVEL_WARNING, fmt, __VA_ARGS__)
+#define SIPE_DEBUG_WARNING_NOFORMAT(msg) SIPE_DEBUG_LOG_NOFORMAT(SIPE_DEBUG_CATEGORY_ALL, SIPE_DEBUG_LEVEL_WARNING, msg)
+#define SIPE_DEBUG_ERROR(fmt, ...)       SIPE_DEBUG_LOG(SIPE_DEBUG_CATEGORY_ALL,          SIPE_DEBUG_LEVEL_ERROR,   fmt, __VA_ARGS__)
+#define SIPE_DEBUG_ERROR_NOFORMAT(msg)   SIPE_DEBUG_LOG_NOFORMAT(SIPE_DEBUG_CATEGORY_ALL, SIPE_DEBUG_LEVEL_ERROR,   msg)
 
 /**
  * Check backend debugging status
@@ -656,6 +691,29 @@ struct sipe_transport_connection *sipe_backend_transport_connect(struct sipe_cor
 void sipe_backend_transport_disconnect(struct sipe_transport_connection *conn);
 void sipe_backend_transport_message(struct sipe_transport_connection *conn,
 				    const gchar *buffer);
+
+/**
+ * Fragment of a message for sipe_backend_transport_message_vector()
+ */
+struct sipe_transport_vector {
+	const gchar *data;
+	gsize length;
+};
+
+/**
+ * Send a message that is split into several fragments
+ *
+ * Same as sipe_backend_transport_message(), but the caller doesn't need
+ * to join the fragments into a temporary buffer first. The fragments
+ * can be released after the function returns.
+ *
+ * @param conn   transport connection
+ * @param vector array of fragments
+ * @param count  number of fragments in @c vector
+ */
+void sipe_backend_transport_message_vector(struct sipe_transport_connection *conn,
+					   const struct sipe_transport_vector *vector,
+					   guint count);
 void sipe_backend_transport_flush(struct sipe_transport_connection *conn);
 
 /** USER *********************************************************************/
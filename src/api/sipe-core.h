@@ -51,20 +51,25 @@ extern "C" {
 /**
  * Transport connection (public part)
  *
- * The receiver in the backend fills "buffer". The backend has to zero
- * terminate the buffer before calling the processing function in the core.
+ * The receiver in the backend fills "buffer". Before each read it calls
+ * sipe_core_transport_buffer_reserve() to make room for the new data.
+ * The backend has to zero terminate the buffer before calling the
+ * processing function in the core. It releases the buffer with
+ * sipe_core_transport_buffer_free().
  *
- * The processing function in the core can remove content from the buffer.
- * It has to update buffer_used accordingly.
+ * The processing function in the core removes content from the start of
+ * the buffer by advancing "buffer" (see sipe_utils_shrink_buffer()), i.e.
+ * "buffer" does not necessarily point to the start of the allocation.
  *
  */
 struct sipe_transport_connection {
 	gpointer user_data;
-	gchar *buffer;
+	gchar *buffer;            /* unread data */
 	gsize buffer_used;        /* 0 < buffer_used < buffer_length */
-	gsize buffer_length;      /* read-only */
+	gsize buffer_length;      /* read-only: space at "buffer" */
 	guint type;               /* read-only */
 	guint client_port;        /* read-only */
+	gchar *buffer_start;      /* private: start of the allocation */
 };
 
 /**
@@ -111,7 +116,9 @@ struct sipe_backend_private;
  * Flags
  */
 /* user disabled calendar information publishing */
-#define SIPE_CORE_FLAG_DONT_PUBLISH 0x00000001
+#define SIPE_CORE_FLAG_DONT_PUBLISH    0x00000001
+/* user enabled persistent Web Ticket cache */
+#define SIPE_CORE_FLAG_WEBTICKET_CACHE 0x00000002
 
 #define SIPE_CORE_FLAG_IS(flag)    \
 	((sipe_public->flags & SIPE_CORE_FLAG_ ## flag) == SIPE_CORE_FLAG_ ## flag)
@@ -155,6 +162,17 @@ struct sipe_core_public {
 void sipe_core_init(const char *locale_dir);
 void sipe_core_destroy(void);
 
+/**
+ * Parse list of debug categories, e.g. from an environment variable
+ *
+ * @param string space, comma, colon or semicolon separated list of
+ *               "core", "transport", "http", "xml", "presence", "media"
+ *               or "all". Unknown names are ignored. May be @c NULL.
+ *
+ * @return bit mask of SIPE_DEBUG_CATEGORY_xxx, 0 if no category was found
+ */
+guint sipe_core_debug_categories(const gchar *string);
+
 /** Utility functions exported by the core to backends ***********************/
 gboolean sipe_strequal(const gchar *left, const gchar *right);
 
@@ -336,6 +354,27 @@ void sipe_core_transport_sip_connect(struct sipe_core_public *sipe_public,
  */
 const gchar *sipe_core_transport_sip_server_name(struct sipe_core_public *sipe_public);
 
+/**
+ * Make room in the receive buffer of a transport connection
+ *
+ * Ensures that at least @c size bytes plus the string terminator can be
+ * read into @c conn->buffer + @c conn->buffer_used. Space taken up by data
+ * the core has already consumed is reclaimed lazily, i.e. only when that
+ * is cheaper than growing the buffer. The buffer grows geometrically.
+ *
+ * @param conn transport connection
+ * @param size minimum number of bytes to read
+ */
+void sipe_core_transport_buffer_reserve(struct sipe_transport_connection *conn,
+					gsize size);
+
+/**
+ * Release the receive buffer of a transport connection
+ *
+ * @param conn transport connection
+ */
+void sipe_core_transport_buffer_free(struct sipe_transport_connection *conn);
+
 /**
  * Get chat ID, f.ex. group chat URI
  */
@@ -27,6 +27,7 @@
 
 #include <glib.h>
 
+#define SIPE_DEBUG_CATEGORY SIPE_DEBUG_CATEGORY_MEDIA
 #include "sipe-backend.h"
 #include "sipe-core.h"
 #include "sdpmsg.h"
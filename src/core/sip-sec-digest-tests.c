@@ -38,6 +38,8 @@ static const gchar *cnonce_fixed;
 /*
  * Stubs
  */
+guint sipe_backend_debug_categories = SIPE_DEBUG_CATEGORY_ALL;
+
 gboolean sipe_backend_debug_enabled(void)
 {
 	return(TRUE);
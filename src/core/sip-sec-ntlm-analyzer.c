@@ -41,6 +41,8 @@
 #include "sip-sec-ntlm.c"
 
 /* stub functions */
+guint sipe_backend_debug_categories = SIPE_DEBUG_CATEGORY_ALL;
+
 void sipe_backend_debug(SIPE_UNUSED_PARAMETER sipe_debug_level level,
 			const gchar *format,
 			...)
@@ -92,6 +92,172 @@ static void assert_equal_guint32(guint32 expected, guint32 got)
 	}
 }
 
+/* previous implementation of the signature input string */
+#define LEGACY_PART(s) ((s) ? (s) : "")
+static gchar *legacy_signature_input(struct sipmsg *msg,
+				     int version,
+				     const gchar *default_realm,
+				     const gchar *default_target)
+{
+	const gchar *call_id = sipmsg_find_header(msg, "Call-ID");
+	const gchar *expires = sipmsg_find_header(msg, "Expires");
+	const gchar *hdr;
+	gchar *protocol, *rand = NULL, *num = NULL, *realm, *target_name;
+	gchar *cseq = NULL, *from_url = NULL, *from_tag = NULL;
+	gchar *to_url = NULL, *to_tag = NULL;
+	gchar *sip_uri = NULL, *tel_uri = NULL;
+	gchar *response_str = NULL;
+	gchar *result = NULL;
+
+	if ((hdr = sipmsg_find_header(msg, "Proxy-Authorization")) ||
+	    (hdr = sipmsg_find_header(msg, "Proxy-Authentication-Info")) ||
+	    (hdr = sipmsg_find_header(msg, "Authentication-Info")) ) {
+		protocol    = sipmsg_find_part_of_header(hdr, NULL, " ", NULL);
+		rand        = sipmsg_find_part_of_header(hdr, "rand=\"", "\"", NULL);
+		num         = sipmsg_find_part_of_header(hdr, "num=\"", "\"", NULL);
+		realm       = sipmsg_find_part_of_header(hdr, "realm=\"", "\"", NULL);
+		target_name = sipmsg_find_part_of_header(hdr, "targetname=\"", "\"", NULL);
+	} else {
+		protocol    = NULL;
+		realm       = g_strdup(default_realm);
+		target_name = g_strdup(default_target);
+	}
+
+	hdr = sipmsg_find_header(msg, "CSeq");
+	if (hdr)
+		cseq = sipmsg_find_part_of_header(hdr, NULL, " ", NULL);
+	hdr = sipmsg_find_header(msg, "From");
+	if (hdr) {
+		from_url = sipmsg_find_part_of_header(hdr, "<", ">", NULL);
+		from_tag = sipmsg_find_part_of_header(hdr, ";tag=", ";", NULL);
+	}
+	hdr = sipmsg_find_header(msg, "To");
+	if (hdr) {
+		to_url = sipmsg_find_part_of_header(hdr, "<", ">", NULL);
+		to_tag = sipmsg_find_part_of_header(hdr, ";tag=", ";", NULL);
+	}
+	hdr = sipmsg_find_header(msg, "P-Asserted-Identity");
+	if (!hdr)
+		hdr = sipmsg_find_header(msg, "P-Preferred-Identity");
+	if (hdr)
+		sipmsg_parse_p_asserted_identity(hdr, &sip_uri, &tel_uri);
+
+	if (realm) {
+		if (msg->response)
+			response_str = g_strdup_printf("<%d>", msg->response);
+		if (version < 3)
+			result = g_strdup_printf("<%s><%s><%s><%s><%s><%s><%s><%s><%s><%s><%s><%s>%s",
+						 LEGACY_PART(protocol), LEGACY_PART(rand), LEGACY_PART(num),
+						 realm, LEGACY_PART(target_name), LEGACY_PART(call_id),
+						 LEGACY_PART(cseq), LEGACY_PART(msg->method),
+						 LEGACY_PART(from_url), LEGACY_PART(from_tag),
+						 LEGACY_PART(to_tag), LEGACY_PART(expires),
+						 LEGACY_PART(response_str));
+		else
+			result = g_strdup_printf("<%s><%s><%s><%s><%s><%s><%s><%s><%s><%s><%s><%s><%s><%s><%s>%s",
+						 LEGACY_PART(protocol), LEGACY_PART(rand), LEGACY_PART(num),
+						 realm, LEGACY_PART(target_name), LEGACY_PART(call_id),
+						 LEGACY_PART(cseq), LEGACY_PART(msg->method),
+						 LEGACY_PART(from_url), LEGACY_PART(from_tag),
+						 LEGACY_PART(to_url), LEGACY_PART(to_tag),
+						 LEGACY_PART(sip_uri), LEGACY_PART(tel_uri),
+						 LEGACY_PART(expires), LEGACY_PART(response_str));
+	}
+
+	g_free(response_str);
+	g_free(tel_uri);
+	g_free(sip_uri);
+	g_free(to_tag);
+	g_free(to_url);
+	g_free(from_tag);
+	g_free(from_url);
+	g_free(cseq);
+	g_free(target_name);
+	g_free(realm);
+	g_free(num);
+	g_free(rand);
+	g_free(protocol);
+
+	return(result);
+}
+
+/* signature verification as done in sip_transport_input() */
+static void benchmark_signature(const gchar *label,
+				const gchar *message,
+				int version,
+				const gchar *target,
+				guint32 flags,
+				guchar *sign_key,
+				guchar *seal_key,
+				guint rounds)
+{
+	struct sipmsg *msg = sipmsg_parse_msg(message);
+	struct ntlm_signing signing = { NULL, { 0 } };
+	struct sipmsg_breakdown msgbd;
+	GString *buffer = g_string_sized_new(512);
+	GTimer *timer = g_timer_new();
+	guint debug_categories = sipe_backend_debug_categories;
+	gdouble elapsed_legacy, elapsed_fast;
+	guint32 legacy_mac[4], fast_mac[4];
+	gchar *legacy, *expected;
+	guint round;
+
+	printf("\n\nBenchmarking signature verification: %s\n", label);
+
+	/* both implementations must create the same signature input */
+	legacy = legacy_signature_input(msg, version, "SIP Communications Service", target);
+	msgbd.msg = msg;
+	sipmsg_breakdown_parse(&msgbd, "SIP Communications Service", target, NULL);
+	sipmsg_breakdown_append_string(version, &msgbd, buffer);
+	assert_equal(legacy, buffer->str, strlen(legacy) + 1, FALSE);
+
+	/* no debug output while measuring */
+	sipe_backend_debug_categories = 0;
+
+	g_timer_start(timer);
+	for (round = 0; round < rounds; round++) {
+		gchar *input = legacy_signature_input(msg, version, "SIP Communications Service", target);
+		gchar *hex;
+
+		MAC(flags, input, strlen(input), sign_key, 16, seal_key, 16, 0, 100, legacy_mac);
+		hex = buff_to_hex_str((guint8 *)legacy_mac, 16);
+		g_free(hex);
+		g_free(input);
+	}
+	elapsed_legacy = g_timer_elapsed(timer, NULL);
+
+	sip_sec_ntlm_signing_init(&signing, flags, sign_key, seal_key);
+	g_timer_start(timer);
+	for (round = 0; round < rounds; round++) {
+		sipmsg_breakdown_parse(&msgbd, "SIP Communications Service", target, NULL);
+		g_string_truncate(buffer, 0);
+		sipmsg_breakdown_append_string(version, &msgbd, buffer);
+		sip_sec_ntlm_signing_mac(&signing, flags, buffer->str, buffer->len, 0, fast_mac);
+	}
+	elapsed_fast = g_timer_elapsed(timer, NULL);
+
+	sipe_backend_debug_categories = debug_categories;
+
+	expected = buff_to_hex_str((guint8 *)legacy_mac, 16);
+	assert_equal(expected, fast_mac, 16, TRUE);
+	g_free(expected);
+
+	printf("%-32s %8.3f ms %12.1f signatures/s\n",
+	       "signature (one-shot)",
+	       elapsed_legacy * 1000,
+	       elapsed_legacy > 0 ? rounds / elapsed_legacy : 0);
+	printf("%-32s %8.3f ms %12.1f signatures/s\n",
+	       "signature (pre-computed)",
+	       elapsed_fast * 1000,
+	       elapsed_fast > 0 ? rounds / elapsed_fast : 0);
+
+	sip_sec_ntlm_signing_free(&signing);
+	g_timer_destroy(timer);
+	g_string_free(buffer, TRUE);
+	sipmsg_free(msg);
+	g_free(legacy);
+}
+
 gboolean sip_sec_ntlm_tests(void)
 {
 	const char *password;
@@ -500,9 +666,14 @@ Response:
 	msg_str = sipmsg_breakdown_get_string(2, &msgbd);
 	sip_sec_ntlm_sipe_signature_make (NEGOTIATE_FLAGS_CONNLESS & ~NTLMSSP_NEGOTIATE_EXTENDED_SESSIONSECURITY,
 		msg_str, 0, exported_session_key2, exported_session_key2, mac);
-	sipmsg_breakdown_free(&msgbd);
 	assert_equal ("0100000000000000BF2E52667DDF6DED", mac, 16, TRUE);
 	/* sig = buff_to_hex_str((guint8 *)mac, 16); */
+
+	benchmark_signature("MS-SIPE (CRC32)",
+			    msg2, 2, "ocs1.ocs.provo.novell.com",
+			    NEGOTIATE_FLAGS_CONNLESS & ~NTLMSSP_NEGOTIATE_EXTENDED_SESSIONSECURITY,
+			    exported_session_key2, exported_session_key2,
+			    100000);
 	}
 
 
@@ -758,7 +929,6 @@ Message (length 352):
 	msg_str = sipmsg_breakdown_get_string(4, &msgbd);
 	assert_equal (request_sig, (guchar *)msg_str, strlen(request_sig), FALSE);
 	sip_sec_ntlm_sipe_signature_make (flags, msg_str, 0, client_sign_key, client_seal_key, mac);
-	sipmsg_breakdown_free(&msgbd);
 	assert_equal ("0100000029618e9651b65a7764000000", mac, 16, TRUE);
 	/* sig = buff_to_hex_str((guint8 *)mac, 16); */
 
@@ -771,7 +941,6 @@ Message (length 352):
 	assert_equal (response_sig, (guchar *)msg_str, strlen(response_sig), FALSE);
 	// server keys here
 	sip_sec_ntlm_sipe_signature_make (flags, msg_str, 0, server_sign_key, server_seal_key, mac);
-	sipmsg_breakdown_free(&msgbd);
 	assert_equal ("01000000E615438A917661BE64000000", mac, 16, TRUE);
 	/* sig = buff_to_hex_str((guint8 *)mac, 16); */
 
@@ -783,6 +952,11 @@ Message (length 352):
 	MAC (flags,   (gchar*)response_sig,strlen(response_sig),   server_sign_key,16,   server_seal_key,16,   0,  100, mac);
 	assert_equal("01000000E615438A917661BE64000000", mac, 16, TRUE);
 
+	benchmark_signature("NTLMv2 / OC 2007 R2 (HMAC-MD5)",
+			    response, 4, "cosmo-ocs-r2.cosmo.local",
+			    flags, server_sign_key, server_seal_key,
+			    100000);
+
 	printf ("\n\nTesting (NTLMv2 / OC 2007 R2) Type3 generation test\n");
 	{
 	guchar *client_sign_key2;
@@ -858,7 +1032,6 @@ Message (length 352):
 
 	assert_equal (response_sig, (guchar *)msg_str, strlen(response_sig), FALSE);
 
-	sipmsg_breakdown_free(&msgbd);
 	}
 
 ////// UUID tests ///////
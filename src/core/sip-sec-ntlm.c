@@ -65,6 +65,7 @@
 #include "sip-sec-mech.h"
 #include "sip-sec-ntlm.h"
 #include "sipe-backend.h"
+#include "sipe-crc32.h"
 #include "sipe-crypt.h"
 #include "sipe-digest.h"
 #include "sipe-utils.h"
@@ -337,49 +338,10 @@ unicode_strconvcopy_back(const gchar *source, gsize len)
 /* Analyzer only needs the _describe() functions */
 #ifndef _SIPE_COMPILING_ANALYZER
 
-/* crc32 source copy from gg's common.c */
-static guint32 crc32_table[256];
-static int crc32_initialized = 0;
-
-static void crc32_make_table()
-{
-	guint32 h = 1;
-	unsigned int i, j;
-
-	memset(crc32_table, 0, sizeof(crc32_table));
-
-	for (i = 128; i; i >>= 1) {
-		h = (h >> 1) ^ ((h & 1) ? 0xedb88320L : 0);
-
-		for (j = 0; j < 256; j += 2 * i)
-			crc32_table[i + j] = crc32_table[j] ^ h;
-	}
-
-	crc32_initialized = 1;
-}
-
-static guint32 crc32(guint32 crc, const guint8 *buf, int len)
-{
-	if (!crc32_initialized)
-		crc32_make_table();
-
-	if (!buf || len < 0)
-		return crc;
-
-	crc ^= 0xffffffffL;
-
-	while (len--)
-		crc = (crc >> 8) ^ crc32_table[(crc ^ *buf++) & 0xff];
-
-	return crc ^ 0xffffffffL;
-}
-
 static guint32
 CRC32 (const char *msg, int len)
 {
-	guint32 crc = 0L;
-	crc = crc32(crc, (guint8 *) msg, len);
-	return crc;
+	return(sipe_crc32(0, (const guchar *) msg, len));
 }
 
 /* Cyphers */
@@ -842,6 +804,7 @@ SeqNum    (4 bytes): A 32-bit unsigned integer that contains the NTLM sequence n
 Version(4), Checksum(8),  SeqNum(4)			-- for ext.sess.sec.
 Version(4), RandomPad(4), Checksum(4), SeqNum(4)
 */
+#ifdef _SIPE_COMPILING_TESTS
 /** MAC(Handle, SigningKey, SeqNum, Message) */
 /* out 16 bytes */
 static void
@@ -936,6 +899,7 @@ MAC (guint32 flags,
 		res_ptr[1] = GUINT32_TO_LE(random_pad); // 4 bytes
 	}
 }
+#endif
 
 /* End Core NTLM Methods */
 
@@ -1294,6 +1258,123 @@ sip_sec_ntlm_gen_negotiate(SipSecBuffer *out_buff)
 	out_buff->length = msglen;
 }
 
+/*
+ * Pre-computed signing state for one direction
+ *
+ * SIPE always uses the same sequence number and RC4 is re-keyed with the
+ * same sealing key for every signature. I.e. the RC4 key stream is the
+ * same for every message and only needs to be calculated once.
+ */
+#define NTLM_SIPE_SEQUENCE 100
+
+struct ntlm_signing {
+	gpointer hmac_context;  /* HMAC_MD5(SigningKey), keyed once */
+	guchar key_stream[12];  /* RC4(SealingKey') */
+};
+
+static void
+sip_sec_ntlm_signing_free(struct ntlm_signing *signing)
+{
+	if (signing->hmac_context) {
+		sipe_digest_hmac_destroy(signing->hmac_context);
+		signing->hmac_context = NULL;
+	}
+}
+
+static void
+sip_sec_ntlm_signing_init(struct ntlm_signing *signing,
+			  guint32 flags,
+			  const guchar *sign_key,
+			  const guchar *seal_key)
+{
+	static const guchar zeros[sizeof(signing->key_stream)] = { 0 };
+	unsigned char seal_key_[16];
+
+	sip_sec_ntlm_signing_free(signing);
+
+	/* see MAC() */
+	if (IS_FLAG(flags, NTLMSSP_NEGOTIATE_EXTENDED_SESSIONSECURITY)) {
+		SIPE_DEBUG_INFO("NTLM signing: Extented Session Security, %s Key Exchange",
+				IS_FLAG(flags, NTLMSSP_NEGOTIATE_KEY_EXCH) ? "with" : "*NO*");
+
+		if (IS_FLAG(flags, NTLMSSP_NEGOTIATE_DATAGRAM)) {
+			guint32 tmp[4+1];
+
+			memcpy(tmp, seal_key, 16);
+			tmp[4] = GUINT32_TO_LE(NTLM_SIPE_SEQUENCE);
+			MD5 ((guchar *)tmp, sizeof(tmp), seal_key_);
+		} else {
+			memcpy(seal_key_, seal_key, 16);
+		}
+
+		signing->hmac_context = sipe_digest_hmac_md5_start(sign_key, 16);
+	} else {
+		SIPE_DEBUG_INFO_NOFORMAT("NTLM signing: *NO* Extented Session Security");
+		memcpy(seal_key_, seal_key, 16);
+	}
+
+	RC4K(seal_key_, 16, zeros, sizeof(zeros), signing->key_stream);
+}
+
+/* same as MAC() with SIPE sequence number, but doesn't allocate memory */
+static void
+sip_sec_ntlm_signing_mac(const struct ntlm_signing *signing,
+			 guint32 flags,
+			 const char *msg,
+			 gsize msg_len,
+			 guint32 random_pad,
+			 guint32 *result)
+{
+	guchar *encrypted = (guchar *)(result + 1);
+	guint i;
+
+	if (IS_FLAG(flags, NTLMSSP_NEGOTIATE_EXTENDED_SESSIONSECURITY)) {
+		guint32 sequence = GUINT32_TO_LE(NTLM_SIPE_SEQUENCE);
+		guchar hmac[16];
+
+		/* HMAC_MD5(SigningKey, ConcatenationOf(SeqNum, Message)) */
+		sipe_digest_hmac_update(signing->hmac_context,
+					(guchar *)&sequence, sizeof(sequence));
+		sipe_digest_hmac_update(signing->hmac_context,
+					(const guchar *)msg, msg_len);
+		sipe_digest_hmac_end(signing->hmac_context, hmac);
+
+		result[0] = GUINT32_TO_LE(1);
+		result[3] = sequence;
+
+		if (IS_FLAG(flags, NTLMSSP_NEGOTIATE_KEY_EXCH)) {
+			for (i = 0; i < 8; i++)
+				encrypted[i] = hmac[i] ^ signing->key_stream[i];
+		} else {
+			memcpy(encrypted, hmac, 8);
+		}
+	} else {
+		guint32 crc = CRC32(msg, msg_len);
+		guint32 plaintext [] = {
+			GUINT32_TO_LE(0),
+			GUINT32_TO_LE(crc),
+			GUINT32_TO_LE(NTLM_SIPE_SEQUENCE)
+		}; // 4, 4, 4 bytes
+		const guchar *bytes = (const guchar *)plaintext;
+
+		for (i = 0; i < sizeof(plaintext); i++)
+			encrypted[i] = bytes[i] ^ signing->key_stream[i];
+
+		// Highest four bytes are the Version
+		result[0] = GUINT32_TO_LE(0x00000001); // 4 bytes
+
+		// Replace the first four bytes of the ciphertext with the random_pad
+		result[1] = GUINT32_TO_LE(random_pad); // 4 bytes
+	}
+
+	if (SIPE_DEBUG_IS_ENABLED(SIPE_DEBUG_CATEGORY)) {
+		char *res = buff_to_hex_str((guint8 *)result, 16);
+		SIPE_DEBUG_INFO("NTLM calculated MAC: %s", res);
+		g_free(res);
+	}
+}
+
+#ifdef _SIPE_COMPILING_TESTS
 static void
 sip_sec_ntlm_sipe_signature_make(guint32 flags,
 				 const char *msg,
@@ -1302,14 +1383,13 @@ sip_sec_ntlm_sipe_signature_make(guint32 flags,
 				 unsigned char *seal_key,
 				 guint32 *result)
 {
-	char *res;
-
-	MAC(flags, msg, strlen(msg), sign_key, 16, seal_key, 16, random_pad, 100, result);
+	struct ntlm_signing signing = { NULL, { 0 } };
 
-	res = buff_to_hex_str((guint8 *)result, 16);
-	SIPE_DEBUG_INFO("NTLM calculated MAC: %s", res);
-	g_free(res);
+	sip_sec_ntlm_signing_init(&signing, flags, sign_key, seal_key);
+	sip_sec_ntlm_signing_mac(&signing, flags, msg, strlen(msg), random_pad, result);
+	sip_sec_ntlm_signing_free(&signing);
 }
+#endif
 
 #endif /* !_SIPE_COMPILING_ANALYZER */
 
@@ -1706,10 +1786,8 @@ typedef struct _context_ntlm {
 	gchar *domain;
 	gchar *username;
 	const gchar *password;
-	guchar *client_sign_key;
-	guchar *server_sign_key;
-	guchar *client_seal_key;
-	guchar *server_seal_key;
+	struct ntlm_signing client_signing;
+	struct ntlm_signing server_signing;
 	guint32 flags;
 } *context_ntlm;
 
@@ -1846,17 +1924,18 @@ sip_sec_init_sec_context__ntlm(SipSecContext context,
 
 		sip_sec_ntlm_message_describe(out_buff, "Authenticate");
 
-		g_free(ctx->client_sign_key);
-		ctx->client_sign_key = client_sign_key;
-
-		g_free(ctx->server_sign_key);
-		ctx->server_sign_key = server_sign_key;
-
-		g_free(ctx->client_seal_key);
-		ctx->client_seal_key = client_seal_key;
-
-		g_free(ctx->server_seal_key);
-		ctx->server_seal_key = server_seal_key;
+		sip_sec_ntlm_signing_init(&ctx->client_signing,
+					  flags,
+					  client_sign_key,
+					  client_seal_key);
+		sip_sec_ntlm_signing_init(&ctx->server_signing,
+					  flags,
+					  server_sign_key,
+					  server_seal_key);
+		g_free(client_sign_key);
+		g_free(server_sign_key);
+		g_free(client_seal_key);
+		g_free(server_seal_key);
 
 		ctx->flags = flags;
 
@@ -1876,19 +1955,21 @@ sip_sec_make_signature__ntlm(SipSecContext context,
 			     const gchar *message,
 			     SipSecBuffer *signature)
 {
+	context_ntlm ctx = (context_ntlm) context;
+
 	signature->length = 16;
 	signature->value = g_malloc0(16);
 
 	/* FIXME? We always use a random_pad of 0 */
-	sip_sec_ntlm_sipe_signature_make(((context_ntlm) context)->flags,
-					 message,
-					 0,
-					 ((context_ntlm) context)->client_sign_key,
-					 ((context_ntlm) context)->client_seal_key,
-					 /* SipSecBuffer.value is g_malloc()'d:
-					  * use (void *) to remove guint8 alignment
-					  */
-					 (void *)signature->value);
+	sip_sec_ntlm_signing_mac(&ctx->client_signing,
+				 ctx->flags,
+				 message,
+				 strlen(message),
+				 0,
+				 /* SipSecBuffer.value is g_malloc()'d:
+				  * use (void *) to remove guint8 alignment
+				  */
+				 (void *)signature->value);
 	return TRUE;
 }
 
@@ -1906,12 +1987,12 @@ sip_sec_verify_signature__ntlm(SipSecContext context,
 	/* SipSecBuffer.value is g_malloc()'d: use (void *) to remove guint8 alignment */
 	guint32 random_pad = GUINT32_FROM_LE(((guint32 *)((void *)signature.value))[1]);
 
-	sip_sec_ntlm_sipe_signature_make(ctx->flags,
-					 message,
-					 random_pad,
-					 ctx->server_sign_key,
-					 ctx->server_seal_key,
-					 mac);
+	sip_sec_ntlm_signing_mac(&ctx->server_signing,
+				 ctx->flags,
+				 message,
+				 strlen(message),
+				 random_pad,
+				 mac);
 	return(memcmp(signature.value, mac, 16) == 0);
 }
 
@@ -1920,10 +2001,8 @@ sip_sec_destroy_sec_context__ntlm(SipSecContext context)
 {
 	context_ntlm ctx = (context_ntlm) context;
 
-	g_free(ctx->client_sign_key);
-	g_free(ctx->server_sign_key);
-	g_free(ctx->client_seal_key);
-	g_free(ctx->server_seal_key);
+	sip_sec_ntlm_signing_free(&ctx->client_signing);
+	sip_sec_ntlm_signing_free(&ctx->server_signing);
 	g_free(ctx->domain);
 	g_free(ctx->username);
 	g_free(ctx);
@@ -66,6 +66,7 @@
 #include "sip-sec.h"
 #include "sip-sec-digest.h"
 #include "sip-transport.h"
+#define SIPE_DEBUG_CATEGORY SIPE_DEBUG_CATEGORY_TRANSPORT
 #include "sipe-backend.h"
 #include "sipe-core.h"
 #include "sipe-core-private.h"
@@ -105,7 +106,7 @@ struct sip_transport {
 
 	gchar *user_agent;
 
-	GSList *transactions;
+	GHashTable *transactions;    /* transaction_key -> transaction */
 
 	struct sip_auth registrar;
 	struct sip_auth proxy;
@@ -116,6 +117,11 @@ struct sip_transport {
 	guint keepalive_timeout;
 	time_t last_message;
 
+	struct sipmsg_framer framer; /* partially received message */
+	gchar *framer_header;        /* header of body received in place (debug) */
+
+	GString *signature_input;    /* re-used for every signed message */
+
 	gboolean processing_input;   /* whether full header received */
 	gboolean auth_incomplete;    /* whether authentication not completed */
 	gboolean auth_retry;         /* whether next authentication should be tried */
@@ -158,31 +164,49 @@ static void sipe_auth_free(struct sip_auth *auth)
 	auth->gssapi_context = NULL;
 }
 
+static const gchar *signature_input(struct sip_transport *transport,
+				    const struct sipmsg_breakdown *msgbd)
+{
+	if (transport->signature_input)
+		g_string_truncate(transport->signature_input, 0);
+	else
+		transport->signature_input = g_string_sized_new(512);
+
+	if (!sipmsg_breakdown_append_string(transport->registrar.version,
+					    msgbd,
+					    transport->signature_input))
+		return(NULL);
+
+	return(transport->signature_input->str);
+}
+
 static void sipe_make_signature(struct sipe_core_private *sipe_private,
 				struct sipmsg *msg)
 {
 	struct sip_transport *transport = sipe_private->transport;
 	if (sip_sec_context_is_ready(transport->registrar.gssapi_context)) {
 		struct sipmsg_breakdown msgbd;
-		gchar *signature_input_str;
+		const gchar *signature_input_str;
+		gchar rand[8 + 1];
+		gchar num[10 + 1];
 		msgbd.msg = msg;
 		sipmsg_breakdown_parse(&msgbd, transport->registrar.realm, transport->registrar.target,
 				       transport->registrar.protocol);
-		msgbd.rand = g_strdup_printf("%08x", g_random_int());
+		g_snprintf(rand, sizeof(rand), "%08x", g_random_int());
+		sipmsg_breakdown_set(&msgbd.rand, rand);
 		transport->registrar.ntlm_num++;
-		msgbd.num = g_strdup_printf("%d", transport->registrar.ntlm_num);
-		signature_input_str = sipmsg_breakdown_get_string(transport->registrar.version, &msgbd);
+		g_snprintf(num, sizeof(num), "%u", transport->registrar.ntlm_num);
+		sipmsg_breakdown_set(&msgbd.num, num);
+		signature_input_str = signature_input(transport, &msgbd);
 		if (signature_input_str != NULL) {
 			char *signature_hex = sip_sec_make_signature(transport->registrar.gssapi_context, signature_input_str);
 			g_free(msg->signature);
 			msg->signature = signature_hex;
 			g_free(msg->rand);
-			msg->rand = g_strdup(msgbd.rand);
+			msg->rand = g_strdup(rand);
 			g_free(msg->num);
-			msg->num = g_strdup(msgbd.num);
-			g_free(signature_input_str);
+			msg->num = g_strdup(num);
 		}
-		sipmsg_breakdown_free(&msgbd);
 	}
 }
 
@@ -566,6 +590,33 @@ static void send_sip_message(struct sip_transport *transport,
 	sipe_backend_transport_message(transport->connection, string);
 }
 
+/* same as send_sip_message() but without joining the fragments */
+static void send_sip_message_vector(struct sip_transport *transport,
+				    const struct sipmsg_vector *vector)
+{
+	if (SIPE_DEBUG_IS_ENABLED(SIPE_DEBUG_CATEGORY)) {
+		gchar *string = sipmsg_vector_to_string(vector);
+		sipe_utils_message_debug("SIP", string, NULL, TRUE);
+		g_free(string);
+	}
+	transport->last_message = time(NULL);
+	sipe_backend_transport_message_vector(transport->connection,
+					      &g_array_index(vector->fragments,
+							     struct sipe_transport_vector,
+							     0),
+					      vector->fragments->len);
+}
+
+static void send_sip_message_msg(struct sip_transport *transport,
+				 const struct sipmsg *msg)
+{
+	struct sipmsg_vector vector;
+
+	sipmsg_to_vector(&vector, msg);
+	send_sip_message_vector(transport, &vector);
+	sipmsg_vector_clear(&vector);
+}
+
 static void start_keepalive_timer(struct sipe_core_private *sipe_private,
 				  guint seconds);
 static void keepalive_timeout(struct sipe_core_private *sipe_private,
@@ -603,11 +654,8 @@ void sip_transport_response(struct sipe_core_private *sipe_private,
 			    const char *text,
 			    const char *body)
 {
-	gchar *name;
-	gchar *value;
-	GString *outstr = g_string_new("");
+	struct sipmsg_vector vector;
 	gchar *contact;
-	GSList *tmp;
 	static const gchar *keepers[] = { "To", "From", "Call-ID", "CSeq", "Via", "Record-Route", NULL };
 
 	/* Can return NULL! */
@@ -633,69 +681,163 @@ void sip_transport_response(struct sipe_core_private *sipe_private,
 	sipmsg_merge_new_headers(msg);
 	sign_outgoing_message(sipe_private, msg);
 
-	g_string_append_printf(outstr, "SIP/2.0 %d %s\r\n", code, text);
-	tmp = msg->headers;
-	while (tmp) {
-		name = ((struct sipnameval*) (tmp->data))->name;
-		value = ((struct sipnameval*) (tmp->data))->value;
+	sipmsg_vector_init(&vector, 4 * g_slist_length(msg->headers) + 4);
+	g_snprintf(vector.status, sizeof(vector.status), "SIP/2.0 %d ", code);
+	sipmsg_vector_append(&vector, vector.status, strlen(vector.status));
+	sipmsg_vector_append(&vector, text, strlen(text));
+	sipmsg_vector_append(&vector, "\r\n", 2);
+	sipmsg_vector_append_headers(&vector, msg);
+	sipmsg_vector_append(&vector, "\r\n", 2);
+	if (body)
+		sipmsg_vector_append(&vector, body, strlen(body));
+	send_sip_message_vector(sipe_private->transport, &vector);
+	sipmsg_vector_clear(&vector);
+}
+
+/*
+ * Transaction index key
+ *
+ * Points either into transaction->key ("<Call-ID><CSeq>") or directly
+ * into the headers of a received message, so that a lookup doesn't need
+ * to allocate memory.
+ */
+struct transaction_key {
+	const gchar *call_id;
+	gsize call_id_length;
+	const gchar *cseq;
+	gsize cseq_length;
+};
+
+static guint transaction_key_hash(gconstpointer key)
+{
+	const struct transaction_key *k = key;
+	guint hash = sipe_utils_ascii_strcase_hash_add(SIPE_UTILS_ASCII_STRCASE_HASH_INIT,
+						       k->call_id,
+						       k->call_id_length);
+	return(sipe_utils_ascii_strcase_hash_add(hash,
+						 k->cseq,
+						 k->cseq_length));
+}
+
+static gboolean transaction_key_equal(gconstpointer a,
+				      gconstpointer b)
+{
+	const struct transaction_key *ka = a;
+	const struct transaction_key *kb = b;
+	return((ka->call_id_length == kb->call_id_length) &&
+	       (ka->cseq_length    == kb->cseq_length)    &&
+	       !g_ascii_strncasecmp(ka->call_id, kb->call_id, ka->call_id_length) &&
+	       !g_ascii_strncasecmp(ka->cseq,    kb->cseq,    ka->cseq_length));
+}
 
-		g_string_append_printf(outstr, "%s: %s\r\n", name, value);
-		tmp = g_slist_next(tmp);
+static void transaction_key_from_trans(struct transaction_key *key,
+				       const struct transaction *trans)
+{
+	/* trans->key format: <Call-ID><CSeq> */
+	const gchar *cseq;
+
+	key->call_id        = trans->key + 1;
+	cseq                = strstr(key->call_id, "><");
+	key->call_id_length = cseq - key->call_id;
+	key->cseq           = cseq + 2;
+	key->cseq_length    = strlen(key->cseq) - 1;
+}
+
+static void transaction_free(struct sipe_core_private *sipe_private,
+			     struct transaction *trans)
+{
+	if (trans->msg) sipmsg_free(trans->msg);
+	if (trans->payload) {
+		if (trans->payload->destroy)
+			(*trans->payload->destroy)(trans->payload->data);
+		g_free(trans->payload);
 	}
-	g_string_append_printf(outstr, "\r\n%s", body ? body : "");
-	send_sip_message(sipe_private->transport, outstr->str);
-	g_string_free(outstr, TRUE);
+	g_free(trans->key);
+	if (trans->timeout_key) {
+		sipe_schedule_cancel(sipe_private, trans->timeout_key);
+		g_free(trans->timeout_key);
+	}
+	g_free(trans);
+}
+
+static void transactions_add(struct sipe_core_private *sipe_private,
+			     struct transaction *trans)
+{
+	struct sip_transport *transport = sipe_private->transport;
+	struct transaction_key *key = g_new(struct transaction_key, 1);
+	struct transaction *old;
+
+	if (!transport->transactions)
+		transport->transactions = g_hash_table_new_full(transaction_key_hash,
+								transaction_key_equal,
+								g_free,
+								NULL);
+
+	transaction_key_from_trans(key, trans);
+
+	/*
+	 * Call-ID+CSeq must be unique. A collision means that the previous
+	 * transaction could never be matched against a response again, i.e.
+	 * drop it now instead of leaking it.
+	 */
+	old = g_hash_table_lookup(transport->transactions, key);
+	if (old) {
+		SIPE_DEBUG_ERROR("transactions_add: duplicate transaction %s, dropping previous one",
+				 trans->key);
+		g_hash_table_remove(transport->transactions, key);
+		transaction_free(sipe_private, old);
+	}
+
+	g_hash_table_insert(transport->transactions, key, trans);
+	SIPE_DEBUG_INFO("SIP transactions count:%u after addition",
+			g_hash_table_size(transport->transactions));
 }
 
 static void transactions_remove(struct sipe_core_private *sipe_private,
 				struct transaction *trans)
 {
 	struct sip_transport *transport = sipe_private->transport;
-	if (transport->transactions) {
-		transport->transactions = g_slist_remove(transport->transactions,
-							 trans);
-		SIPE_DEBUG_INFO("SIP transactions count:%d after removal", g_slist_length(transport->transactions));
-
-		if (trans->msg) sipmsg_free(trans->msg);
-		if (trans->payload) {
-			if (trans->payload->destroy)
-				(*trans->payload->destroy)(trans->payload->data);
-			g_free(trans->payload);
-		}
-		g_free(trans->key);
-		if (trans->timeout_key) {
-			sipe_schedule_cancel(sipe_private, trans->timeout_key);
-			g_free(trans->timeout_key);
-		}
-		g_free(trans);
+	if (sip_transport_transactions_pending(sipe_private)) {
+		struct transaction_key key;
+
+		/* only remove index entry if it belongs to this transaction */
+		transaction_key_from_trans(&key, trans);
+		if (g_hash_table_lookup(transport->transactions, &key) == trans)
+			g_hash_table_remove(transport->transactions, &key);
+		SIPE_DEBUG_INFO("SIP transactions count:%u after removal",
+				g_hash_table_size(transport->transactions));
+
+		transaction_free(sipe_private, trans);
 	}
 }
 
 static struct transaction *transactions_find(struct sip_transport *transport,
 					     struct sipmsg *msg)
 {
-	GSList *transactions = transport->transactions;
-	const gchar *call_id = sipmsg_find_header(msg, "Call-ID");
-	const gchar *cseq = sipmsg_find_header(msg, "CSeq");
-	gchar *key;
+	struct transaction_key key;
 
-	if (!call_id || !cseq) {
+	key.call_id = sipmsg_find_header(msg, "Call-ID");
+	key.cseq    = sipmsg_find_header(msg, "CSeq");
+
+	if (!key.call_id || !key.cseq) {
 		SIPE_DEBUG_ERROR_NOFORMAT("transaction_find: no Call-ID or CSeq!");
 		return NULL;
 	}
 
-	key = g_strdup_printf("<%s><%s>", call_id, cseq);
-	while (transactions) {
-		struct transaction *trans = transactions->data;
-		if (!g_ascii_strcasecmp(trans->key, key)) {
-			g_free(key);
-			return trans;
-		}
-		transactions = transactions->next;
-	}
-	g_free(key);
+	if (!transport->transactions)
+		return NULL;
 
-	return NULL;
+	key.call_id_length = strlen(key.call_id);
+	key.cseq_length    = strlen(key.cseq);
+	return(g_hash_table_lookup(transport->transactions, &key));
+}
+
+guint sip_transport_transactions_pending(struct sipe_core_private *sipe_private)
+{
+	struct sip_transport *transport = sipe_private->transport;
+	return((transport && transport->transactions) ?
+	       g_hash_table_size(transport->transactions) :
+	       0);
 }
 
 static void transaction_timeout_cb(struct sipe_core_private *sipe_private,
@@ -809,8 +951,6 @@ struct transaction *sip_transport_request_timeout(struct sipe_core_private *sipe
 	/* The authentication scheme is not ready so we can't send the message.
 	   This should only happen for REGISTER messages. */
 	if (!transport->auth_incomplete) {
-		buf = sipmsg_to_string(msg);
-
 		/* add to ongoing transactions */
 		/* ACK isn't supposed to be answered ever. So we do not keep transaction for it. */
 		if (!sipe_strequal(method, "ACK")) {
@@ -828,13 +968,10 @@ struct transaction *sip_transport_request_timeout(struct sipe_core_private *sipe
 						      transaction_timeout_cb,
 						      NULL);
 			}
-			transport->transactions = g_slist_append(transport->transactions,
-								 trans);
-			SIPE_DEBUG_INFO("SIP transactions count:%d after addition", g_slist_length(transport->transactions));
+			transactions_add(sipe_private, trans);
 		}
 
-		send_sip_message(transport, buf);
-		g_free(buf);
+		send_sip_message_msg(transport, msg);
 	}
 
 	if (!trans) sipmsg_free(msg);
@@ -1506,10 +1643,21 @@ void sip_transport_disconnect(struct sipe_core_private *sipe_private)
 		g_free(transport->server_name);
 		g_free(transport->server_version);
 		g_free(transport->user_agent);
+		if (transport->signature_input)
+			g_string_free(transport->signature_input, TRUE);
+
+		if (transport->transactions) {
+			GList *transactions = g_hash_table_get_values(transport->transactions);
+			GList *entry;
 
-		while (transport->transactions)
-			transactions_remove(sipe_private,
-					    transport->transactions->data);
+			for (entry = transactions; entry; entry = entry->next)
+				transactions_remove(sipe_private, entry->data);
+			g_list_free(transactions);
+			g_hash_table_destroy(transport->transactions);
+		}
+
+		sipmsg_framer_reset(&transport->framer);
+		g_free(transport->framer_header);
 
 		g_free(transport);
 	}
@@ -1596,8 +1744,6 @@ static void process_input_message(struct sipe_core_private *sipe_private,
 					transport->registrar.retries++;
 					SIPE_DEBUG_INFO("process_input_message: RE-REGISTER CSeq: %d", transport->cseq);
 				} else {
-					gchar *resend;
-
 					/* Are we registered? */
 					if (transport->reregister_set) {
 						SIPE_DEBUG_INFO_NOFORMAT("process_input_message: 401 response to non-REGISTER message. Retrying with new authentication.");
@@ -1614,9 +1760,8 @@ static void process_input_message(struct sipe_core_private *sipe_private,
 					}
 
 					/* Resend request */
-					resend = sipmsg_to_string(trans->msg);
-					send_sip_message(sipe_private->transport, resend);
-					g_free(resend);
+					send_sip_message_msg(sipe_private->transport,
+							     trans->msg);
 
 					/* Transaction not yet completed */
 					trans = NULL;
@@ -1654,17 +1799,14 @@ static void process_input_message(struct sipe_core_private *sipe_private,
 						}
 
 						if (auth) {
-							gchar *resend;
-
 							/* replace old proxy authentication with new one */
 							sipmsg_remove_header_now(trans->msg, "Proxy-Authorization");
 							sipmsg_add_header_now(trans->msg, "Proxy-Authorization", auth);
 							g_free(auth);
 
 							/* resend request with proxy authentication */
-							resend = sipmsg_to_string(trans->msg);
-							send_sip_message(sipe_private->transport, resend);
-							g_free(resend);
+							send_sip_message_msg(sipe_private->transport,
+									     trans->msg);
 
 							/* Transaction not yet completed */
 							trans = NULL;
@@ -1694,7 +1836,7 @@ static void process_input_message(struct sipe_core_private *sipe_private,
 				 * Redirect case: sipe_private->transport is
 				 * the new transport with empty queue
 				 */
-				if (sipe_private->transport->transactions) {
+				if (sip_transport_transactions_pending(sipe_private)) {
 					SIPE_DEBUG_INFO("process_input_message: removing CSeq %d", transport->cseq);
 					transactions_remove(sipe_private, trans);
 				}
@@ -1710,51 +1852,79 @@ static void process_input_message(struct sipe_core_private *sipe_private,
 	}
 }
 
+/* bodies of at least this size are received in place */
+#define SIP_TRANSPORT_LARGE_BODY 16384
+
 static void sip_transport_input(struct sipe_transport_connection *conn)
 {
 	struct sipe_core_private *sipe_private = conn->user_data;
 	struct sip_transport *transport = sipe_private->transport;
-	gchar *cur = conn->buffer;
-
-	/* according to the RFC remove CRLF at the beginning */
-	while (*cur == '\r' || *cur == '\n') {
-		cur++;
-	}
-	if (cur != conn->buffer)
-		sipe_utils_shrink_buffer(conn, cur);
 
-	/* Received a full Header? */
+	/* Received a full message? */
 	transport->processing_input = TRUE;
-	while (transport->processing_input &&
-	       ((cur = strstr(conn->buffer, "\r\n\r\n")) != NULL)) {
+	while (transport->processing_input) {
+		struct sipmsg_framer *framer = &transport->framer;
 		struct sipmsg *msg;
-		guint remainder;
-
-		cur += 2;
-		cur[0] = '\0';
-		msg = sipmsg_parse_header(conn->buffer);
-
-		cur += 2;
-		remainder = conn->buffer_used - (cur - conn->buffer);
-		if (msg && remainder >= (guint) msg->bodylen) {
-			char *dummy = g_malloc(msg->bodylen + 1);
-			memcpy(dummy, cur, msg->bodylen);
-			dummy[msg->bodylen] = '\0';
-			msg->body = dummy;
-			cur += msg->bodylen;
-			sipe_utils_message_debug("SIP",
-						 conn->buffer,
-						 msg->body,
-						 FALSE);
-			sipe_utils_shrink_buffer(conn, cur);
+		gsize consumed;
+
+		/* large body received in place: hand it over without copying */
+		if (framer->msg &&
+		    (framer->header_length == 0) &&
+		    (conn->buffer_used >= (gsize) framer->msg->bodylen)) {
+			msg = sipmsg_framer_complete(framer,
+						     sipe_utils_take_buffer(conn,
+									    framer->msg->bodylen));
+			if (transport->framer_header) {
+				sipe_utils_message_debug("SIP",
+							 transport->framer_header,
+							 msg->body,
+							 FALSE);
+				g_free(transport->framer_header);
+				transport->framer_header = NULL;
+			}
+			consumed = 0;
+
 		} else {
-			if (msg) {
-				SIPE_DEBUG_INFO("sipe_transport_input: body too short (%d < %d, strlen %d) - ignoring message", remainder, msg->bodylen, (int)strlen(conn->buffer));
-				sipmsg_free(msg);
-                        }
+			msg = sipmsg_framer_next(framer,
+						 conn->buffer,
+						 conn->buffer_used,
+						 &consumed);
+
+			if (msg && SIPE_DEBUG_IS_ENABLED(SIPE_DEBUG_CATEGORY)) {
+				/* message is at the end of the consumed data */
+				gsize header_length = framer->header_length;
+				gchar *header = g_strndup(conn->buffer + consumed - msg->bodylen - header_length,
+							  header_length - 2);
+				sipe_utils_message_debug("SIP",
+							 header,
+							 msg->body,
+							 FALSE);
+				g_free(header);
+			}
+		}
+
+		if (consumed)
+			sipe_utils_shrink_buffer(conn, conn->buffer + consumed);
+
+		if (!msg) {
+			/*
+			 * Large body still incomplete: drop the already parsed
+			 * header from the buffer and receive the body at the
+			 * start of a buffer large enough to hold all of it.
+			 */
+			if (framer->msg &&
+			    framer->header_length &&
+			    (framer->msg->bodylen >= SIP_TRANSPORT_LARGE_BODY)) {
+				if (SIPE_DEBUG_IS_ENABLED(SIPE_DEBUG_CATEGORY))
+					transport->framer_header = g_strndup(conn->buffer,
+									     framer->header_length - 2);
+				sipe_utils_shrink_buffer(conn,
+							 conn->buffer + framer->header_length);
+				framer->header_length = 0;
+				sipe_utils_realign_buffer(conn, framer->msg->bodylen);
+			}
 
-			/* restore header for next try */
-			cur[-2] = '\r';
+			/* wait for more data */
 			return;
 		}
 
@@ -1769,12 +1939,12 @@ static void sip_transport_input(struct sipe_transport_connection *conn)
 		/* Verify the signature before processing it */
 		} else if (sip_sec_context_is_ready(transport->registrar.gssapi_context)) {
 			struct sipmsg_breakdown msgbd;
-			gchar *signature_input_str;
+			const gchar *signature_input_str;
 			gchar *rspauth;
 			msgbd.msg = msg;
 			sipmsg_breakdown_parse(&msgbd, transport->registrar.realm, transport->registrar.target,
 					       transport->registrar.protocol);
-			signature_input_str = sipmsg_breakdown_get_string(transport->registrar.version, &msgbd);
+			signature_input_str = signature_input(transport, &msgbd);
 
 			rspauth = sipmsg_find_part_of_header(sipmsg_find_header(msg, "Authentication-Info"), "rspauth=\"", "\"", NULL);
 
@@ -1805,10 +1975,7 @@ static void sip_transport_input(struct sipe_transport_connection *conn)
 				}
 				SIPE_DEBUG_INFO_NOFORMAT("sip_transport_input: message without authentication data - ignoring");
 			}
-			g_free(signature_input_str);
-
 			g_free(rspauth);
-			sipmsg_breakdown_free(&msgbd);
 		} else {
 			process_input_message(sipe_private, msg);
 		}
@@ -115,6 +115,15 @@ void sip_transport_deregister(struct sipe_core_private *sipe_private);
 void sip_transport_disconnect(struct sipe_core_private *sipe_private);
 void sip_transport_authentication_completed(struct sipe_core_private *sipe_private);
 
+/**
+ * Number of SIP transactions waiting for a final response
+ *
+ * @param sipe_private SIPE core private data
+ *
+ * @return in-flight transaction count
+ */
+guint sip_transport_transactions_pending(struct sipe_core_private *sipe_private);
+
 int sip_transaction_cseq(struct transaction *trans);
 
 /*
@@ -38,6 +38,7 @@
 #include "sip-csta.h"
 #include "sip-soap.h"
 #include "sip-transport.h"
+#define SIPE_DEBUG_CATEGORY SIPE_DEBUG_CATEGORY_PRESENCE
 #include "sipe-backend.h"
 #include "sipe-buddy.h"
 #include "sipe-cal.h"
@@ -46,6 +47,7 @@
 #include "sipe-core.h"
 #include "sipe-core-private.h"
 #include "sipe-digest.h"
+#include "sipe-freebusy.h"
 #include "sipe-group.h"
 #include "sipe-http.h"
 #include "sipe-im.h"
@@ -62,6 +64,9 @@
 #include "sipe-webticket.h"
 #include "sipe-xml.h"
 
+/* key for sipe_buddies->uri, see sipe_buddy_add() */
+#define BUDDY_URI_KEY(buddy) ((buddy)->uri_key ? (buddy)->uri_key : (buddy)->name)
+
 struct sipe_buddies {
 	GHashTable *uri;
 	GHashTable *exchange_key;
@@ -78,6 +83,7 @@ struct buddy_group_data {
 struct photo_response_data {
 	gchar *who;
 	gchar *photo_hash;
+	GByteArray *photo; /* streamed HTTP response body */
 	struct sipe_http_request *request;
 };
 
@@ -105,16 +111,28 @@ struct sipe_buddy *sipe_buddy_add(struct sipe_core_private *sipe_private,
 				  const gchar *exchange_key,
 				  const gchar *change_key)
 {
-	/* Buddy name must be lower case as we use purple_normalize_nocase() to compare */
-	gchar *normalized_uri = g_ascii_strdown(uri, -1);
-	struct sipe_buddy *buddy = sipe_buddy_find_by_uri(sipe_private,
-							  normalized_uri);
+	/*
+	 * Buddy name must be lower case as we use purple_normalize_nocase()
+	 * to compare. Only ASCII is lowered, as the name is also passed to
+	 * the backend and sent to the server. The key for the buddy URI hash
+	 * table is the fully normalized URI.
+	 */
+	gchar *key = sipe_utils_uri_normalize(uri);
+	struct sipe_buddy *buddy = g_hash_table_lookup(sipe_private->buddies->uri,
+						       key ? key : uri);
 
 	if (!buddy) {
+		gchar *normalized_uri = g_ascii_strdown(uri, -1);
+
 		buddy = g_new0(struct sipe_buddy, 1);
 		buddy->name = normalized_uri;
+		/* differs only for non-ASCII URIs */
+		if (key && strcmp(key, normalized_uri)) {
+			buddy->uri_key = key;
+			key = NULL;
+		}
 		g_hash_table_insert(sipe_private->buddies->uri,
-				    buddy->name,
+				    BUDDY_URI_KEY(buddy),
 				    buddy);
 
 		sipe_buddy_add_keys(sipe_private,
@@ -131,13 +149,11 @@ struct sipe_buddy *sipe_buddy_add(struct sipe_core_private *sipe_private,
 		}
 
 		buddy_fetch_photo(sipe_private, normalized_uri);
-
-		normalized_uri = NULL; /* buddy takes ownership */
 	} else {
-		SIPE_DEBUG_INFO("sipe_buddy_add: Buddy %s already exists", normalized_uri);
+		SIPE_DEBUG_INFO("sipe_buddy_add: Buddy %s already exists", buddy->name);
 		buddy->is_obsolete = FALSE;
 	}
-	g_free(normalized_uri);
+	g_free(key);
 
 	return(buddy);
 }
@@ -161,6 +177,16 @@ static gboolean is_buddy_in_group(struct sipe_buddy *buddy,
 	return(FALSE);
 }
 
+static void buddy_properties_forget(struct sipe_buddy *buddy)
+{
+	guint i;
+
+	for (i = 0; i < SIPE_BUDDY_INFO_PROPERTIES; i++) {
+		g_free(buddy->properties[i]);
+		buddy->properties[i] = NULL;
+	}
+}
+
 void sipe_buddy_add_to_group(struct sipe_core_private *sipe_private,
 			     struct sipe_buddy *buddy,
 			     struct sipe_group *group,
@@ -179,6 +205,7 @@ void sipe_buddy_add_to_group(struct sipe_core_private *sipe_private,
 					    group_name);
 		SIPE_DEBUG_INFO("sipe_buddy_add_to_group: created backend buddy '%s' with alias '%s'",
 				uri, alias ? alias : "<NONE>");
+		buddy_properties_forget(buddy);
 	}
 
 
@@ -215,6 +242,9 @@ void sipe_buddy_insert_group(struct sipe_buddy *buddy,
 {
 	struct buddy_group_data *bgd = g_new0(struct buddy_group_data, 1);
 
+	/* new backend buddy in this group doesn't have any properties yet */
+	buddy_properties_forget(buddy);
+
 	bgd->group = group;
 
 	buddy->groups = sipe_utils_slist_insert_unique_sorted(buddy->groups,
@@ -344,7 +374,19 @@ void sipe_buddy_cleanup_local_list(struct sipe_core_private *sipe_private)
 struct sipe_buddy *sipe_buddy_find_by_uri(struct sipe_core_private *sipe_private,
 					  const gchar *uri)
 {
-	return(g_hash_table_lookup(sipe_private->buddies->uri, uri));
+	struct sipe_buddy *buddy;
+	gchar *normalized;
+
+	if (!uri)
+		return(NULL);
+
+	/* fast path: URIs are usually already in normalized form */
+	normalized = sipe_utils_uri_normalize(uri);
+	buddy = g_hash_table_lookup(sipe_private->buddies->uri,
+				    normalized ? normalized : uri);
+	g_free(normalized);
+
+	return(buddy);
 }
 
 struct sipe_buddy *sipe_buddy_find_by_exchange_key(struct sipe_core_private *sipe_private,
@@ -380,6 +422,7 @@ static void buddy_free(struct sipe_buddy *buddy)
 	  *             with the memory leak until this is fixed.
 	  */
 	g_free(buddy->name);
+	g_free(buddy->uri_key);
 #endif
 	g_free(buddy->exchange_key);
 	g_free(buddy->change_key);
@@ -390,12 +433,13 @@ static void buddy_free(struct sipe_buddy *buddy)
 
 	g_free(buddy->cal_start_time);
 	g_free(buddy->cal_free_busy_base64);
-	g_free(buddy->cal_free_busy);
+	sipe_freebusy_free(buddy->cal_free_busy);
 	g_free(buddy->last_non_cal_activity);
 
 	sipe_cal_free_working_hours(buddy->cal_working_hours);
 
 	g_free(buddy->device_name);
+	buddy_properties_forget(buddy);
 	sipe_utils_slist_free_full(buddy->groups, buddy_group_free);
 	g_free(buddy);
 }
@@ -689,7 +733,7 @@ void sipe_buddy_remove(struct sipe_core_private *sipe_private,
 		entry = entry->next;
 	}
 
-	g_hash_table_remove(buddies->uri, uri);
+	g_hash_table_remove(buddies->uri, BUDDY_URI_KEY(buddy));
 	if (buddy->exchange_key)
 		g_hash_table_remove(buddies->exchange_key,
 				    buddy->exchange_key);
@@ -852,56 +896,126 @@ void sipe_core_buddy_tooltip_info(struct sipe_core_public *sipe_public,
 	}
 }
 
-void sipe_buddy_update_property(struct sipe_core_private *sipe_private,
-				const char *uri,
-				sipe_buddy_info_fields propkey,
-				char *property_value)
+void sipe_buddy_property_update_init(struct sipe_buddy_property_update *update,
+				     const gchar *uri)
 {
-	GSList *buddies, *entry;
+	memset(update, 0, sizeof(struct sipe_buddy_property_update));
+	update->uri = uri;
+}
+
+void sipe_buddy_property_update_set(struct sipe_buddy_property_update *update,
+				    sipe_buddy_info_fields propkey,
+				    gchar *property_value)
+{
+	if ((guint) propkey >= SIPE_BUDDY_INFO_PROPERTIES)
+		return;
 
 	if (property_value)
 		property_value = g_strstrip(property_value);
+	if (is_empty(property_value))
+		return;
 
-	entry = buddies = sipe_backend_buddy_find_all(SIPE_CORE_PUBLIC, uri, NULL); /* all buddies in different groups */
-	while (entry) {
-		gchar *prop_str;
-		sipe_backend_buddy p_buddy = entry->data;
-
-		/* for Display Name */
-		if (propkey == SIPE_BUDDY_INFO_DISPLAY_NAME) {
-			gchar *alias;
-			alias = sipe_backend_buddy_get_alias(SIPE_CORE_PUBLIC, p_buddy);
-			if (property_value && sipe_is_bad_alias(uri, alias)) {
-				SIPE_DEBUG_INFO("Replacing alias for %s with %s", uri, property_value);
-				sipe_backend_buddy_set_alias(SIPE_CORE_PUBLIC, p_buddy, property_value);
-			}
-			g_free(alias);
+	g_free(update->values[propkey]);
+	update->values[propkey] = g_strdup(property_value);
+	update->collected |= 1U << propkey;
+}
 
-			alias = sipe_backend_buddy_get_server_alias(SIPE_CORE_PUBLIC, p_buddy);
-			if (!is_empty(property_value) &&
-			   (!sipe_strequal(property_value, alias) || is_empty(alias)) )
-			{
-				SIPE_DEBUG_INFO("Replacing service alias for %s with %s", uri, property_value);
-				sipe_backend_buddy_set_server_alias(SIPE_CORE_PUBLIC, p_buddy, property_value);
-			}
-			g_free(alias);
-		}
-		/* for other properties */
-		else {
-			if (!is_empty(property_value)) {
-				prop_str = sipe_backend_buddy_get_string(SIPE_CORE_PUBLIC, p_buddy, propkey);
-				if (!prop_str || !sipe_strcase_equal(prop_str, property_value)) {
-					sipe_backend_buddy_set_string(SIPE_CORE_PUBLIC, p_buddy, propkey, property_value);
-				}
-				g_free(prop_str);
-			}
+static void buddy_property_push(struct sipe_core_private *sipe_private,
+				const gchar *uri,
+				sipe_backend_buddy p_buddy,
+				sipe_buddy_info_fields propkey,
+				const gchar *property_value)
+{
+	/* for Display Name */
+	if (propkey == SIPE_BUDDY_INFO_DISPLAY_NAME) {
+		gchar *alias;
+		alias = sipe_backend_buddy_get_alias(SIPE_CORE_PUBLIC, p_buddy);
+		if (sipe_is_bad_alias(uri, alias)) {
+			SIPE_DEBUG_INFO("Replacing alias for %s with %s", uri, property_value);
+			sipe_backend_buddy_set_alias(SIPE_CORE_PUBLIC, p_buddy, property_value);
 		}
+		g_free(alias);
 
-		entry = entry->next;
+		alias = sipe_backend_buddy_get_server_alias(SIPE_CORE_PUBLIC, p_buddy);
+		if (!sipe_strequal(property_value, alias) || is_empty(alias)) {
+			SIPE_DEBUG_INFO("Replacing service alias for %s with %s", uri, property_value);
+			sipe_backend_buddy_set_server_alias(SIPE_CORE_PUBLIC, p_buddy, property_value);
+		}
+		g_free(alias);
+	}
+	/* for other properties */
+	else {
+		gchar *prop_str = sipe_backend_buddy_get_string(SIPE_CORE_PUBLIC, p_buddy, propkey);
+		if (!prop_str || !sipe_strcase_equal(prop_str, property_value)) {
+			sipe_backend_buddy_set_string(SIPE_CORE_PUBLIC, p_buddy, propkey, property_value);
+		}
+		g_free(prop_str);
 	}
-	g_slist_free(buddies);
 }
 
+gboolean sipe_buddy_property_update_commit(struct sipe_core_private *sipe_private,
+					   struct sipe_buddy_property_update *update)
+{
+	struct sipe_buddy *sbuddy = sipe_buddy_find_by_uri(sipe_private,
+							   update->uri);
+	guint32 changed = 0;
+	guint i;
+
+	if (!update->collected)
+		return(FALSE);
+
+	/* drop values the backend buddies already have */
+	for (i = 0; i < SIPE_BUDDY_INFO_PROPERTIES; i++) {
+		gchar *value = update->values[i];
+
+		if (!value)
+			continue;
+
+		if (sbuddy &&
+		    ((i == SIPE_BUDDY_INFO_DISPLAY_NAME) ?
+		     sipe_strequal(sbuddy->properties[i], value) :
+		     sipe_strcase_equal(sbuddy->properties[i], value))) {
+			g_free(value);
+			update->values[i] = NULL;
+		} else {
+			changed |= 1U << i;
+		}
+	}
+
+	if (changed) {
+		/* all buddies in different groups */
+		GSList *buddies = sipe_backend_buddy_find_all(SIPE_CORE_PUBLIC,
+							      update->uri,
+							      NULL);
+		GSList *entry;
+
+		for (entry = buddies; entry; entry = entry->next)
+			for (i = 0; i < SIPE_BUDDY_INFO_PROPERTIES; i++)
+				if (changed & (1U << i))
+					buddy_property_push(sipe_private,
+							    update->uri,
+							    entry->data,
+							    i,
+							    update->values[i]);
+		g_slist_free(buddies);
+
+		/* cache takes ownership of the new values */
+		for (i = 0; i < SIPE_BUDDY_INFO_PROPERTIES; i++)
+			if (changed & (1U << i)) {
+				if (sbuddy) {
+					g_free(sbuddy->properties[i]);
+					sbuddy->properties[i] = update->values[i];
+				} else {
+					g_free(update->values[i]);
+				}
+				update->values[i] = NULL;
+			}
+	}
+
+	update->collected = 0;
+
+	return(changed != 0);
+}
 
 struct ms_dlx_data;
 struct ms_dlx_data {
@@ -1633,15 +1747,19 @@ static gboolean process_get_info_response(struct sipe_core_private *sipe_private
 			 */
 			if (!SIPE_CORE_PRIVATE_FLAG_IS(OCS2007)) {
 				char *tel_uri = sip_to_tel_uri(phone_number);
+				struct sipe_buddy_property_update update;
+
 				/* trims its parameters, so call first */
-				sipe_buddy_update_property(sipe_private, uri, SIPE_BUDDY_INFO_DISPLAY_NAME, server_alias);
-				sipe_buddy_update_property(sipe_private, uri, SIPE_BUDDY_INFO_EMAIL, email);
-				sipe_buddy_update_property(sipe_private, uri, SIPE_BUDDY_INFO_WORK_PHONE, tel_uri);
-				sipe_buddy_update_property(sipe_private, uri, SIPE_BUDDY_INFO_WORK_PHONE_DISPLAY, phone_number);
+				sipe_buddy_property_update_init(&update, uri);
+				sipe_buddy_property_update_set(&update, SIPE_BUDDY_INFO_DISPLAY_NAME, server_alias);
+				sipe_buddy_property_update_set(&update, SIPE_BUDDY_INFO_EMAIL, email);
+				sipe_buddy_property_update_set(&update, SIPE_BUDDY_INFO_WORK_PHONE, tel_uri);
+				sipe_buddy_property_update_set(&update, SIPE_BUDDY_INFO_WORK_PHONE_DISPLAY, phone_number);
 				g_free(tel_uri);
 
-				sipe_backend_buddy_refresh_properties(SIPE_CORE_PUBLIC,
-								      uri);
+				if (sipe_buddy_property_update_commit(sipe_private, &update))
+					sipe_backend_buddy_refresh_properties(SIPE_CORE_PUBLIC,
+									      uri);
 			}
 
 			if (!is_empty(server_alias)) {
@@ -1771,6 +1889,8 @@ static void photo_response_data_free(struct photo_response_data *data)
 {
 	g_free(data->who);
 	g_free(data->photo_hash);
+	if (data->photo)
+		g_byte_array_free(data->photo, TRUE);
 	if (data->request) {
 		sipe_http_request_cancel(data->request);
 	}
@@ -1786,31 +1906,40 @@ static void photo_response_data_remove(struct sipe_core_private *sipe_private,
 	photo_response_data_free(data);
 }
 
+static void process_buddy_photo_data(SIPE_UNUSED_PARAMETER struct sipe_core_private *sipe_private,
+				     const gchar *data,
+				     gsize length,
+				     gpointer callback_data)
+{
+	struct photo_response_data *rdata = callback_data;
+
+	if (!rdata->photo)
+		rdata->photo = g_byte_array_new();
+	g_byte_array_append(rdata->photo, (const guint8 *) data, length);
+}
+
 static void process_buddy_photo_response(struct sipe_core_private *sipe_private,
 					 guint status,
-					 GSList *headers,
-					 const char *body,
+					 SIPE_UNUSED_PARAMETER GSList *headers,
+					 SIPE_UNUSED_PARAMETER const char *body,
 					 gpointer data)
 {
 	struct photo_response_data *rdata = (struct photo_response_data *) data;
 
-	if (status == SIPE_HTTP_STATUS_OK) {
-		const gchar *len_str = sipe_utils_nameval_find(headers,
-							       "Content-Length");
-		if (len_str) {
-			gsize photo_size = atoi(len_str);
-			gpointer photo = g_new(char, photo_size);
-
-			if (photo) {
-				memcpy(photo, body, photo_size);
-
-				sipe_backend_buddy_set_photo(SIPE_CORE_PUBLIC,
-							     rdata->who,
-							     photo,
-							     photo_size,
-							     rdata->photo_hash);
-			}
-		}
+	/* body has been collected by process_buddy_photo_data() */
+	if ((status == SIPE_HTTP_STATUS_OK) && rdata->photo) {
+		gsize photo_size = rdata->photo->len;
+
+		if (photo_size)
+			/* backend takes ownership of photo data */
+			sipe_backend_buddy_set_photo(SIPE_CORE_PUBLIC,
+						     rdata->who,
+						     g_byte_array_free(rdata->photo, FALSE),
+						     photo_size,
+						     rdata->photo_hash);
+		else
+			g_byte_array_free(rdata->photo, TRUE);
+		rdata->photo = NULL;
 	}
 
 	photo_response_data_remove(sipe_private, rdata);
@@ -1987,6 +2116,9 @@ void sipe_buddy_update_photo(struct sipe_core_private *sipe_private,
 							      headers,
 							      process_buddy_photo_response,
 							      data);
+			if (data->request)
+				sipe_http_request_stream(data->request,
+							 process_buddy_photo_data);
 		}
 
 		photo_response_data_finalize(sipe_private,
@@ -2354,40 +2486,12 @@ guint sipe_buddy_count(struct sipe_core_private *sipe_private)
 	return(g_hash_table_size(sipe_private->buddies->uri));
 }
 
-static guint sipe_ht_hash_nick(const char *nick)
-{
-	char *lc = g_utf8_strdown(nick, -1);
-	guint bucket = g_str_hash(lc);
-	g_free(lc);
-
-	return bucket;
-}
-
-static gboolean sipe_ht_equals_nick(const char *nick1, const char *nick2)
-{
-	char *nick1_norm = NULL;
-	char *nick2_norm = NULL;
-	gboolean equal;
-
-	if (nick1 == NULL && nick2 == NULL) return TRUE;
-	if (nick1 == NULL || nick2 == NULL    ||
-	    !g_utf8_validate(nick1, -1, NULL) ||
-	    !g_utf8_validate(nick2, -1, NULL)) return FALSE;
-
-	nick1_norm = g_utf8_casefold(nick1, -1);
-	nick2_norm = g_utf8_casefold(nick2, -1);
-	equal = g_utf8_collate(nick1_norm, nick2_norm) == 0;
-	g_free(nick2_norm);
-	g_free(nick1_norm);
-
-	return equal;
-}
-
 void sipe_buddy_init(struct sipe_core_private *sipe_private)
 {
 	struct sipe_buddies *buddies = g_new0(struct sipe_buddies, 1);
-	buddies->uri          = g_hash_table_new((GHashFunc)  sipe_ht_hash_nick,
-						 (GEqualFunc) sipe_ht_equals_nick);
+	/* keys are normalized URIs, see sipe_utils_uri_normalize() */
+	buddies->uri          = g_hash_table_new(g_str_hash,
+						 g_str_equal);
 	buddies->exchange_key = g_hash_table_new(g_str_hash,
 						 g_str_equal);
 	sipe_private->buddies = buddies;
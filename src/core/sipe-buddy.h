@@ -24,10 +24,16 @@
 struct sipe_backend_search_results;
 struct sipe_cal_working_hours;
 struct sipe_core_private;
+struct sipe_freebusy;
 struct sipe_group;
 
+/* properties handled by sipe_backend_buddy_get/set_string() */
+#define SIPE_BUDDY_INFO_PROPERTIES SIPE_BUDDY_INFO_ALIAS
+
 struct sipe_buddy {
 	gchar *name;
+	/* URI hash table key, NULL if it is the same as name */
+	gchar *uri_key;
 	gchar *exchange_key;
 	gchar *change_key;
 	gchar *activity;
@@ -46,7 +52,7 @@ struct sipe_buddy {
 	gchar *cal_start_time;
 	int cal_granularity;
 	gchar *cal_free_busy_base64;
-	gchar *cal_free_busy;
+	struct sipe_freebusy *cal_free_busy;
 	time_t cal_free_busy_published;
 	/* for 2005 systems */
 	int user_avail;
@@ -58,6 +64,8 @@ struct sipe_buddy {
 	struct sipe_cal_working_hours *cal_working_hours;
 
 	gchar *device_name;
+	/* property values last pushed to the backend buddies */
+	gchar *properties[SIPE_BUDDY_INFO_PROPERTIES];
 	GSList *groups;
 	 /** flag to control sending 'context' element in 2007 subscriptions */
 	gboolean just_added;
@@ -214,17 +222,52 @@ gchar *sipe_buddy_get_alias(struct sipe_core_private *sipe_private,
 			    const gchar *with);
 
 /**
- * Update the value of a buddy property with given SIP URI
+ * Buddy property update transaction
+ *
+ * Collects the new property values for one buddy. All changed values are
+ * pushed to the backend buddies in one go by
+ * sipe_buddy_property_update_commit().
+ */
+struct sipe_buddy_property_update {
+	const gchar *uri;
+	guint32 collected; /* bit mask of sipe_buddy_info_fields */
+	gchar *values[SIPE_BUDDY_INFO_PROPERTIES];
+};
+
+/**
+ * Start a property update transaction for the buddy with given SIP URI
+ *
+ * @param update       property update data structure
+ * @param uri          a SIP URI (must be valid until commit)
+ */
+void sipe_buddy_property_update_init(struct sipe_buddy_property_update *update,
+				     const gchar *uri);
+
+/**
+ * Add new value of a buddy property to the transaction. Empty values
+ * are ignored. A later value for the same property replaces the earlier.
  *
- * @param sipe_private   SIPE core data
- * @param uri            a SIP URI
+ * @param update         property update data structure
  * @param propkey        property id (see sipe-backend.h)
- * @param property_value new value for the property
+ * @param property_value new value for the property (may be modified to
+ *                       strip white space)
+ */
+void sipe_buddy_property_update_set(struct sipe_buddy_property_update *update,
+				    sipe_buddy_info_fields propkey,
+				    gchar *property_value);
+
+/**
+ * Push all property values that differ from the ones cached for the buddy
+ * to the backend and release the transaction data.
+ *
+ * @param sipe_private SIPE core data
+ * @param update       property update data structure
+ *
+ * @return @c TRUE if any property was updated, i.e. the caller should
+ *         call sipe_backend_buddy_refresh_properties()
  */
-void sipe_buddy_update_property(struct sipe_core_private *sipe_private,
-				const gchar *uri,
-				sipe_buddy_info_fields propkey,
-				gchar *property_value);
+gboolean sipe_buddy_property_update_commit(struct sipe_core_private *sipe_private,
+					   struct sipe_buddy_property_update *update);
 
 /**
  * Update the buddy photo with given SIP URI. If hash is the same
@@ -26,6 +26,7 @@
 #include "config.h"
 #endif
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
@@ -37,11 +38,13 @@
 #include "sipe-core.h"
 #include "sipe-core-private.h"
 #include "sipe-cal.h"
+#include "sipe-freebusy.h"
 #include "sipe-http.h"
 #include "sipe-nls.h"
 #include "sipe-ocs2005.h"
 #include "sipe-ocs2007.h"
 #include "sipe-schedule.h"
+#include "sipe-tz.h"
 #include "sipe-utils.h"
 #include "sipe-xml.h"
 
@@ -103,8 +106,6 @@ struct sipe_cal_std_dst {
 	int month;          /* 1..12 */
 	gchar *day_of_week; /* Sunday or Monday or Tuesday or Wednesday or Thursday or Friday or Saturday */
 	gchar *year;        /* YYYY */
-
-	time_t switch_time;
 };
 
 struct sipe_cal_working_hours {
@@ -115,13 +116,7 @@ struct sipe_cal_working_hours {
 	int start_time;               /* 0...1440 */
 	int end_time;                 /* 0...1440 */
 
-	gchar *tz;                    /* aggregated timezone string as in TZ environment variable.
-	                                 Ex.: TST+8TDT+7,M3.2.0/02:00:00,M11.1.0/02:00:00 */
-	/** separate simple strings for Windows platform as the proper TZ does not work there.
-	 *  anyway, dynamic timezones would't work with just TZ
-	 */
-	gchar *tz_std;                /* Ex.: TST8 */
-	gchar *tz_dst;                /* Ex.: TDT7 */
+	struct sipe_tz *tz;           /* compiled from bias, std & dst. Shared between buddies */
 };
 
 /* not for translation, a part of XML Schema definitions */
@@ -256,73 +251,6 @@ sipe_cal_event_hash(struct sipe_cal_event* event)
 				event->is_meeting);
 }
 
-#define ENVIRONMENT_TIMEZONE "TZ"
-
-static gchar *
-sipe_switch_tz(const char *tz)
-{
-	gchar *tz_orig;
-
-	tz_orig = g_strdup(g_getenv(ENVIRONMENT_TIMEZONE));
-	g_setenv(ENVIRONMENT_TIMEZONE, tz, TRUE);
-	tzset();
-	return(tz_orig);
-}
-
-static void
-sipe_reset_tz(gchar *tz_orig)
-{
-	if (tz_orig) {
-		g_setenv(ENVIRONMENT_TIMEZONE, tz_orig, TRUE);
-		g_free(tz_orig);
-	} else {
-		g_unsetenv(ENVIRONMENT_TIMEZONE);
-	}
-	tzset();
-}
-
-/**
- * Converts struct tm to Epoch time_t considering timezone.
- *
- * @param tz as defined for TZ environment variable.
- *
- * Reference: see timegm(3) - Linux man page
- */
-time_t
-sipe_mktime_tz(struct tm *tm,
-	       const char* tz)
-{
-	time_t ret;
-	gchar *tz_orig;
-
-	tz_orig = sipe_switch_tz(tz);
-	ret = mktime(tm);
-	sipe_reset_tz(tz_orig);
-
-	return ret;
-}
-
-/**
- * Converts Epoch time_t to struct tm considering timezone.
- *
- * @param tz as defined for TZ environment variable.
- *
- * Reference: see timegm(3) - Linux man page
- */
-static struct tm *
-sipe_localtime_tz(const time_t *time,
-		  const char* tz)
-{
-	struct tm *ret;
-	gchar *tz_orig;
-
-	tz_orig = sipe_switch_tz(tz);
-	ret = localtime(time);
-	sipe_reset_tz(tz_orig);
-
-	return ret;
-}
-
 void
 sipe_cal_free_working_hours(struct sipe_cal_working_hours *wh)
 {
@@ -337,65 +265,28 @@ sipe_cal_free_working_hours(struct sipe_cal_working_hours *wh)
 	g_free(wh->dst.year);
 
 	g_free(wh->days_of_week);
-	g_free(wh->tz);
-	g_free(wh->tz_std);
-	g_free(wh->tz_dst);
+	sipe_tz_release(wh->tz);
 	g_free(wh);
 }
 
 /**
- * Returns time_t of daylight savings time start/end
- * in the provided timezone or otherwise
- * (time_t)-1 if no daylight savings time.
+ * Converts parsed StandardTime/DaylightTime to timezone rule
  */
-static time_t
-sipe_cal_get_std_dst_time(time_t now,
-			  int bias,
-			  struct sipe_cal_std_dst* std_dst,
-			  struct sipe_cal_std_dst* dst_std)
+static void
+sipe_cal_get_std_dst_rule(const struct sipe_cal_std_dst *std_dst,
+			  struct sipe_tz_rule *rule)
 {
-	struct tm switch_tm;
-	time_t res = TIME_NULL;
-	struct tm *gm_now_tm;
-	gchar **time_arr;
-
-	if (std_dst->month == 0) return TIME_NULL;
-
-	gm_now_tm = gmtime(&now);
-	time_arr = g_strsplit(std_dst->time, ":", 0);
-
-	switch_tm.tm_sec  = atoi(time_arr[2]);
-	switch_tm.tm_min  = atoi(time_arr[1]);
-	switch_tm.tm_hour = atoi(time_arr[0]);
-	g_strfreev(time_arr);
-	switch_tm.tm_mday  = std_dst->year ? std_dst->day_order : 1 /* to adjust later */ ;
-	switch_tm.tm_mon   = std_dst->month - 1;
-	switch_tm.tm_year  = std_dst->year ? atoi(std_dst->year) - 1900 : gm_now_tm->tm_year;
-	switch_tm.tm_isdst = 0;
-	/* to set tm_wday */
-	res = sipe_mktime_tz(&switch_tm, "UTC");
-
-	/* if not dynamic, calculate right tm_mday */
-	if (!std_dst->year) {
-		int switch_wday = sipe_cal_get_wday(std_dst->day_of_week);
-		int needed_month;
-		/* get first desired wday in the month */
-		int delta = switch_wday >= switch_tm.tm_wday ? (switch_wday - switch_tm.tm_wday) : (switch_wday + 7 - switch_tm.tm_wday);
-		switch_tm.tm_mday = 1 + delta;
-		/* try nth order */
-		switch_tm.tm_mday += (std_dst->day_order - 1) * 7;
-		needed_month = switch_tm.tm_mon;
-		/* to set settle date if ahead of allowed month dates */
-		res = sipe_mktime_tz(&switch_tm, "UTC");
-		if (needed_month != switch_tm.tm_mon) {
-			/* moving 1 week back to stay within required month */
-			switch_tm.tm_mday -= 7;
-			/* to fix date again */
-			res = sipe_mktime_tz(&switch_tm, "UTC");
-		}
-	}
-	/* note: bias is taken from "switch to" structure */
-	return res + (bias + dst_std->bias)*60;
+	int hours = 0, minutes = 0, seconds = 0;
+
+	if (std_dst->time)
+		sscanf(std_dst->time, "%d:%d:%d", &hours, &minutes, &seconds);
+
+	rule->bias        = std_dst->bias;
+	rule->time        = (hours * 60 + minutes) * 60 + seconds;
+	rule->day_order   = std_dst->day_order;
+	rule->month       = std_dst->month;
+	rule->day_of_week = MAX(sipe_cal_get_wday(std_dst->day_of_week), 0);
+	rule->year        = std_dst->year ? atoi(std_dst->year) : 0;
 }
 
 static void
@@ -456,9 +347,10 @@ sipe_cal_parse_working_hours(const sipe_xml *xn_working_hours,
 	const sipe_xml *xn_standard_time;
 	const sipe_xml *xn_daylight_time;
 	gchar *tmp;
-	time_t now = time(NULL);
 	struct sipe_cal_std_dst* std;
 	struct sipe_cal_std_dst* dst;
+	struct sipe_tz_rule std_rule;
+	struct sipe_tz_rule dst_rule;
 
 	if (!xn_working_hours) return;
 /*
@@ -509,33 +401,11 @@ sipe_cal_parse_working_hours(const sipe_xml *xn_working_hours,
 		g_free(tmp);
 	}
 
-	std->switch_time = sipe_cal_get_std_dst_time(now, buddy->cal_working_hours->bias, std, dst);
-	dst->switch_time = sipe_cal_get_std_dst_time(now, buddy->cal_working_hours->bias, dst, std);
-
-	/* TST8TDT7,M3.2.0/02:00:00,M11.1.0/02:00:00 */
-	buddy->cal_working_hours->tz =
-		g_strdup_printf("TST%dTDT%d,M%d.%d.%d/%s,M%d.%d.%d/%s",
-				(buddy->cal_working_hours->bias + buddy->cal_working_hours->std.bias) / 60,
-				(buddy->cal_working_hours->bias + buddy->cal_working_hours->dst.bias) / 60,
-
-				buddy->cal_working_hours->dst.month,
-				buddy->cal_working_hours->dst.day_order,
-				sipe_cal_get_wday(buddy->cal_working_hours->dst.day_of_week),
-				buddy->cal_working_hours->dst.time,
-
-				buddy->cal_working_hours->std.month,
-				buddy->cal_working_hours->std.day_order,
-				sipe_cal_get_wday(buddy->cal_working_hours->std.day_of_week),
-				buddy->cal_working_hours->std.time
-				);
-	/* TST8 */
-	buddy->cal_working_hours->tz_std =
-		g_strdup_printf("TST%d",
-				(buddy->cal_working_hours->bias + buddy->cal_working_hours->std.bias) / 60);
-	/* TDT7 */
-	buddy->cal_working_hours->tz_dst =
-		g_strdup_printf("TDT%d",
-				(buddy->cal_working_hours->bias + buddy->cal_working_hours->dst.bias) / 60);
+	sipe_cal_get_std_dst_rule(std, &std_rule);
+	sipe_cal_get_std_dst_rule(dst, &dst_rule);
+	buddy->cal_working_hours->tz = sipe_tz_get(buddy->cal_working_hours->bias,
+						   &std_rule,
+						   &dst_rule);
 }
 
 struct sipe_cal_event*
@@ -573,7 +443,7 @@ sipe_cal_get_event(GSList *cal_events,
 }
 
 static int
-sipe_cal_get_status0(const gchar *free_busy,
+sipe_cal_get_status0(const struct sipe_freebusy *free_busy,
 		     time_t cal_start,
 		     int granularity,
 		     time_t time_in_question,
@@ -581,7 +451,7 @@ sipe_cal_get_status0(const gchar *free_busy,
 {
 	int res = SIPE_CAL_NO_DATA;
 	int shift;
-	time_t cal_end = cal_start + strlen(free_busy)*granularity*60 - 1;
+	time_t cal_end = cal_start + free_busy->count*granularity*60 - 1;
 
 	if (!(time_in_question >= cal_start && time_in_question <= cal_end)) return res;
 
@@ -590,7 +460,7 @@ sipe_cal_get_status0(const gchar *free_busy,
 		*index = shift;
 	}
 
-	res = free_busy[shift] - '0';
+	res = sipe_freebusy_get(free_busy, shift);
 
 	return res;
 }
@@ -599,29 +469,17 @@ sipe_cal_get_status0(const gchar *free_busy,
  * Returns time when current calendar state started
  */
 static time_t
-sipe_cal_get_since_time(const gchar *free_busy,
+sipe_cal_get_since_time(const struct sipe_freebusy *free_busy,
 			time_t calStart,
 			int granularity,
-			int index,
-			int current_state)
+			int index)
 {
-	int i;
-
-	if ((index < 0) || ((size_t)(index + 1) > strlen(free_busy))) return 0;
-
-	for (i = index; i >= 0; i--) {
-		int temp_status = free_busy[i] - '0';
+	if ((index < 0) || ((gsize) index >= free_busy->count)) return 0;
 
-		if (current_state != temp_status) {
-			return calStart + (i + 1)*granularity*60;
-		}
-
-		if (i == 0) return calStart;
-	}
-
-	return 0;
+	return calStart + sipe_freebusy_run_start(free_busy, index)*granularity*60;
 }
-static char*
+
+static const struct sipe_freebusy *
 sipe_cal_get_free_busy(struct sipe_buddy *buddy);
 
 int
@@ -630,7 +488,7 @@ sipe_cal_get_status(struct sipe_buddy *buddy,
 		    time_t *since)
 {
 	time_t cal_start;
-	const char* free_busy;
+	const struct sipe_freebusy *free_busy;
 	int ret = SIPE_CAL_NO_DATA;
 	time_t state_since;
 	int index = -1;
@@ -645,7 +503,6 @@ sipe_cal_get_status(struct sipe_buddy *buddy,
 		SIPE_DEBUG_INFO("sipe_cal_get_status: no calendar data2 for %s, exiting", buddy->name);
 		return SIPE_CAL_NO_DATA;
 	}
-	SIPE_DEBUG_INFO("sipe_cal_get_description: buddy->cal_free_busy=\n%s", free_busy);
 
 	cal_start = sipe_utils_str_to_time(buddy->cal_start_time);
 
@@ -657,81 +514,44 @@ sipe_cal_get_status(struct sipe_buddy *buddy,
 	state_since = sipe_cal_get_since_time(free_busy,
 					      cal_start,
 					      buddy->cal_granularity,
-					      index,
-					      ret);
+					      index);
 
 	if (since) *since = state_since;
 	return ret;
 }
 
 static time_t
-sipe_cal_get_switch_time(const gchar *free_busy,
+sipe_cal_get_switch_time(const struct sipe_freebusy *free_busy,
 			 time_t calStart,
 			 int granularity,
 			 int index,
-			 int current_state,
 			 int *to_state)
 {
-	size_t i;
-	time_t ret = TIME_NULL;
+	gsize i;
 
-	if ((index < 0) || ((size_t) (index + 1) > strlen(free_busy))) {
+	if ((index < 0) || ((gsize) index >= free_busy->count)) {
 		*to_state = SIPE_CAL_NO_DATA;
-		return ret;
+		return TIME_NULL;
 	}
 
-	for (i = index + 1; i < strlen(free_busy); i++) {
-		int temp_status = free_busy[i] - '0';
+	i = sipe_freebusy_next_change(free_busy, index);
+	if (i == free_busy->count)
+		return TIME_NULL;
 
-		if (current_state != temp_status) {
-			*to_state = temp_status;
-			return calStart + i*granularity*60;
-		}
-	}
-
-	return ret;
-}
-
-static const char*
-sipe_cal_get_tz(struct sipe_cal_working_hours *wh,
-                time_t time_in_question)
-{
-	time_t dst_switch_time = (*wh).dst.switch_time;
-	time_t std_switch_time = (*wh).std.switch_time;
-	gboolean is_dst = FALSE;
-
-	/* No daylight savings */
-	if (dst_switch_time == TIME_NULL) {
-		return wh->tz_std;
-	}
-
-	if (dst_switch_time < std_switch_time) { /* North hemosphere - Europe, US */
-		if (time_in_question >= dst_switch_time && time_in_question < std_switch_time) {
-			is_dst = TRUE;
-		}
-	} else { /* South hemisphere - Australia */
-		if (time_in_question >= dst_switch_time || time_in_question < std_switch_time) {
-			is_dst = TRUE;
-		}
-	}
-
-	if (is_dst) {
-		return wh->tz_dst;
-	} else {
-		return wh->tz_std;
-	}
+	*to_state = sipe_freebusy_get(free_busy, i);
+	return calStart + i*granularity*60;
 }
 
 static time_t
 sipe_cal_mktime_of_day(struct tm *sample_today_tm,
 		       const int shift_minutes,
-		       const char *tz)
+		       const struct sipe_tz *tz)
 {
 	sample_today_tm->tm_sec  = 0;
 	sample_today_tm->tm_min  = shift_minutes % 60;
 	sample_today_tm->tm_hour = shift_minutes / 60;
 
-	return sipe_mktime_tz(sample_today_tm, tz);
+	return sipe_tz_mktime(tz, sample_today_tm);
 }
 
 /**
@@ -746,10 +566,11 @@ sipe_cal_get_today_work_hours(struct sipe_cal_working_hours *wh,
 			      time_t *next_start)
 {
 	time_t now = time(NULL);
-	const char *tz = sipe_cal_get_tz(wh, now);
-	struct tm *remote_now_tm = sipe_localtime_tz(&now, tz);
+	struct tm remote_now_tm;
+
+	sipe_tz_localtime(wh->tz, now, &remote_now_tm);
 
-	if (!(wh->days_of_week && strstr(wh->days_of_week, wday_names[remote_now_tm->tm_wday]))) {
+	if (!(wh->days_of_week && strstr(wh->days_of_week, wday_names[remote_now_tm.tm_wday]))) {
 		/* not a work day */
 		*start = TIME_NULL;
 		*end = TIME_NULL;
@@ -757,21 +578,23 @@ sipe_cal_get_today_work_hours(struct sipe_cal_working_hours *wh,
 		return;
 	}
 
-	*end = sipe_cal_mktime_of_day(remote_now_tm, wh->end_time, tz);
+	*end = sipe_cal_mktime_of_day(&remote_now_tm, wh->end_time, wh->tz);
 
 	if (now < *end) {
-		*start = sipe_cal_mktime_of_day(remote_now_tm, wh->start_time, tz);
+		*start = sipe_cal_mktime_of_day(&remote_now_tm, wh->start_time, wh->tz);
 		*next_start = TIME_NULL;
 	} else { /* calculate start of tomorrow's work day if any */
 		time_t tom = now + 24*60*60;
-		struct tm *remote_tom_tm = sipe_localtime_tz(&tom, sipe_cal_get_tz(wh, tom));
+		struct tm remote_tom_tm;
 
-		if (!(wh->days_of_week && strstr(wh->days_of_week, wday_names[remote_tom_tm->tm_wday]))) {
+		sipe_tz_localtime(wh->tz, tom, &remote_tom_tm);
+
+		if (!(wh->days_of_week && strstr(wh->days_of_week, wday_names[remote_tom_tm.tm_wday]))) {
 			/* not a work day */
 			*next_start = TIME_NULL;
 		}
 
-		*next_start = sipe_cal_mktime_of_day(remote_tom_tm, wh->start_time, sipe_cal_get_tz(wh, tom));
+		*next_start = sipe_cal_mktime_of_day(&remote_tom_tm, wh->start_time, wh->tz);
 		*start = TIME_NULL;
 	}
 }
@@ -817,19 +640,11 @@ sipe_cal_get_until(const time_t now,
 	return ret;
 }
 
-static char*
+static const struct sipe_freebusy *
 sipe_cal_get_free_busy(struct sipe_buddy *buddy)
 {
 /* do lazy decode if necessary */
 	if (!buddy->cal_free_busy && buddy->cal_free_busy_base64) {
-		gsize cal_dec64_len;
-		guchar *cal_dec64;
-		gsize i;
-		int j = 0;
-
-		cal_dec64 = g_base64_decode(buddy->cal_free_busy_base64, &cal_dec64_len);
-
-		buddy->cal_free_busy = g_malloc0(cal_dec64_len * 4 + 1);
 /*
    http://msdn.microsoft.com/en-us/library/dd941537%28office.13%29.aspx
 		00, Free (Fr)
@@ -844,16 +659,9 @@ sipe_cal_get_free_busy(struct sipe_buddy *buddy)
 		3  Out of Office (OOF)
 		4  No data
 */
-		for (i = 0; i < cal_dec64_len; i++) {
-#define TWO_BIT_MASK	0x03
-			char tmp = cal_dec64[i];
-			buddy->cal_free_busy[j++] = (tmp & TWO_BIT_MASK) + '0';
-			buddy->cal_free_busy[j++] = ((tmp >> 2) & TWO_BIT_MASK) + '0';
-			buddy->cal_free_busy[j++] = ((tmp >> 4) & TWO_BIT_MASK) + '0';
-			buddy->cal_free_busy[j++] = ((tmp >> 6) & TWO_BIT_MASK) + '0';
-		}
-		buddy->cal_free_busy[j++] = '\0';
-		g_free(cal_dec64);
+		buddy->cal_free_busy = sipe_freebusy_from_base64(buddy->cal_free_busy_base64);
+		SIPE_DEBUG_INFO("sipe_cal_get_free_busy: %" G_GSIZE_FORMAT " slots for %s",
+				buddy->cal_free_busy->count, buddy->name);
 	}
 
 	return buddy->cal_free_busy;
@@ -862,32 +670,33 @@ sipe_cal_get_free_busy(struct sipe_buddy *buddy)
 char *
 sipe_cal_get_freebusy_base64(const char* freebusy_hex)
 {
-	guint i = 0;
-	guint j = 0;
-	guint shift_factor = 0;
-	guint len, res_len;
-	guchar *res;
+	struct sipe_freebusy *free_busy;
 	gchar *res_base64;
 
 	if (!freebusy_hex) return NULL;
 
-	len = strlen(freebusy_hex);
-	res_len = len / 4 + 1;
-	res = g_malloc0(res_len);
-	while (i < len) {
-		res[j] |= (freebusy_hex[i++] - '0') << shift_factor;
-		shift_factor += 2;
-		if (shift_factor == 8) {
-			shift_factor = 0;
-			j++;
-		}
-	}
-
-	res_base64 = g_base64_encode(res, shift_factor ? res_len : res_len - 1);
-	g_free(res);
+	free_busy = sipe_freebusy_from_string(freebusy_hex);
+	res_base64 = sipe_freebusy_to_base64(free_busy);
+	sipe_freebusy_free(free_busy);
 	return res_base64;
 }
 
+/* NULL timezone: GMT */
+static const gchar *
+sipe_cal_time_to_debug_str(const struct sipe_tz *tz,
+			   time_t time)
+{
+	struct tm tm;
+
+	if (!IS(time)) return "";
+
+	if (tz)
+		sipe_tz_localtime(tz, time, &tm);
+	else
+		sipe_tz_gmtime(time, &tm);
+	return sipe_utils_time_to_debug_str(&tm);
+}
+
 char *
 sipe_cal_get_description(struct sipe_buddy *buddy)
 {
@@ -903,7 +712,7 @@ sipe_cal_get_description(struct sipe_buddy *buddy)
 	time_t until = TIME_NULL;
 	int index = 0;
 	gboolean has_working_hours = (buddy->cal_working_hours != NULL);
-	const char *free_busy;
+	const struct sipe_freebusy *free_busy;
 	const char *cal_states[] = {_("Free"),
 				    _("Tentative"),
 				    _("Busy"),
@@ -917,15 +726,14 @@ sipe_cal_get_description(struct sipe_buddy *buddy)
 
 	/* to lazy load if needed */
 	free_busy = sipe_cal_get_free_busy(buddy);
-	SIPE_DEBUG_INFO("sipe_cal_get_description: buddy->cal_free_busy=\n%s", free_busy ? free_busy : "");
 
-	if (!buddy->cal_free_busy || !buddy->cal_granularity || !buddy->cal_start_time) {
+	if (!free_busy || !buddy->cal_granularity || !buddy->cal_start_time) {
 		SIPE_DEBUG_INFO_NOFORMAT("sipe_cal_get_description: no calendar data, exiting");
 		return NULL;
 	}
 
 	cal_start = sipe_utils_str_to_time(buddy->cal_start_time);
-	cal_end = cal_start + 60 * (buddy->cal_granularity) * strlen(buddy->cal_free_busy);
+	cal_end = cal_start + 60 * (buddy->cal_granularity) * free_busy->count;
 
 	current_cal_state = sipe_cal_get_status0(free_busy, cal_start, buddy->cal_granularity, time(NULL), &index);
 	if (current_cal_state == SIPE_CAL_NO_DATA) {
@@ -933,34 +741,32 @@ sipe_cal_get_description(struct sipe_buddy *buddy)
 		return NULL;
 	}
 
-	switch_time = sipe_cal_get_switch_time(free_busy, cal_start, buddy->cal_granularity, index, current_cal_state, &to_state);
+	switch_time = sipe_cal_get_switch_time(free_busy, cal_start, buddy->cal_granularity, index, &to_state);
 
 	SIPE_DEBUG_INFO_NOFORMAT("\n* Calendar *");
 	if (buddy->cal_working_hours) {
-		sipe_cal_get_today_work_hours(buddy->cal_working_hours, &start, &end, &next_start);
+		struct sipe_tz *tz = buddy->cal_working_hours->tz;
+		time_t dst_start = TIME_NULL;
+		time_t std_start = TIME_NULL;
 
-		SIPE_DEBUG_INFO("Remote now timezone : %s", sipe_cal_get_tz(buddy->cal_working_hours, now));
-		SIPE_DEBUG_INFO("std.switch_time(GMT): %s",
-				IS((*buddy->cal_working_hours).std.switch_time) ? sipe_utils_time_to_debug_str(gmtime(&((*buddy->cal_working_hours).std.switch_time))) : "");
-		SIPE_DEBUG_INFO("dst.switch_time(GMT): %s",
-				IS((*buddy->cal_working_hours).dst.switch_time) ? sipe_utils_time_to_debug_str(gmtime(&((*buddy->cal_working_hours).dst.switch_time))) : "");
-		SIPE_DEBUG_INFO("Remote now time     : %s",
-			sipe_utils_time_to_debug_str(sipe_localtime_tz(&now, sipe_cal_get_tz(buddy->cal_working_hours, now))));
-		SIPE_DEBUG_INFO("Remote start time   : %s",
-			IS(start) ? sipe_utils_time_to_debug_str(sipe_localtime_tz(&start, sipe_cal_get_tz(buddy->cal_working_hours, start))) : "");
-		SIPE_DEBUG_INFO("Remote end time     : %s",
-			IS(end) ? sipe_utils_time_to_debug_str(sipe_localtime_tz(&end, sipe_cal_get_tz(buddy->cal_working_hours, end))) : "");
-		SIPE_DEBUG_INFO("Rem. next_start time: %s",
-			IS(next_start) ? sipe_utils_time_to_debug_str(sipe_localtime_tz(&next_start, sipe_cal_get_tz(buddy->cal_working_hours, next_start))) : "");
-		SIPE_DEBUG_INFO("Remote switch time  : %s",
-			IS(switch_time) ? sipe_utils_time_to_debug_str(sipe_localtime_tz(&switch_time, sipe_cal_get_tz(buddy->cal_working_hours, switch_time))) : "");
+		sipe_cal_get_today_work_hours(buddy->cal_working_hours, &start, &end, &next_start);
+		sipe_tz_transitions(tz, now, &dst_start, &std_start);
+
+		SIPE_DEBUG_INFO("Remote timezone     : %s", sipe_tz_name(tz));
+		SIPE_DEBUG_INFO("std.switch_time(GMT): %s", sipe_cal_time_to_debug_str(NULL, std_start));
+		SIPE_DEBUG_INFO("dst.switch_time(GMT): %s", sipe_cal_time_to_debug_str(NULL, dst_start));
+		SIPE_DEBUG_INFO("Remote now time     : %s", sipe_cal_time_to_debug_str(tz, now));
+		SIPE_DEBUG_INFO("Remote start time   : %s", sipe_cal_time_to_debug_str(tz, start));
+		SIPE_DEBUG_INFO("Remote end time     : %s", sipe_cal_time_to_debug_str(tz, end));
+		SIPE_DEBUG_INFO("Rem. next_start time: %s", sipe_cal_time_to_debug_str(tz, next_start));
+		SIPE_DEBUG_INFO("Remote switch time  : %s", sipe_cal_time_to_debug_str(tz, switch_time));
 	} else {
 		SIPE_DEBUG_INFO("Local now time      : %s",
 			sipe_utils_time_to_debug_str(localtime(&now)));
 		SIPE_DEBUG_INFO("Local switch time   : %s",
 			IS(switch_time) ? sipe_utils_time_to_debug_str(localtime(&switch_time)) : "");
 	}
-	SIPE_DEBUG_INFO("Calendar End (GMT)  : %s", sipe_utils_time_to_debug_str(gmtime(&cal_end)));
+	SIPE_DEBUG_INFO("Calendar End (GMT)  : %s", sipe_cal_time_to_debug_str(NULL, cal_end));
 	SIPE_DEBUG_INFO("current cal state   : %s", cal_states[current_cal_state]);
 	SIPE_DEBUG_INFO("switch  cal state   : %s", cal_states[to_state]         );
 
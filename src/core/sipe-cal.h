@@ -113,17 +113,6 @@ void
 sipe_cal_event_debug(const struct sipe_cal_event *cal_event,
 		     const gchar *label);
 
-/**
- * Converts struct tm to Epoch time_t considering timezone.
- *
- * @param tz as defined for TZ environment variable.
- *
- * Reference: see timegm(3) - Linux man page
- */
-time_t
-sipe_mktime_tz(struct tm *tm,
-	       const char* tz);
-
 /**
  * Converts hex representation of freebusy string as
  * returned by Exchange Web Services to
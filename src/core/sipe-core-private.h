@@ -34,6 +34,7 @@ struct sipe_groups;
 struct sipe_http;
 struct sipe_http_request;
 struct sipe_media_call_private;
+struct sipe_schedule_queue;
 struct sipe_svc;
 struct sipe_ucs;
 struct sipe_webticket;
@@ -117,7 +118,7 @@ struct sipe_core_private {
 	gchar *ocs2005_user_states;
 
 	/* Scheduling system */
-	GSList *timeouts;
+	struct sipe_schedule_queue *timeouts;
 
 	/* Active subscriptions */
 	GHashTable *subscriptions;
@@ -151,10 +151,13 @@ void sipe_core_init(SIPE_UNUSED_PARAMETER const char *locale_dir)
 	sip_sec_init();
 
 #ifdef ENABLE_NLS
-	SIPE_DEBUG_INFO("bindtextdomain = %s",
-			bindtextdomain(PACKAGE_NAME, locale_dir));
-	SIPE_DEBUG_INFO("bind_textdomain_codeset = %s",
-			bind_textdomain_codeset(PACKAGE_NAME, "UTF-8"));
+	{
+		/* must be called even when debugging is disabled */
+		const gchar *dir     = bindtextdomain(PACKAGE_NAME, locale_dir);
+		const gchar *codeset = bind_textdomain_codeset(PACKAGE_NAME, "UTF-8");
+		SIPE_DEBUG_INFO("bindtextdomain = %s", dir);
+		SIPE_DEBUG_INFO("bind_textdomain_codeset = %s", codeset);
+	}
 	textdomain(PACKAGE_NAME);
 #endif
 	/* Initialization for crypto backend (production mode) */
@@ -172,6 +175,22 @@ void sipe_core_destroy(void)
 	sip_sec_destroy();
 }
 
+guint sipe_core_debug_categories(const gchar *string)
+{
+	static const GDebugKey keys[] = {
+		{ "core",      SIPE_DEBUG_CATEGORY_CORE      },
+		{ "transport", SIPE_DEBUG_CATEGORY_TRANSPORT },
+		{ "http",      SIPE_DEBUG_CATEGORY_HTTP      },
+		{ "xml",       SIPE_DEBUG_CATEGORY_XML       },
+		{ "presence",  SIPE_DEBUG_CATEGORY_PRESENCE  },
+		{ "media",     SIPE_DEBUG_CATEGORY_MEDIA     },
+	};
+
+	return(string ?
+	       g_parse_debug_string(string, keys, G_N_ELEMENTS(keys)) :
+	       0);
+}
+
 gchar *sipe_core_about(void)
 {
 	gchar *options = g_strjoinv(" / ", (gchar **) sipe_core_build_options);
@@ -0,0 +1,214 @@
+/**
+ * @file sipe-crc32-tests.c
+ *
+ * pidgin-sipe
+ *
+ * Copyright (C) 2015 SIPE Project <http://sipe.sourceforge.net/>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* Tests & micro benchmarks for sipe-crc32.c */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "sipe-common.h"
+#include "sipe-crc32.h"
+
+/*
+ * Tester code
+ */
+static guint succeeded = 0;
+static guint failed    = 0;
+static guint32 seed    = 1;
+
+/* reproducible test data */
+static guchar test_random(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return((guchar) (seed >> 16));
+}
+
+/* previous implementation: byte-at-a-time (crc32() in sip-sec-ntlm.c) */
+static guint32 test_legacy_table[256];
+
+static void test_legacy_make_table(void)
+{
+	guint32 h = 1;
+	unsigned int i, j;
+
+	memset(test_legacy_table, 0, sizeof(test_legacy_table));
+
+	for (i = 128; i; i >>= 1) {
+		h = (h >> 1) ^ ((h & 1) ? 0xedb88320L : 0);
+
+		for (j = 0; j < 256; j += 2 * i)
+			test_legacy_table[i + j] = test_legacy_table[j] ^ h;
+	}
+}
+
+static guint32 test_legacy_crc32(guint32 crc, const guint8 *buf, gsize len)
+{
+	crc ^= 0xffffffffL;
+
+	while (len--)
+		crc = (crc >> 8) ^ test_legacy_table[(crc ^ *buf++) & 0xff];
+
+	return crc ^ 0xffffffffL;
+}
+
+static void test_result(const gchar *label,
+			gsize length,
+			gsize offset,
+			guint32 value,
+			guint32 expected)
+{
+	if (value == expected) {
+		succeeded++;
+	} else {
+		printf("FAILED %s (length %" G_GSIZE_FORMAT ", offset %" G_GSIZE_FORMAT "): %08X (expected %08X)\n",
+		       label, length, offset, value, expected);
+		failed++;
+	}
+}
+
+static void test_vector(const gchar *label,
+			const gchar *data,
+			gsize length,
+			guint32 expected)
+{
+	test_result(label, length, 0,
+		    sipe_crc32(0, (const guchar *) data, length),
+		    expected);
+	test_result(label, length, 0,
+		    sipe_crc32_portable(0, (const guchar *) data, length),
+		    expected);
+}
+
+static void test_lengths(gsize max_length)
+{
+	guchar *data = g_malloc(max_length + 8);
+	gsize length, offset;
+
+	for (length = 0; length < max_length + 8; length++)
+		data[length] = test_random();
+
+	/* all alignments, hardware paths have length thresholds */
+	for (length = 0; length <= max_length; length++)
+		for (offset = 0; offset < 8; offset++) {
+			guint32 expected = test_legacy_crc32(0, data + offset, length);
+			gsize split      = length / 3;
+
+			test_result("portable", length, offset,
+				    sipe_crc32_portable(0, data + offset, length),
+				    expected);
+			test_result("selected", length, offset,
+				    sipe_crc32(0, data + offset, length),
+				    expected);
+
+			/* incremental */
+			test_result("incremental", length, offset,
+				    sipe_crc32(sipe_crc32(0, data + offset, split),
+					       data + offset + split,
+					       length - split),
+				    expected);
+		}
+
+	g_free(data);
+}
+
+static void test_benchmark(gsize length, guint rounds)
+{
+	guchar *data = g_malloc(length);
+	GTimer *timer = g_timer_new();
+	gdouble elapsed_legacy, elapsed_portable, elapsed_selected;
+	guint32 legacy = 0, portable = 0, selected = 0;
+	gsize i;
+	guint round;
+
+	for (i = 0; i < length; i++)
+		data[i] = test_random();
+
+	g_timer_start(timer);
+	for (round = 0; round < rounds; round++)
+		legacy = test_legacy_crc32(legacy, data, length);
+	elapsed_legacy = g_timer_elapsed(timer, NULL);
+
+	g_timer_start(timer);
+	for (round = 0; round < rounds; round++)
+		portable = sipe_crc32_portable(portable, data, length);
+	elapsed_portable = g_timer_elapsed(timer, NULL);
+
+	g_timer_start(timer);
+	for (round = 0; round < rounds; round++)
+		selected = sipe_crc32(selected, data, length);
+	elapsed_selected = g_timer_elapsed(timer, NULL);
+
+	test_result("benchmark portable", length, 0, portable, legacy);
+	test_result("benchmark selected", length, 0, selected, legacy);
+
+	printf("%" G_GSIZE_FORMAT " bytes\n", length);
+	printf("%-32s %8.3f ms %12.1f MB/s\n",
+	       "crc32 (byte-at-a-time)",
+	       elapsed_legacy * 1000,
+	       elapsed_legacy > 0 ? rounds * length / elapsed_legacy / 1000000 : 0);
+	printf("%-32s %8.3f ms %12.1f MB/s\n",
+	       "crc32 (slicing-by-8)",
+	       elapsed_portable * 1000,
+	       elapsed_portable > 0 ? rounds * length / elapsed_portable / 1000000 : 0);
+	printf("%-32s %8.3f ms %12.1f MB/s\n",
+	       sipe_crc32_implementation(),
+	       elapsed_selected * 1000,
+	       elapsed_selected > 0 ? rounds * length / elapsed_selected / 1000000 : 0);
+
+	g_timer_destroy(timer);
+	g_free(data);
+}
+
+int main(SIPE_UNUSED_PARAMETER int argc, SIPE_UNUSED_PARAMETER char *argv[])
+{
+	test_legacy_make_table();
+
+	printf("CRC-32 implementation: %s\n", sipe_crc32_implementation());
+
+	test_vector("empty", "", 0, 0x00000000);
+	test_vector("check", "123456789", 9, 0xCBF43926);
+	/* "Plaintext" in UTF-16LE, see sip-sec-ntlm-tests.c */
+	test_vector("NTLM",
+		    "\x50\x00\x6c\x00\x61\x00\x69\x00\x6e\x00\x74\x00\x65\x00\x78\x00\x74\x00",
+		    18, 0x93AA847D);
+
+	test_lengths(300);
+
+	/* typical NTLM signature input & file transfer chunk */
+	test_benchmark(  256, 400000);
+	test_benchmark(16384,   8000);
+
+	printf("Result: %u PASSED %u FAILED\n", succeeded, failed);
+	return(failed);
+}
+
+/*
+  Local Variables:
+  mode: c
+  c-file-style: "bsd"
+  indent-tabs-mode: t
+  tab-width: 8
+  End:
+*/
@@ -0,0 +1,331 @@
+/**
+ * @file sipe-crc32.c
+ *
+ * pidgin-sipe
+ *
+ * Copyright (C) 2015 SIPE Project <http://sipe.sourceforge.net/>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * CRC-32, reflected polynomial 0xEDB88320
+ *
+ * Portable implementation: slicing-by-8, i.e. 8 input bytes per step
+ * with 8 lookup tables.
+ *
+ * Hardware implementations are selected at run time:
+ *
+ *  - x86:     PCLMULQDQ folding, see Intel whitepaper "Fast CRC
+ *             Computation for Generic Polynomials Using PCLMULQDQ
+ *             Instruction". Used for blocks >= 64 bytes.
+ *  - ARMv8:   CRC32 instructions (Linux only, needs HWCAP_CRC32)
+ *
+ * Tables & implementation selection are initialized once with g_once().
+ */
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "sipe-common.h"
+#include "sipe-crc32.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || \
+     (defined(__GNUC__) && ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)))))
+#define SIPE_CRC32_PCLMUL
+#include <cpuid.h>
+#include <wmmintrin.h>
+#include <smmintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__linux__) && \
+    defined(__GNUC__) && !defined(__clang__) && (__GNUC__ >= 7)
+#define SIPE_CRC32_ARMV8
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#endif
+
+#define CRC32_POLYNOMIAL 0xEDB88320
+
+typedef guint32 (*crc32_function)(guint32 crc,
+				  const guchar *buffer,
+				  gsize length);
+
+static guint32 crc32_table[8][256];
+static crc32_function crc32_selected = NULL;
+static const gchar *crc32_name       = NULL;
+static GOnce crc32_once              = G_ONCE_INIT;
+
+static void crc32_make_tables(void)
+{
+	guint32 i;
+	guint j;
+
+	for (i = 0; i < 256; i++) {
+		guint32 crc = i;
+		for (j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ ((crc & 1) ? CRC32_POLYNOMIAL : 0);
+		crc32_table[0][i] = crc;
+	}
+
+	/* table[n]: CRC of byte followed by n zero bytes */
+	for (i = 0; i < 256; i++)
+		for (j = 1; j < 8; j++)
+			crc32_table[j][i] = (crc32_table[j - 1][i] >> 8) ^
+				crc32_table[0][crc32_table[j - 1][i] & 0xFF];
+}
+
+static guint32 crc32_slicing_by_8(guint32 crc,
+				  const guchar *buffer,
+				  gsize length)
+{
+	crc = ~crc;
+
+	while (length && ((gsize) buffer & 7)) {
+		crc = (crc >> 8) ^ crc32_table[0][(crc ^ *buffer++) & 0xFF];
+		length--;
+	}
+
+	while (length >= 8) {
+		guint32 one, two;
+
+		/* aligned, but memcpy() keeps strict aliasing happy */
+		memcpy(&one, buffer,     sizeof(one));
+		memcpy(&two, buffer + 4, sizeof(two));
+		one = GUINT32_FROM_LE(one) ^ crc;
+		two = GUINT32_FROM_LE(two);
+
+		crc = crc32_table[7][ one        & 0xFF] ^
+		      crc32_table[6][(one >>  8) & 0xFF] ^
+		      crc32_table[5][(one >> 16) & 0xFF] ^
+		      crc32_table[4][ one >> 24        ] ^
+		      crc32_table[3][ two        & 0xFF] ^
+		      crc32_table[2][(two >>  8) & 0xFF] ^
+		      crc32_table[1][(two >> 16) & 0xFF] ^
+		      crc32_table[0][ two >> 24        ];
+
+		buffer += 8;
+		length -= 8;
+	}
+
+	while (length--)
+		crc = (crc >> 8) ^ crc32_table[0][(crc ^ *buffer++) & 0xFF];
+
+	return(~crc);
+}
+
+#ifdef SIPE_CRC32_PCLMUL
+/*
+ * Operates on the CRC register, i.e. without pre/post inversion.
+ * Length must be >= 64 and a multiple of 16.
+ */
+__attribute__((target("pclmul,sse4.1")))
+static guint32 crc32_fold(guint32 crc,
+			  const guchar *buffer,
+			  gsize length)
+{
+	/* constants for the reflected polynomial, see whitepaper */
+	const __m128i k1k2 = _mm_set_epi64x(0x01C6E41596, 0x0154442BD4);
+	const __m128i k3k4 = _mm_set_epi64x(0x00CCAA009E, 0x01751997D0);
+	const __m128i k5k0 = _mm_set_epi64x(0x0000000000, 0x0163CD6124);
+	const __m128i poly = _mm_set_epi64x(0x01F7011641, 0x01DB710641);
+	const __m128i mask = _mm_setr_epi32(~0, 0, ~0, 0);
+	__m128i x1, x2, x3, x4, x5, x6, x7, x8;
+
+	x1 = _mm_loadu_si128((const __m128i *) (buffer + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *) (buffer + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *) (buffer + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *) (buffer + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int) crc));
+	buffer += 64;
+	length -= 64;
+
+	/* fold 4 x 128 bits in parallel */
+	while (length >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+				   _mm_loadu_si128((const __m128i *) (buffer + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6),
+				   _mm_loadu_si128((const __m128i *) (buffer + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7),
+				   _mm_loadu_si128((const __m128i *) (buffer + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8),
+				   _mm_loadu_si128((const __m128i *) (buffer + 0x30)));
+
+		buffer += 64;
+		length -= 64;
+	}
+
+	/* fold 4 x 128 bits into 128 bits */
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	/* remaining 128 bit blocks */
+	while (length >= 16) {
+		x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+				   _mm_loadu_si128((const __m128i *) buffer));
+		buffer += 16;
+		length -= 16;
+	}
+
+	/* fold 128 bits into 64 bits */
+	x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, mask);
+	x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduction to 32 bits */
+	x2 = _mm_and_si128(x1, mask);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+	x2 = _mm_and_si128(x2, mask);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return((guint32) _mm_extract_epi32(x1, 1));
+}
+
+static guint32 crc32_pclmul(guint32 crc,
+			    const guchar *buffer,
+			    gsize length)
+{
+	if (length >= 64) {
+		gsize blocks = length & ~((gsize) 15);
+
+		crc     = ~crc32_fold(~crc, buffer, blocks);
+		buffer += blocks;
+		length -= blocks;
+	}
+
+	return(crc32_slicing_by_8(crc, buffer, length));
+}
+
+static gboolean crc32_pclmul_supported(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return(FALSE);
+
+	return((ecx & bit_PCLMUL) && (ecx & bit_SSE4_1));
+}
+#endif
+
+#ifdef SIPE_CRC32_ARMV8
+__attribute__((target("+crc")))
+static guint32 crc32_armv8(guint32 crc,
+			   const guchar *buffer,
+			   gsize length)
+{
+	crc = ~crc;
+
+	while (length && ((gsize) buffer & 7)) {
+		crc = __crc32b(crc, *buffer++);
+		length--;
+	}
+
+	while (length >= 8) {
+		guint64 data;
+
+		memcpy(&data, buffer, sizeof(data));
+		crc = __crc32d(crc, GUINT64_FROM_LE(data));
+		buffer += 8;
+		length -= 8;
+	}
+
+	while (length--)
+		crc = __crc32b(crc, *buffer++);
+
+	return(~crc);
+}
+#endif
+
+static gpointer crc32_setup(SIPE_UNUSED_PARAMETER gpointer data)
+{
+	crc32_make_tables();
+
+	crc32_selected = crc32_slicing_by_8;
+	crc32_name     = "slicing-by-8";
+#ifdef SIPE_CRC32_PCLMUL
+	if (crc32_pclmul_supported()) {
+		crc32_selected = crc32_pclmul;
+		crc32_name     = "PCLMULQDQ";
+	}
+#endif
+#ifdef SIPE_CRC32_ARMV8
+	if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+		crc32_selected = crc32_armv8;
+		crc32_name     = "ARMv8 CRC32";
+	}
+#endif
+
+	return(NULL);
+}
+
+#define crc32_init() g_once(&crc32_once, crc32_setup, NULL)
+
+guint32 sipe_crc32(guint32 crc,
+		   const guchar *buffer,
+		   gsize length)
+{
+	crc32_init();
+	return((*crc32_selected)(crc, buffer, length));
+}
+
+guint32 sipe_crc32_portable(guint32 crc,
+			    const guchar *buffer,
+			    gsize length)
+{
+	crc32_init();
+	return(crc32_slicing_by_8(crc, buffer, length));
+}
+
+const gchar *sipe_crc32_implementation(void)
+{
+	crc32_init();
+	return(crc32_name);
+}
+
+/*
+  Local Variables:
+  mode: c
+  c-file-style: "bsd"
+  indent-tabs-mode: t
+  tab-width: 8
+  End:
+*/
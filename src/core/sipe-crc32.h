@@ -0,0 +1,53 @@
+/**
+ * @file sipe-crc32.h
+ *
+ * pidgin-sipe
+ *
+ * Copyright (C) 2015 SIPE Project <http://sipe.sourceforge.net/>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Interface dependencies:
+ *
+ * <glib.h>
+ */
+
+/**
+ * CRC-32 as used by NTLM, zlib, Ethernet, etc.
+ *
+ * Thread-safe. Uses the fastest implementation available on the CPU.
+ *
+ * @param crc    CRC of the preceding data or 0 for the first block
+ * @param buffer data
+ * @param length length of data
+ *
+ * @return CRC-32
+ */
+guint32 sipe_crc32(guint32 crc,
+		   const guchar *buffer,
+		   gsize length);
+
+/**
+ * CRC-32 implementation selected by sipe_crc32(), Ex.: "slicing-by-8"
+ */
+const gchar *sipe_crc32_implementation(void);
+
+/* for tests only: portable implementation */
+guint32 sipe_crc32_portable(guint32 crc,
+			    const guchar *buffer,
+			    gsize length);
+
@@ -140,6 +140,12 @@ sipe_crypt(CK_MECHANISM_TYPE cipherMech,
 
 /* PUBLIC methods */
 
+gboolean
+sipe_crypt_random(guchar *buffer, gsize length)
+{
+	return(PK11_GenerateRandom(buffer, length) == SECSuccess);
+}
+
 void
 sipe_crypt_des(const guchar *key,
 	       const guchar *plaintext, gsize plaintext_length,
@@ -285,6 +291,27 @@ void sipe_crypt_tls_block(const guchar *key, gsize key_length,
 	}
 }
 
+/* Block AES-CBC cipher for TLS with persistent context */
+gpointer sipe_crypt_tls_block_start(const guchar *key, gsize key_length,
+				    const guchar *iv, gsize iv_length)
+{
+	return sipe_crypt_ctx_create(CKM_AES_CBC,
+				     key, key_length,
+				     iv, iv_length);
+}
+
+void sipe_crypt_tls_block_encrypt(gpointer context,
+				  const guchar *in, gsize length,
+				  guchar *out)
+{
+	sipe_crypt_ctx_encrypt(context, in, length, out);
+}
+
+void sipe_crypt_tls_block_destroy(gpointer context)
+{
+	sipe_crypt_ctx_destroy(context);
+}
+
 /*
   Local Variables:
   mode: c
@@ -24,6 +24,7 @@
  * Cipher routines implementation based on OpenSSL.
  */
 #include <openssl/evp.h>
+#include <openssl/rand.h>
 #include <openssl/rsa.h>
 
 #include "glib.h"
@@ -71,6 +72,11 @@ static void openssl_oneshot_crypt(const EVP_CIPHER *type,
 	EVP_CIPHER_CTX_cleanup(&ctx);
 }
 
+gboolean sipe_crypt_random(guchar *buffer, gsize length)
+{
+	return(RAND_bytes(buffer, length) == 1);
+}
+
 /* DES CBC with 56-bit key */
 void sipe_crypt_des(const guchar *key,
 		    const guchar *plaintext, gsize plaintext_length,
@@ -207,13 +213,7 @@ void sipe_crypt_tls_destroy(gpointer context)
 	g_free(context);
 }
 
-/* Block AES-CBC cipher for TLS */
-void sipe_crypt_tls_block(const guchar *key, gsize key_length,
-			  const guchar *iv,
-			  /* OpenSSL assumes that iv is of correct size */
-			  SIPE_UNUSED_PARAMETER gsize iv_length,
-			  const guchar *in, gsize length,
-			  guchar *out)
+static const EVP_CIPHER *openssl_aes_cbc(gsize key_length)
 {
 	const EVP_CIPHER *type = NULL;
 
@@ -232,25 +232,61 @@ void sipe_crypt_tls_block(const guchar *key, gsize key_length,
 		type = EVP_aes_256_cbc();
 		break;
 	default:
-		SIPE_DEBUG_ERROR("sipe_crypt_tls_block: unsupported key length %" G_GSIZE_FORMAT " bytes for AES CBC",
+		SIPE_DEBUG_ERROR("openssl_aes_cbc: unsupported key length %" G_GSIZE_FORMAT " bytes for AES CBC",
 				 key_length);
 		break;
 	}
 
-	if (type) {
-		EVP_CIPHER_CTX *context = openssl_EVP_init(type,
-							   key, key_length,
-							   iv);
-
-		if (context) {
-			int tmp;
-			EVP_EncryptUpdate(context, out, &tmp, in, length);
-			EVP_CIPHER_CTX_cleanup(context);
-			g_free(context);
-		}
+	return(type);
+}
+
+/* Block AES-CBC cipher for TLS */
+void sipe_crypt_tls_block(const guchar *key, gsize key_length,
+			  const guchar *iv, gsize iv_length,
+			  const guchar *in, gsize length,
+			  guchar *out)
+{
+	gpointer context = sipe_crypt_tls_block_start(key, key_length,
+						      iv, iv_length);
+
+	if (context) {
+		sipe_crypt_tls_block_encrypt(context, in, length, out);
+		sipe_crypt_tls_block_destroy(context);
 	}
 }
 
+/* Block AES-CBC cipher for TLS with persistent context */
+gpointer sipe_crypt_tls_block_start(const guchar *key, gsize key_length,
+				    const guchar *iv,
+				    /* OpenSSL assumes that iv is of correct size */
+				    SIPE_UNUSED_PARAMETER gsize iv_length)
+{
+	const EVP_CIPHER *type = openssl_aes_cbc(key_length);
+	EVP_CIPHER_CTX *context;
+
+	if (!type)
+		return(NULL);
+
+	context = openssl_EVP_init(type, key, key_length, iv);
+	/* TLS adds its own padding */
+	EVP_CIPHER_CTX_set_padding(context, 0);
+	return(context);
+}
+
+void sipe_crypt_tls_block_encrypt(gpointer context,
+				  const guchar *in, gsize length,
+				  guchar *out)
+{
+	int tmp;
+	EVP_EncryptUpdate(context, out, &tmp, in, length);
+}
+
+void sipe_crypt_tls_block_destroy(gpointer context)
+{
+	EVP_CIPHER_CTX_cleanup(context);
+	g_free(context);
+}
+
 /*
   Local Variables:
   mode: c
@@ -29,6 +29,9 @@
 void sipe_crypto_init(gboolean production_mode);
 void sipe_crypto_shutdown(void);
 
+/* Cryptographically strong random bytes, FALSE on failure */
+gboolean sipe_crypt_random(guchar *buffer, gsize length);
+
 void sipe_crypt_des(const guchar *key,
 		    const guchar *plaintext, gsize plaintext_length,
 		    guchar *encrypted_text);
@@ -52,7 +55,7 @@ gboolean sipe_crypt_verify_rsa(gpointer public,
 			       const guchar *digest, gsize digest_length,
 			       const guchar *signature, gsize signature_length);
 
-/* Stream RC4 cipher for file transfer */
+/* Stream RC4 cipher for file transfer, in & out may point to the same buffer */
 gpointer sipe_crypt_ft_start(const guchar *key);
 void sipe_crypt_ft_stream(gpointer context,
 			  const guchar *in, gsize length,
@@ -71,3 +74,17 @@ void sipe_crypt_tls_block(const guchar *key, gsize key_length,
 			  const guchar *iv, gsize iv_length,
 			  const guchar *in, gsize length,
 			  guchar *out);
+
+/*
+ * Block AES-CBC cipher for TLS with persistent context
+ *
+ * The CBC state is carried over between calls, i.e. the IV of the next
+ * record is the last cipher text block of the previous one (TLS 1.0).
+ * in & out may point to the same buffer.
+ */
+gpointer sipe_crypt_tls_block_start(const guchar *key, gsize key_length,
+				    const guchar *iv, gsize iv_length);
+void sipe_crypt_tls_block_encrypt(gpointer context,
+				  const guchar *in, gsize length,
+				  guchar *out);
+void sipe_crypt_tls_block_destroy(gpointer context);
@@ -152,6 +152,35 @@ void sipe_digest_hmac_sha1(const guchar *key, gsize key_length,
 	sipe_digest_hmac(CKM_SHA_1_HMAC, key, key_length, data, data_length, digest, SIPE_DIGEST_HMAC_SHA1_LENGTH);
 }
 
+/* Stream HMAC(MD5/SHA-1) digests with persistent key */
+gpointer sipe_digest_hmac_md5_start(const guchar *key, gsize key_length)
+{
+	return sipe_digest_hmac_ctx_create(CKM_MD5_HMAC, key, key_length);
+}
+
+gpointer sipe_digest_hmac_sha1_start(const guchar *key, gsize key_length)
+{
+	return sipe_digest_hmac_ctx_create(CKM_SHA_1_HMAC, key, key_length);
+}
+
+void sipe_digest_hmac_update(gpointer context, const guchar *data, gsize length)
+{
+	sipe_digest_ctx_append(context, data, length);
+}
+
+void sipe_digest_hmac_end(gpointer context, guchar *digest)
+{
+	/* SHA-1 is the longest supported HMAC */
+	sipe_digest_ctx_digest(context, digest, SIPE_DIGEST_HMAC_SHA1_LENGTH);
+	/* re-use key for next message */
+	PK11_DigestBegin(context);
+}
+
+void sipe_digest_hmac_destroy(gpointer context)
+{
+	sipe_digest_ctx_destroy(context);
+}
+
 /* Stream HMAC(SHA1) digest for file transfer */
 gpointer sipe_digest_ft_start(const guchar *sha1_digest)
 {
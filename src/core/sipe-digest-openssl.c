@@ -58,6 +58,44 @@ void sipe_digest_hmac_sha1(const guchar *key, gsize key_length,
 	HMAC(EVP_sha1(), key, key_length, data, data_length, digest, NULL);
 }
 
+/* Stream HMAC(MD5/SHA-1) digests with persistent key */
+static gpointer openssl_hmac_start(const EVP_MD *type,
+				   const guchar *key, gsize key_length)
+{
+	HMAC_CTX *ctx = g_malloc(sizeof(HMAC_CTX));
+	HMAC_CTX_init(ctx);
+	HMAC_Init_ex(ctx, key, key_length, type, NULL);
+	return(ctx);
+}
+
+gpointer sipe_digest_hmac_md5_start(const guchar *key, gsize key_length)
+{
+	return(openssl_hmac_start(EVP_md5(), key, key_length));
+}
+
+gpointer sipe_digest_hmac_sha1_start(const guchar *key, gsize key_length)
+{
+	return(openssl_hmac_start(EVP_sha1(), key, key_length));
+}
+
+void sipe_digest_hmac_update(gpointer context, const guchar *data, gsize length)
+{
+	HMAC_Update(context, data, length);
+}
+
+void sipe_digest_hmac_end(gpointer context, guchar *digest)
+{
+	HMAC_Final(context, digest, NULL);
+	/* re-use key schedule for next message */
+	HMAC_Init_ex(context, NULL, 0, NULL, NULL);
+}
+
+void sipe_digest_hmac_destroy(gpointer context)
+{
+	HMAC_CTX_cleanup(context);
+	g_free(context);
+}
+
 /* Stream HMAC(SHA1) digest for file transfer */
 gpointer sipe_digest_ft_start(const guchar *sha1_digest)
 {
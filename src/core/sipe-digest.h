@@ -38,6 +38,18 @@ void sipe_digest_hmac_sha1(const guchar *key, gsize key_length,
 			  const guchar *data, gsize data_length,
 			  guchar *digest);
 
+/*
+ * Stream HMAC digests with persistent key, e.g. for TLS records
+ *
+ * sipe_digest_hmac_end() resets the context for the next message
+ * with the same key. digest must have space for the HMAC length.
+ */
+gpointer sipe_digest_hmac_md5_start(const guchar *key, gsize key_length);
+gpointer sipe_digest_hmac_sha1_start(const guchar *key, gsize key_length);
+void sipe_digest_hmac_update(gpointer context, const guchar *data, gsize length);
+void sipe_digest_hmac_end(gpointer context, guchar *digest);
+void sipe_digest_hmac_destroy(gpointer context);
+
 /* Stream HMAC(SHA1) digest for file transfer */
 #define SIPE_DIGEST_FILETRANSFER_LENGTH SIPE_DIGEST_SHA1_LENGTH
 gpointer sipe_digest_ft_start(const guchar *sha1_digest);
@@ -78,6 +78,7 @@ Similar functionality for iCalendar/CalDAV/Google would be great to implement to
 #include "sipe-domino.h"
 #include "sipe-http.h"
 #include "sipe-nls.h"
+#include "sipe-tz.h"
 #include "sipe-utils.h"
 #include "sipe-xml.h"
 
@@ -323,16 +324,16 @@ static void sipe_domino_do_calendar_request(struct sipe_calendar *cal)
 		time_t now = time(NULL);
 		char *start_str;
 		char *end_str;
-		struct tm *now_tm;
+		struct tm now_tm;
 
 		SIPE_DEBUG_INFO_NOFORMAT("sipe_domino_do_calendar_request: going Calendar req.");
 
-		now_tm = gmtime(&now);
+		sipe_tz_gmtime(now, &now_tm);
 		/* start -1 day, 00:00:00 */
-		now_tm->tm_sec = 0;
-		now_tm->tm_min = 0;
-		now_tm->tm_hour = 0;
-		cal->fb_start = sipe_mktime_tz(now_tm, "UTC");
+		now_tm.tm_sec = 0;
+		now_tm.tm_min = 0;
+		now_tm.tm_hour = 0;
+		cal->fb_start = sipe_tz_timegm(&now_tm);
 		cal->fb_start -= 24*60*60;
 		/* end = start + 4 days - 1 sec */
 		end = cal->fb_start + SIPE_FREE_BUSY_PERIOD_SEC - 1;
@@ -57,6 +57,7 @@ be great to implement too.
 #include "sipe-ews.h"
 #include "sipe-ews-autodiscover.h"
 #include "sipe-http.h"
+#include "sipe-tz.h"
 #include "sipe-utils.h"
 #include "sipe-xml.h"
 
@@ -368,16 +369,16 @@ static void sipe_ews_do_avail_request(struct sipe_calendar *cal)
 		time_t now = time(NULL);
 		char *start_str;
 		char *end_str;
-		struct tm *now_tm;
+		struct tm now_tm;
 
 		SIPE_DEBUG_INFO_NOFORMAT("sipe_ews_do_avail_request: going Availability req.");
 
-		now_tm = gmtime(&now);
+		sipe_tz_gmtime(now, &now_tm);
 		/* start -1 day, 00:00:00 */
-		now_tm->tm_sec = 0;
-		now_tm->tm_min = 0;
-		now_tm->tm_hour = 0;
-		cal->fb_start = sipe_mktime_tz(now_tm, "UTC");
+		now_tm.tm_sec = 0;
+		now_tm.tm_min = 0;
+		now_tm.tm_hour = 0;
+		cal->fb_start = sipe_tz_timegm(&now_tm);
 		cal->fb_start -= 24*60*60;
 		/* end = start + 4 days - 1 sec */
 		end = cal->fb_start + SIPE_FREE_BUSY_PERIOD_SEC - 1;
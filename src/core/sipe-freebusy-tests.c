@@ -0,0 +1,279 @@
+/**
+ * @file sipe-freebusy-tests.c
+ *
+ * pidgin-sipe
+ *
+ * Copyright (C) 2015 SIPE Project <http://sipe.sourceforge.net/>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* Tests & micro benchmarks for sipe-freebusy.c */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "sipe-common.h"
+#include "sipe-freebusy.h"
+
+/*
+ * Tester code
+ */
+static guint succeeded = 0;
+static guint failed    = 0;
+static guint32 seed    = 1;
+
+/* reproducible test data */
+static guint test_random(guint range)
+{
+	seed = seed * 1103515245 + 12345;
+	return((seed >> 16) % range);
+}
+
+/* calendar-like data: long runs of the same state */
+static gchar *test_slots(gsize count, guint max_run)
+{
+	gchar *slots = g_malloc(count + 1);
+	gsize i = 0;
+
+	while (i < count) {
+		gchar state = '0' + test_random(4);
+		guint run   = 1 + test_random(max_run);
+		while (run-- && (i < count))
+			slots[i++] = state;
+	}
+	slots[count] = '\0';
+
+	return(slots);
+}
+
+/* previous implementation of sipe_cal_get_freebusy_base64() */
+static gchar *test_legacy_base64(const gchar *freebusy_hex)
+{
+	guint i = 0;
+	guint j = 0;
+	guint shift_factor = 0;
+	guint len, res_len;
+	guchar *res;
+	gchar *res_base64;
+
+	len = strlen(freebusy_hex);
+	res_len = len / 4 + 1;
+	res = g_malloc0(res_len);
+	while (i < len) {
+		res[j] |= (freebusy_hex[i++] - '0') << shift_factor;
+		shift_factor += 2;
+		if (shift_factor == 8) {
+			shift_factor = 0;
+			j++;
+		}
+	}
+
+	res_base64 = g_base64_encode(res, shift_factor ? res_len : res_len - 1);
+	g_free(res);
+	return res_base64;
+}
+
+/* previous implementation of the slot scans */
+static gsize test_legacy_next_change(const gchar *slots, gsize index)
+{
+	gsize i;
+	for (i = index + 1; i < strlen(slots); i++)
+		if (slots[i] != slots[index])
+			return(i);
+	return(strlen(slots));
+}
+
+static gsize test_legacy_run_start(const gchar *slots, gsize index)
+{
+	gsize i;
+	for (i = index; i > 0; i--)
+		if (slots[i - 1] != slots[index])
+			return(i);
+	return(0);
+}
+
+static gsize test_legacy_count(const gchar *slots, gsize start, gsize end, guint state)
+{
+	gsize i, result = 0;
+	for (i = start; (i < end) && slots[i]; i++)
+		if (slots[i] == (gchar) ('0' + state))
+			result++;
+	return(result);
+}
+
+static void test_result(const gchar *label,
+			gsize count,
+			gsize index,
+			gsize value,
+			gsize expected)
+{
+	if (value == expected) {
+		succeeded++;
+	} else {
+		printf("FAILED %s (%" G_GSIZE_FORMAT " slots, index %" G_GSIZE_FORMAT "): %" G_GSIZE_FORMAT " (expected %" G_GSIZE_FORMAT ")\n",
+		       label, count, index, value, expected);
+		failed++;
+	}
+}
+
+static void test_encoding(gsize count)
+{
+	gchar *slots  = test_slots(count, 8);
+	gchar *legacy = test_legacy_base64(slots);
+	struct sipe_freebusy *freebusy = sipe_freebusy_from_string(slots);
+	gchar *base64 = sipe_freebusy_to_base64(freebusy);
+	gsize i, mismatch = 0;
+
+	if (!strcmp(base64, legacy)) {
+		succeeded++;
+	} else {
+		printf("FAILED encode %" G_GSIZE_FORMAT " slots: '%s' (expected '%s')\n",
+		       count, base64, legacy);
+		failed++;
+	}
+	sipe_freebusy_free(freebusy);
+
+	/* decoded data is padded to full bytes */
+	freebusy = sipe_freebusy_from_base64(base64);
+	for (i = 0; i < count; i++)
+		if (sipe_freebusy_get(freebusy, i) != (guint) (slots[i] - '0'))
+			mismatch++;
+	test_result("decode", count, 0, mismatch, 0);
+	test_result("decoded length", count, 0, freebusy->count, (count + 3) & ~3);
+
+	sipe_freebusy_free(freebusy);
+	g_free(base64);
+	g_free(legacy);
+	g_free(slots);
+}
+
+/* EWS "4" (No data) must not turn into Free or spill into the next slot */
+static void test_no_data(void)
+{
+	static const gchar slots[]    = "0123440";
+	static const guint expected[] = { 0, 1, 2, 3, 2, 2, 0 };
+	struct sipe_freebusy *freebusy = sipe_freebusy_from_string(slots);
+	gsize i;
+
+	test_result("no data length", 7, 0, freebusy->count, 7);
+	for (i = 0; i < G_N_ELEMENTS(expected); i++)
+		test_result("no data", 7, i,
+			    sipe_freebusy_get(freebusy, i), expected[i]);
+
+	sipe_freebusy_free(freebusy);
+}
+
+static void test_scans(gsize count, guint max_run)
+{
+	gchar *slots = test_slots(count, max_run);
+	struct sipe_freebusy *freebusy = sipe_freebusy_from_string(slots);
+	gsize i;
+
+	for (i = 0; i < count; i++) {
+		gsize end = i + test_random(count + 1);
+
+		test_result("next change", count, i,
+			    sipe_freebusy_next_change(freebusy, i),
+			    test_legacy_next_change(slots, i));
+		test_result("run start",   count, i,
+			    sipe_freebusy_run_start(freebusy, i),
+			    test_legacy_run_start(slots, i));
+		test_result("count",       count, i,
+			    sipe_freebusy_count(freebusy, i, end, slots[i] - '0'),
+			    test_legacy_count(slots, i, end, slots[i] - '0'));
+	}
+
+	sipe_freebusy_free(freebusy);
+	g_free(slots);
+}
+
+static void test_benchmark(gsize count, guint rounds)
+{
+	gchar *slots = test_slots(count, 64);
+	struct sipe_freebusy *freebusy = sipe_freebusy_from_string(slots);
+	GTimer *timer = g_timer_new();
+	gsize legacy = 0, packed = 0;
+	gdouble elapsed_legacy, elapsed_packed;
+	guint round;
+
+	g_timer_start(timer);
+	for (round = 0; round < rounds; round++) {
+		gsize index = round % count;
+		legacy += test_legacy_next_change(slots, index);
+		legacy += test_legacy_run_start(slots, index);
+		legacy += test_legacy_count(slots, 0, count, 2);
+	}
+	elapsed_legacy = g_timer_elapsed(timer, NULL);
+
+	g_timer_start(timer);
+	for (round = 0; round < rounds; round++) {
+		gsize index = round % count;
+		packed += sipe_freebusy_next_change(freebusy, index);
+		packed += sipe_freebusy_run_start(freebusy, index);
+		packed += sipe_freebusy_count(freebusy, 0, count, 2);
+	}
+	elapsed_packed = g_timer_elapsed(timer, NULL);
+
+	test_result("benchmark", count, 0, packed, legacy);
+
+	printf("%-32s %8.3f ms %12.1f scans/s\n",
+	       "free/busy scans (string)",
+	       elapsed_legacy * 1000,
+	       elapsed_legacy > 0 ? rounds / elapsed_legacy : 0);
+	printf("%-32s %8.3f ms %12.1f scans/s\n",
+	       "free/busy scans (packed)",
+	       elapsed_packed * 1000,
+	       elapsed_packed > 0 ? rounds / elapsed_packed : 0);
+
+	g_timer_destroy(timer);
+	sipe_freebusy_free(freebusy);
+	g_free(slots);
+}
+
+int main(SIPE_UNUSED_PARAMETER int argc, SIPE_UNUSED_PARAMETER char *argv[])
+{
+	gsize count;
+
+	for (count = 1; count <= 70; count++)
+		test_encoding(count);
+
+	test_no_data();
+
+	/* runs shorter & longer than a 64-bit word (32 slots) */
+	test_scans(  1,   1);
+	test_scans( 31,   2);
+	test_scans(100,   4);
+	test_scans(257,  40);
+	test_scans(500, 200);
+
+	/* 4 weeks with 15 minute granularity */
+	test_benchmark(4 * 7 * 24 * 4, 100000);
+
+	printf("Result: %u PASSED %u FAILED\n", succeeded, failed);
+	return(failed);
+}
+
+/*
+  Local Variables:
+  mode: c
+  c-file-style: "bsd"
+  indent-tabs-mode: t
+  tab-width: 8
+  End:
+*/
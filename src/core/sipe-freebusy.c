@@ -0,0 +1,223 @@
+/**
+ * @file sipe-freebusy.c
+ *
+ * pidgin-sipe
+ *
+ * Copyright (C) 2015 SIPE Project <http://sipe.sourceforge.net/>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * http://msdn.microsoft.com/en-us/library/dd941537%28office.13%29.aspx
+ *
+ * Scans compare whole 64-bit words against the current state repeated
+ * over all slots and only fall back to single slots at run boundaries.
+ */
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "sipe-freebusy.h"
+
+#define SLOTS_PER_BYTE 4
+#define SLOTS_PER_WORD (SLOTS_PER_BYTE * sizeof(guint64))
+#define SLOT_MASK      0x03
+#define SLOT_BUSY      2
+
+/* state repeated in all slots of a byte/word */
+#define BYTE_PATTERN(state) ((guchar) ((state) * 0x55))
+#define WORD_PATTERN(state) ((state) * G_GUINT64_CONSTANT(0x5555555555555555))
+
+#define SLOT(freebusy, index) \
+	(((freebusy)->slots[(index) / SLOTS_PER_BYTE] >> (((index) % SLOTS_PER_BYTE) * 2)) & SLOT_MASK)
+
+static guint64 load_word(const guchar *p)
+{
+	guint64 word;
+	/* unaligned access */
+	memcpy(&word, p, sizeof(word));
+	return(word);
+}
+
+static guint popcount64(guint64 x)
+{
+	x = x - ((x >> 1) & G_GUINT64_CONSTANT(0x5555555555555555));
+	x = (x & G_GUINT64_CONSTANT(0x3333333333333333)) +
+		((x >> 2) & G_GUINT64_CONSTANT(0x3333333333333333));
+	x = (x + (x >> 4)) & G_GUINT64_CONSTANT(0x0F0F0F0F0F0F0F0F);
+	return((guint) ((x * G_GUINT64_CONSTANT(0x0101010101010101)) >> 56));
+}
+
+struct sipe_freebusy *sipe_freebusy_from_base64(const gchar *base64)
+{
+	struct sipe_freebusy *freebusy = g_new0(struct sipe_freebusy, 1);
+	gsize length;
+
+	freebusy->slots = g_base64_decode(base64, &length);
+	freebusy->count = length * SLOTS_PER_BYTE;
+
+	return(freebusy);
+}
+
+struct sipe_freebusy *sipe_freebusy_from_string(const gchar *string)
+{
+	struct sipe_freebusy *freebusy = g_new0(struct sipe_freebusy, 1);
+	gsize i;
+
+	freebusy->count = strlen(string);
+	freebusy->slots = g_malloc0((freebusy->count + SLOTS_PER_BYTE - 1) / SLOTS_PER_BYTE);
+
+	for (i = 0; i < freebusy->count; i++) {
+		guint state = string[i] - '0';
+
+		/* "4" (No data) has no 2-bit encoding: treat as Busy */
+		if (state > SLOT_MASK)
+			state = SLOT_BUSY;
+
+		freebusy->slots[i / SLOTS_PER_BYTE] |=
+			state << ((i % SLOTS_PER_BYTE) * 2);
+	}
+
+	return(freebusy);
+}
+
+gchar *sipe_freebusy_to_base64(const struct sipe_freebusy *freebusy)
+{
+	return(g_base64_encode(freebusy->slots,
+			       (freebusy->count + SLOTS_PER_BYTE - 1) / SLOTS_PER_BYTE));
+}
+
+void sipe_freebusy_free(struct sipe_freebusy *freebusy)
+{
+	if (freebusy) {
+		g_free(freebusy->slots);
+		g_free(freebusy);
+	}
+}
+
+guint sipe_freebusy_get(const struct sipe_freebusy *freebusy,
+			gsize index)
+{
+	return(SLOT(freebusy, index));
+}
+
+gsize sipe_freebusy_next_change(const struct sipe_freebusy *freebusy,
+				gsize index)
+{
+	const guchar *slots = freebusy->slots;
+	gsize count         = freebusy->count;
+	guint state         = SLOT(freebusy, index);
+	guint64 word        = WORD_PATTERN(state);
+	guchar byte         = BYTE_PATTERN(state);
+	gsize i             = index + 1;
+
+	/* rest of the current byte */
+	while ((i < count) && (i % SLOTS_PER_BYTE)) {
+		if (SLOT(freebusy, i) != state)
+			return(i);
+		i++;
+	}
+
+	/* skip unchanged words & bytes */
+	while ((i + SLOTS_PER_WORD <= count) &&
+	       (load_word(slots + i / SLOTS_PER_BYTE) == word))
+		i += SLOTS_PER_WORD;
+	while ((i + SLOTS_PER_BYTE <= count) &&
+	       (slots[i / SLOTS_PER_BYTE] == byte))
+		i += SLOTS_PER_BYTE;
+
+	/* locate change inside the byte */
+	while ((i < count) && (SLOT(freebusy, i) == state))
+		i++;
+
+	return(i);
+}
+
+gsize sipe_freebusy_run_start(const struct sipe_freebusy *freebusy,
+			      gsize index)
+{
+	const guchar *slots = freebusy->slots;
+	guint state         = SLOT(freebusy, index);
+	guint64 word        = WORD_PATTERN(state);
+	guchar byte         = BYTE_PATTERN(state);
+	gsize i             = index;
+
+	/* start of the current byte */
+	while (i % SLOTS_PER_BYTE) {
+		if (SLOT(freebusy, i - 1) != state)
+			return(i);
+		i--;
+	}
+
+	/* skip unchanged words & bytes */
+	while ((i >= SLOTS_PER_WORD) &&
+	       (load_word(slots + (i - SLOTS_PER_WORD) / SLOTS_PER_BYTE) == word))
+		i -= SLOTS_PER_WORD;
+	while ((i >= SLOTS_PER_BYTE) &&
+	       (slots[i / SLOTS_PER_BYTE - 1] == byte))
+		i -= SLOTS_PER_BYTE;
+
+	/* locate change inside the byte */
+	while ((i > 0) && (SLOT(freebusy, i - 1) == state))
+		i--;
+
+	return(i);
+}
+
+gsize sipe_freebusy_count(const struct sipe_freebusy *freebusy,
+			  gsize start,
+			  gsize end,
+			  guint state)
+{
+	const guchar *slots = freebusy->slots;
+	guint64 word        = WORD_PATTERN(state);
+	gsize result        = 0;
+	gsize i             = start;
+
+	if (end > freebusy->count)
+		end = freebusy->count;
+
+	while ((i < end) && (i % SLOTS_PER_BYTE)) {
+		if (SLOT(freebusy, i) == state)
+			result++;
+		i++;
+	}
+
+	/* slot matches if both of its bits are equal to the pattern */
+	while (i + SLOTS_PER_WORD <= end) {
+		guint64 match = ~(load_word(slots + i / SLOTS_PER_BYTE) ^ word);
+		result += popcount64(match & (match >> 1) & G_GUINT64_CONSTANT(0x5555555555555555));
+		i += SLOTS_PER_WORD;
+	}
+
+	while (i < end) {
+		if (SLOT(freebusy, i) == state)
+			result++;
+		i++;
+	}
+
+	return(result);
+}
+
+/*
+  Local Variables:
+  mode: c
+  c-file-style: "bsd"
+  indent-tabs-mode: t
+  tab-width: 8
+  End:
+*/
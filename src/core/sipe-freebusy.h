@@ -0,0 +1,133 @@
+/**
+ * @file sipe-freebusy.h
+ *
+ * pidgin-sipe
+ *
+ * Copyright (C) 2015 SIPE Project <http://sipe.sourceforge.net/>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Interface dependencies:
+ *
+ * <glib.h>
+ */
+
+/**
+ * Packed free/busy information
+ *
+ * Same layout as the decoded calendarData/freeBusy publication:
+ * 2 bits per slot, 4 slots per byte, first slot in the lowest bits.
+ *
+ * Slot values (same as SIPE_CAL_FREE ... SIPE_CAL_OOF):
+ *
+ *    0 Free
+ *    1 Tentative
+ *    2 Busy
+ *    3 Out of Office
+ */
+struct sipe_freebusy {
+	guchar *slots;
+	gsize count;
+};
+
+/**
+ * Create free/busy information from base64 encoded publication
+ *
+ * @param base64 calendarData/freeBusy contents
+ *
+ * @return free/busy information. Must be freed with sipe_freebusy_free().
+ */
+struct sipe_freebusy *sipe_freebusy_from_base64(const gchar *base64);
+
+/**
+ * Create free/busy information from a string with one digit per slot,
+ * e.g. MergedFreeBusy as returned by Exchange Web Services
+ *
+ * EWS uses "4" for slots without data. As the packed format has no
+ * such state, these slots (and any other unexpected character) are
+ * stored as Busy.
+ *
+ * @param string slot digits
+ *
+ * @return free/busy information. Must be freed with sipe_freebusy_free().
+ */
+struct sipe_freebusy *sipe_freebusy_from_string(const gchar *string);
+
+/**
+ * Encode free/busy information for publication
+ *
+ * @param freebusy free/busy information
+ *
+ * @return base64 encoded string. Must be g_free()'d after use.
+ */
+gchar *sipe_freebusy_to_base64(const struct sipe_freebusy *freebusy);
+
+/**
+ * Free free/busy information
+ *
+ * @param freebusy free/busy information (may be @c NULL)
+ */
+void sipe_freebusy_free(struct sipe_freebusy *freebusy);
+
+/**
+ * State of a slot
+ *
+ * @param freebusy free/busy information
+ * @param index    slot index (must be < @c freebusy->count)
+ *
+ * @return slot state
+ */
+guint sipe_freebusy_get(const struct sipe_freebusy *freebusy,
+			gsize index);
+
+/**
+ * Find the first slot after @c index with a different state
+ *
+ * @param freebusy free/busy information
+ * @param index    slot index (must be < @c freebusy->count)
+ *
+ * @return slot index or @c freebusy->count if state doesn't change
+ */
+gsize sipe_freebusy_next_change(const struct sipe_freebusy *freebusy,
+				gsize index);
+
+/**
+ * Find the first slot of the run of equal states containing @c index
+ *
+ * @param freebusy free/busy information
+ * @param index    slot index (must be < @c freebusy->count)
+ *
+ * @return slot index
+ */
+gsize sipe_freebusy_run_start(const struct sipe_freebusy *freebusy,
+			      gsize index);
+
+/**
+ * Count slots with a given state in the range [@c start, @c end)
+ *
+ * @param freebusy free/busy information
+ * @param start    first slot index
+ * @param end      slot index after the last slot (clipped to @c freebusy->count)
+ * @param state    slot state to count
+ *
+ * @return number of slots
+ */
+gsize sipe_freebusy_count(const struct sipe_freebusy *freebusy,
+			  gsize start,
+			  gsize end,
+			  guint state);
+
@@ -35,6 +35,7 @@
 #endif
 
 #include "sip-transport.h"
+#define SIPE_DEBUG_CATEGORY SIPE_DEBUG_CATEGORY_MEDIA
 #include "sipe-backend.h"
 #include "sipe-common.h"
 #include "sipe-core.h"
@@ -533,10 +534,17 @@ write_chunk(struct sipe_media_stream *stream,
 	    guint8 type, guint16 len, const gchar *buffer)
 {
 	guint16 len_be = GUINT16_TO_BE(len);
+	struct sipe_media_iovec vectors[3];
 
-	sipe_media_stream_write(stream, &type, sizeof (guint8));
-	sipe_media_stream_write(stream, (guint8 *)&len_be, sizeof (guint16));
-	sipe_media_stream_write(stream, (guint8 *)buffer, len);
+	vectors[0].buffer = &type;
+	vectors[0].len = sizeof (guint8);
+	vectors[1].buffer = &len_be;
+	vectors[1].len = sizeof (guint16);
+	vectors[2].buffer = buffer;
+	vectors[2].len = len;
+
+	/* header & data are sent without a copy or queued together */
+	sipe_media_stream_writev(stream, vectors, G_N_ELEMENTS(vectors));
 }
 
 static gboolean
@@ -558,7 +566,9 @@ send_file_chunk(SIPE_UNUSED_PARAMETER GIOChannel *source,
 	}
 
 	if (!sipe_media_stream_is_writable(stream)) {
-		return TRUE; /* G_SOURCE_CONTINUE */
+		/* writable_cb() resumes when the write queue has drained */
+		ft_private->backend_pipe_write_source_id = 0;
+		return FALSE; /* G_SOURCE_REMOVE */
 	}
 
 	bytes_read = read(ft_private->backend_pipe[0],
@@ -575,19 +585,44 @@ send_file_chunk(SIPE_UNUSED_PARAMETER GIOChannel *source,
 			    strlen(request_id_str), request_id_str);
 		g_free(request_id_str);
 
+		stream->writable_cb = NULL;
+		ft_private->backend_pipe_write_source_id = 0;
 		return FALSE; /* G_SOURCE_REMOVE */
 	}
 
 	return TRUE; /* G_SOURCE_CONTINUE */
 }
 
+static void
+watch_backend_pipe(struct sipe_file_transfer_lync *ft_private)
+{
+	GIOChannel *channel;
+
+	channel = g_io_channel_unix_new(ft_private->backend_pipe[0]);
+	ft_private->backend_pipe_write_source_id = g_io_add_watch(channel,
+								  G_IO_IN | G_IO_HUP,
+								  send_file_chunk,
+								  ft_private);
+	g_io_channel_unref(channel);
+}
+
+static void
+writable_cb(struct sipe_media_stream *stream)
+{
+	struct sipe_file_transfer_lync *ft_private =
+			sipe_media_stream_get_data(stream);
+
+	if (ft_private && !ft_private->backend_pipe_write_source_id) {
+		watch_backend_pipe(ft_private);
+	}
+}
+
 static void
 start_writing(struct sipe_file_transfer_lync *ft_private)
 {
 	struct sipe_media_stream *stream;
 	gchar *request_id_str;
 	struct sipe_backend_fd *fd;
-	GIOChannel *channel;
 
 	stream = sipe_core_media_get_stream_by_id(ft_private->call, "data");
 	if (!stream) {
@@ -600,17 +635,18 @@ start_writing(struct sipe_file_transfer_lync *ft_private)
 		return;
 	}
 
+	/* keep a few chunks queued so the backend always has data */
+	sipe_media_stream_set_write_watermarks(stream,
+					       8 * sizeof (ft_private->buffer),
+					       32 * sizeof (ft_private->buffer));
+	stream->writable_cb = writable_cb;
+
 	request_id_str = g_strdup_printf("%u", ft_private->request_id);
 	write_chunk(stream, SIPE_XDATA_START_OF_STREAM,
 		    strlen(request_id_str), request_id_str);
 	g_free(request_id_str);
 
-	channel = g_io_channel_unix_new(ft_private->backend_pipe[0]);
-	ft_private->backend_pipe_write_source_id = g_io_add_watch(channel,
-								  G_IO_IN | G_IO_HUP,
-								  send_file_chunk,
-								  ft_private);
-	g_io_channel_unref(channel);
+	watch_backend_pipe(ft_private);
 
 	fd = sipe_backend_fd_from_int(ft_private->backend_pipe[1]);
 	sipe_backend_ft_start(SIPE_FILE_TRANSFER, fd, NULL, 0);
@@ -0,0 +1,343 @@
+/**
+ * @file sipe-ft-tftp-tests.c
+ *
+ * pidgin-sipe
+ *
+ * Copyright (C) 2015 SIPE Project <http://sipe.sourceforge.net/>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* Tests for the chunk framing in sipe_ft_tftp_read/write() */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "sipe-common.h"
+#include "sipe-backend.h"
+#include "sipe-core.h"
+#include "sipe-crypt.h"
+#include "sipe-digest.h"
+#include "sipe-ft.h"
+#include "sipe-ft-tftp.h"
+
+/*
+ * Socket emulation
+ *
+ * Every read/write call transfers at most "limit" bytes. Data written by
+ * the sender is appended to "stream", the receiver reads from it.
+ */
+static GByteArray *stream   = NULL;
+static gsize stream_offset  = 0;
+static gsize limit          = 0;
+static gboolean is_receiver = FALSE;
+
+gssize sipe_backend_ft_read(SIPE_UNUSED_PARAMETER struct sipe_file_transfer *ft,
+			    guchar *data,
+			    gsize size)
+{
+	gsize length;
+
+	/* sender only checks for a cancel from the receiver */
+	if (!is_receiver)
+		return(0);
+
+	length = MIN(MIN(size, limit), stream->len - stream_offset);
+	memcpy(data, stream->data + stream_offset, length);
+	stream_offset += length;
+	return(length);
+}
+
+gssize sipe_backend_ft_write(SIPE_UNUSED_PARAMETER struct sipe_file_transfer *ft,
+			     const guchar *data,
+			     gsize size)
+{
+	gsize length = MIN(size, limit);
+	g_byte_array_append(stream, data, length);
+	return(length);
+}
+
+void sipe_backend_ft_error(SIPE_UNUSED_PARAMETER struct sipe_file_transfer *ft,
+			   const gchar *errmsg)
+{
+	printf("ERROR: %s\n", errmsg);
+}
+
+const gchar *sipe_backend_ft_get_error(SIPE_UNUSED_PARAMETER struct sipe_file_transfer *ft)
+{
+	return("");
+}
+
+void sipe_ft_raise_error_and_cancel(SIPE_UNUSED_PARAMETER struct sipe_file_transfer_private *ft_private,
+				    const gchar *errmsg)
+{
+	printf("ERROR: %s\n", errmsg);
+}
+
+void sipe_ft_free(SIPE_UNUSED_PARAMETER struct sipe_file_transfer *ft)
+{
+}
+
+/*
+ * Tester code
+ */
+static guint succeeded = 0;
+static guint failed    = 0;
+static guint32 seed    = 1;
+
+/* reproducible test data */
+static guchar test_random(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return((guchar) (seed >> 16));
+}
+
+static struct sipe_file_transfer_private *test_ft_new(gsize block_size)
+{
+	static const guchar key[SIPE_DIGEST_SHA1_LENGTH] = "0123456789abcdef012";
+	struct sipe_file_transfer_private *ft_private = g_new0(struct sipe_file_transfer_private, 1);
+
+	ft_private->block_size     = block_size;
+	ft_private->cipher_context = sipe_crypt_ft_start(key);
+	ft_private->hmac_context   = sipe_digest_ft_start(key);
+	return(ft_private);
+}
+
+static void test_ft_free(struct sipe_file_transfer_private *ft_private,
+			 guchar *digest)
+{
+	sipe_digest_ft_end(ft_private->hmac_context, digest);
+	sipe_crypt_ft_destroy(ft_private->cipher_context);
+	sipe_digest_ft_destroy(ft_private->hmac_context);
+	g_free(ft_private->encrypted_outbuf);
+	g_free(ft_private);
+}
+
+static void test_failed(const gchar *name,
+			gsize block_size,
+			gsize write_limit,
+			gsize read_limit,
+			const gchar *reason)
+{
+	printf("FAILED: %s block %" G_GSIZE_FORMAT " write %" G_GSIZE_FORMAT " read %" G_GSIZE_FORMAT ": %s\n",
+	       name, block_size, write_limit, read_limit, reason);
+	failed++;
+}
+
+/*
+ * Send "size" bytes in pieces of "offer" bytes through a socket that
+ * accepts "write_limit" bytes per call. Then receive them through a
+ * socket that returns "read_limit" bytes per call.
+ */
+static void test_transfer(const gchar *name,
+			  gsize size,
+			  gsize offer,
+			  gsize block_size,
+			  gsize write_limit,
+			  gsize read_limit)
+{
+	struct sipe_file_transfer_private *sender   = test_ft_new(block_size);
+	struct sipe_file_transfer_private *receiver = test_ft_new(block_size);
+	guchar *data     = g_malloc(size);
+	GByteArray *copy = g_byte_array_new();
+	guchar sent_digest[SIPE_DIGEST_FILETRANSFER_LENGTH];
+	guchar received_digest[SIPE_DIGEST_FILETRANSFER_LENGTH];
+	gsize expected   = 0;
+	gsize i, position = 0;
+	gboolean ok = TRUE;
+
+	for (i = 0; i < size; i++)
+		data[i] = test_random();
+
+	/* each batch of offered data is split into chunks separately */
+	for (i = 0; i < size; i += offer) {
+		gsize batch = MIN(offer, size - i);
+		expected += batch +
+			((batch + block_size - 1) / block_size) * SIPE_FT_CHUNK_HEADER_LENGTH;
+	}
+
+	stream        = g_byte_array_new();
+	stream_offset = 0;
+
+	/* sending: backend offers unsent data again until it is reported */
+	is_receiver = FALSE;
+	limit       = write_limit;
+	while (ok && (position < size)) {
+		gssize written = sipe_ft_tftp_write((struct sipe_file_transfer *) sender,
+						    data + position,
+						    MIN(offer, size - position));
+		if ((written < 0) || ((gsize) written > size - position)) {
+			test_failed(name, block_size, write_limit, read_limit,
+				    "write returned invalid length");
+			ok = FALSE;
+		} else {
+			position += written;
+		}
+	}
+
+	if (ok && (stream->len != expected)) {
+		test_failed(name, block_size, write_limit, read_limit,
+			    "unexpected stream length");
+		ok = FALSE;
+	}
+
+	/* receiving: chunk headers may be split between reads */
+	is_receiver = TRUE;
+	limit       = read_limit;
+	position    = 0;
+	while (ok && (position < size)) {
+		guchar *buffer = NULL;
+		gssize received = sipe_ft_tftp_read((struct sipe_file_transfer *) receiver,
+						    &buffer,
+						    size - position,
+						    read_limit);
+		if ((received < 0) || ((gsize) received > size - position)) {
+			test_failed(name, block_size, write_limit, read_limit,
+				    "read returned invalid length");
+			ok = FALSE;
+		} else if ((received == 0) &&
+			   (stream_offset == stream->len)) {
+			test_failed(name, block_size, write_limit, read_limit,
+				    "stream ended prematurely");
+			ok = FALSE;
+		} else if (received > 0) {
+			g_byte_array_append(copy, buffer, received);
+			position += received;
+		}
+		g_free(buffer);
+	}
+
+	test_ft_free(sender, sent_digest);
+	test_ft_free(receiver, received_digest);
+
+	if (ok) {
+		if (stream_offset != stream->len)
+			test_failed(name, block_size, write_limit, read_limit,
+				    "stream not consumed completely");
+		else if ((copy->len != size) || memcmp(copy->data, data, size))
+			test_failed(name, block_size, write_limit, read_limit,
+				    "received data differs");
+		else if (memcmp(sent_digest, received_digest, sizeof(sent_digest)))
+			test_failed(name, block_size, write_limit, read_limit,
+				    "MAC differs");
+		else
+			succeeded++;
+	}
+
+	g_byte_array_free(copy, TRUE);
+	g_byte_array_free(stream, TRUE);
+	stream = NULL;
+	g_free(data);
+}
+
+/* check chunk headers of the stream produced by sipe_ft_tftp_write() */
+static void test_headers(gsize size, gsize block_size)
+{
+	struct sipe_file_transfer_private *sender = test_ft_new(block_size);
+	guchar *data = g_malloc0(size);
+	guchar digest[SIPE_DIGEST_FILETRANSFER_LENGTH];
+	gsize offset = 0, remaining = size;
+	gboolean ok = TRUE;
+
+	stream      = g_byte_array_new();
+	is_receiver = FALSE;
+	limit       = G_MAXSIZE;
+	if (sipe_ft_tftp_write((struct sipe_file_transfer *) sender,
+			       data, size) != (gssize) size) {
+		printf("FAILED: headers block %" G_GSIZE_FORMAT ": write incomplete\n",
+		       block_size);
+		ok = FALSE;
+	}
+
+	while (ok && remaining) {
+		const guchar *header = stream->data + offset;
+		gsize expected = MIN(remaining, block_size);
+
+		if ((offset + SIPE_FT_CHUNK_HEADER_LENGTH > stream->len) ||
+		    (header[0] != 0) ||
+		    ((gsize) (header[1] + (header[2] << 8)) != expected)) {
+			printf("FAILED: headers block %" G_GSIZE_FORMAT ": invalid header at offset %" G_GSIZE_FORMAT "\n",
+			       block_size, offset);
+			ok = FALSE;
+		}
+		offset    += SIPE_FT_CHUNK_HEADER_LENGTH + expected;
+		remaining -= expected;
+	}
+	if (ok && (offset != stream->len)) {
+		printf("FAILED: headers block %" G_GSIZE_FORMAT ": trailing data\n",
+		       block_size);
+		ok = FALSE;
+	}
+
+	if (ok)
+		succeeded++;
+	else
+		failed++;
+
+	test_ft_free(sender, digest);
+	g_byte_array_free(stream, TRUE);
+	stream = NULL;
+	g_free(data);
+}
+
+int main(SIPE_UNUSED_PARAMETER int argc, SIPE_UNUSED_PARAMETER char *argv[])
+{
+	static const gsize limits[] = { 1, 2, 3, 4, 5, 7, 2047, 2048, 2049, 4096, 65536 };
+	guint i, j;
+
+	sipe_crypto_init(FALSE);
+
+	test_headers(1, SIPE_FT_BLOCK_SIZE_FOREFRONT);
+	test_headers(SIPE_FT_BLOCK_SIZE_FOREFRONT, SIPE_FT_BLOCK_SIZE_FOREFRONT);
+	test_headers(10000, SIPE_FT_BLOCK_SIZE_FOREFRONT);
+	test_headers(300, 256);
+
+	/* headers split between reads, partial writes ending in a header */
+	for (i = 0; i < G_N_ELEMENTS(limits); i++)
+		for (j = 0; j < G_N_ELEMENTS(limits); j++)
+			test_transfer("ForeFront",
+				      10000, 4096,
+				      SIPE_FT_BLOCK_SIZE_FOREFRONT,
+				      limits[i], limits[j]);
+
+	/* small blocks: many chunks per read & write */
+	for (i = 0; i < G_N_ELEMENTS(limits); i++)
+		test_transfer("small blocks",
+			      1000, 1000,
+			      5,
+			      limits[i], limits[G_N_ELEMENTS(limits) - 1 - i]);
+
+	/* data offered in odd pieces, last chunk shorter than block */
+	test_transfer("odd offers",   7777, 333,  SIPE_FT_BLOCK_SIZE_FOREFRONT, 1000, 3);
+	test_transfer("single byte",  1,    1,    SIPE_FT_BLOCK_SIZE_FOREFRONT, 1,    1);
+	test_transfer("exact block",  2045, 2045, SIPE_FT_BLOCK_SIZE_FOREFRONT, 2048, 2048);
+
+	sipe_crypto_shutdown();
+
+	printf("Result: %u PASSED %u FAILED\n", succeeded, failed);
+	return(failed);
+}
+
+/*
+  Local Variables:
+  mode: c
+  c-file-style: "bsd"
+  indent-tabs-mode: t
+  tab-width: 8
+  End:
+*/
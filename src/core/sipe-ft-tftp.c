@@ -43,7 +43,6 @@
 #include "sipe-utils.h"
 
 #define BUFFER_SIZE 50
-#define SIPE_FT_CHUNK_HEADER_LENGTH  3
 
 static gboolean
 write_exact(struct sipe_file_transfer_private *ft_private, const guchar *data,
@@ -166,6 +165,63 @@ sipe_hmac_finalize(gpointer hmac_context)
 	return g_base64_encode(hmac_digest, sizeof (hmac_digest));
 }
 
+/* [us], monotonic: statistics must not jump with the wall clock */
+static gint64
+ft_statistics_now(void)
+{
+#if GLIB_CHECK_VERSION(2,28,0)
+	return(g_get_monotonic_time());
+#else
+	GTimeVal now;
+	g_get_current_time(&now);
+	return(((gint64) now.tv_sec) * G_USEC_PER_SEC + now.tv_usec);
+#endif
+}
+
+static void
+ft_statistics_start(struct sipe_file_transfer_private *ft_private)
+{
+	ft_private->start_time        = ft_statistics_now();
+	ft_private->busy_time         = 0;
+	ft_private->bytes_transferred = 0;
+	ft_private->wakeups           = 0;
+}
+
+/*
+ * Busy time is the time spent in the TFTP data path. It is not CPU time,
+ * i.e. it includes time where the process was scheduled out.
+ */
+static void
+ft_statistics_update(struct sipe_file_transfer_private *ft_private,
+		     gint64 busy_start,
+		     gsize bytes)
+{
+	ft_private->busy_time         += ft_statistics_now() - busy_start;
+	ft_private->bytes_transferred += bytes;
+	ft_private->wakeups++;
+}
+
+static void
+ft_statistics_report(struct sipe_file_transfer_private *ft_private,
+		     const gchar *direction)
+{
+	gdouble elapsed, busy;
+
+	if (!ft_private->start_time)
+		return;
+
+	elapsed = (gdouble) (ft_statistics_now() - ft_private->start_time) / G_USEC_PER_SEC;
+	busy    = (gdouble) ft_private->busy_time / G_USEC_PER_SEC;
+	SIPE_DEBUG_INFO("sipe_ft_tftp: %s %" G_GUINT64_FORMAT " bytes in %.3f s (%.1f KiB/s), %u wakeups, busy %.3f s (%.1f%%)",
+			direction,
+			ft_private->bytes_transferred,
+			elapsed,
+			elapsed > 0 ? ft_private->bytes_transferred / elapsed / 1024 : 0,
+			ft_private->wakeups,
+			busy,
+			elapsed > 0 ? 100 * busy / elapsed : 0);
+}
+
 void
 sipe_ft_tftp_start_receiving(struct sipe_file_transfer *ft, gsize total_size)
 {
@@ -215,8 +271,10 @@ sipe_ft_tftp_start_receiving(struct sipe_file_transfer *ft, gsize total_size)
 	}
 
 	ft_private->bytes_remaining_chunk = 0;
+	ft_private->chunk_header_length   = 0;
 	ft_private->cipher_context = sipe_cipher_context_init(ft_private->encryption_key);
 	ft_private->hmac_context   = sipe_hmac_context_init(ft_private->hash_key);
+	ft_statistics_start(ft_private);
 }
 
 gboolean
@@ -261,6 +319,7 @@ sipe_ft_tftp_stop_receiving(struct sipe_file_transfer *ft)
 	g_free(mac1);
 	g_free(mac);
 
+	ft_statistics_report(ft_private, "received");
 	sipe_ft_free(ft);
 
 	return(TRUE);
@@ -331,9 +390,13 @@ sipe_ft_tftp_start_sending(struct sipe_file_transfer *ft, gsize total_size)
 		return;
 	}
 
-	ft_private->bytes_remaining_chunk = 0;
+	if (!ft_private->block_size)
+		ft_private->block_size = SIPE_FT_BLOCK_SIZE_FOREFRONT;
+	ft_private->outbuf_length = 0;
+	ft_private->outbuf_offset = 0;
 	ft_private->cipher_context = sipe_cipher_context_init(ft_private->encryption_key);
 	ft_private->hmac_context   = sipe_hmac_context_init(ft_private->hash_key);
+	ft_statistics_start(ft_private);
 }
 
 gboolean
@@ -363,6 +426,7 @@ sipe_ft_tftp_stop_sending(struct sipe_file_transfer *ft)
 		return FALSE;
 	}
 
+	ft_statistics_report(ft_private, "sent");
 	sipe_ft_free(ft);
 
 	return TRUE;
@@ -377,46 +441,29 @@ static void raise_ft_error(struct sipe_file_transfer_private *ft_private,
 	g_free(tmp);
 }
 
+/* chunk header format:
+ *
+ *  0:  00   unknown             (always zero?)
+ *  1:  LL   chunk size in bytes (low byte)
+ *  2:  HH   chunk size in bytes (high byte)
+ */
+
 gssize
 sipe_ft_tftp_read(struct sipe_file_transfer *ft, guchar **buffer,
 		  gsize bytes_remaining, gsize bytes_available)
 {
 	struct sipe_file_transfer_private *ft_private = SIPE_FILE_TRANSFER_PRIVATE;
-	gsize  bytes_to_read;
+	gint64 busy_start = ft_statistics_now();
+	gsize  bytes_to_read = MIN(bytes_remaining, bytes_available);
 	gssize bytes_read;
+	guchar *in, *out, *end;
 
-	if (ft_private->bytes_remaining_chunk == 0) {
-		guchar hdr_buf[SIPE_FT_CHUNK_HEADER_LENGTH];
-
-		/* read chunk header */
-		if (!read_exact(ft_private, hdr_buf, sizeof(hdr_buf))) {
-			raise_ft_error(ft_private, _("Socket read failed"));
-			return -1;
-		}
-
-		/* chunk header format:
-		 *
-		 *  0:  00   unknown             (always zero?)
-		 *  1:  LL   chunk size in bytes (low byte)
-		 *  2:  HH   chunk size in bytes (high byte)
-		 *
-		 * Convert size from little endian to host order
-		 */
-		ft_private->bytes_remaining_chunk =
-			hdr_buf[1] + (hdr_buf[2] << 8);
-	}
-
-	bytes_to_read = MIN(bytes_remaining, bytes_available);
-	bytes_to_read = MIN(bytes_to_read, ft_private->bytes_remaining_chunk);
-
+	/*
+	 * Read the raw stream directly into the buffer handed to the
+	 * backend. It may contain several chunks, but never extends beyond
+	 * the last chunk as the headers make the stream longer than the data.
+	 */
 	*buffer = g_malloc(bytes_to_read);
-	if (!*buffer) {
-		sipe_backend_ft_error(SIPE_FILE_TRANSFER_PUBLIC, _("Out of memory"));
-		SIPE_DEBUG_ERROR("sipe_core_ft_read: can't allocate %" G_GSIZE_FORMAT " bytes for receive buffer",
-				 bytes_to_read);
-		return -1;
-	}
-
 	bytes_read = sipe_backend_ft_read(SIPE_FILE_TRANSFER_PUBLIC, *buffer, bytes_to_read);
 	if (bytes_read < 0) {
 		raise_ft_error(ft_private, _("Socket read failed"));
@@ -425,49 +472,81 @@ sipe_ft_tftp_read(struct sipe_file_transfer *ft, guchar **buffer,
 		return -1;
 	}
 
-	if (bytes_read > 0) {
-		guchar *decrypted = g_malloc(bytes_read);
-
-		if (!decrypted) {
-			sipe_backend_ft_error(SIPE_FILE_TRANSFER_PUBLIC, _("Out of memory"));
-			SIPE_DEBUG_ERROR("sipe_core_ft_read: can't allocate %" G_GSIZE_FORMAT " bytes for decryption buffer",
-					 (gsize)bytes_read);
-			g_free(*buffer);
-			*buffer = NULL;
-			return -1;
+	/* strip chunk headers, headers may be split between reads */
+	in  = out = *buffer;
+	end = in + bytes_read;
+	while (in < end) {
+		if (ft_private->bytes_remaining_chunk == 0) {
+			ft_private->chunk_header[ft_private->chunk_header_length++] = *in++;
+
+			if (ft_private->chunk_header_length == SIPE_FT_CHUNK_HEADER_LENGTH) {
+				/* Convert size from little endian to host order */
+				ft_private->bytes_remaining_chunk =
+					ft_private->chunk_header[1] +
+					(ft_private->chunk_header[2] << 8);
+				ft_private->chunk_header_length = 0;
+			}
+		} else {
+			gsize length = MIN((gsize) (end - in),
+					   ft_private->bytes_remaining_chunk);
+
+			if (out != in)
+				memmove(out, in, length);
+			in  += length;
+			out += length;
+			ft_private->bytes_remaining_chunk -= length;
 		}
-		sipe_crypt_ft_stream(ft_private->cipher_context,
-				     *buffer, bytes_read, decrypted);
-		g_free(*buffer);
-		*buffer = decrypted;
+	}
+	bytes_read = out - *buffer;
 
+	if (bytes_read > 0) {
+		/* RC4 decryption in place */
+		sipe_crypt_ft_stream(ft_private->cipher_context,
+				     *buffer, bytes_read, *buffer);
 		sipe_digest_ft_update(ft_private->hmac_context,
-				      decrypted, bytes_read);
-
-		ft_private->bytes_remaining_chunk -= bytes_read;
+				      *buffer, bytes_read);
+	} else {
+		g_free(*buffer);
+		*buffer = NULL;
 	}
 
+	ft_statistics_update(ft_private, busy_start, bytes_read);
 	return(bytes_read);
 }
 
+/* number of data bytes in the first "offset" bytes of the chunk stream */
+static gsize
+chunk_data_length(gsize offset, gsize block_size)
+{
+	gsize chunk_size = block_size + SIPE_FT_CHUNK_HEADER_LENGTH;
+	gsize rest       = offset % chunk_size;
+
+	return((offset / chunk_size) * block_size +
+	       (rest > SIPE_FT_CHUNK_HEADER_LENGTH ?
+		rest - SIPE_FT_CHUNK_HEADER_LENGTH : 0));
+}
+
 gssize
 sipe_ft_tftp_write(struct sipe_file_transfer *ft, const guchar *buffer,
 		   gsize size)
 {
 	struct sipe_file_transfer_private *ft_private = SIPE_FILE_TRANSFER_PRIVATE;
+	gsize block_size  = ft_private->block_size;
+	gint64 busy_start = ft_statistics_now();
 	gssize bytes_written;
+	gsize data_written;
 
-	/* When sending data via server with ForeFront installed, block bigger than
-	 * this default causes ending of transmission. Hard limit block to this value
-	 * when libpurple sends us more data. */
-	const gsize DEFAULT_BLOCK_SIZE = 2045;
-	if (size > DEFAULT_BLOCK_SIZE)
-		size = DEFAULT_BLOCK_SIZE;
-
-	if (ft_private->bytes_remaining_chunk == 0) {
+	/*
+	 * Previous chunks completely sent: convert all data offered by the
+	 * backend into chunks. Only the data actually sent is reported back,
+	 * i.e. the backend offers the rest again until the chunks are sent.
+	 */
+	if (ft_private->outbuf_offset == ft_private->outbuf_length) {
 		gssize bytes_read;
 		guchar local_buf[16 + 1]; /* space for string terminator */
-		guchar hdr_buf[SIPE_FT_CHUNK_HEADER_LENGTH];
+		gsize chunks = (size + block_size - 1) / block_size;
+		gsize length = size + chunks * SIPE_FT_CHUNK_HEADER_LENGTH;
+		guchar *out;
 
 		/* Check if receiver did not cancel the transfer
 		   before it is finished */
@@ -486,58 +565,51 @@ sipe_ft_tftp_write(struct sipe_file_transfer *ft, const guchar *buffer,
 			return -1;
 		}
 
-		if (ft_private->outbuf_size < size) {
+		/* send buffer is re-used for the whole transfer */
+		if (ft_private->outbuf_size < length) {
 			g_free(ft_private->encrypted_outbuf);
-			ft_private->outbuf_size = size;
+			ft_private->outbuf_size = length;
 			ft_private->encrypted_outbuf = g_malloc(ft_private->outbuf_size);
-			if (!ft_private->encrypted_outbuf) {
-				sipe_backend_ft_error(SIPE_FILE_TRANSFER_PUBLIC,
-						      _("Out of memory"));
-				SIPE_DEBUG_ERROR("sipe_core_ft_write: can't allocate %" G_GSIZE_FORMAT " bytes for send buffer",
-						 ft_private->outbuf_size);
-				return -1;
-			}
 		}
 
-		ft_private->bytes_remaining_chunk = size;
-		ft_private->outbuf_ptr = ft_private->encrypted_outbuf;
-		sipe_crypt_ft_stream(ft_private->cipher_context,
-				     buffer, size,
-				     ft_private->encrypted_outbuf);
-		sipe_digest_ft_update(ft_private->hmac_context,
-				      buffer, size);
-
-		/* chunk header format:
-		 *
-		 *  0:  00   unknown             (always zero?)
-		 *  1:  LL   chunk size in bytes (low byte)
-		 *  2:  HH   chunk size in bytes (high byte)
-		 *
-		 * Convert size from host order to little endian
-		 */
-		hdr_buf[0] = 0;
-		hdr_buf[1] = (ft_private->bytes_remaining_chunk & 0x00FF);
-		hdr_buf[2] = (ft_private->bytes_remaining_chunk & 0xFF00) >> 8;
-
-		/* write chunk header */
-		if (sipe_backend_ft_write(SIPE_FILE_TRANSFER_PUBLIC, hdr_buf, sizeof(hdr_buf)) != sizeof(hdr_buf)) {
-			sipe_backend_ft_error(SIPE_FILE_TRANSFER_PUBLIC,
-					      _("Socket write failed"));
-			return -1;
+		out = ft_private->encrypted_outbuf;
+		while (size) {
+			gsize chunk_size = MIN(size, block_size);
+
+			/* Convert size from host order to little endian */
+			out[0] = 0;
+			out[1] = (chunk_size & 0x00FF);
+			out[2] = (chunk_size & 0xFF00) >> 8;
+			out += SIPE_FT_CHUNK_HEADER_LENGTH;
+
+			sipe_crypt_ft_stream(ft_private->cipher_context,
+					     buffer, chunk_size, out);
+			sipe_digest_ft_update(ft_private->hmac_context,
+					      buffer, chunk_size);
+
+			buffer += chunk_size;
+			out    += chunk_size;
+			size   -= chunk_size;
 		}
+
+		ft_private->outbuf_length = length;
+		ft_private->outbuf_offset = 0;
 	}
 
 	bytes_written = sipe_backend_ft_write(SIPE_FILE_TRANSFER_PUBLIC,
-					      ft_private->outbuf_ptr,
-					      ft_private->bytes_remaining_chunk);
+					      ft_private->encrypted_outbuf + ft_private->outbuf_offset,
+					      ft_private->outbuf_length - ft_private->outbuf_offset);
 	if (bytes_written < 0) {
 		raise_ft_error(ft_private, _("Socket write failed"));
-	} else if (bytes_written > 0) {
-		ft_private->bytes_remaining_chunk -= bytes_written;
-		ft_private->outbuf_ptr += bytes_written;
+		return -1;
 	}
 
-	return bytes_written;
+	data_written = chunk_data_length(ft_private->outbuf_offset + bytes_written, block_size) -
+		chunk_data_length(ft_private->outbuf_offset, block_size);
+	ft_private->outbuf_offset += bytes_written;
+
+	ft_statistics_update(ft_private, busy_start, data_written);
+	return(data_written);
 }
 
 /*
@@ -26,6 +26,13 @@
 struct sipe_core_private;
 
 #define SIPE_FT_KEY_LENGTH 24
+#define SIPE_FT_CHUNK_HEADER_LENGTH 3
+
+/*
+ * When sending data via server with ForeFront installed, block bigger than
+ * this default causes ending of transmission.
+ */
+#define SIPE_FT_BLOCK_SIZE_FOREFRONT 2045
 
 /**
  * File transport (private part)
@@ -49,10 +56,20 @@ struct sipe_file_transfer_private {
 	gpointer hmac_context;
 
 	gsize bytes_remaining_chunk;
+	guchar chunk_header[SIPE_FT_CHUNK_HEADER_LENGTH];
+	gsize chunk_header_length;
 
+	gsize block_size;
 	guchar *encrypted_outbuf;
-	guchar *outbuf_ptr;
 	gsize outbuf_size;
+	gsize outbuf_length;
+	gsize outbuf_offset;
+
+	/* transfer statistics [us] */
+	gint64 start_time;
+	gint64 busy_time;
+	guint64 bytes_transferred;
+	guint wakeups;
 
 	struct sipe_backend_listendata *listendata;
 };
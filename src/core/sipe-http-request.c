@@ -26,7 +26,8 @@
  *  - request handling: creation, parameters, deletion, cancelling
  *  - session handling: creation, closing
  *  - client authorization handling
- *  - connection request queue handling
+ *  - connection request queue handling, pipelining
+ *  - request body compression
  *  - compile HTTP header contents and hand-off to transport layer
  *  - process HTTP response and hand-off to user callback
  */
@@ -39,9 +40,14 @@
 
 #include <glib.h>
 
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
 #include "sipe-common.h"
 #include "sipmsg.h"
 #include "sip-sec.h"
+#define SIPE_DEBUG_CATEGORY SIPE_DEBUG_CATEGORY_HTTP
 #include "sipe-backend.h"
 #include "sipe-core.h"
 #include "sipe-core-private.h"
@@ -52,6 +58,14 @@
 #define _SIPE_HTTP_PRIVATE_IF_TRANSPORT
 #include "sipe-http-transport.h"
 
+#ifdef HAVE_ZLIB
+#define SIPE_HTTP_ACCEPT_ENCODING "Accept-Encoding: gzip, deflate\r\n"
+/* only large request bodies are worth compressing */
+#define SIPE_HTTP_COMPRESS_THRESHOLD 16384
+#else
+#define SIPE_HTTP_ACCEPT_ENCODING ""
+#endif
+
 struct sipe_http_session {
 	GHashTable *cookie_jar;
 };
@@ -66,20 +80,41 @@ struct sipe_http_request {
 	gchar *body;           /* NULL for GET */
 	gchar *content_type;   /* NULL if body == NULL */
 	gchar *authorization;
+	gchar *compressed;     /* gzip encoded body, NULL if not compressed */
+	gsize compressed_length;
 
 	const gchar *user;     /* not copied */
 	const gchar *password; /* not copied */
 
 	sipe_http_response_callback *cb;
+	sipe_http_stream_callback *stream;
 	gpointer cb_data;
 
+	guint64 queued; /* in milliseconds */
+	guint64 sent;   /* in milliseconds */
+
 	guint32 flags;
 };
 
-#define SIPE_HTTP_REQUEST_FLAG_FIRST     0x00000001
 #define SIPE_HTTP_REQUEST_FLAG_REDIRECT  0x00000002
 #define SIPE_HTTP_REQUEST_FLAG_AUTHDATA  0x00000004
 #define SIPE_HTTP_REQUEST_FLAG_HANDSHAKE 0x00000008
+#define SIPE_HTTP_REQUEST_FLAG_READY     0x00000010
+#define SIPE_HTTP_REQUEST_FLAG_SENT      0x00000020 /* waiting for response */
+#define SIPE_HTTP_REQUEST_FLAG_CANCELLED 0x00000040
+#define SIPE_HTTP_REQUEST_FLAG_COMPRESS  0x00000080 /* requested by caller */
+
+/* [ms], monotonic: wait times must not jump with the wall clock */
+static guint64 sipe_http_request_now(void)
+{
+#if GLIB_CHECK_VERSION(2,28,0)
+	return(g_get_monotonic_time() / 1000);
+#else
+	GTimeVal now;
+	g_get_current_time(&now);
+	return(((guint64) now.tv_sec) * 1000 + now.tv_usec / 1000);
+#endif
+}
 
 static void sipe_http_request_free(struct sipe_core_private *sipe_private,
 				   struct sipe_http_request *req,
@@ -97,6 +132,7 @@ static void sipe_http_request_free(struct sipe_core_private *sipe_private,
 	g_free(req->body);
 	g_free(req->content_type);
 	g_free(req->authorization);
+	g_free(req->compressed);
 	g_free(req);
 }
 
@@ -107,18 +143,79 @@ static void add_cookie_cb(SIPE_UNUSED_PARAMETER const gchar *key,
 	g_string_append_printf(string, "Cookie: %s\r\n", cookie);
 }
 
-static void sipe_http_request_send(struct sipe_http_connection_public *conn_public)
+#ifdef HAVE_ZLIB
+static void sipe_http_request_compress_body(struct sipe_http_request *req,
+					    gsize length)
+{
+	z_stream stream;
+	gsize size;
+	Bytef *out;
+
+	memset(&stream, 0, sizeof(stream));
+	/* +16: write gzip header & trailer */
+	if (deflateInit2(&stream,
+			 Z_DEFAULT_COMPRESSION,
+			 Z_DEFLATED,
+			 16 + MAX_WBITS,
+			 8,
+			 Z_DEFAULT_STRATEGY) != Z_OK)
+		return;
+
+	size = deflateBound(&stream, length);
+	out  = g_malloc(size);
+	stream.next_in   = (Bytef *) req->body;
+	stream.avail_in  = length;
+	stream.next_out  = out;
+	stream.avail_out = size;
+
+	if ((deflate(&stream, Z_FINISH) == Z_STREAM_END) &&
+	    (stream.total_out < length)) {
+		SIPE_DEBUG_INFO("sipe_http_request_compress_body: body %" G_GSIZE_FORMAT " bytes, compressed %lu bytes",
+				length, stream.total_out);
+		req->compressed        = (gchar *) out;
+		req->compressed_length = stream.total_out;
+	} else {
+		g_free(out);
+	}
+
+	deflateEnd(&stream);
+}
+#endif
+
+static void sipe_http_request_send(struct sipe_http_connection_public *conn_public,
+				   struct sipe_http_request *req)
 {
-	struct sipe_http_request *req = conn_public->pending_requests->data;
 	gchar *header;
 	gchar *content = NULL;
 	gchar *cookie  = NULL;
+	const gchar *body = req->body;
+	gsize length      = body ? strlen(body) : 0;
+
+#ifdef HAVE_ZLIB
+	/* server has rejected compressed request bodies before */
+	if (sipe_http_transport_uncompressed(conn_public)) {
+		g_free(req->compressed);
+		req->compressed = NULL;
+	} else if (body &&
+		   (req->flags & SIPE_HTTP_REQUEST_FLAG_COMPRESS) &&
+		   !req->compressed &&
+		   (length >= SIPE_HTTP_COMPRESS_THRESHOLD)) {
+		sipe_http_request_compress_body(req, length);
+	}
+#endif
 
-	if (req->body)
+	if (req->compressed) {
+		body   = req->compressed;
+		length = req->compressed_length;
+	}
+
+	if (body)
 		content = g_strdup_printf("Content-Length: %" G_GSIZE_FORMAT "\r\n"
-					  "Content-Type: %s\r\n",
-					  strlen(req->body),
-					  req->content_type);
+					  "Content-Type: %s\r\n"
+					  "%s",
+					  length,
+					  req->content_type,
+					  req->compressed ? "Content-Encoding: gzip\r\n" : "");
 
 	if (req->session && g_hash_table_size(req->session->cookie_jar)) {
 		GString *cookies = g_string_new("");
@@ -131,6 +228,7 @@ static void sipe_http_request_send(struct sipe_http_connection_public *conn_publ
 	header = g_strdup_printf("%s /%s HTTP/1.1\r\n"
 				 "Host: %s\r\n"
 				 "User-Agent: Sipe/" PACKAGE_VERSION "\r\n"
+				 SIPE_HTTP_ACCEPT_ENCODING
 				 "%s%s%s%s",
 				 content ? "POST" : "GET",
 				 req->path,
@@ -147,20 +245,90 @@ static void sipe_http_request_send(struct sipe_http_connection_public *conn_publ
 	g_free(req->authorization);
 	req->authorization = NULL;
 
+	req->flags |= SIPE_HTTP_REQUEST_FLAG_SENT;
+	req->sent   = sipe_http_request_now();
+	conn_public->in_flight++;
+
 	sipe_http_transport_send(conn_public,
 				 header,
-				 req->body);
+				 body,
+				 length,
+				 req->compressed != NULL);
 	g_free(header);
 }
 
 gboolean sipe_http_request_pending(struct sipe_http_connection_public *conn_public)
 {
-	return(conn_public->pending_requests != NULL);
+	return(conn_public->pending_requests &&
+	       !g_queue_is_empty(conn_public->pending_requests));
+}
+
+/*
+ * Pipelining is restricted to idempotent GET requests on a connection
+ * that has already completed a request, i.e. authentication is done.
+ */
+static gboolean sipe_http_request_sendable(struct sipe_http_connection_public *conn_public,
+					   struct sipe_http_request *req)
+{
+	struct sipe_http_request *head;
+
+	if (!(req->flags & SIPE_HTTP_REQUEST_FLAG_READY))
+		return(FALSE);
+	if (conn_public->in_flight == 0)
+		return(TRUE);
+
+	head = g_queue_peek_head(conn_public->pending_requests);
+	return((conn_public->in_flight < conn_public->pipeline) &&
+	       conn_public->established                         &&
+	       !head->body                                      &&
+	       !req->body                                       &&
+	       !req->authorization                              &&
+	       !(req->flags & SIPE_HTTP_REQUEST_FLAG_HANDSHAKE));
 }
 
 void sipe_http_request_next(struct sipe_http_connection_public *conn_public)
 {
-	sipe_http_request_send(conn_public);
+	GList *entry;
+
+	if (!conn_public->pending_requests)
+		return;
+
+	/* requests in flight are always at the head of the queue */
+	entry = g_queue_peek_nth_link(conn_public->pending_requests,
+				      conn_public->in_flight);
+	while (entry) {
+		struct sipe_http_request *req = entry->data;
+
+		if (!sipe_http_request_sendable(conn_public, req))
+			break;
+		sipe_http_request_send(conn_public, req);
+
+		entry = entry->next;
+	}
+}
+
+void sipe_http_request_restart(struct sipe_http_connection_public *conn_public)
+{
+	GList *entry;
+
+	if (!conn_public->pending_requests)
+		return;
+
+	entry = conn_public->pending_requests->head;
+	while (entry) {
+		struct sipe_http_request *req = entry->data;
+
+		entry = entry->next;
+		if (req->flags & SIPE_HTTP_REQUEST_FLAG_CANCELLED) {
+			g_queue_remove(conn_public->pending_requests, req);
+			sipe_http_request_free(conn_public->sipe_private,
+					       req,
+					       SIPE_HTTP_STATUS_CANCELLED);
+		} else {
+			req->flags &= ~SIPE_HTTP_REQUEST_FLAG_SENT;
+		}
+	}
+	conn_public->in_flight = 0;
 }
 
 static void sipe_http_request_enqueue(struct sipe_core_private *sipe_private,
@@ -174,11 +342,27 @@ static void sipe_http_request_enqueue(struct sipe_core_private *sipe_private,
 								parsed_uri->host,
 								parsed_uri->port,
 								parsed_uri->tls);
-	if (!sipe_http_request_pending(conn_public))
-		req->flags |= SIPE_HTTP_REQUEST_FLAG_FIRST;
 
-	conn_public->pending_requests = g_slist_append(conn_public->pending_requests,
-						       req);
+	if (!conn_public->pending_requests)
+		conn_public->pending_requests = g_queue_new();
+	req->queued = sipe_http_request_now();
+	g_queue_push_tail(conn_public->pending_requests, req);
+}
+
+/*
+ * Keep the request in the queue. As it is at the head it will be pulled
+ * automatically by the transport layer after returning. Pipelined
+ * requests that are still in flight must stay in front of it.
+ */
+static void sipe_http_request_resend(struct sipe_http_connection_public *conn_public,
+				     struct sipe_http_request *req)
+{
+	if (conn_public->in_flight) {
+		g_queue_pop_head(conn_public->pending_requests);
+		g_queue_push_nth(conn_public->pending_requests,
+				 req,
+				 conn_public->in_flight);
+	}
 }
 
 static void sipe_http_request_drop_context(struct sipe_http_connection_public *conn_public)
@@ -249,16 +433,16 @@ static gboolean sipe_http_request_response_redirection(struct sipe_core_private
 		if (parsed_uri) {
 			/* remove request from old connection */
 			struct sipe_http_connection_public *conn_public = req->connection;
-			conn_public->pending_requests = g_slist_remove(conn_public->pending_requests,
-								       req);
+			g_queue_remove(conn_public->pending_requests, req);
 
 			/* free old request data */
 			g_free(req->path);
-			req->flags &= ~( SIPE_HTTP_REQUEST_FLAG_FIRST |
-					 SIPE_HTTP_REQUEST_FLAG_HANDSHAKE );
+			req->flags &= ~SIPE_HTTP_REQUEST_FLAG_HANDSHAKE;
 
 			/* resubmit request on other connection */
 			sipe_http_request_enqueue(sipe_private, req, parsed_uri);
+			if (req->connection->connected)
+				sipe_http_request_next(req->connection);
 			failed = FALSE;
 
 			sipe_http_parsed_uri_free(parsed_uri);
@@ -390,11 +574,7 @@ static gboolean sipe_http_request_response_unauthorized(struct sipe_core_private
 					conn_public->cached_authorization = g_strdup(req->authorization);
 				}
 
-				/*
-				 * Keep the request in the queue. As it is at
-				 * the head it will be pulled automatically
-				 * by the transport layer after returning.
-				 */
+				sipe_http_request_resend(conn_public, req);
 				failed = FALSE;
 
 			} else {
@@ -471,9 +651,31 @@ void sipe_http_request_response(struct sipe_http_connection_public *conn_public,
 				struct sipmsg *msg)
 {
 	struct sipe_core_private *sipe_private = conn_public->sipe_private;
-	struct sipe_http_request *req = conn_public->pending_requests->data;
+	struct sipe_http_request *req = conn_public->in_flight ?
+		g_queue_peek_head(conn_public->pending_requests) : NULL;
 	gboolean failed;
 
+	if (!req) {
+		SIPE_DEBUG_ERROR("sipe_http_request_response: unexpected response from '%s', ignoring it",
+				 conn_public->host);
+		return;
+	}
+
+	/* response is for the oldest request in flight */
+	req->flags &= ~SIPE_HTTP_REQUEST_FLAG_SENT;
+	conn_public->in_flight--;
+	sipe_http_transport_statistics(conn_public,
+				       req->sent - req->queued,
+				       sipe_http_request_now() - req->sent);
+
+	if (req->flags & SIPE_HTTP_REQUEST_FLAG_CANCELLED) {
+		g_queue_pop_head(conn_public->pending_requests);
+		sipe_http_request_free(sipe_private,
+				       req,
+				       SIPE_HTTP_STATUS_CANCELLED);
+		return;
+	}
+
 	if ((req->flags & SIPE_HTTP_REQUEST_FLAG_REDIRECT)   &&
 	    (msg->response >= SIPE_HTTP_STATUS_REDIRECTION)  &&
 	    (msg->response <  SIPE_HTTP_STATUS_CLIENT_ERROR)) {
@@ -486,6 +688,16 @@ void sipe_http_request_response(struct sipe_http_connection_public *conn_public,
 								 req,
 								 msg);
 
+	} else if (((msg->response == SIPE_HTTP_STATUS_CLIENT_ERROR) ||
+		    (msg->response == SIPE_HTTP_STATUS_CLIENT_UNSUPPORTED)) &&
+		   req->compressed) {
+		/* server doesn't accept compressed body: send it as is */
+		SIPE_DEBUG_INFO("sipe_http_request_response: '%s' rejected compressed body, disabling compression",
+				conn_public->host);
+		sipe_http_transport_set_uncompressed(conn_public);
+		sipe_http_request_resend(conn_public, req);
+		failed = FALSE;
+
 	} else {
 		/* On some errors throw away the security context */
 		if (((msg->response == SIPE_HTTP_STATUS_CLIENT_FORBIDDEN)  ||
@@ -497,6 +709,10 @@ void sipe_http_request_response(struct sipe_http_connection_public *conn_public,
 			sipe_http_request_drop_context(conn_public);
 		}
 
+		/* connection is ready for pipelining */
+		if (msg->response < SIPE_HTTP_STATUS_CLIENT_ERROR)
+			conn_public->established = TRUE;
+
 		/* All other cases are passed on to the user */
 		sipe_http_request_response_callback(sipe_private, req, msg);
 
@@ -517,22 +733,44 @@ void sipe_http_request_response(struct sipe_http_connection_public *conn_public,
 	}
 }
 
+gboolean sipe_http_request_body(struct sipe_http_connection_public *conn_public,
+				struct sipmsg *msg,
+				const gchar *data,
+				gsize length)
+{
+	struct sipe_http_request *req = conn_public->in_flight ?
+		g_queue_peek_head(conn_public->pending_requests) : NULL;
+
+	/* only the body of a successful response is streamed */
+	if (!(req                                                &&
+	      req->stream                                        &&
+	      !(req->flags & SIPE_HTTP_REQUEST_FLAG_CANCELLED)   &&
+	      (msg->response == SIPE_HTTP_STATUS_OK)))
+		return(FALSE);
+
+	/* Callback: body data */
+	(*req->stream)(conn_public->sipe_private,
+		       data,
+		       length,
+		       req->cb_data);
+	return(TRUE);
+}
+
 void sipe_http_request_shutdown(struct sipe_http_connection_public *conn_public,
 				gboolean abort)
 {
 	if (conn_public->pending_requests) {
-		GSList *entry = conn_public->pending_requests;
-		while (entry) {
+		struct sipe_http_request *req;
+		while ((req = g_queue_pop_head(conn_public->pending_requests)) != NULL)
 			sipe_http_request_free(conn_public->sipe_private,
-					       entry->data,
+					       req,
 					       abort ?
 					       SIPE_HTTP_STATUS_ABORTED :
 					       SIPE_HTTP_STATUS_FAILED);
-			entry = entry->next;
-		}
-		g_slist_free(conn_public->pending_requests);
+		g_queue_free(conn_public->pending_requests);
 		conn_public->pending_requests = NULL;
 	}
+	conn_public->in_flight = 0;
 
 	if (conn_public->context) {
 		g_free(conn_public->cached_authorization);
@@ -594,10 +832,11 @@ void sipe_http_request_ready(struct sipe_http_request *request)
 {
 	struct sipe_http_connection_public *conn_public = request->connection;
 
-	/* pass first request on already opened connection through directly */
-	if ((request->flags & SIPE_HTTP_REQUEST_FLAG_FIRST) &&
-	    conn_public->connected)
-		sipe_http_request_send(conn_public);
+	request->flags |= SIPE_HTTP_REQUEST_FLAG_READY;
+
+	/* pass request on already opened connection through directly */
+	if (conn_public->connected)
+		sipe_http_request_next(conn_public);
 }
 
 struct sipe_http_session *sipe_http_session_start(void)
@@ -621,12 +860,17 @@ void sipe_http_session_close(struct sipe_http_session *session)
 void sipe_http_request_cancel(struct sipe_http_request *request)
 {
 	struct sipe_http_connection_public *conn_public = request->connection;
-	conn_public->pending_requests = g_slist_remove(conn_public->pending_requests,
-						       request);
 
 	/* cancelled by requester, don't use callback */
 	request->cb = NULL;
 
+	/* response is still outstanding: drop request when it arrives */
+	if (request->flags & SIPE_HTTP_REQUEST_FLAG_SENT) {
+		request->flags |= SIPE_HTTP_REQUEST_FLAG_CANCELLED;
+		return;
+	}
+
+	g_queue_remove(conn_public->pending_requests, request);
 	sipe_http_request_free(conn_public->sipe_private,
 			       request,
 			       SIPE_HTTP_STATUS_CANCELLED);
@@ -643,6 +887,17 @@ void sipe_http_request_allow_redirect(struct sipe_http_request *request)
 	request->flags |= SIPE_HTTP_REQUEST_FLAG_REDIRECT;
 }
 
+void sipe_http_request_compress(struct sipe_http_request *request)
+{
+	request->flags |= SIPE_HTTP_REQUEST_FLAG_COMPRESS;
+}
+
+void sipe_http_request_stream(struct sipe_http_request *request,
+			      sipe_http_stream_callback *callback)
+{
+	request->stream = callback;
+}
+
 void sipe_http_request_authentication(struct sipe_http_request *request,
 				      const gchar *user,
 				      const gchar *password)
@@ -72,10 +72,23 @@ gboolean sipe_http_request_pending(struct sipe_http_connection_public *conn_publ
 /**
  * HTTP connection is ready for next request
  *
+ * Sends the next pending request. With pipelining enabled this can send
+ * more than one request.
+ *
  * @param conn_public HTTP connection public data
  */
 void sipe_http_request_next(struct sipe_http_connection_public *conn_public);
 
+/**
+ * HTTP connection has been (re-)established
+ *
+ * Requests sent on the previous connection without response will be sent
+ * again.
+ *
+ * @param conn_public HTTP connection public data
+ */
+void sipe_http_request_restart(struct sipe_http_connection_public *conn_public);
+
 /**
  * HTTP response received
  *
@@ -85,6 +98,21 @@ void sipe_http_request_next(struct sipe_http_connection_public *conn_public);
 void sipe_http_request_response(struct sipe_http_connection_public *conn_public,
 				struct sipmsg *msg);
 
+/**
+ * HTTP response body data received
+ *
+ * @param conn_public HTTP connection public data
+ * @param msg         parsed message header
+ * @param data        body data
+ * @param length      length of body data
+ *
+ * @return @c TRUE if data was passed on to the stream callback
+ */
+gboolean sipe_http_request_body(struct sipe_http_connection_public *conn_public,
+				struct sipmsg *msg,
+				const gchar *data,
+				gsize length);
+
 /**
  * HTTP connection shutdown
  *
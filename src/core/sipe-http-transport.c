@@ -23,17 +23,27 @@
  *
  * SIPE HTTP transport layer implementation
  *
- *  - connection handling: opening, closing, timeout
+ *  - connection handling: opening, closing, timeout, per-host pool
  *  - interface to backend: sending & receiving of raw messages
  *  - request queue pulling
+ *  - response body decoding: chunked transfer, gzip/deflate content
  */
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include <string.h>
 #include <time.h>
 
 #include <glib.h>
 
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
 #include "sipmsg.h"
+#define SIPE_DEBUG_CATEGORY SIPE_DEBUG_CATEGORY_HTTP
 #include "sipe-backend.h"
 #include "sipe-common.h"
 #include "sipe-core.h"
@@ -54,6 +64,23 @@
 #define SIPE_HTTP_TIMEOUT_ACTION  "<+http-timeout>"
 #define SIPE_HTTP_DEFAULT_TIMEOUT 60 /* in seconds */
 
+/*
+ * Connections per host/port. Web services (EWS, address book, webticket)
+ * are usually accessed in parallel, so more than one connection avoids
+ * queueing requests behind a slow one.
+ */
+#define SIPE_HTTP_CONNECTIONS 2
+/*
+ * Requests in flight per connection. 1 disables pipelining, as there is
+ * no way to detect HTTP/1.1 servers or proxies that break it.
+ */
+#define SIPE_HTTP_PIPELINE    1
+
+#ifdef HAVE_ZLIB
+/* output block size for Content-Encoding decoder */
+#define SIPE_HTTP_INFLATE_BLOCK 16384
+#endif
+
 struct sipe_http_connection {
 	struct sipe_http_connection_public public;
 
@@ -62,12 +89,47 @@ struct sipe_http_connection {
 	gchar *host_port;
 	time_t timeout;  /* in seconds from epoch */
 	gboolean use_tls;
+
+	/* response with body in progress */
+	struct sipmsg *msg;
+	gchar *header;         /* raw header for debugging output */
+	GString *body;
+	gsize wire_bytes;      /* body bytes received */
+	gsize decoded_bytes;   /* body bytes after Content-Encoding */
+	gboolean body_error;
+#ifdef HAVE_ZLIB
+	z_stream *inflate;     /* Content-Encoding: gzip or deflate */
+	gboolean inflate_done;
+	gboolean inflate_probe; /* "deflate" might be raw, i.e. without zlib header */
+	gsize probe_length;
+	gchar probe[2];
+#endif
+
+	/* Content-Length: body bytes still to be received */
+	gsize content_remainder;
+
+	/* HTTP/1.1 Transfer-Encoding: chunked */
+	gboolean chunked;
+	gsize chunk_remainder; /* bytes left in current chunk */
+	enum {
+		CHUNK_STATE_SIZE = 0,
+		CHUNK_STATE_DATA,
+		CHUNK_STATE_DATA_END,
+		CHUNK_STATE_TRAILER,
+	} chunk_state;
 };
 
 struct sipe_http {
 	GHashTable *connections;
 	GQueue *timeouts;
 	time_t next_timeout; /* in seconds from epoch, 0 if timer isn't running */
+	GHashTable *uncompressed; /* "host:port" that reject compressed bodies */
+	/* statistics */
+	guint requests;
+	guint64 wait_time;   /* in milliseconds */
+	guint64 server_time; /* in milliseconds */
+	guint64 wire_bytes;
+	guint64 decoded_bytes;
 	gboolean shutting_down;
 };
 
@@ -79,6 +141,27 @@ static gint timeout_compare(gconstpointer a,
 	       ((struct sipe_http_connection *) b)->timeout);
 }
 
+static void sipe_http_transport_body_free(struct sipe_http_connection *conn)
+{
+#ifdef HAVE_ZLIB
+	if (conn->inflate) {
+		inflateEnd(conn->inflate);
+		g_free(conn->inflate);
+		conn->inflate = NULL;
+	}
+#endif
+	if (conn->msg) {
+		sipmsg_free(conn->msg);
+		conn->msg = NULL;
+	}
+	g_free(conn->header);
+	conn->header = NULL;
+	if (conn->body) {
+		g_string_free(conn->body, TRUE);
+		conn->body = NULL;
+	}
+}
+
 static void sipe_http_transport_update_timeout_queue(struct sipe_http_connection *conn,
 						     gboolean remove);
 static void sipe_http_transport_free(gpointer data)
@@ -93,6 +176,7 @@ static void sipe_http_transport_free(gpointer data)
 	conn->connection = NULL;
 
 	sipe_http_transport_update_timeout_queue(conn, TRUE);
+	sipe_http_transport_body_free(conn);
 
 	sipe_http_request_shutdown(SIPE_HTTP_CONNECTION_PUBLIC,
 				   conn->public.sipe_private->http->shutting_down);
@@ -219,8 +303,17 @@ void sipe_http_free(struct sipe_core_private *sipe_private)
 	/* HTTP stack is shutting down: reject all new requests */
 	http->shutting_down = TRUE;
 
+	if (http->requests)
+		SIPE_DEBUG_INFO("sipe_http_free: %u requests, average queue time %" G_GUINT64_FORMAT " ms, average server time %" G_GUINT64_FORMAT " ms, body bytes %" G_GUINT64_FORMAT " received %" G_GUINT64_FORMAT " decoded",
+				http->requests,
+				http->wait_time   / http->requests,
+				http->server_time / http->requests,
+				http->wire_bytes,
+				http->decoded_bytes);
+
 	sipe_schedule_cancel(sipe_private, SIPE_HTTP_TIMEOUT_ACTION);
 	g_hash_table_destroy(http->connections);
+	g_hash_table_destroy(http->uncompressed);
 	g_queue_free(http->timeouts);
 	g_free(http);
 	sipe_private->http = NULL;
@@ -237,6 +330,8 @@ static void sipe_http_init(struct sipe_core_private *sipe_private)
 						  NULL,
 						  sipe_http_transport_free);
 	http->timeouts = g_queue_new();
+	http->uncompressed = g_hash_table_new_full(g_str_hash, g_str_equal,
+						   g_free, NULL);
 }
 
 static void sipe_http_transport_connected(struct sipe_transport_connection *connection)
@@ -260,175 +355,428 @@ static void sipe_http_transport_connected(struct sipe_transport_connection *conn
 	if (http->next_timeout == 0)
 		start_timer(sipe_private, current_time);
 
+	/* requests in flight on a previous connection need to be resent */
+	sipe_http_request_restart(SIPE_HTTP_CONNECTION_PUBLIC);
 	sipe_http_request_next(SIPE_HTTP_CONNECTION_PUBLIC);
 }
 
-static void sipe_http_transport_input(struct sipe_transport_connection *connection)
+static void sipe_http_transport_reconnect(struct sipe_http_connection *conn);
+
+static void sipe_http_transport_deliver(struct sipe_http_connection *conn,
+					const gchar *data,
+					gsize length)
 {
-	struct sipe_http_connection *conn = SIPE_HTTP_CONNECTION;
-	char *current = connection->buffer;
+	conn->decoded_bytes += length;
+
+	/* body data is either streamed to the requester or collected */
+	if (!sipe_http_request_body(SIPE_HTTP_CONNECTION_PUBLIC,
+				    conn->msg,
+				    data,
+				    length))
+		g_string_append_len(conn->body, data, length);
+}
 
-	/* according to the RFC remove CRLF at the beginning */
-	while (*current == '\r' || *current == '\n') {
-		current++;
-	}
-	if (current != connection->buffer)
-		sipe_utils_shrink_buffer(connection, current);
+#ifdef HAVE_ZLIB
+static void sipe_http_transport_inflate(struct sipe_http_connection *conn,
+					const gchar *data,
+					gsize length)
+{
+	z_stream *stream = conn->inflate;
+	Bytef out[SIPE_HTTP_INFLATE_BLOCK];
+	int ret;
 
-	if (conn->connection &&
-	    (current = strstr(connection->buffer, "\r\n\r\n")) != NULL) {
-		struct sipmsg *msg;
-		gboolean drop = FALSE;
-		gboolean next;
+	/* ignore anything after the end of the compressed data */
+	if (conn->inflate_done)
+		return;
 
-		current += 2;
-		current[0] = '\0';
-		msg = sipmsg_parse_header(connection->buffer);
-		if (!msg) {
-			/* restore header for next try */
-			current[0] = '\r';
+	stream->next_in  = (Bytef *) data;
+	stream->avail_in = length;
+	do {
+		stream->next_out  = out;
+		stream->avail_out = sizeof(out);
+		ret = inflate(stream, Z_NO_FLUSH);
+
+		if ((ret != Z_OK) && (ret != Z_STREAM_END) && (ret != Z_BUF_ERROR)) {
+			SIPE_DEBUG_ERROR("sipe_http_transport_inflate: decoding failed for '%s': %s",
+					 conn->host_port,
+					 stream->msg ? stream->msg : "unknown error");
+			conn->body_error = TRUE;
+			break;
+		}
+
+		if (stream->avail_out < sizeof(out))
+			sipe_http_transport_deliver(conn,
+						    (const gchar *) out,
+						    sizeof(out) - stream->avail_out);
+
+		if (ret == Z_STREAM_END) {
+			conn->inflate_done = TRUE;
+			break;
+		}
+
+		/* no progress possible without more input */
+		if (ret == Z_BUF_ERROR)
+			break;
+
+	} while (stream->avail_in || (stream->avail_out == 0));
+}
+
+/*
+ * Some servers send "deflate" without zlib header. The first two bytes
+ * of the body decide which format is used.
+ */
+static void sipe_http_transport_inflate_probe(struct sipe_http_connection *conn,
+					      const gchar *data,
+					      gsize length)
+{
+	gsize missing = MIN(2 - conn->probe_length, length);
+	guint header;
+
+	memcpy(conn->probe + conn->probe_length, data, missing);
+	conn->probe_length += missing;
+	if (conn->probe_length < 2)
+		return;
+	conn->inflate_probe = FALSE;
+
+	/* zlib header: CM is 8 and CMF/FLG are a multiple of 31 */
+	header = (((guchar) conn->probe[0]) << 8) | ((guchar) conn->probe[1]);
+	if (((header & 0x0f00) != 0x0800) || (header % 31)) {
+		SIPE_DEBUG_INFO("sipe_http_transport_inflate_probe: raw deflate from '%s'",
+				conn->host_port);
+		inflateEnd(conn->inflate);
+		memset(conn->inflate, 0, sizeof(z_stream));
+		if (inflateInit2(conn->inflate, -MAX_WBITS) != Z_OK) {
+			g_free(conn->inflate);
+			conn->inflate    = NULL;
+			conn->body_error = TRUE;
 			return;
 		}
+	}
 
-		/* HTTP/1.1 Transfer-Encoding: chunked */
-		if (msg->bodylen == SIPMSG_BODYLEN_CHUNKED) {
-			gchar *start        = current + 2;
-			GSList *chunks      = NULL;
-			gboolean incomplete = TRUE;
+	sipe_http_transport_inflate(conn, conn->probe, 2);
+	if (length > missing)
+		sipe_http_transport_inflate(conn,
+					    data   + missing,
+					    length - missing);
+}
+#endif
+
+static void sipe_http_transport_body(struct sipe_http_connection *conn,
+				     const gchar *data,
+				     gsize length)
+{
+	conn->wire_bytes += length;
+
+	if (conn->body_error)
+		return;
+
+#ifdef HAVE_ZLIB
+	if (conn->inflate) {
+		if (conn->inflate_probe)
+			sipe_http_transport_inflate_probe(conn, data, length);
+		else
+			sipe_http_transport_inflate(conn, data, length);
+		return;
+	}
+#endif
+
+	sipe_http_transport_deliver(conn, data, length);
+}
+
+static void sipe_http_transport_body_start(struct sipe_http_connection *conn,
+					   struct sipmsg *msg,
+					   const gchar *header)
+{
+	const gchar *encoding = sipmsg_find_header(msg, "Content-Encoding");
+
+	conn->msg           = msg;
+	conn->header        = g_strdup(header);
+	conn->body          = g_string_new("");
+	conn->wire_bytes    = 0;
+	conn->decoded_bytes = 0;
+	conn->body_error    = FALSE;
+
+	if (encoding && !sipe_strcase_equal(encoding, "identity")) {
+#ifdef HAVE_ZLIB
+		gboolean gzip = sipe_strcase_equal(encoding, "gzip") ||
+				sipe_strcase_equal(encoding, "x-gzip");
+
+		if (gzip || sipe_strcase_equal(encoding, "deflate")) {
+			conn->inflate       = g_new0(z_stream, 1);
+			conn->inflate_done  = FALSE;
+			conn->inflate_probe = !gzip;
+			conn->probe_length  = 0;
+
+			/* +16: decode gzip header & trailer */
+			if (inflateInit2(conn->inflate,
+					 gzip ? 16 + MAX_WBITS : MAX_WBITS) != Z_OK) {
+				SIPE_DEBUG_ERROR("sipe_http_transport_body_start: can't initialize decoder for '%s'",
+						 encoding);
+				g_free(conn->inflate);
+				conn->inflate    = NULL;
+				conn->body_error = TRUE;
+			}
+		} else
+#endif
+		{
+			SIPE_DEBUG_ERROR("sipe_http_transport_body_start: unsupported Content-Encoding '%s'",
+					 encoding);
+			conn->body_error = TRUE;
+		}
+	}
+}
+
+static struct sipmsg *sipe_http_transport_body_complete(struct sipe_http_connection *conn)
+{
+	struct sipe_http *http = conn->public.sipe_private->http;
+	struct sipmsg *msg     = conn->msg;
+
+#ifdef HAVE_ZLIB
+	if (conn->inflate) {
+		/* empty body, e.g. "304 Not Modified", is not encoded */
+		if (conn->wire_bytes &&
+		    !(conn->inflate_done || conn->body_error)) {
+			SIPE_DEBUG_ERROR("sipe_http_transport_body_complete: compressed body from '%s' is truncated",
+					 conn->host_port);
+			conn->body_error = TRUE;
+		}
+		SIPE_DEBUG_INFO("sipe_http_transport_body_complete: '%s' body %" G_GSIZE_FORMAT " bytes, decoded %" G_GSIZE_FORMAT " bytes",
+				conn->host_port,
+				conn->wire_bytes,
+				conn->decoded_bytes);
+	}
+#endif
+	http->wire_bytes    += conn->wire_bytes;
+	http->decoded_bytes += conn->decoded_bytes;
+
+	/* requester will receive an error instead of a damaged body */
+	if (conn->body_error &&
+	    (msg->response != SIPMSG_RESPONSE_FATAL_ERROR))
+		msg->response = SIPE_HTTP_STATUS_SERVER_ERROR;
+
+	/* hand over decoded data to message */
+	msg->bodylen = conn->body->len;
+	msg->body    = g_string_free(conn->body, FALSE);
+	conn->body   = NULL;
+	sipe_utils_message_debug("HTTP",
+				 conn->header,
+				 msg->body,
+				 FALSE);
+
+	conn->msg = NULL;
+	sipe_http_transport_body_free(conn);
+
+	return(msg);
+}
 
-			msg->bodylen = 0;
-			while (strlen(start) > 0) {
+/*
+ * Decode as much of the chunked body as is available in the buffer.
+ * Decoder state is kept in the connection so that every byte received
+ * is only looked at once, regardless of how the body is split up.
+ *
+ * TRUE indicates that the body is complete
+ */
+static gboolean sipe_http_transport_chunked(struct sipe_http_connection *conn,
+					    struct sipe_transport_connection *connection)
+{
+	gchar *current    = connection->buffer;
+	const gchar *end  = current + connection->buffer_used;
+	gboolean complete = FALSE;
+	gboolean wait     = FALSE;
+
+	while (!(complete || wait)) {
+		gsize available = end - current;
+		gchar *eol;
+
+		switch (conn->chunk_state) {
+		case CHUNK_STATE_SIZE:
+			eol = g_strstr_len(current, available, "\r\n");
+			if (eol) {
 				gchar *tmp;
-				guint length = g_ascii_strtoll(start, &tmp, 16);
-				guint remainder;
-				struct _chunk {
-					guint length;
-					const gchar *start;
-				} *chunk;
-
-				/* Illegal number */
-				if ((length == 0) && (start == tmp))
-					break;
-				msg->bodylen += length;
-
-				/* Chunk header not finished yet */
-				tmp = strstr(tmp, "\r\n");
-				if (tmp == NULL)
-					break;
-
-				/* Chunk not finished yet */
-				tmp += 2;
-				remainder = connection->buffer_used - (tmp - connection->buffer);
-				if (remainder < length + 2)
-					break;
-
-				/* Next chunk */
-				start = tmp + length + 2;
-
-				/* Body completed */
-				if (length == 0) {
-					gchar *dummy  = g_malloc(msg->bodylen + 1);
-					gchar *p      = dummy;
-					GSList *entry = chunks;
-
-					while (entry) {
-						chunk = entry->data;
-						memcpy(p, chunk->start, chunk->length);
-						p += chunk->length;
-						entry = entry->next;
-					}
-					p[0] = '\0';
-
-					msg->body = dummy;
-					sipe_utils_message_debug("HTTP",
-								 connection->buffer,
-								 msg->body,
-								 FALSE);
-
-					current = start;
-					sipe_utils_shrink_buffer(connection,
-								 current);
-
-					incomplete = FALSE;
-					break;
+				guint64 length = g_ascii_strtoull(current, &tmp, 16);
+
+				if (tmp == current) {
+					SIPE_DEBUG_ERROR("sipe_http_transport_chunked: illegal chunk size from '%s'",
+							 conn->host_port);
+					conn->msg->response = SIPMSG_RESPONSE_FATAL_ERROR;
+					complete = TRUE;
+				} else if (length) {
+					conn->chunk_remainder = length;
+					conn->chunk_state     = CHUNK_STATE_DATA;
+				} else {
+					conn->chunk_state     = CHUNK_STATE_TRAILER;
 				}
-
-				/* Append completed chunk */
-				chunk = g_new0(struct _chunk, 1);
-				chunk->length = length;
-				chunk->start  = tmp;
-				chunks = g_slist_append(chunks, chunk);
+				current = eol + 2;
+			} else {
+				wait = TRUE;
 			}
+			break;
 
-			if (chunks)
-				sipe_utils_slist_free_full(chunks, g_free);
+		case CHUNK_STATE_DATA:
+			if (available) {
+				gsize length = MIN(available, conn->chunk_remainder);
 
-			if (incomplete) {
-				/* restore header for next try */
-				sipmsg_free(msg);
-				current[0] = '\r';
-				return;
+				sipe_http_transport_body(conn, current, length);
+				current               += length;
+				conn->chunk_remainder -= length;
+				if (conn->chunk_remainder == 0)
+					conn->chunk_state = CHUNK_STATE_DATA_END;
+			} else {
+				wait = TRUE;
 			}
+			break;
 
-		} else {
-			guint remainder = connection->buffer_used - (current + 2 - connection->buffer);
-
-			if (remainder >= (guint) msg->bodylen) {
-				char *dummy = g_malloc(msg->bodylen + 1);
-				current += 2;
-				memcpy(dummy, current, msg->bodylen);
-				dummy[msg->bodylen] = '\0';
-				msg->body = dummy;
-				current += msg->bodylen;
-				sipe_utils_message_debug("HTTP",
-							 connection->buffer,
-							 msg->body,
-							 FALSE);
-				sipe_utils_shrink_buffer(connection, current);
+		case CHUNK_STATE_DATA_END:
+			/* skip CRLF after chunk data */
+			if (available >= 2) {
+				current          += 2;
+				conn->chunk_state = CHUNK_STATE_SIZE;
 			} else {
-				SIPE_DEBUG_INFO("sipe_http_transport_input: body too short (%d < %d, strlen %" G_GSIZE_FORMAT ") - ignoring message",
-						remainder, msg->bodylen, strlen(connection->buffer));
+				wait = TRUE;
+			}
+			break;
 
-				/* restore header for next try */
-				sipmsg_free(msg);
-				current[0] = '\r';
-				return;
+		case CHUNK_STATE_TRAILER:
+			/* trailer headers are ignored, empty line ends body */
+			eol = g_strstr_len(current, available, "\r\n");
+			if (eol) {
+				complete = (eol == current);
+				current  = eol + 2;
+			} else {
+				wait = TRUE;
 			}
+			break;
 		}
+	}
+
+	sipe_utils_shrink_buffer(connection, current);
+	return(complete);
+}
+
+/*
+ * Pass on as much of a Content-Length body as is available in the buffer.
+ *
+ * TRUE indicates that the body is complete
+ */
+static gboolean sipe_http_transport_content(struct sipe_http_connection *conn,
+					    struct sipe_transport_connection *connection)
+{
+	gsize length = MIN(connection->buffer_used, conn->content_remainder);
 
-		if (msg->response == SIPMSG_RESPONSE_FATAL_ERROR) {
-			/* fatal header parse error */
-			msg->response = SIPE_HTTP_STATUS_SERVER_ERROR;
-			drop          = TRUE;
-		} else if (sipe_strcase_equal(sipmsg_find_header(msg, "Connection"), "close")) {
-			SIPE_DEBUG_INFO("sipe_http_transport_input: server requested close '%s'",
-					conn->host_port);
-			drop          = TRUE;
+	if (length) {
+		sipe_http_transport_body(conn, connection->buffer, length);
+		conn->content_remainder -= length;
+		sipe_utils_shrink_buffer(connection, connection->buffer + length);
+	}
+
+	return(conn->content_remainder == 0);
+}
+
+/* TRUE indicates that a message was processed and connection is still open */
+static gboolean sipe_http_transport_message(struct sipe_http_connection *conn,
+					    struct sipe_transport_connection *connection)
+{
+	struct sipmsg *msg;
+	gboolean drop = FALSE;
+	gboolean next;
+
+	if (conn->connection != connection)
+		return(FALSE);
+
+	if (!conn->msg) {
+		char *current = connection->buffer;
+
+		/* according to the RFC remove CRLF at the beginning */
+		while (*current == '\r' || *current == '\n') {
+			current++;
+		}
+		if (current != connection->buffer)
+			sipe_utils_shrink_buffer(connection, current);
+
+		current = strstr(connection->buffer, "\r\n\r\n");
+		if (!current)
+			return(FALSE);
+
+		current += 2;
+		current[0] = '\0';
+		msg = sipmsg_parse_header(connection->buffer);
+		if (!msg) {
+			/* restore header for next try */
+			current[0] = '\r';
+			return(FALSE);
 		}
 
-		sipe_http_request_response(SIPE_HTTP_CONNECTION_PUBLIC, msg);
-		next = sipe_http_request_pending(SIPE_HTTP_CONNECTION_PUBLIC);
-
-		if (drop) {
-			/* drop backend connection */
-			sipe_backend_transport_disconnect(conn->connection);
-			conn->connection       = NULL;
-			conn->public.connected = FALSE;
-
-			/* if we have pending requests we need to trigger re-connect */
-			if (next)
-				sipe_http_transport_new(conn->public.sipe_private,
-							conn->public.host,
-							conn->public.port,
-							conn->use_tls);
-
-		} else if (next) {
-			/* trigger sending of next pending request */
-			sipe_http_request_next(SIPE_HTTP_CONNECTION_PUBLIC);
+		sipe_http_transport_body_start(conn,
+					       msg,
+					       connection->buffer);
+
+		/* HTTP/1.1 Transfer-Encoding: chunked */
+		if (msg->bodylen == SIPMSG_BODYLEN_CHUNKED) {
+			conn->chunked         = TRUE;
+			conn->chunk_remainder = 0;
+			conn->chunk_state     = CHUNK_STATE_SIZE;
+		} else {
+			conn->chunked           = FALSE;
+			conn->content_remainder = (msg->bodylen > 0) ? msg->bodylen : 0;
 		}
+		msg->bodylen = 0;
+
+		/* header is no longer needed in buffer */
+		sipe_utils_shrink_buffer(connection, current + 2);
+	}
+
+	/* body is decoded as it arrives, each byte is only looked at once */
+	if (conn->chunked) {
+		if (!sipe_http_transport_chunked(conn, connection))
+			return(FALSE);
+	} else if (!sipe_http_transport_content(conn, connection))
+		return(FALSE);
 
-		sipmsg_free(msg);
+	/* body completed */
+	msg = sipe_http_transport_body_complete(conn);
+
+	if (msg->response == SIPMSG_RESPONSE_FATAL_ERROR) {
+		/* fatal header parse error */
+		msg->response = SIPE_HTTP_STATUS_SERVER_ERROR;
+		drop          = TRUE;
+	} else if (sipe_strcase_equal(sipmsg_find_header(msg, "Connection"), "close")) {
+		SIPE_DEBUG_INFO("sipe_http_transport_message: server requested close '%s'",
+				conn->host_port);
+		drop          = TRUE;
 	}
+
+	sipe_http_request_response(SIPE_HTTP_CONNECTION_PUBLIC, msg);
+	next = sipe_http_request_pending(SIPE_HTTP_CONNECTION_PUBLIC);
+
+	sipmsg_free(msg);
+
+	if (drop) {
+		/* drop backend connection */
+		sipe_backend_transport_disconnect(conn->connection);
+		conn->connection         = NULL;
+		conn->public.connected   = FALSE;
+		conn->public.established = FALSE;
+
+		/* if we have pending requests we need to trigger re-connect */
+		if (next)
+			sipe_http_transport_reconnect(conn);
+
+		return(FALSE);
+	}
+
+	if (next)
+		/* trigger sending of next pending request */
+		sipe_http_request_next(SIPE_HTTP_CONNECTION_PUBLIC);
+
+	return(TRUE);
+}
+
+static void sipe_http_transport_input(struct sipe_transport_connection *connection)
+{
+	struct sipe_http_connection *conn = SIPE_HTTP_CONNECTION;
+
+	/* pipelined responses can arrive in the same buffer */
+	while (sipe_http_transport_message(conn, connection));
 }
 
 static void sipe_http_transport_error(struct sipe_transport_connection *connection,
@@ -441,6 +789,43 @@ static void sipe_http_transport_error(struct sipe_transport_connection *connecti
 	/* conn is no longer valid */
 }
 
+static void sipe_http_transport_connect(struct sipe_http_connection *conn)
+{
+	struct sipe_core_private *sipe_private = conn->public.sipe_private;
+	sipe_connect_setup setup = {
+		conn->use_tls ? SIPE_TRANSPORT_TLS : SIPE_TRANSPORT_TCP,
+		conn->public.host,
+		conn->public.port,
+		conn,
+		sipe_http_transport_connected,
+		sipe_http_transport_input,
+		sipe_http_transport_error
+	};
+
+	sipe_http_transport_body_free(conn);
+	conn->public.connected   = FALSE;
+	conn->public.established = FALSE;
+	conn->connection = sipe_backend_transport_connect(SIPE_CORE_PUBLIC,
+							  &setup);
+}
+
+static void sipe_http_transport_reconnect(struct sipe_http_connection *conn)
+{
+	SIPE_DEBUG_INFO("sipe_http_transport_reconnect: re-establishing %s",
+			conn->host_port);
+
+	/* will be re-inserted after connect */
+	sipe_http_transport_update_timeout_queue(conn, TRUE);
+
+	sipe_http_transport_connect(conn);
+}
+
+static guint sipe_http_transport_load(struct sipe_http_connection *conn)
+{
+	GQueue *queue = conn->public.pending_requests;
+	return(queue ? g_queue_get_length(queue) : 0);
+}
+
 struct sipe_http_connection_public *sipe_http_transport_new(struct sipe_core_private *sipe_private,
 							    const gchar *host_in,
 							    const guint32 port,
@@ -459,50 +844,73 @@ struct sipe_http_connection_public *sipe_http_transport_new(struct sipe_core_pri
 		SIPE_DEBUG_ERROR("sipe_http_transport_new: new connection requested during shutdown: THIS SHOULD NOT HAPPEN! Debugging information:\n"
 				 "Host/Port: %s", host_port);
 	} else {
-		conn = g_hash_table_lookup(http->connections, host_port);
-
-		if (conn) {
-			/* re-establishing connection */
-			if (!conn->connection) {
-				SIPE_DEBUG_INFO("sipe_http_transport_new: re-establishing %s", host_port);
+		struct sipe_http_connection *least_loaded = NULL;
+		gchar *free_key = NULL;
+		guint i;
+
+		/*
+		 * Pool slot 0 uses "host:port" as key, all other slots
+		 * use "host:port#<slot>". Pick the first idle connection,
+		 * otherwise open a new one in a free slot, otherwise
+		 * share the connection with the shortest request queue.
+		 */
+		for (i = 0; i < SIPE_HTTP_CONNECTIONS; i++) {
+			gchar *key = i ?
+				g_strdup_printf("%s#%u", host_port, i) :
+				g_strdup(host_port);
+			struct sipe_http_connection *slot = g_hash_table_lookup(http->connections,
+										key);
+
+			if (!slot) {
+				if (free_key)
+					g_free(key);
+				else
+					free_key = key;
+				continue;
+			}
+			g_free(key);
 
-				/* will be re-inserted after connect */
-				sipe_http_transport_update_timeout_queue(conn, TRUE);
+			if (sipe_http_transport_load(slot) == 0) {
+				conn = slot;
+				break;
 			}
+			if (!least_loaded ||
+			    (sipe_http_transport_load(slot) < sipe_http_transport_load(least_loaded)))
+				least_loaded = slot;
+		}
 
-		} else {
+		if (conn) {
+			/* re-use idle connection */
+			g_free(free_key);
+			if (!conn->connection)
+				sipe_http_transport_reconnect(conn);
+
+		} else if (free_key) {
 			/* new connection */
-			SIPE_DEBUG_INFO("sipe_http_transport_new: new %s", host_port);
+			SIPE_DEBUG_INFO("sipe_http_transport_new: new %s", free_key);
 
 			conn = g_new0(struct sipe_http_connection, 1);
 
 			conn->public.sipe_private = sipe_private;
 			conn->public.host         = g_strdup(host);
 			conn->public.port         = port;
+			conn->public.pipeline     = SIPE_HTTP_PIPELINE;
 
-			conn->host_port           = host_port;
+			conn->host_port           = free_key;
 			conn->use_tls             = use_tls;
 
 			g_hash_table_insert(http->connections,
-					    host_port,
+					    free_key,
 					    conn);
-			host_port = NULL; /* conn_private takes ownership of the key */
-		}
+			/* conn_private takes ownership of the key */
+
+			sipe_http_transport_connect(conn);
 
-		if (!conn->connection) {
-			sipe_connect_setup setup = {
-				use_tls ? SIPE_TRANSPORT_TLS : SIPE_TRANSPORT_TCP,
-				host,
-				port,
-				conn,
-				sipe_http_transport_connected,
-				sipe_http_transport_input,
-				sipe_http_transport_error
-			};
-
-			conn->public.connected = FALSE;
-			conn->connection = sipe_backend_transport_connect(SIPE_CORE_PUBLIC,
-									  &setup);
+		} else {
+			/* pool is exhausted */
+			conn = least_loaded;
+			if (!conn->connection)
+				sipe_http_transport_reconnect(conn);
 		}
 	}
 
@@ -511,20 +919,71 @@ struct sipe_http_connection_public *sipe_http_transport_new(struct sipe_core_pri
 	return(SIPE_HTTP_CONNECTION_PUBLIC);
 }
 
+static gchar *sipe_http_transport_host_port(struct sipe_http_connection_public *conn_public)
+{
+	return(g_strdup_printf("%s:%" G_GUINT32_FORMAT,
+			       conn_public->host,
+			       conn_public->port));
+}
+
+gboolean sipe_http_transport_uncompressed(struct sipe_http_connection_public *conn_public)
+{
+	gchar *host_port = sipe_http_transport_host_port(conn_public);
+	gboolean uncompressed = g_hash_table_lookup(conn_public->sipe_private->http->uncompressed,
+						    host_port) != NULL;
+	g_free(host_port);
+	return(uncompressed);
+}
+
+void sipe_http_transport_set_uncompressed(struct sipe_http_connection_public *conn_public)
+{
+	/* hash table takes ownership of the key */
+	g_hash_table_replace(conn_public->sipe_private->http->uncompressed,
+			     sipe_http_transport_host_port(conn_public),
+			     GINT_TO_POINTER(TRUE));
+}
+
 void sipe_http_transport_send(struct sipe_http_connection_public *conn_public,
 			      const gchar *header,
-			      const gchar *body)
+			      const gchar *body,
+			      gsize body_length,
+			      gboolean compressed)
 {
 	struct sipe_http_connection *conn = SIPE_HTTP_CONNECTION_PRIVATE;
-	GString *message = g_string_new(header);
+	struct sipe_transport_vector vector[3];
+
+	vector[0].data   = header;
+	vector[0].length = strlen(header);
+	vector[1].data   = "\r\n";
+	vector[1].length = 2;
+	vector[2].data   = body;
+	vector[2].length = body ? body_length : 0;
+
+	/* compressed body can't be printed */
+	sipe_utils_message_debug("HTTP",
+				 header,
+				 compressed ? NULL : body,
+				 TRUE);
+	sipe_backend_transport_message_vector(conn->connection,
+					      vector,
+					      body ? 3 : 2);
 
-	g_string_append_printf(message, "\r\n%s", body ? body : "");
+	sipe_http_transport_update_timeout_queue(conn, FALSE);
+}
 
-	sipe_utils_message_debug("HTTP", message->str, NULL, TRUE);
-	sipe_backend_transport_message(conn->connection, message->str);
-	g_string_free(message, TRUE);
+void sipe_http_transport_statistics(struct sipe_http_connection_public *conn_public,
+				    guint64 wait_time,
+				    guint64 server_time)
+{
+	struct sipe_http_connection *conn = SIPE_HTTP_CONNECTION_PRIVATE;
+	struct sipe_http *http = conn->public.sipe_private->http;
 
-	sipe_http_transport_update_timeout_queue(conn, FALSE);
+	http->requests++;
+	http->wait_time   += wait_time;
+	http->server_time += server_time;
+
+	SIPE_DEBUG_INFO("sipe_http_transport_statistics: %s queue %" G_GUINT64_FORMAT " ms server %" G_GUINT64_FORMAT " ms",
+			conn->host_port, wait_time, server_time);
 }
 
 /*
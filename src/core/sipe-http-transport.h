@@ -39,13 +39,16 @@ struct sip_sec_context;
 struct sipe_http_connection_public {
 	struct sipe_core_private *sipe_private;
 
-	GSList *pending_requests;        /* handled by sipe-http-request.c */
+	GQueue *pending_requests;        /* handled by sipe-http-request.c */
 	struct sip_sec_context *context; /* handled by sipe-http-request.c */
 	gchar *cached_authorization;     /* handled by sipe-http-request.c */
+	guint in_flight;                 /* handled by sipe-http-request.c */
 
 	gchar *host;
 	guint32 port;
+	guint pipeline;       /* max. requests in flight, 1: no pipelining */
 	gboolean connected;
+	gboolean established; /* a request has been completed on connection */
 };
 
 /**
@@ -60,7 +63,9 @@ gboolean sipe_http_shutting_down(struct sipe_core_private *sipe_private);
 /**
  * Initiate HTTP connection
  *
- * If a connection to this host/port already exists it will be reused.
+ * Each host/port has a pool of connections. An idle connection is reused,
+ * otherwise a new connection is opened until the pool limit is reached.
+ * After that the connection with the shortest request queue is returned.
  *
  * @param sipe_private SIPE core private data
  * @param host         name of the host to connect to
@@ -74,13 +79,46 @@ struct sipe_http_connection_public *sipe_http_transport_new(struct sipe_core_pri
 							    guint32 port,
 							    gboolean use_tls);
 
+/**
+ * Check if host has rejected compressed request bodies before
+ *
+ * @param conn_public HTTP connection public data
+ *
+ * @return @c TRUE if request bodies must be sent uncompressed
+ */
+gboolean sipe_http_transport_uncompressed(struct sipe_http_connection_public *conn_public);
+
+/**
+ * Remember that host rejects compressed request bodies
+ *
+ * Applies to all connections to the same host/port.
+ *
+ * @param conn_public HTTP connection public data
+ */
+void sipe_http_transport_set_uncompressed(struct sipe_http_connection_public *conn_public);
+
 /**
  * Send HTTP request
  *
  * @param conn_public HTTP connection public data
  * @param header      HTTP header
- * @param body        HTTP body (may be @c NULL)
+ * @param body        HTTP body (may be @c NULL, may contain binary data)
+ * @param body_length length of HTTP body
+ * @param compressed  @c TRUE if body is Content-Encoding compressed
  */
 void sipe_http_transport_send(struct sipe_http_connection_public *conn_public,
 			      const gchar *header,
-			      const gchar *body);
+			      const gchar *body,
+			      gsize body_length,
+			      gboolean compressed);
+
+/**
+ * Record timing of a completed HTTP request
+ *
+ * @param conn_public HTTP connection public data
+ * @param wait_time   time spent in request queue (in milliseconds)
+ * @param server_time time from sending until response (in milliseconds)
+ */
+void sipe_http_transport_statistics(struct sipe_http_connection_public *conn_public,
+				    guint64 wait_time,
+				    guint64 server_time);
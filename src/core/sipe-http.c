@@ -30,6 +30,7 @@
 
 #include <glib.h>
 
+#define SIPE_DEBUG_CATEGORY SIPE_DEBUG_CATEGORY_HTTP
 #include "sipe-backend.h"
 #include "sipe-http.h"
 
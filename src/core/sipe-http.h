@@ -50,6 +50,22 @@ typedef void (sipe_http_response_callback)(struct sipe_core_private *sipe_privat
 					   const gchar *body,
 					   gpointer callback_data);
 
+/**
+ * HTTP response body stream callback
+ *
+ * Receives the body of a successful response as it arrives. The response
+ * callback is called afterwards with an empty body.
+ *
+ * @param sipe_private  SIPE core private data
+ * @param data          body data (not zero-terminated)
+ * @param length        length of body data
+ * @param callback_data callback data
+ */
+typedef void (sipe_http_stream_callback)(struct sipe_core_private *sipe_private,
+					 const gchar *data,
+					 gsize length,
+					 gpointer callback_data);
+
 /* HTTP response status codes */
 #define SIPE_HTTP_STATUS_FAILED                0 /* internal use */
 #define SIPE_HTTP_STATUS_OK                  200
@@ -58,6 +74,7 @@ typedef void (sipe_http_response_callback)(struct sipe_core_private *sipe_privat
 #define SIPE_HTTP_STATUS_CLIENT_UNAUTHORIZED 401
 #define SIPE_HTTP_STATUS_CLIENT_FORBIDDEN    403
 #define SIPE_HTTP_STATUS_CLIENT_PROXY_AUTH   407
+#define SIPE_HTTP_STATUS_CLIENT_UNSUPPORTED  415
 #define SIPE_HTTP_STATUS_SERVER_ERROR        500 /* - 599 */
 #define SIPE_HTTP_STATUS_CANCELLED            -2 /* internal use */
 #define SIPE_HTTP_STATUS_ABORTED              -1 /* internal use */
@@ -151,6 +168,27 @@ void sipe_http_request_session(struct sipe_http_request *request,
  */
 void sipe_http_request_allow_redirect(struct sipe_http_request *request);
 
+/**
+ * Send body of HTTP request gzip encoded
+ *
+ * Only for servers known to accept "Content-Encoding: gzip" request bodies.
+ * If the server rejects the body with "400 Bad Request" or "415 Unsupported
+ * Media Type" the request is sent again uncompressed. Has no effect for small
+ * bodies or when compiled without zlib.
+ *
+ * @param request pointer to opaque HTTP request data structure
+ */
+void sipe_http_request_compress(struct sipe_http_request *request);
+
+/**
+ * Stream body of successful HTTP response
+ *
+ * @param request  pointer to opaque HTTP request data structure
+ * @param callback stream callback function
+ */
+void sipe_http_request_stream(struct sipe_http_request *request,
+			      sipe_http_stream_callback *callback);
+
 /**
  * Provide authentication information for HTTP request
  *
@@ -0,0 +1,308 @@
+/**
+ * @file sipe-media-write-queue-tests.c
+ *
+ * pidgin-sipe
+ *
+ * Copyright (C) 2015 SIPE Project <http://sipe.sourceforge.net/>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "sipe-common.h"
+#include "sipe-backend.h"
+#include "sipe-core.h"
+#include "sipe-media.h"
+#include "sipe-media-write-queue.h"
+
+/*
+ * Backend emulation
+ *
+ * Every write call accepts at most "limit" bytes, -1 simulates an error.
+ * Accepted data is appended to "output".
+ */
+static GByteArray *output         = NULL;
+static gssize limit               = 0;
+static guint calls                = 0;
+static const guint8 *last_buffer  = NULL;
+
+static gssize test_write(SIPE_UNUSED_PARAMETER gpointer context,
+			 const guint8 *buffer,
+			 gsize len)
+{
+	gsize length;
+
+	calls++;
+	last_buffer = buffer;
+	if (limit < 0)
+		return(-1);
+
+	length = MIN(len, (gsize) limit);
+	g_byte_array_append(output, buffer, length);
+	return(length);
+}
+
+/*
+ * Tester code
+ */
+static guint succeeded = 0;
+static guint failed    = 0;
+
+static guint8 data[256];
+
+static void test_reset(gssize new_limit)
+{
+	if (output)
+		g_byte_array_set_size(output, 0);
+	else
+		output = g_byte_array_new();
+	limit       = new_limit;
+	calls       = 0;
+	last_buffer = NULL;
+}
+
+static void test_check(const gchar *name, gboolean ok)
+{
+	if (ok) {
+		succeeded++;
+	} else {
+		printf("FAILED: %s\n", name);
+		failed++;
+	}
+}
+
+/* output must be data[0] ... data[len - 1] */
+static gboolean output_is(gsize len)
+{
+	return((output->len == len) && !memcmp(output->data, data, len));
+}
+
+static void test_writev(void)
+{
+	struct sipe_media_write_queue *queue = sipe_media_write_queue_new();
+	struct sipe_media_iovec vectors[3];
+	gboolean result;
+
+	vectors[0].buffer = data;
+	vectors[0].len    = 3;
+	vectors[1].buffer = data + 3;
+	vectors[1].len    = 10;
+	vectors[2].buffer = data + 13;
+	vectors[2].len    = 20;
+
+	/* writable & nothing queued: every buffer goes out without a copy */
+	test_reset(1000);
+	result = sipe_media_write_queue_writev(queue, vectors, 3, TRUE,
+					       test_write, NULL);
+	test_check("writev direct",
+		   result &&
+		   (calls == 3) &&
+		   (last_buffer == data + 13) &&
+		   (sipe_media_write_queue_length(queue) == 0) &&
+		   (queue->data->len == 0) &&
+		   output_is(33));
+
+	/* backend accepts only part of the second buffer: tail gets queued */
+	test_reset(5);
+	result = sipe_media_write_queue_writev(queue, vectors, 3, TRUE,
+					       test_write, NULL);
+	test_check("writev partial",
+		   !result &&
+		   (calls == 2) &&
+		   (last_buffer == data + 3) &&
+		   (sipe_media_write_queue_length(queue) == 25) &&
+		   output_is(8));
+
+	/* queue not empty: data is appended and drained with one write */
+	limit = 1000;
+	calls = 0;
+	result = sipe_media_write_queue_writev(queue, vectors, 1, TRUE,
+					       test_write, NULL);
+	test_check("writev behind queue",
+		   result &&
+		   (calls == 1) &&
+		   (sipe_media_write_queue_length(queue) == 0) &&
+		   (output->len == 36) &&
+		   !memcmp(output->data, data, 33) &&
+		   !memcmp(output->data + 33, data, 3));
+
+	/* not writable: everything is queued, backend isn't called */
+	test_reset(1000);
+	result = sipe_media_write_queue_writev(queue, vectors, 3, FALSE,
+					       test_write, NULL);
+	test_check("writev not writable",
+		   !result &&
+		   (calls == 0) &&
+		   (sipe_media_write_queue_length(queue) == 33));
+	sipe_media_write_queue_drain(queue, test_write, NULL);
+	test_check("drain",
+		   (calls == 1) &&
+		   (sipe_media_write_queue_length(queue) == 0) &&
+		   (queue->pos == 0) &&
+		   (queue->data->len == 0) &&
+		   output_is(33));
+
+	/* backend error: everything is queued */
+	test_reset(-1);
+	result = sipe_media_write_queue_writev(queue, vectors, 3, TRUE,
+					       test_write, NULL);
+	test_check("writev error",
+		   !result &&
+		   (calls == 1) &&
+		   (sipe_media_write_queue_length(queue) == 33));
+	sipe_media_write_queue_drain(queue, test_write, NULL);
+	test_check("drain error",
+		   (calls == 2) &&
+		   (sipe_media_write_queue_length(queue) == 33));
+
+	sipe_media_write_queue_free(queue);
+}
+
+static void test_compaction(void)
+{
+	struct sipe_media_write_queue *queue = sipe_media_write_queue_new();
+	struct sipe_media_iovec vector;
+
+	test_reset(60);
+	vector.buffer = data;
+	vector.len    = 100;
+	sipe_media_write_queue_writev(queue, &vector, 1, FALSE,
+				      test_write, NULL);
+	sipe_media_write_queue_drain(queue, test_write, NULL);
+	test_check("partial drain keeps sent data",
+		   (queue->pos == 60) &&
+		   (queue->data->len == 100) &&
+		   (sipe_media_write_queue_length(queue) == 40));
+
+	/* sent data is at least half of the queue: discarded on append */
+	vector.buffer = data + 100;
+	vector.len    = 10;
+	sipe_media_write_queue_writev(queue, &vector, 1, FALSE,
+				      test_write, NULL);
+	test_check("compaction",
+		   (queue->pos == 0) &&
+		   (queue->data->len == 50) &&
+		   !memcmp(queue->data->data, data + 60, 50));
+
+	/* sent data is less than half of the queue: kept on append */
+	limit = 10;
+	sipe_media_write_queue_drain(queue, test_write, NULL);
+	vector.buffer = data + 110;
+	sipe_media_write_queue_writev(queue, &vector, 1, FALSE,
+				      test_write, NULL);
+	test_check("no compaction",
+		   (queue->pos == 10) &&
+		   (queue->data->len == 60) &&
+		   (sipe_media_write_queue_length(queue) == 50));
+
+	limit = 1000;
+	sipe_media_write_queue_drain(queue, test_write, NULL);
+	test_check("drain after compaction",
+		   (queue->pos == 0) &&
+		   (queue->data->len == 0) &&
+		   output_is(120));
+
+	sipe_media_write_queue_free(queue);
+}
+
+static void test_watermarks(void)
+{
+	struct sipe_media_write_queue *queue = sipe_media_write_queue_new();
+	struct sipe_media_iovec vector;
+
+	vector.buffer = data;
+
+	/* default 0/0: writable & drained only when the queue is empty */
+	test_check("default empty",
+		   sipe_media_write_queue_is_writable(queue) &&
+		   sipe_media_write_queue_is_drained(queue));
+	test_reset(0);
+	vector.len = 1;
+	sipe_media_write_queue_writev(queue, &vector, 1, TRUE,
+				      test_write, NULL);
+	test_check("default queued",
+		   !sipe_media_write_queue_is_writable(queue) &&
+		   !sipe_media_write_queue_is_drained(queue));
+	limit = 1;
+	sipe_media_write_queue_drain(queue, test_write, NULL);
+	test_check("default drained",
+		   sipe_media_write_queue_is_writable(queue) &&
+		   sipe_media_write_queue_is_drained(queue));
+
+	sipe_media_write_queue_set_watermarks(queue, 10, 20);
+
+	/* below high watermark */
+	vector.len = 15;
+	sipe_media_write_queue_writev(queue, &vector, 1, FALSE,
+				      test_write, NULL);
+	test_check("below high",
+		   sipe_media_write_queue_is_writable(queue) &&
+		   !sipe_media_write_queue_is_drained(queue));
+
+	/* at high watermark */
+	vector.len = 5;
+	sipe_media_write_queue_writev(queue, &vector, 1, FALSE,
+				      test_write, NULL);
+	test_check("at high",
+		   !sipe_media_write_queue_is_writable(queue) &&
+		   !sipe_media_write_queue_is_drained(queue));
+
+	/* above low watermark */
+	limit = 9;
+	sipe_media_write_queue_drain(queue, test_write, NULL);
+	test_check("above low",
+		   sipe_media_write_queue_is_writable(queue) &&
+		   !sipe_media_write_queue_is_drained(queue));
+
+	/* at low watermark */
+	limit = 1;
+	sipe_media_write_queue_drain(queue, test_write, NULL);
+	test_check("at low",
+		   sipe_media_write_queue_is_writable(queue) &&
+		   sipe_media_write_queue_is_drained(queue));
+
+	sipe_media_write_queue_free(queue);
+}
+
+int main(SIPE_UNUSED_PARAMETER int argc, SIPE_UNUSED_PARAMETER char *argv[])
+{
+	guint i;
+
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = i;
+
+	test_writev();
+	test_compaction();
+	test_watermarks();
+
+	g_byte_array_free(output, TRUE);
+
+	printf("Result: %u PASSED %u FAILED\n", succeeded, failed);
+	return(failed);
+}
+
+/*
+  Local Variables:
+  mode: c
+  c-file-style: "bsd"
+  indent-tabs-mode: t
+  tab-width: 8
+  End:
+*/
@@ -0,0 +1,146 @@
+/**
+ * @file sipe-media-write-queue.c
+ *
+ * pidgin-sipe
+ *
+ * Copyright (C) 2015 SIPE Project <http://sipe.sourceforge.net/>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <glib.h>
+
+#include "sipe-backend.h"
+#include "sipe-core.h"
+#include "sipe-media.h"
+#include "sipe-media-write-queue.h"
+
+struct sipe_media_write_queue *sipe_media_write_queue_new(void)
+{
+	struct sipe_media_write_queue *queue = g_new0(struct sipe_media_write_queue, 1);
+	queue->data = g_byte_array_new();
+	return(queue);
+}
+
+void sipe_media_write_queue_free(struct sipe_media_write_queue *queue)
+{
+	if (queue) {
+		g_byte_array_free(queue->data, TRUE);
+		g_free(queue);
+	}
+}
+
+void sipe_media_write_queue_set_watermarks(struct sipe_media_write_queue *queue,
+					   gsize low, gsize high)
+{
+	queue->low_watermark  = low;
+	queue->high_watermark = high;
+}
+
+gsize sipe_media_write_queue_length(struct sipe_media_write_queue *queue)
+{
+	return(queue->data->len - queue->pos);
+}
+
+static void queue_append(struct sipe_media_write_queue *queue,
+			 const guint8 *buffer, gsize len)
+{
+	/* discard sent data before the queue grows */
+	if (queue->pos && (queue->pos >= queue->data->len / 2)) {
+		g_byte_array_remove_range(queue->data, 0, queue->pos);
+		queue->pos = 0;
+	}
+
+	g_byte_array_append(queue->data, buffer, len);
+}
+
+gboolean sipe_media_write_queue_writev(struct sipe_media_write_queue *queue,
+				       const struct sipe_media_iovec *vectors,
+				       guint count,
+				       gboolean writable,
+				       sipe_media_write_queue_write write,
+				       gpointer context)
+{
+	guint i = 0;
+
+	/* nothing queued: try to send without a copy */
+	if (writable && (sipe_media_write_queue_length(queue) == 0)) {
+		for (; i < count; i++) {
+			gssize written = write(context,
+					       vectors[i].buffer,
+					       vectors[i].len);
+			if (written < 0)
+				written = 0;
+			if ((gsize) written < vectors[i].len) {
+				queue_append(queue,
+					     (const guint8 *) vectors[i].buffer + written,
+					     vectors[i].len - written);
+				i++;
+				break;
+			}
+		}
+
+		/* backend is full: no point in trying the rest now */
+		writable = FALSE;
+	}
+
+	for (; i < count; i++)
+		queue_append(queue, vectors[i].buffer, vectors[i].len);
+
+	if (writable)
+		sipe_media_write_queue_drain(queue, write, context);
+
+	return(sipe_media_write_queue_length(queue) == 0);
+}
+
+void sipe_media_write_queue_drain(struct sipe_media_write_queue *queue,
+				  sipe_media_write_queue_write write,
+				  gpointer context)
+{
+	gsize length = sipe_media_write_queue_length(queue);
+
+	if (length) {
+		gssize written = write(context,
+				       queue->data->data + queue->pos,
+				       length);
+		if (written > 0)
+			queue->pos += written;
+	}
+
+	if (queue->pos == queue->data->len) {
+		g_byte_array_set_size(queue->data, 0);
+		queue->pos = 0;
+	}
+}
+
+gboolean sipe_media_write_queue_is_writable(struct sipe_media_write_queue *queue)
+{
+	gsize length = sipe_media_write_queue_length(queue);
+	return((length == 0) || (length < queue->high_watermark));
+}
+
+gboolean sipe_media_write_queue_is_drained(struct sipe_media_write_queue *queue)
+{
+	return(sipe_media_write_queue_length(queue) <= queue->low_watermark);
+}
+
+/*
+  Local Variables:
+  mode: c
+  c-file-style: "bsd"
+  indent-tabs-mode: t
+  tab-width: 8
+  End:
+*/
@@ -0,0 +1,119 @@
+/**
+ * @file sipe-media-write-queue.h
+ *
+ * pidgin-sipe
+ *
+ * Copyright (C) 2015 SIPE Project <http://sipe.sourceforge.net/>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Interface dependencies:
+ *
+ * <glib.h>
+ */
+
+/* Forward declarations */
+struct sipe_media_iovec;
+
+/**
+ * Write function of the queue owner
+ *
+ * @param context (in) opaque data passed to the queue functions
+ * @param buffer  (in) data to send
+ * @param len     (in) length of @c buffer
+ *
+ * @return number of bytes written, -1 on error
+ */
+typedef gssize (*sipe_media_write_queue_write)(gpointer context,
+					       const guint8 *buffer,
+					       gsize len);
+
+/**
+ * Unsent data of a media stream
+ *
+ * Data sent from the queue is not removed immediately. It is discarded
+ * when the queue is appended to and it makes up at least half of it.
+ */
+struct sipe_media_write_queue {
+	/* unsent data: data->data[pos] ... end */
+	GByteArray *data;
+	gsize pos;
+	gsize low_watermark;
+	gsize high_watermark;
+};
+
+/**
+ * Create a write queue with both watermarks set to 0, i.e. the owner
+ * accepts more data only when nothing is queued.
+ */
+struct sipe_media_write_queue *sipe_media_write_queue_new(void);
+void sipe_media_write_queue_free(struct sipe_media_write_queue *queue);
+
+/**
+ * Set flow control limits, see sipe_media_write_queue_is_writable()
+ * and sipe_media_write_queue_is_drained()
+ */
+void sipe_media_write_queue_set_watermarks(struct sipe_media_write_queue *queue,
+					   gsize low, gsize high);
+
+/**
+ * @return number of queued bytes
+ */
+gsize sipe_media_write_queue_length(struct sipe_media_write_queue *queue);
+
+/**
+ * Write @c count buffers from @c vectors
+ *
+ * When @c writable is @c TRUE and nothing is queued, the buffers are passed
+ * to @c write directly and only the part not accepted gets queued.
+ * Otherwise the buffers are appended to the queue and, when @c writable is
+ * @c TRUE, the queue is drained.
+ *
+ * @return @c TRUE when all data was written, @c FALSE when some data is queued
+ */
+gboolean sipe_media_write_queue_writev(struct sipe_media_write_queue *queue,
+				       const struct sipe_media_iovec *vectors,
+				       guint count,
+				       gboolean writable,
+				       sipe_media_write_queue_write write,
+				       gpointer context);
+
+/**
+ * Pass all queued data to @c write with one call
+ */
+void sipe_media_write_queue_drain(struct sipe_media_write_queue *queue,
+				  sipe_media_write_queue_write write,
+				  gpointer context);
+
+/**
+ * @return @c TRUE when the queue is empty or below the high watermark
+ */
+gboolean sipe_media_write_queue_is_writable(struct sipe_media_write_queue *queue);
+
+/**
+ * @return @c TRUE when the queue has been emptied down to the low watermark
+ */
+gboolean sipe_media_write_queue_is_drained(struct sipe_media_write_queue *queue);
+
+/*
+  Local Variables:
+  mode: c
+  c-file-style: "bsd"
+  indent-tabs-mode: t
+  tab-width: 8
+  End:
+*/
@@ -34,6 +34,7 @@
 #include "sipe-common.h"
 #include "sipmsg.h"
 #include "sip-transport.h"
+#define SIPE_DEBUG_CATEGORY SIPE_DEBUG_CATEGORY_MEDIA
 #include "sipe-backend.h"
 #include "sdpmsg.h"
 #include "sipe-chat.h"
@@ -42,6 +43,7 @@
 #include "sipe-core-private.h"
 #include "sipe-dialog.h"
 #include "sipe-media.h"
+#include "sipe-media-write-queue.h"
 #include "sipe-ocs2007.h"
 #include "sipe-session.h"
 #include "sipe-utils.h"
@@ -84,7 +86,7 @@ struct sipe_media_stream_private {
 
 	gboolean writable;
 
-	GQueue *write_queue;
+	struct sipe_media_write_queue *write_queue;
 	GQueue *async_reads;
 	gssize read_pos;
 
@@ -126,8 +128,7 @@ remove_stream(struct sipe_media_call* call,
 	sipe_backend_media_stream_free(SIPE_MEDIA_STREAM->backend_private);
 	g_free(SIPE_MEDIA_STREAM->id);
 	g_free(stream_private->encryption_key);
-	g_queue_free_full(stream_private->write_queue,
-			  (GDestroyNotify)g_byte_array_unref);
+	sipe_media_write_queue_free(stream_private->write_queue);
 	g_queue_free_full(stream_private->async_reads, g_free);
 	sipe_utils_nameval_free(stream_private->extra_sdp);
 	g_free(stream_private);
@@ -1135,7 +1136,7 @@ sipe_media_stream_add(struct sipe_media_call *call, const gchar *id,
 	}
 #endif
 
-	stream_private->write_queue = g_queue_new();
+	stream_private->write_queue = sipe_media_write_queue_new();
 	stream_private->async_reads = g_queue_new();
 
 	SIPE_MEDIA_CALL_PRIVATE->streams =
@@ -2096,63 +2097,66 @@ sipe_media_stream_read_async(struct sipe_media_stream *stream,
 	g_queue_push_tail(SIPE_MEDIA_STREAM_PRIVATE->async_reads, data);
 }
 
-static void
-stream_append_buffer(struct sipe_media_stream *stream,
-		     guint8 *buffer, guint len)
+static gssize
+stream_backend_write(gpointer context, const guint8 *buffer, gsize len)
+{
+	return sipe_backend_media_stream_write(context, (guint8 *)buffer, len);
+}
+
+gboolean
+sipe_media_stream_writev(struct sipe_media_stream *stream,
+			 const struct sipe_media_iovec *vectors, guint count)
 {
-	GByteArray *b = g_byte_array_sized_new(len);
-	g_byte_array_append(b, buffer, len);
-	g_queue_push_tail(SIPE_MEDIA_STREAM_PRIVATE->write_queue, b);
+	struct sipe_media_stream_private *stream_private =
+			SIPE_MEDIA_STREAM_PRIVATE;
+
+	return sipe_media_write_queue_writev(stream_private->write_queue,
+					     vectors, count,
+					     stream_private->writable,
+					     stream_backend_write, stream);
 }
 
 gboolean
 sipe_media_stream_write(struct sipe_media_stream *stream,
 			gpointer buffer, gsize len)
 {
-	if (!sipe_media_stream_is_writable(stream)) {
-		stream_append_buffer(stream, buffer, len);
-		return FALSE;
-	} else {
-		guint written;
+	struct sipe_media_iovec vector;
 
-		written = sipe_backend_media_stream_write(stream, buffer, len);
-		if (written == len) {
-			return TRUE;
-		}
+	vector.buffer = buffer;
+	vector.len = len;
 
-		stream_append_buffer(stream,
-				     (guint8 *)buffer + written, len - written);
-		return FALSE;
-	}
+	return sipe_media_stream_writev(stream, &vector, 1);
+}
+
+void
+sipe_media_stream_set_write_watermarks(struct sipe_media_stream *stream,
+				       gsize low, gsize high)
+{
+	g_return_if_fail(stream && (low <= high));
+
+	sipe_media_write_queue_set_watermarks(SIPE_MEDIA_STREAM_PRIVATE->write_queue,
+					      low, high);
 }
 
 void
 sipe_core_media_stream_writable(struct sipe_media_stream *stream,
 				gboolean writable)
 {
-	SIPE_MEDIA_STREAM_PRIVATE->writable = writable;
+	struct sipe_media_stream_private *stream_private =
+			SIPE_MEDIA_STREAM_PRIVATE;
+
+	stream_private->writable = writable;
 
 	if (!writable) {
 		return;
 	}
 
-	while (!g_queue_is_empty(SIPE_MEDIA_STREAM_PRIVATE->write_queue)) {
-		GByteArray *b;
-		guint written;
+	sipe_media_write_queue_drain(stream_private->write_queue,
+				     stream_backend_write, stream);
 
-		b = g_queue_peek_head(SIPE_MEDIA_STREAM_PRIVATE->write_queue);
-
-		written = sipe_backend_media_stream_write(stream, b->data, b->len);
-		if (written != b->len) {
-			g_byte_array_remove_range(b, 0, written);
-			return;
-		}
-
-		g_byte_array_unref(b);
-		g_queue_pop_head(SIPE_MEDIA_STREAM_PRIVATE->write_queue);
-	}
-
-	if (sipe_media_stream_is_writable(stream) && stream->writable_cb) {
+	if (stream_private->writable &&
+	    sipe_media_write_queue_is_drained(stream_private->write_queue) &&
+	    stream->writable_cb) {
 		stream->writable_cb(stream);
 	}
 }
@@ -2160,8 +2164,11 @@ sipe_core_media_stream_writable(struct sipe_media_stream *stream,
 gboolean
 sipe_media_stream_is_writable(struct sipe_media_stream *stream)
 {
-	return SIPE_MEDIA_STREAM_PRIVATE->writable &&
-	       g_queue_is_empty(SIPE_MEDIA_STREAM_PRIVATE->write_queue);
+	struct sipe_media_stream_private *stream_private =
+			SIPE_MEDIA_STREAM_PRIVATE;
+
+	return stream_private->writable &&
+	       sipe_media_write_queue_is_writable(stream_private->write_queue);
 }
 #endif
 
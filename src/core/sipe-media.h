@@ -215,15 +215,62 @@ sipe_media_stream_read_async(struct sipe_media_stream *stream,
  * @param len (in) length of @c buffer
  *
  * @return @c TRUE when @c buffer was written into the stream as a whole,
- *         @c FALSE when some data had to be queued for later (and thus
- *         the stream is now in unwritable state).
+ *         @c FALSE when some data had to be queued for later.
  */
 gboolean
 sipe_media_stream_write(struct sipe_media_stream *stream,
 			gpointer buffer, gsize len);
 
 /**
- * Checks whether a @c SIPE_MEDIA_APPLICATION stream is in writable state.
+ * Data buffer for sipe_media_stream_writev()
+ */
+struct sipe_media_iovec {
+	gconstpointer buffer;
+	gsize len;
+};
+
+/**
+ * Writes @c count buffers from @c vectors into @c stream.
+ *
+ * When the stream is writable and nothing is queued, the buffers are passed
+ * to the backend without a copy and only the part the backend didn't accept
+ * gets queued. Otherwise the buffers are coalesced in the write queue of
+ * @c stream and passed to the backend with a single write once it becomes
+ * writable. Otherwise same as sipe_media_stream_write().
+ *
+ * @param stream (in) media stream data
+ * @param vectors (in) data to send
+ * @param count (in) number of elements in @c vectors
+ *
+ * @return @c TRUE when all data was written into the stream,
+ *         @c FALSE when some data had to be queued for later.
+ */
+gboolean
+sipe_media_stream_writev(struct sipe_media_stream *stream,
+			 const struct sipe_media_iovec *vectors, guint count);
+
+/**
+ * Sets flow control limits for the write queue of @c stream.
+ *
+ * sipe_media_stream_is_writable() returns @c FALSE while @c high or more
+ * bytes are queued. @c writable_cb of @c stream gets called when the queue
+ * has been emptied down to @c low bytes or less.
+ *
+ * Both watermarks default to 0, i.e. the stream accepts more data only when
+ * nothing is queued and @c writable_cb gets called when the queue is empty.
+ *
+ * @param stream (in) media stream data
+ * @param low (in) low watermark in bytes
+ * @param high (in) high watermark in bytes
+ */
+void
+sipe_media_stream_set_write_watermarks(struct sipe_media_stream *stream,
+				       gsize low, gsize high);
+
+/**
+ * Checks whether a @c SIPE_MEDIA_APPLICATION stream is in writable state,
+ * i.e. the backend accepts data and the write queue is empty or below the
+ * high watermark.
  *
  * @param stream (in) media stream data
  *
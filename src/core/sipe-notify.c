@@ -37,12 +37,14 @@
 #include "sipmsg.h"
 #include "sip-csta.h"
 #include "sip-soap.h"
+#define SIPE_DEBUG_CATEGORY SIPE_DEBUG_CATEGORY_PRESENCE
 #include "sipe-backend.h"
 #include "sipe-buddy.h"
 #include "sipe-cal.h"
 #include "sipe-conf.h"
 #include "sipe-core.h"
 #include "sipe-core-private.h"
+#include "sipe-freebusy.h"
 #include "sipe-group.h"
 #include "sipe-groupchat.h"
 #include "sipe-media.h"
@@ -279,14 +281,13 @@ static void process_incoming_notify_rlmi_resub(struct sipe_core_private *sipe_pr
  * Update user phone
  * Suitable for both 2005 and 2007 systems.
  *
- * @param uri                   buddy SIP URI with 'sip:' prefix whose info we want to change.
+ * @param update                property update for the buddy whose info we want to change.
  * @param phone_type
  * @param phone                 may be modified to strip white space
  * @param phone_display_string  may be modified to strip white space
  */
 static void
-sipe_update_user_phone(struct sipe_core_private *sipe_private,
-		       const gchar *uri,
+sipe_update_user_phone(struct sipe_buddy_property_update *update,
 		       const gchar *phone_type,
 		       gchar *phone,
 		       gchar *phone_display_string)
@@ -310,9 +311,9 @@ sipe_update_user_phone(struct sipe_core_private *sipe_private,
 		phone_display_node = SIPE_BUDDY_INFO_CUSTOM1_PHONE_DISPLAY;
 	}
 
-	sipe_buddy_update_property(sipe_private, uri, phone_node, phone);
+	sipe_buddy_property_update_set(update, phone_node, phone);
 	if (phone_display_string) {
-		sipe_buddy_update_property(sipe_private, uri, phone_display_node, phone_display_string);
+		sipe_buddy_property_update_set(update, phone_display_node, phone_display_string);
 	}
 }
 
@@ -345,6 +346,7 @@ static void process_incoming_notify_msrtc(struct sipe_core_private *sipe_private
 	const sipe_xml *xn_oof;
 	const sipe_xml *xn_state;
 	const sipe_xml *xn_contact;
+	struct sipe_buddy_property_update update;
 	char *note;
 	int user_avail;
 	const char *user_avail_nil;
@@ -396,6 +398,8 @@ static void process_incoming_notify_msrtc(struct sipe_core_private *sipe_private
 		status_id = sipe_ocs2007_status_from_legacy_availability(user_avail, NULL);
 	}
 
+	sipe_buddy_property_update_init(&update, uri);
+
 	if (xn_display_name) {
 		char *display_name = g_strdup(sipe_xml_attribute(xn_display_name, "displayName"));
 		char *email        = xn_email ? g_strdup(sipe_xml_attribute(xn_email, "email")) : NULL;
@@ -403,10 +407,10 @@ static void process_incoming_notify_msrtc(struct sipe_core_private *sipe_private
 		char *phone_number = xn_phone_number ? g_strdup(sipe_xml_attribute(xn_phone_number, "number")) : NULL;
 		char *tel_uri      = sip_to_tel_uri(phone_number);
 
-		sipe_buddy_update_property(sipe_private, uri, SIPE_BUDDY_INFO_DISPLAY_NAME, display_name);
-		sipe_buddy_update_property(sipe_private, uri, SIPE_BUDDY_INFO_EMAIL, email);
-		sipe_buddy_update_property(sipe_private, uri, SIPE_BUDDY_INFO_WORK_PHONE, tel_uri);
-		sipe_buddy_update_property(sipe_private, uri, SIPE_BUDDY_INFO_WORK_PHONE_DISPLAY, !is_empty(phone_label) ? phone_label : phone_number);
+		sipe_buddy_property_update_set(&update, SIPE_BUDDY_INFO_DISPLAY_NAME, display_name);
+		sipe_buddy_property_update_set(&update, SIPE_BUDDY_INFO_EMAIL, email);
+		sipe_buddy_property_update_set(&update, SIPE_BUDDY_INFO_WORK_PHONE, tel_uri);
+		sipe_buddy_property_update_set(&update, SIPE_BUDDY_INFO_WORK_PHONE_DISPLAY, !is_empty(phone_label) ? phone_label : phone_number);
 
 		g_free(tel_uri);
 		g_free(phone_label);
@@ -423,13 +427,13 @@ static void process_incoming_notify_msrtc(struct sipe_core_private *sipe_private
 			const char *phone_type = sipe_xml_attribute(node, "type");
 			char* phone = sipe_xml_data(node);
 
-			sipe_update_user_phone(sipe_private, uri, phone_type, phone, NULL);
+			sipe_update_user_phone(&update, phone_type, phone, NULL);
 
 			g_free(phone);
 		}
 	}
 
-	if (xn_display_name || xn_contact)
+	if (sipe_buddy_property_update_commit(sipe_private, &update))
 		sipe_backend_buddy_refresh_properties(SIPE_CORE_PUBLIC, uri);
 
 	/* devicePresence */
@@ -547,7 +551,7 @@ static void process_incoming_notify_msrtc(struct sipe_core_private *sipe_private
 			sbuddy->cal_free_busy_base64 = cal_free_busy_base64;
 			cal_free_busy_base64 = NULL;
 
-			g_free(sbuddy->cal_free_busy);
+			sipe_freebusy_free(sbuddy->cal_free_busy);
 			sbuddy->cal_free_busy = NULL;
 		}
 
@@ -594,8 +598,14 @@ static void process_incoming_notify_rlmi(struct sipe_core_private *sipe_private,
 					 const gchar *data,
 					 unsigned len)
 {
+	/* evaluated for every category of every buddy */
+	static sipe_xml_selector select_display_name  = SIPE_XML_SELECTOR("name/displayName");
+	static sipe_xml_selector select_note_body     = SIPE_XML_SELECTOR("note/body");
+	static sipe_xml_selector select_free_busy     = SIPE_XML_SELECTOR("calendarData/freeBusy");
+	static sipe_xml_selector select_working_hours = SIPE_XML_SELECTOR("calendarData/WorkingHours");
 	const char *uri;
 	struct sipe_buddy *sbuddy = NULL;
+	struct sipe_buddy_property_update update;
 	sipe_xml *xn_categories;
 	const sipe_xml *xn_category;
 	const char *status = NULL;
@@ -615,6 +625,9 @@ static void process_incoming_notify_rlmi(struct sipe_core_private *sipe_private,
 		return;
 	}
 
+	/* collect properties from all categories, push them once at the end */
+	sipe_buddy_property_update_init(&update, uri);
+
 	for (xn_category = sipe_xml_child(xn_categories, "category");
 		 xn_category ;
 		 xn_category = sipe_xml_twin(xn_category) )
@@ -636,12 +649,12 @@ static void process_incoming_notify_rlmi(struct sipe_core_private *sipe_private,
 				node = sipe_xml_child(card, "identity");
 				if (node) {
 					char* display_name = sipe_xml_data(
-						sipe_xml_child(node, "name/displayName"));
+						sipe_xml_select(node, &select_display_name));
 					char* email = sipe_xml_data(
 						sipe_xml_child(node, "email"));
 
-					sipe_buddy_update_property(sipe_private, uri, SIPE_BUDDY_INFO_DISPLAY_NAME, display_name);
-					sipe_buddy_update_property(sipe_private, uri, SIPE_BUDDY_INFO_EMAIL, email);
+					sipe_buddy_property_update_set(&update, SIPE_BUDDY_INFO_DISPLAY_NAME, display_name);
+					sipe_buddy_property_update_set(&update, SIPE_BUDDY_INFO_EMAIL, email);
 
 					g_free(display_name);
 					g_free(email);
@@ -650,35 +663,35 @@ static void process_incoming_notify_rlmi(struct sipe_core_private *sipe_private,
 				node = sipe_xml_child(card, "company");
 				if (node) {
 					char* company = sipe_xml_data(node);
-					sipe_buddy_update_property(sipe_private, uri, SIPE_BUDDY_INFO_COMPANY, company);
+					sipe_buddy_property_update_set(&update, SIPE_BUDDY_INFO_COMPANY, company);
 					g_free(company);
 				}
 				/* department */
 				node = sipe_xml_child(card, "department");
 				if (node) {
 					char* department = sipe_xml_data(node);
-					sipe_buddy_update_property(sipe_private, uri, SIPE_BUDDY_INFO_DEPARTMENT, department);
+					sipe_buddy_property_update_set(&update, SIPE_BUDDY_INFO_DEPARTMENT, department);
 					g_free(department);
 				}
 				/* title */
 				node = sipe_xml_child(card, "title");
 				if (node) {
 					char* title = sipe_xml_data(node);
-					sipe_buddy_update_property(sipe_private, uri, SIPE_BUDDY_INFO_JOB_TITLE, title);
+					sipe_buddy_property_update_set(&update, SIPE_BUDDY_INFO_JOB_TITLE, title);
 					g_free(title);
 				}
 				/* office */
 				node = sipe_xml_child(card, "office");
 				if (node) {
 					char* office = sipe_xml_data(node);
-					sipe_buddy_update_property(sipe_private, uri, SIPE_BUDDY_INFO_OFFICE, office);
+					sipe_buddy_property_update_set(&update, SIPE_BUDDY_INFO_OFFICE, office);
 					g_free(office);
 				}
 				/* site (url) */
 				node = sipe_xml_child(card, "url");
 				if (node) {
 					char* site = sipe_xml_data(node);
-					sipe_buddy_update_property(sipe_private, uri, SIPE_BUDDY_INFO_SITE, site);
+					sipe_buddy_property_update_set(&update, SIPE_BUDDY_INFO_SITE, site);
 					g_free(site);
 				}
 				/* phone */
@@ -690,7 +703,7 @@ static void process_incoming_notify_rlmi(struct sipe_core_private *sipe_private,
 					char* phone = sipe_xml_data(sipe_xml_child(node, "uri"));
 					char* phone_display_string = sipe_xml_data(sipe_xml_child(node, "displayString"));
 
-					sipe_update_user_phone(sipe_private, uri, phone_type, phone, phone_display_string);
+					sipe_update_user_phone(&update, phone_type, phone, phone_display_string);
 
 					g_free(phone);
 					g_free(phone_display_string);
@@ -707,11 +720,11 @@ static void process_incoming_notify_rlmi(struct sipe_core_private *sipe_private,
 						char* zipcode = sipe_xml_data(sipe_xml_child(node, "zipcode"));
 						char* country_code = sipe_xml_data(sipe_xml_child(node, "countryCode"));
 
-						sipe_buddy_update_property(sipe_private, uri, SIPE_BUDDY_INFO_STREET, street);
-						sipe_buddy_update_property(sipe_private, uri, SIPE_BUDDY_INFO_CITY, city);
-						sipe_buddy_update_property(sipe_private, uri, SIPE_BUDDY_INFO_STATE, state);
-						sipe_buddy_update_property(sipe_private, uri, SIPE_BUDDY_INFO_ZIPCODE, zipcode);
-						sipe_buddy_update_property(sipe_private, uri, SIPE_BUDDY_INFO_COUNTRY, country_code);
+						sipe_buddy_property_update_set(&update, SIPE_BUDDY_INFO_STREET, street);
+						sipe_buddy_property_update_set(&update, SIPE_BUDDY_INFO_CITY, city);
+						sipe_buddy_property_update_set(&update, SIPE_BUDDY_INFO_STATE, state);
+						sipe_buddy_property_update_set(&update, SIPE_BUDDY_INFO_ZIPCODE, zipcode);
+						sipe_buddy_property_update_set(&update, SIPE_BUDDY_INFO_COUNTRY, country_code);
 
 						g_free(street);
 						g_free(city);
@@ -769,7 +782,7 @@ static void process_incoming_notify_rlmi(struct sipe_core_private *sipe_private,
 				sbuddy->is_oof_note = FALSE;
 				sbuddy->note_since = publish_time;
 
-				xn_node = sipe_xml_child(xn_category, "note/body");
+				xn_node = sipe_xml_select(xn_category, &select_note_body);
 				if (xn_node) {
 					char *tmp;
 					sbuddy->note = g_markup_escape_text((tmp = sipe_xml_data(xn_node)), -1);
@@ -880,8 +893,8 @@ static void process_incoming_notify_rlmi(struct sipe_core_private *sipe_private,
 		/* calendarData */
 		else if(sipe_strequal(attrVar, "calendarData"))
 		{
-			const sipe_xml *xn_free_busy = sipe_xml_child(xn_category, "calendarData/freeBusy");
-			const sipe_xml *xn_working_hours = sipe_xml_child(xn_category, "calendarData/WorkingHours");
+			const sipe_xml *xn_free_busy = sipe_xml_select(xn_category, &select_free_busy);
+			const sipe_xml *xn_working_hours = sipe_xml_select(xn_category, &select_working_hours);
 
 			if (xn_free_busy) {
 				if (!has_free_busy_cleaned) {
@@ -893,7 +906,7 @@ static void process_incoming_notify_rlmi(struct sipe_core_private *sipe_private,
 					g_free(sbuddy->cal_free_busy_base64);
 					sbuddy->cal_free_busy_base64 = NULL;
 
-					g_free(sbuddy->cal_free_busy);
+					sipe_freebusy_free(sbuddy->cal_free_busy);
 					sbuddy->cal_free_busy = NULL;
 
 					sbuddy->cal_free_busy_published = publish_time;
@@ -909,7 +922,7 @@ static void process_incoming_notify_rlmi(struct sipe_core_private *sipe_private,
 					g_free(sbuddy->cal_free_busy_base64);
 					sbuddy->cal_free_busy_base64 = sipe_xml_data(xn_free_busy);
 
-					g_free(sbuddy->cal_free_busy);
+					sipe_freebusy_free(sbuddy->cal_free_busy);
 					sbuddy->cal_free_busy = NULL;
 
 					sbuddy->cal_free_busy_published = publish_time;
@@ -940,7 +953,8 @@ static void process_incoming_notify_rlmi(struct sipe_core_private *sipe_private,
 		sipe_core_buddy_got_status(SIPE_CORE_PUBLIC, uri, activity);
 	}
 
-	sipe_backend_buddy_refresh_properties(SIPE_CORE_PUBLIC, uri);
+	if (sipe_buddy_property_update_commit(sipe_private, &update))
+		sipe_backend_buddy_refresh_properties(SIPE_CORE_PUBLIC, uri);
 
 	sipe_xml_free(xn_categories);
 }
@@ -1024,11 +1038,14 @@ static void process_incoming_notify_pidf(struct sipe_core_private *sipe_private,
 	display_name_node = sipe_xml_child(pidf, "display-name");
 	if (display_name_node) {
 		char * display_name = sipe_xml_data(display_name_node);
+		struct sipe_buddy_property_update update;
 
-		sipe_buddy_update_property(sipe_private, uri, SIPE_BUDDY_INFO_DISPLAY_NAME, display_name);
+		sipe_buddy_property_update_init(&update, uri);
+		sipe_buddy_property_update_set(&update, SIPE_BUDDY_INFO_DISPLAY_NAME, display_name);
 		g_free(display_name);
 
-		sipe_backend_buddy_refresh_properties(SIPE_CORE_PUBLIC, uri);
+		if (sipe_buddy_property_update_commit(sipe_private, &update))
+			sipe_backend_buddy_refresh_properties(SIPE_CORE_PUBLIC, uri);
 	}
 
 	if ((tuple = sipe_xml_child(pidf, "tuple"))) {
@@ -1226,235 +1243,304 @@ static void add_new_buddy(struct sipe_core_private *sipe_private,
 	g_strfreev(item_groups);
 }
 
-static gboolean sipe_process_roaming_contacts(struct sipe_core_private *sipe_private,
-					      struct sipmsg *msg)
+/* [MS-SIP]: deltaNum MUST be non-zero */
+static void roaming_contacts_delta_num(struct sipe_core_private *sipe_private,
+				       const sipe_xml *node)
 {
-	int len = msg->bodylen;
+	guint delta = sipe_xml_int_attribute(node, "deltaNum", 0);
+	if (delta) {
+		sipe_private->deltanum_contacts = delta;
+	}
+}
 
-	const gchar *tmp = sipmsg_find_header(msg, "Event");
-	const sipe_xml *item;
-	sipe_xml *isc;
-	guint delta;
-	const sipe_xml *group_node;
+struct roaming_contacts {
+	struct sipe_core_private *sipe_private;
+	gboolean processing;     /* processing whole buddy list */
+	gboolean groups_checked; /* made sure there is at least one group */
+};
 
-	if (!g_str_has_prefix(tmp, "vnd-microsoft-roaming-contacts")) {
-		return FALSE;
+/*
+ * Process whole buddy list
+ *
+ *  - Only sent once
+ *    * up to Lync 2010
+ *    * Lync 2013 (and later) with buddy list not migrated
+ *
+ *  - Lync 2013 with buddy list migrated to Unified Contact Store (UCS)
+ *    * Notify piggy-backed on SUBSCRIBE response with empty list
+ *    * NOTIFY send by server with standard list (ignored by us)
+ *
+ * Called at the start tag, i.e. before any group or contact.
+ */
+static void roaming_contacts_list(gpointer user_data,
+				  const sipe_xml *node)
+{
+	struct roaming_contacts *context = user_data;
+	struct sipe_core_private *sipe_private = context->sipe_private;
+	const gchar *ucsmode = sipe_xml_attribute(node, "ucsmode");
+
+	roaming_contacts_delta_num(sipe_private, node);
+
+	SIPE_CORE_PRIVATE_FLAG_UNSET(LYNC2013);
+	if (ucsmode) {
+		gboolean migrated = sipe_strcase_equal(ucsmode,
+						       "migrated");
+		SIPE_CORE_PRIVATE_FLAG_SET(LYNC2013);
+		SIPE_DEBUG_INFO_NOFORMAT("contact list contains 'ucsmode' attribute (indicates Lync 2013+)");
+
+		if (migrated)
+			SIPE_DEBUG_INFO_NOFORMAT("contact list has been migrated to Unified Contact Store (UCS)");
+		sipe_ucs_init(sipe_private, migrated);
 	}
 
-	/* Convert the contact from XML to backend Buddies */
-	isc = sipe_xml_parse(msg->body, len);
-	if (!isc) {
-		return FALSE;
+	if (!sipe_ucs_is_migrated(sipe_private)) {
+		/* Start processing contact list */
+		sipe_backend_buddy_list_processing_start(SIPE_CORE_PUBLIC);
+		context->processing = TRUE;
 	}
+}
 
-	/* [MS-SIP]: deltaNum MUST be non-zero */
-	delta = sipe_xml_int_attribute(isc, "deltaNum", 0);
-	if (delta) {
-		sipe_private->deltanum_contacts = delta;
-	}
+static void roaming_contacts_list_group(gpointer user_data,
+					const sipe_xml *node)
+{
+	struct roaming_contacts *context = user_data;
 
-	/*
-	 * Process whole buddy list
-	 *
-	 *  - Only sent once
-	 *    * up to Lync 2010
-	 *    * Lync 2013 (and later) with buddy list not migrated
-	 *
-	 *  - Lync 2013 with buddy list migrated to Unified Contact Store (UCS)
-	 *    * Notify piggy-backed on SUBSCRIBE response with empty list
-	 *    * NOTIFY send by server with standard list (ignored by us)
-	 */
-	if (sipe_strequal(sipe_xml_name(isc), "contactList")) {
-		const gchar *ucsmode = sipe_xml_attribute(isc, "ucsmode");
-
-		SIPE_CORE_PRIVATE_FLAG_UNSET(LYNC2013);
-		if (ucsmode) {
-			gboolean migrated = sipe_strcase_equal(ucsmode,
-							       "migrated");
-			SIPE_CORE_PRIVATE_FLAG_SET(LYNC2013);
-			SIPE_DEBUG_INFO_NOFORMAT("contact list contains 'ucsmode' attribute (indicates Lync 2013+)");
-
-			if (migrated)
-				SIPE_DEBUG_INFO_NOFORMAT("contact list has been migrated to Unified Contact Store (UCS)");
-			sipe_ucs_init(sipe_private, migrated);
+	if (context->processing)
+		add_new_group(context->sipe_private, node);
+}
+
+/* Make sure we have at least one group */
+static void roaming_contacts_check_groups(struct roaming_contacts *context)
+{
+	struct sipe_core_private *sipe_private = context->sipe_private;
+
+	if (!context->groups_checked) {
+		if (sipe_group_count(sipe_private) == 0) {
+			sipe_group_create(sipe_private,
+					  NULL,
+					  _("Other Contacts"),
+					  NULL);
 		}
+		context->groups_checked = TRUE;
+	}
+}
 
-		if (!sipe_ucs_is_migrated(sipe_private)) {
-			/* Start processing contact list */
-			sipe_backend_buddy_list_processing_start(SIPE_CORE_PUBLIC);
+static void roaming_contacts_list_contact(gpointer user_data,
+					  const sipe_xml *node)
+{
+	struct roaming_contacts *context = user_data;
 
-			/* Parse groups */
-			for (group_node = sipe_xml_child(isc, "group"); group_node; group_node = sipe_xml_twin(group_node))
-				add_new_group(sipe_private, group_node);
+	if (context->processing) {
+		const gchar *name = sipe_xml_attribute(node, "uri");
+		gchar *uri        = sip_uri_from_name(name);
 
-			/* Make sure we have at least one group */
-			if (sipe_group_count(sipe_private) == 0) {
-				sipe_group_create(sipe_private,
-						  NULL,
-						  _("Other Contacts"),
-						  NULL);
-			}
+		/* groups precede the contacts */
+		roaming_contacts_check_groups(context);
 
-			/* Parse contacts */
-			for (item = sipe_xml_child(isc, "contact"); item; item = sipe_xml_twin(item)) {
-				const gchar *name = sipe_xml_attribute(item, "uri");
-				gchar *uri        = sip_uri_from_name(name);
-				add_new_buddy(sipe_private, item, uri);
-				g_free(uri);
-			}
+		add_new_buddy(context->sipe_private, node, uri);
+		g_free(uri);
+	}
+}
 
-			sipe_buddy_cleanup_local_list(sipe_private);
+/* Process buddy list updates */
+static void roaming_contacts_delta(gpointer user_data,
+				   const sipe_xml *node)
+{
+	struct roaming_contacts *context = user_data;
+	struct sipe_core_private *sipe_private = context->sipe_private;
+	const sipe_xml *group_node;
+	const sipe_xml *item;
 
-			/* Add self-contact if not there yet. 2005 systems. */
-			/* This will resemble subscription to roaming_self in 2007 systems */
-			if (!SIPE_CORE_PRIVATE_FLAG_IS(OCS2007)) {
-				gchar *self_uri = sip_uri_self(sipe_private);
-				sipe_buddy_add(sipe_private,
-					       self_uri,
-					       NULL,
-					       NULL);
-				g_free(self_uri);
-			}
+	roaming_contacts_delta_num(sipe_private, node);
 
-			/* Finished processing contact list */
-			sipe_backend_buddy_list_processing_finish(SIPE_CORE_PUBLIC);
-		}
+	/* Process new groups */
+	for (group_node = sipe_xml_child(node, "addedGroup"); group_node; group_node = sipe_xml_twin(group_node))
+		add_new_group(sipe_private, group_node);
 
-	/* Process buddy list updates */
-	} else if (sipe_strequal(sipe_xml_name(isc), "contactDelta")) {
-
-		/* Process new groups */
-		for (group_node = sipe_xml_child(isc, "addedGroup"); group_node; group_node = sipe_xml_twin(group_node))
-			add_new_group(sipe_private, group_node);
-
-		/* Process modified groups */
-		for (group_node = sipe_xml_child(isc, "modifiedGroup"); group_node; group_node = sipe_xml_twin(group_node)) {
-			struct sipe_group *group = sipe_group_find_by_id(sipe_private,
-									 (int)g_ascii_strtod(sipe_xml_attribute(group_node, "id"),
-											     NULL));
-			if (group) {
-				const gchar *name = get_group_name(group_node);
-
-				if (!(is_empty(name) ||
-				      sipe_strequal(group->name, name)) &&
-				    sipe_group_rename(sipe_private,
-						      group,
-						      name))
-					SIPE_DEBUG_INFO("Replaced group %d name with %s", group->id, name);
-			}
+	/* Process modified groups */
+	for (group_node = sipe_xml_child(node, "modifiedGroup"); group_node; group_node = sipe_xml_twin(group_node)) {
+		struct sipe_group *group = sipe_group_find_by_id(sipe_private,
+								 (int)g_ascii_strtod(sipe_xml_attribute(group_node, "id"),
+										     NULL));
+		if (group) {
+			const gchar *name = get_group_name(group_node);
+
+			if (!(is_empty(name) ||
+			      sipe_strequal(group->name, name)) &&
+			    sipe_group_rename(sipe_private,
+					      group,
+					      name))
+				SIPE_DEBUG_INFO("Replaced group %d name with %s", group->id, name);
 		}
+	}
 
-		/* Process new buddies */
-		for (item = sipe_xml_child(isc, "addedContact"); item; item = sipe_xml_twin(item)) {
-			add_new_buddy(sipe_private,
-				      item,
-				      sipe_xml_attribute(item, "uri"));
-		}
+	/* Process new buddies */
+	for (item = sipe_xml_child(node, "addedContact"); item; item = sipe_xml_twin(item)) {
+		add_new_buddy(sipe_private,
+			      item,
+			      sipe_xml_attribute(item, "uri"));
+	}
 
-		/* Process modified buddies */
-		for (item = sipe_xml_child(isc, "modifiedContact"); item; item = sipe_xml_twin(item)) {
-			const gchar *uri = sipe_xml_attribute(item, "uri");
-			struct sipe_buddy *buddy = sipe_buddy_find_by_uri(sipe_private,
-									  uri);
-
-			if (buddy) {
-				gchar **item_groups = g_strsplit(sipe_xml_attribute(item,
-										    "groups"),
-								 " ", 0);
-
-				/* this should be defined. Otherwise we would get "deletedContact" */
-				if (item_groups) {
-					const gchar *name = sipe_xml_attribute(item, "name");
-					gboolean empty_name = is_empty(name);
-					GSList *found = NULL;
-					int i = 0;
-
-					while (item_groups[i]) {
-						struct sipe_group *group = sipe_group_find_by_id(sipe_private,
-												 g_ascii_strtod(item_groups[i],
-														NULL));
-						/* ignore unkown groups */
-						if (group) {
-							sipe_backend_buddy b = sipe_backend_buddy_find(SIPE_CORE_PUBLIC,
-												       uri,
-												       group->name);
-
-							/* add group to found list */
-							found = g_slist_prepend(found, group);
-
-							if (b) {
-								/* new alias? */
-								gchar *b_alias = sipe_backend_buddy_get_alias(SIPE_CORE_PUBLIC,
-													      b);
-
-								if (!(empty_name ||
-								      sipe_strequal(b_alias, name))) {
-									sipe_backend_buddy_set_alias(SIPE_CORE_PUBLIC,
-												     b,
-												     name);
-									SIPE_DEBUG_INFO("Replaced for buddy %s in group '%s' old alias '%s' with '%s'",
-											uri, group->name, b_alias, name);
-								}
-								g_free(b_alias);
-
-							} else {
-								const gchar *alias = empty_name ? uri : name;
-								/* buddy was not in this group */
-								sipe_backend_buddy_add(SIPE_CORE_PUBLIC,
-										       uri,
-										       alias,
-										       group->name);
-								sipe_buddy_insert_group(buddy, group);
-								SIPE_DEBUG_INFO("Added buddy %s (alias '%s' to group '%s'",
-										uri, alias, group->name);
+	/* Process modified buddies */
+	for (item = sipe_xml_child(node, "modifiedContact"); item; item = sipe_xml_twin(item)) {
+		const gchar *uri = sipe_xml_attribute(item, "uri");
+		struct sipe_buddy *buddy = sipe_buddy_find_by_uri(sipe_private,
+								  uri);
+
+		if (buddy) {
+			gchar **item_groups = g_strsplit(sipe_xml_attribute(item,
+									    "groups"),
+							 " ", 0);
+
+			/* this should be defined. Otherwise we would get "deletedContact" */
+			if (item_groups) {
+				const gchar *name = sipe_xml_attribute(item, "name");
+				gboolean empty_name = is_empty(name);
+				GSList *found = NULL;
+				int i = 0;
+
+				while (item_groups[i]) {
+					struct sipe_group *group = sipe_group_find_by_id(sipe_private,
+											 g_ascii_strtod(item_groups[i],
+													NULL));
+					/* ignore unkown groups */
+					if (group) {
+						sipe_backend_buddy b = sipe_backend_buddy_find(SIPE_CORE_PUBLIC,
+											       uri,
+											       group->name);
+
+						/* add group to found list */
+						found = g_slist_prepend(found, group);
+
+						if (b) {
+							/* new alias? */
+							gchar *b_alias = sipe_backend_buddy_get_alias(SIPE_CORE_PUBLIC,
+												      b);
+
+							if (!(empty_name ||
+							      sipe_strequal(b_alias, name))) {
+								sipe_backend_buddy_set_alias(SIPE_CORE_PUBLIC,
+											     b,
+											     name);
+								SIPE_DEBUG_INFO("Replaced for buddy %s in group '%s' old alias '%s' with '%s'",
+										uri, group->name, b_alias, name);
 							}
+							g_free(b_alias);
+
+						} else {
+							const gchar *alias = empty_name ? uri : name;
+							/* buddy was not in this group */
+							sipe_backend_buddy_add(SIPE_CORE_PUBLIC,
+									       uri,
+									       alias,
+									       group->name);
+							sipe_buddy_insert_group(buddy, group);
+							SIPE_DEBUG_INFO("Added buddy %s (alias '%s' to group '%s'",
+									uri, alias, group->name);
 						}
-
-						/* next group */
-						i++;
 					}
-					g_strfreev(item_groups);
 
- 					/* removed from groups? */
-					sipe_buddy_update_groups(sipe_private,
-								 buddy,
-								 found);
-					g_slist_free(found);
+					/* next group */
+					i++;
 				}
+				g_strfreev(item_groups);
+
+				/* removed from groups? */
+				sipe_buddy_update_groups(sipe_private,
+							 buddy,
+							 found);
+				g_slist_free(found);
 			}
 		}
+	}
 
-		/* Process deleted buddies */
-		for (item = sipe_xml_child(isc, "deletedContact"); item; item = sipe_xml_twin(item)) {
-			const gchar *uri = sipe_xml_attribute(item, "uri");
-			struct sipe_buddy *buddy = sipe_buddy_find_by_uri(sipe_private,
-									  uri);
+	/* Process deleted buddies */
+	for (item = sipe_xml_child(node, "deletedContact"); item; item = sipe_xml_twin(item)) {
+		const gchar *uri = sipe_xml_attribute(item, "uri");
+		struct sipe_buddy *buddy = sipe_buddy_find_by_uri(sipe_private,
+								  uri);
 
-			if (buddy) {
-				SIPE_DEBUG_INFO("Removing buddy %s", uri);
-				sipe_buddy_remove(sipe_private, buddy);
-			}
+		if (buddy) {
+			SIPE_DEBUG_INFO("Removing buddy %s", uri);
+			sipe_buddy_remove(sipe_private, buddy);
+		}
+	}
+
+	/* Process deleted groups
+	 *
+	 * NOTE: all buddies will already have been removed from the
+	 *       group prior to this. The log shows that OCS actually
+	 *       sends two separate updates when you delete a group:
+	 *
+	 *         - first one with "modifiedContact" removing buddies
+	 *           from the group, leaving it empty, and
+	 *
+	 *         - then one with "deletedGroup" removing the group
+	 */
+	for (group_node = sipe_xml_child(node, "deletedGroup"); group_node; group_node = sipe_xml_twin(group_node))
+		sipe_group_remove(sipe_private,
+				  sipe_group_find_by_id(sipe_private,
+							(int)g_ascii_strtod(sipe_xml_attribute(group_node, "id"),
+									    NULL)));
+}
+
+static const struct sipe_xml_stream_handler roaming_contacts_handlers[] = {
+	{ "contactList",         roaming_contacts_list },
+	{ "contactList/group",   roaming_contacts_list_group },
+	{ "contactList/contact", roaming_contacts_list_contact },
+	{ "contactDelta",        roaming_contacts_delta },
+	{ NULL,                  NULL }
+};
+
+static gboolean sipe_process_roaming_contacts(struct sipe_core_private *sipe_private,
+					      struct sipmsg *msg)
+{
+	const gchar *tmp = sipmsg_find_header(msg, "Event");
+	struct roaming_contacts context;
+	gboolean ok;
+
+	if (!g_str_has_prefix(tmp, "vnd-microsoft-roaming-contacts")) {
+		return FALSE;
+	}
+
+	/*
+	 * Convert the contact from XML to backend Buddies
+	 *
+	 * The list can contain thousands of contacts: process each of them
+	 * as soon as it has been parsed instead of building the whole tree.
+	 */
+	memset(&context, 0, sizeof(context));
+	context.sipe_private = sipe_private;
+	ok = sipe_xml_parse_stream(msg->body,
+				   msg->bodylen,
+				   roaming_contacts_handlers,
+				   &context);
+
+	if (context.processing) {
+		roaming_contacts_check_groups(&context);
+
+		/* don't drop buddies missing from a truncated list */
+		if (ok)
+			sipe_buddy_cleanup_local_list(sipe_private);
+
+		/* Add self-contact if not there yet. 2005 systems. */
+		/* This will resemble subscription to roaming_self in 2007 systems */
+		if (!SIPE_CORE_PRIVATE_FLAG_IS(OCS2007)) {
+			gchar *self_uri = sip_uri_self(sipe_private);
+			sipe_buddy_add(sipe_private,
+				       self_uri,
+				       NULL,
+				       NULL);
+			g_free(self_uri);
 		}
 
-		/* Process deleted groups
-		 *
-		 * NOTE: all buddies will already have been removed from the
-		 *       group prior to this. The log shows that OCS actually
-		 *       sends two separate updates when you delete a group:
-		 *
-		 *         - first one with "modifiedContact" removing buddies
-		 *           from the group, leaving it empty, and
-		 *
-		 *         - then one with "deletedGroup" removing the group
-		 */
-		for (group_node = sipe_xml_child(isc, "deletedGroup"); group_node; group_node = sipe_xml_twin(group_node))
-			sipe_group_remove(sipe_private,
-					  sipe_group_find_by_id(sipe_private,
-								(int)g_ascii_strtod(sipe_xml_attribute(group_node, "id"),
-										    NULL)));
+		/* Finished processing contact list */
+		sipe_backend_buddy_list_processing_finish(SIPE_CORE_PUBLIC);
+	}
 
+	if (!ok) {
+		return FALSE;
 	}
-	sipe_xml_free(isc);
 
 	/* Subscribe to buddies, if contact list not migrated to UCS */
 	if (!sipe_ucs_is_migrated(sipe_private))
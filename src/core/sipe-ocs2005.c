@@ -31,6 +31,7 @@
 
 #include "sipe-common.h"
 #include "sip-soap.h"
+#define SIPE_DEBUG_CATEGORY SIPE_DEBUG_CATEGORY_PRESENCE
 #include "sipe-backend.h"
 #include "sipe-buddy.h"
 #include "sipe-cal.h"
@@ -39,6 +39,7 @@
 #include "sipmsg.h"
 #include "sip-csta.h"
 #include "sip-transport.h"
+#define SIPE_DEBUG_CATEGORY SIPE_DEBUG_CATEGORY_PRESENCE
 #include "sipe-backend.h"
 #include "sipe-buddy.h"
 #include "sipe-cal.h"
@@ -2413,6 +2414,7 @@ void sipe_ocs2007_process_roaming_self(struct sipe_core_private *sipe_private,
 		const char *acknowledged;
 		gchar *hdr;
 		gchar *body;
+		struct sipe_buddy_property_update update;
 
 		user = sipe_xml_attribute(node, "user"); /* without 'sip:' prefix */
 		if (!user) continue;
@@ -2420,8 +2422,10 @@ void sipe_ocs2007_process_roaming_self(struct sipe_core_private *sipe_private,
 		display_name = g_strdup(sipe_xml_attribute(node, "displayName"));
 		uri = sip_uri_from_name(user);
 
-		sipe_buddy_update_property(sipe_private, uri, SIPE_BUDDY_INFO_DISPLAY_NAME, display_name);
-		sipe_backend_buddy_refresh_properties(SIPE_CORE_PUBLIC, uri);
+		sipe_buddy_property_update_init(&update, uri);
+		sipe_buddy_property_update_set(&update, SIPE_BUDDY_INFO_DISPLAY_NAME, display_name);
+		if (sipe_buddy_property_update_commit(sipe_private, &update))
+			sipe_backend_buddy_refresh_properties(SIPE_CORE_PUBLIC, uri);
 
 	        acknowledged= sipe_xml_attribute(node, "acknowledged");
 		if(sipe_strcase_equal(acknowledged,"false")){
@@ -3,7 +3,7 @@
  *
  * pidgin-sipe
  *
- * Copyright (C) 2010 SIPE Project <http://sipe.sourceforge.net/>
+ * Copyright (C) 2010-2015 SIPE Project <http://sipe.sourceforge.net/>
  *
  * This program is free software; you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published by
@@ -34,13 +34,120 @@ struct sipe_schedule {
 	 * Example:  <presence><sip:user@domain.com> or <registration>
 	 */
 	gchar *name;
-	struct sipe_core_private *sipe_private;
-	gpointer backend_private;
 	gpointer payload;
 	sipe_schedule_action action;
 	GDestroyNotify destroy;
+	guint64 deadline;   /* [ms] */
+	guint64 sequence;   /* keeps order for identical deadlines */
+	guint index;        /* position in heap */
+	gboolean seconds;   /* scheduled with seconds resolution */
 };
 
+/*
+ * All pending actions are kept in a binary min-heap ordered by deadline.
+ * Only the action at the head of the heap has a backend timer, i.e. all
+ * actions that expire at the same time are executed from one callback.
+ */
+struct sipe_schedule_queue {
+	GHashTable *names;          /* name -> struct sipe_schedule */
+	struct sipe_schedule **heap;
+	guint count;
+	guint size;
+	guint64 sequence;
+	gpointer backend_private;   /* backend timer for head of heap */
+	guint64 backend_deadline;
+	gboolean executing;         /* inside sipe_core_schedule_execute() */
+	gboolean cancelled;         /* cancel_all() called while executing */
+};
+
+#define SIPE_SCHEDULE_HEAP_INITIAL_SIZE 64
+
+/* [ms], monotonic: deadlines must not jump with the wall clock */
+static guint64 sipe_schedule_now(void)
+{
+#if GLIB_CHECK_VERSION(2,28,0)
+	return(g_get_monotonic_time() / 1000);
+#else
+	GTimeVal now;
+	g_get_current_time(&now);
+	return(((guint64) now.tv_sec) * 1000 + now.tv_usec / 1000);
+#endif
+}
+
+static gboolean sipe_schedule_before(const struct sipe_schedule *a,
+				     const struct sipe_schedule *b)
+{
+	return((a->deadline <  b->deadline) ||
+	       ((a->deadline == b->deadline) && (a->sequence < b->sequence)));
+}
+
+static void sipe_schedule_heap_set(struct sipe_schedule_queue *queue,
+				   guint index,
+				   struct sipe_schedule *schedule)
+{
+	queue->heap[index] = schedule;
+	schedule->index    = index;
+}
+
+static void sipe_schedule_heap_up(struct sipe_schedule_queue *queue,
+				  guint index)
+{
+	struct sipe_schedule *schedule = queue->heap[index];
+
+	while (index > 0) {
+		guint parent = (index - 1) / 2;
+		if (!sipe_schedule_before(schedule, queue->heap[parent]))
+			break;
+		sipe_schedule_heap_set(queue, index, queue->heap[parent]);
+		index = parent;
+	}
+	sipe_schedule_heap_set(queue, index, schedule);
+}
+
+static void sipe_schedule_heap_down(struct sipe_schedule_queue *queue,
+				    guint index)
+{
+	struct sipe_schedule *schedule = queue->heap[index];
+
+	while (TRUE) {
+		guint child = 2 * index + 1;
+		if (child >= queue->count)
+			break;
+		if ((child + 1 < queue->count) &&
+		    sipe_schedule_before(queue->heap[child + 1], queue->heap[child]))
+			child++;
+		if (!sipe_schedule_before(queue->heap[child], schedule))
+			break;
+		sipe_schedule_heap_set(queue, index, queue->heap[child]);
+		index = child;
+	}
+	sipe_schedule_heap_set(queue, index, schedule);
+}
+
+static void sipe_schedule_heap_insert(struct sipe_schedule_queue *queue,
+				      struct sipe_schedule *schedule)
+{
+	if (queue->count == queue->size) {
+		queue->size = queue->size ? 2 * queue->size : SIPE_SCHEDULE_HEAP_INITIAL_SIZE;
+		queue->heap = g_renew(struct sipe_schedule *, queue->heap, queue->size);
+	}
+	sipe_schedule_heap_set(queue, queue->count++, schedule);
+	sipe_schedule_heap_up(queue, schedule->index);
+}
+
+static void sipe_schedule_heap_remove(struct sipe_schedule_queue *queue,
+				      struct sipe_schedule *schedule)
+{
+	guint index = schedule->index;
+
+	if (index != --queue->count) {
+		struct sipe_schedule *last = queue->heap[queue->count];
+		sipe_schedule_heap_set(queue, index, last);
+		sipe_schedule_heap_up(queue, index);
+		sipe_schedule_heap_down(queue, last->index);
+	}
+}
+
 static void sipe_schedule_deallocate(struct sipe_schedule *schedule)
 {
 	if (schedule->destroy) (*schedule->destroy)(schedule->payload);
@@ -48,41 +155,126 @@ static void sipe_schedule_deallocate(struct sipe_schedule *schedule)
 	g_free(schedule);
 }
 
+static void sipe_schedule_backend_cancel(struct sipe_core_private *sipe_private,
+					 struct sipe_schedule_queue *queue)
+{
+	if (queue->backend_private) {
+		sipe_backend_schedule_cancel(SIPE_CORE_PUBLIC,
+					     queue->backend_private);
+		queue->backend_private = NULL;
+	}
+}
+
+/* make sure the backend timer matches the head of the heap */
+static void sipe_schedule_backend_update(struct sipe_core_private *sipe_private,
+					 struct sipe_schedule_queue *queue)
+{
+	struct sipe_schedule *head;
+	guint64 now;
+	guint64 remaining;
+
+	/* will be updated after all expired actions have been executed */
+	if (queue->executing)
+		return;
+
+	if (queue->count == 0) {
+		sipe_schedule_backend_cancel(sipe_private, queue);
+		return;
+	}
+
+	head = queue->heap[0];
+	if (queue->backend_private &&
+	    (queue->backend_deadline == head->deadline))
+		return;
+
+	sipe_schedule_backend_cancel(sipe_private, queue);
+
+	now       = sipe_schedule_now();
+	remaining = head->deadline > now ? head->deadline - now : 0;
+	queue->backend_deadline = head->deadline;
+	if (head->seconds && (remaining >= 1000))
+		queue->backend_private = sipe_backend_schedule_seconds(SIPE_CORE_PUBLIC,
+								       (remaining + 999) / 1000,
+								       sipe_private);
+	else
+		queue->backend_private = sipe_backend_schedule_mseconds(SIPE_CORE_PUBLIC,
+									remaining,
+									sipe_private);
+}
+
+static void sipe_schedule_queue_free(struct sipe_core_private *sipe_private)
+{
+	struct sipe_schedule_queue *queue = sipe_private->timeouts;
+	g_hash_table_destroy(queue->names);
+	g_free(queue->heap);
+	g_free(queue);
+	sipe_private->timeouts = NULL;
+}
+
 void sipe_core_schedule_execute(gpointer data)
 {
-	struct sipe_schedule *expired = data;
-	struct sipe_core_private *sipe_private = expired->sipe_private;
+	struct sipe_core_private *sipe_private = data;
+	struct sipe_schedule_queue *queue = sipe_private->timeouts;
+	guint64 now = sipe_schedule_now();
+
+	/* backend has already released its timer data */
+	queue->backend_private = NULL;
+	queue->executing       = TRUE;
+
+	while (queue->count && (queue->heap[0]->deadline <= now)) {
+		struct sipe_schedule *expired = queue->heap[0];
 
-	SIPE_DEBUG_INFO("sipe_core_schedule_execute: executing %s", expired->name);
-	sipe_private->timeouts = g_slist_remove(sipe_private->timeouts, expired);
-	SIPE_DEBUG_INFO("sipe_core_schedule_execute timeouts count %d after removal",
-			g_slist_length(sipe_private->timeouts));
+		SIPE_DEBUG_INFO("sipe_core_schedule_execute: executing %s", expired->name);
+		sipe_schedule_heap_remove(queue, expired);
+		g_hash_table_remove(queue->names, expired->name);
+		SIPE_DEBUG_INFO("sipe_core_schedule_execute timeouts count %d after removal",
+				queue->count);
 
-	(*expired->action)(sipe_private, expired->payload);
-	sipe_schedule_deallocate(expired);
+		(*expired->action)(sipe_private, expired->payload);
+		sipe_schedule_deallocate(expired);
+	}
+
+	queue->executing = FALSE;
+	if (queue->cancelled)
+		sipe_schedule_queue_free(sipe_private);
+	else
+		sipe_schedule_backend_update(sipe_private, queue);
 }
 
-static struct sipe_schedule *sipe_schedule_allocate(struct sipe_core_private *sipe_private,
-						    const gchar *name,
-						    gpointer payload,
-						    sipe_schedule_action action,
-						    GDestroyNotify destroy)
+static void sipe_schedule_allocate(struct sipe_core_private *sipe_private,
+				   const gchar *name,
+				   gpointer payload,
+				   guint64 timeout,
+				   gboolean seconds,
+				   sipe_schedule_action action,
+				   GDestroyNotify destroy)
 {
+	struct sipe_schedule_queue *queue;
 	struct sipe_schedule *new;
 
 	/* Make sure each action only exists once */
 	sipe_schedule_cancel(sipe_private, name);
 
+	queue = sipe_private->timeouts;
+	if (!queue) {
+		sipe_private->timeouts = queue = g_new0(struct sipe_schedule_queue, 1);
+		queue->names = g_hash_table_new(g_str_hash, g_str_equal);
+	}
+
 	new = g_new0(struct sipe_schedule, 1);
 	new->name = g_strdup(name);
-	new->sipe_private = sipe_private;
 	new->payload = payload;
 	new->action = action;
 	new->destroy = destroy;
-	sipe_private->timeouts = g_slist_append(sipe_private->timeouts, new);
+	new->deadline = sipe_schedule_now() + timeout;
+	new->sequence = queue->sequence++;
+	new->seconds = seconds;
+	g_hash_table_insert(queue->names, new->name, new);
+	sipe_schedule_heap_insert(queue, new);
 	SIPE_DEBUG_INFO("sipe_schedule_allocate timeouts count %d after addition",
-			g_slist_length(sipe_private->timeouts));
-	return(new);
+			queue->count);
+
+	sipe_schedule_backend_update(sipe_private, queue);
 }
 
 void sipe_schedule_seconds(struct sipe_core_private *sipe_private,
@@ -92,16 +284,15 @@ void sipe_schedule_seconds(struct sipe_core_private *sipe_private,
 			   sipe_schedule_action action,
 			   GDestroyNotify destroy)
 {
-	struct sipe_schedule *new = sipe_schedule_allocate(sipe_private,
-							   name,
-							   payload,
-							   action,
-							   destroy);
 	SIPE_DEBUG_INFO("scheduling action %s timeout %d seconds",
 			name, seconds);
-	new->backend_private = sipe_backend_schedule_seconds(SIPE_CORE_PUBLIC,
-							     seconds,
-							     new);
+	sipe_schedule_allocate(sipe_private,
+			       name,
+			       payload,
+			       ((guint64) seconds) * 1000,
+			       TRUE,
+			       action,
+			       destroy);
 }
 
 void sipe_schedule_mseconds(struct sipe_core_private *sipe_private,
@@ -111,61 +302,57 @@ void sipe_schedule_mseconds(struct sipe_core_private *sipe_private,
 			    sipe_schedule_action action,
 			    GDestroyNotify destroy)
 {
-	struct sipe_schedule *new = sipe_schedule_allocate(sipe_private,
-							   name,
-							   payload,
-							   action,
-							   destroy);
 	SIPE_DEBUG_INFO("scheduling action %s timeout %d milliseconds",
 			name, milliseconds);
-	new->backend_private = sipe_backend_schedule_mseconds(SIPE_CORE_PUBLIC,
-							      milliseconds,
-							      new);
-}
-
-static void sipe_schedule_remove(struct sipe_core_private *sipe_private,
-				 struct sipe_schedule *schedule)
-{
-	SIPE_DEBUG_INFO("sipe_schedule_remove: action name=%s",
-			schedule->name);
-	sipe_backend_schedule_cancel(SIPE_CORE_PUBLIC,
-				     schedule->backend_private);
-	sipe_schedule_deallocate(schedule);
+	sipe_schedule_allocate(sipe_private,
+			       name,
+			       payload,
+			       milliseconds,
+			       FALSE,
+			       action,
+			       destroy);
 }
 
 void sipe_schedule_cancel(struct sipe_core_private *sipe_private,
 			  const gchar *name)
 {
-	GSList *entry;
-
-	if (!sipe_private->timeouts || !name) return;
-
-	entry = sipe_private->timeouts;
-	while (entry) {
-		struct sipe_schedule *schedule = entry->data;
-		if (sipe_strequal(schedule->name, name)) {
-			GSList *to_delete = entry;
-			entry = entry->next;
-			sipe_private->timeouts = g_slist_delete_link(sipe_private->timeouts,
-								     to_delete);
-			sipe_schedule_remove(sipe_private, schedule);
-		} else {
-			entry = entry->next;
-		}
+	struct sipe_schedule_queue *queue = sipe_private->timeouts;
+	struct sipe_schedule *schedule;
+
+	if (!queue || !name) return;
+
+	schedule = g_hash_table_lookup(queue->names, name);
+	if (schedule) {
+		SIPE_DEBUG_INFO("sipe_schedule_remove: action name=%s",
+				schedule->name);
+		sipe_schedule_heap_remove(queue, schedule);
+		g_hash_table_remove(queue->names, schedule->name);
+		sipe_schedule_deallocate(schedule);
+		sipe_schedule_backend_update(sipe_private, queue);
 	}
 }
 
 void sipe_schedule_cancel_all(struct sipe_core_private *sipe_private)
 {
-	GSList *entry = sipe_private->timeouts;
+	struct sipe_schedule_queue *queue = sipe_private->timeouts;
+	guint index;
 
-	while (entry) {
-		sipe_schedule_remove(sipe_private, entry->data);
-		entry = entry->next;
+	if (!queue) return;
+
+	sipe_schedule_backend_cancel(sipe_private, queue);
+	g_hash_table_remove_all(queue->names);
+	for (index = 0; index < queue->count; index++) {
+		SIPE_DEBUG_INFO("sipe_schedule_remove: action name=%s",
+				queue->heap[index]->name);
+		sipe_schedule_deallocate(queue->heap[index]);
 	}
+	queue->count = 0;
 
-	g_slist_free(sipe_private->timeouts);
-	sipe_private->timeouts = NULL;
+	/* sipe_core_schedule_execute() will free the queue */
+	if (queue->executing)
+		queue->cancelled = TRUE;
+	else
+		sipe_schedule_queue_free(sipe_private);
 }
 
 /*
@@ -29,146 +29,206 @@
 #include "sipe-backend.h"
 #include "sipe-sign.h"
 
-static gchar * const empty_string = "";
+/*
+ * Same semantics as sipmsg_find_part_of_header(), but limited to
+ * [start, end) and without copying the result.
+ */
+static gboolean sipmsg_breakdown_find(const gchar *start,
+				      const gchar *end,
+				      const gchar *before,
+				      const gchar *after,
+				      struct sipmsg_breakdown_part *part)
+{
+	const gchar *value = start;
+	const gchar *tmp   = NULL;
+
+	if (before) {
+		value = g_strstr_len(start, end - start, before);
+		if (!value)
+			return(FALSE);
+		value += strlen(before);
+	}
+
+	if (after)
+		tmp = g_strstr_len(value, end - value, after);
+
+	part->value  = value;
+	part->length = (tmp ? tmp : end) - value;
+	return(TRUE);
+}
+
+static void sipmsg_breakdown_find_in_header(const gchar *hdr,
+					    const gchar *before,
+					    const gchar *after,
+					    struct sipmsg_breakdown_part *part)
+{
+	if (hdr)
+		sipmsg_breakdown_find(hdr, hdr + strlen(hdr),
+				      before, after,
+				      part);
+}
+
+/* Same semantics as sipmsg_parse_p_asserted_identity() */
+static void sipmsg_breakdown_identity(struct sipmsg_breakdown *msg,
+				      const gchar *hdr)
+{
+	const gchar *end = hdr + strlen(hdr);
+
+	if (g_ascii_strncasecmp(hdr, "tel:", 4) == 0) {
+		sipmsg_breakdown_set(&msg->p_assertet_identity_tel_uri, hdr);
+		return;
+	}
+
+	while (hdr <= end) {
+		const gchar *comma    = memchr(hdr, ',', end - hdr);
+		const gchar *part_end = comma ? comma : end;
+		struct sipmsg_breakdown_part uri;
+
+		if (sipmsg_breakdown_find(hdr, part_end, "<", ">", &uri) &&
+		    (uri.length >= 4)) {
+			if (g_ascii_strncasecmp(uri.value, "sip:", 4) == 0) {
+				if (msg->p_assertet_identity_sip_uri.value) {
+					SIPE_DEBUG_WARNING_NOFORMAT("More than one "
+						"sip: URI found in P-Asserted-Identity!");
+				} else {
+					msg->p_assertet_identity_sip_uri = uri;
+				}
+			} else if (g_ascii_strncasecmp(uri.value, "tel:", 4) == 0) {
+				if (msg->p_assertet_identity_tel_uri.value) {
+					SIPE_DEBUG_WARNING_NOFORMAT("More than one "
+						"tel: URI found in P-Asserted-Identity!");
+				} else {
+					msg->p_assertet_identity_tel_uri = uri;
+				}
+			}
+		}
+
+		hdr = part_end + 1;
+	}
+}
+
+void sipmsg_breakdown_set(struct sipmsg_breakdown_part *part,
+			  const gchar *value)
+{
+	part->value  = value;
+	part->length = value ? strlen(value) : 0;
+}
 
-void sipmsg_breakdown_parse(struct sipmsg_breakdown * msg, gchar * realm, gchar * target,
+void sipmsg_breakdown_parse(struct sipmsg_breakdown * msg, const gchar * realm, const gchar * target,
 			    const gchar *protocol)
 {
 	const gchar * hdr;
+	struct sipmsg *sipmsg;
+
 	if (msg == NULL || msg->msg == NULL) {
 		SIPE_DEBUG_INFO_NOFORMAT("sipmsg_breakdown_parse msg or msg->msg is NULL");
 		return;
 	}
 
-	msg->rand = msg->num = msg->realm = msg->target_name =
-		msg->cseq = msg->from_url = msg->from_tag = msg->to_url = msg->to_tag =
-		msg->p_assertet_identity_sip_uri = msg->p_assertet_identity_tel_uri = empty_string;
-	msg->call_id = msg->expires = empty_string;
+	/* all parts empty */
+	sipmsg = msg->msg;
+	memset(msg, 0, sizeof(struct sipmsg_breakdown));
+	msg->msg = sipmsg;
 
 	if ((hdr = sipmsg_find_header(msg->msg, "Proxy-Authorization")) ||
 	    (hdr = sipmsg_find_header(msg->msg, "Proxy-Authentication-Info")) ||
 	    (hdr = sipmsg_find_header(msg->msg, "Authentication-Info")) ) {
-		msg->protocol = sipmsg_find_part_of_header(hdr, NULL, " ", empty_string);
-		msg->rand   = sipmsg_find_part_of_header(hdr, "rand=\"", "\"", empty_string);
-		msg->num    = sipmsg_find_part_of_header(hdr, "num=\"", "\"", empty_string);
-		msg->realm  = sipmsg_find_part_of_header(hdr, "realm=\"", "\"", empty_string);
-		msg->target_name = sipmsg_find_part_of_header(hdr, "targetname=\"", "\"", empty_string);
+		sipmsg_breakdown_find_in_header(hdr, NULL, " ", &msg->protocol);
+		sipmsg_breakdown_find_in_header(hdr, "rand=\"", "\"", &msg->rand);
+		sipmsg_breakdown_find_in_header(hdr, "num=\"", "\"", &msg->num);
+		sipmsg_breakdown_find_in_header(hdr, "realm=\"", "\"", &msg->realm);
+		sipmsg_breakdown_find_in_header(hdr, "targetname=\"", "\"", &msg->target_name);
 	} else {
-		msg->protocol = g_strdup(protocol);
-		msg->realm = g_strdup(realm);
-		msg->target_name = g_strdup(target);
+		sipmsg_breakdown_set(&msg->protocol, protocol);
+		sipmsg_breakdown_set(&msg->realm, realm);
+		sipmsg_breakdown_set(&msg->target_name, target);
 	}
 
-	msg->call_id = sipmsg_find_header(msg->msg, "Call-ID");
+	sipmsg_breakdown_set(&msg->call_id, sipmsg_find_header(msg->msg, "Call-ID"));
 
 	hdr = sipmsg_find_header(msg->msg, "CSeq");
-	if (NULL != hdr) {
-		msg->cseq = sipmsg_find_part_of_header(hdr, NULL, " ", empty_string);
-	}
+	sipmsg_breakdown_find_in_header(hdr, NULL, " ", &msg->cseq);
 
 	hdr = sipmsg_find_header(msg->msg, "From");
-	if (NULL != hdr) {
-		msg->from_url = sipmsg_find_part_of_header(hdr, "<", ">", empty_string);
-		msg->from_tag = sipmsg_find_part_of_header(hdr, ";tag=", ";", empty_string);
-	}
+	sipmsg_breakdown_find_in_header(hdr, "<", ">", &msg->from_url);
+	sipmsg_breakdown_find_in_header(hdr, ";tag=", ";", &msg->from_tag);
 
 	hdr = sipmsg_find_header(msg->msg, "To");
-	if (NULL != hdr) {
-		msg->to_url = sipmsg_find_part_of_header(hdr, "<", ">", empty_string);
-		msg->to_tag = sipmsg_find_part_of_header(hdr, ";tag=", ";", empty_string);
-	}
+	sipmsg_breakdown_find_in_header(hdr, "<", ">", &msg->to_url);
+	sipmsg_breakdown_find_in_header(hdr, ";tag=", ";", &msg->to_tag);
 
 	hdr = sipmsg_find_header(msg->msg, "P-Asserted-Identity");
 	if (NULL == hdr) {
 		hdr = sipmsg_find_header(msg->msg, "P-Preferred-Identity");
 	}
 	if (NULL != hdr) {
-		gchar *sip_uri = NULL;
-		gchar *tel_uri = NULL;
-
-		sipmsg_parse_p_asserted_identity(hdr, &sip_uri, &tel_uri);
-		if (sip_uri)
-			msg->p_assertet_identity_sip_uri = sip_uri;
-		if (tel_uri)
-			msg->p_assertet_identity_tel_uri = tel_uri;
+		sipmsg_breakdown_identity(msg, hdr);
 	}
 
-	msg->expires = sipmsg_find_header(msg->msg, "Expires");
+	sipmsg_breakdown_set(&msg->expires, sipmsg_find_header(msg->msg, "Expires"));
 }
 
-void
-sipmsg_breakdown_free(struct sipmsg_breakdown * msg)
+static void sipmsg_breakdown_append(GString *buffer,
+				    const gchar *value,
+				    gsize length)
 {
-	if (msg->protocol != empty_string)
-		g_free(msg->protocol);
-	if (msg->rand != empty_string)
-		g_free(msg->rand);
-	if (msg->num != empty_string)
-		g_free(msg->num);
-	if (msg->realm != empty_string)
-		g_free(msg->realm);
-	if (msg->target_name != empty_string)
-		g_free(msg->target_name);
-
-	// straight from header
-	//g_free(msg->call_id);
-
-	if (msg->cseq != empty_string)
-		g_free(msg->cseq);
-	if (msg->from_url != empty_string)
-		g_free(msg->from_url);
-	if (msg->from_tag != empty_string)
-		g_free(msg->from_tag);
-	if (msg->to_url != empty_string)
-		g_free(msg->to_url);
-	if (msg->to_tag != empty_string)
-		g_free(msg->to_tag);
-
-	if (msg->p_assertet_identity_sip_uri != empty_string)
-		g_free(msg->p_assertet_identity_sip_uri);
-	if (msg->p_assertet_identity_tel_uri != empty_string)
-		g_free(msg->p_assertet_identity_tel_uri);
-
-	// straight from header
-	//g_free (msg->expires);
+	g_string_append_c(buffer, '<');
+	if (value)
+		g_string_append_len(buffer, value, length);
+	g_string_append_c(buffer, '>');
 }
 
-gchar *
-sipmsg_breakdown_get_string(int version,
-			    struct sipmsg_breakdown * msgbd)
+#define APPEND_PART(part) \
+	sipmsg_breakdown_append(buffer, msgbd->part.value, msgbd->part.length)
+
+gboolean
+sipmsg_breakdown_append_string(int version,
+			       const struct sipmsg_breakdown * msgbd,
+			       GString *buffer)
 {
-	gchar *response_str;
-	gchar *msg;
-	if (msgbd->realm == empty_string || msgbd->realm == NULL) {
+	const gchar *method = msgbd->msg->method;
+
+	if (msgbd->realm.value == NULL) {
 		SIPE_DEBUG_INFO_NOFORMAT("realm NULL, so returning NULL signature string");
-		return NULL;
+		return FALSE;
 	}
 
-	response_str = msgbd->msg->response != 0 ? g_strdup_printf("<%d>", msgbd->msg->response) : empty_string;
-	if (version < 3) {
-		msg = g_strdup_printf(
-			"<%s><%s><%s><%s><%s><%s><%s><%s><%s><%s><%s>" // 1 - 11
-			"<%s>%s", // 12 - 13
-			msgbd->protocol, msgbd->rand, msgbd->num, msgbd->realm, msgbd->target_name, msgbd->call_id, msgbd->cseq,
-			msgbd->msg->method, msgbd->from_url, msgbd->from_tag, msgbd->to_tag,
-			msgbd->expires ? msgbd->expires : empty_string, response_str
-		);
-	} else {
-		msg = g_strdup_printf(
-			"<%s><%s><%s><%s><%s><%s><%s><%s><%s><%s><%s><%s><%s><%s>" // 1 - 14
-			"<%s>%s", // 15 - 16
-			msgbd->protocol, msgbd->rand, msgbd->num, msgbd->realm, msgbd->target_name, msgbd->call_id, msgbd->cseq,
-			msgbd->msg->method, msgbd->from_url, msgbd->from_tag, msgbd->to_url, msgbd->to_tag,
-			msgbd->p_assertet_identity_sip_uri, msgbd->p_assertet_identity_tel_uri,
-			msgbd->expires ? msgbd->expires : empty_string, response_str
-		);
+	APPEND_PART(protocol);    /* 1 */
+	APPEND_PART(rand);
+	APPEND_PART(num);
+	APPEND_PART(realm);
+	APPEND_PART(target_name); /* 5 */
+	APPEND_PART(call_id);
+	APPEND_PART(cseq);
+	sipmsg_breakdown_append(buffer, method, method ? strlen(method) : 0);
+	APPEND_PART(from_url);
+	APPEND_PART(from_tag);    /* 10 */
+	if (version >= 3)
+		APPEND_PART(to_url);
+	APPEND_PART(to_tag);
+	if (version >= 3) {
+		APPEND_PART(p_assertet_identity_sip_uri);
+		APPEND_PART(p_assertet_identity_tel_uri);
 	}
+	APPEND_PART(expires);
+	if (msgbd->msg->response != 0)
+		g_string_append_printf(buffer, "<%d>", msgbd->msg->response);
+
+	return TRUE;
+}
 
-	if (response_str != empty_string) {
-		g_free(response_str);
+gchar *
+sipmsg_breakdown_get_string(int version,
+			    const struct sipmsg_breakdown * msgbd)
+{
+	GString *buffer = g_string_new(NULL);
+
+	if (!sipmsg_breakdown_append_string(version, msgbd, buffer)) {
+		g_string_free(buffer, TRUE);
+		return NULL;
 	}
 
-	return msg;
+	return g_string_free(buffer, FALSE);
 }
 
 /*
@@ -20,32 +20,47 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111-1301  USA
  */
 
+/* points into the message headers, i.e. not NUL terminated */
+struct sipmsg_breakdown_part {
+	const gchar *value; /* NULL if not found */
+	gsize length;
+};
+
 struct sipmsg_breakdown {
 	struct sipmsg * msg;
-	gchar * protocol;
-	gchar * rand;
-	gchar * num;
-	gchar * realm;
-	gchar * target_name;
-	const gchar * call_id;
-	gchar * cseq;
+	struct sipmsg_breakdown_part protocol;
+	struct sipmsg_breakdown_part rand;
+	struct sipmsg_breakdown_part num;
+	struct sipmsg_breakdown_part realm;
+	struct sipmsg_breakdown_part target_name;
+	struct sipmsg_breakdown_part call_id;
+	struct sipmsg_breakdown_part cseq;
 	//method
-	gchar * from_url;
-	gchar * from_tag;
+	struct sipmsg_breakdown_part from_url;
+	struct sipmsg_breakdown_part from_tag;
 	/** @since 3 */
-	gchar * to_url;
-	gchar * to_tag;
+	struct sipmsg_breakdown_part to_url;
+	struct sipmsg_breakdown_part to_tag;
 	/** @since 3 */
-	gchar * p_assertet_identity_sip_uri;
+	struct sipmsg_breakdown_part p_assertet_identity_sip_uri;
 	/** @since 3 */
-	gchar * p_assertet_identity_tel_uri;
-	const gchar * expires;
+	struct sipmsg_breakdown_part p_assertet_identity_tel_uri;
+	struct sipmsg_breakdown_part expires;
 	//response code
 };
 
-void sipmsg_breakdown_parse(struct sipmsg_breakdown * msg, gchar * realm, gchar * target,
+/* doesn't allocate memory, msg, realm, target & protocol must stay valid */
+void sipmsg_breakdown_parse(struct sipmsg_breakdown * msg, const gchar * realm, const gchar * target,
 			    const gchar *protocol);
+/* set part to a NUL terminated string */
+void sipmsg_breakdown_set(struct sipmsg_breakdown_part *part,
+			  const gchar *value);
+/* signature input string, appended to buffer. FALSE if realm is missing */
+gboolean
+sipmsg_breakdown_append_string(int version,
+			       const struct sipmsg_breakdown * msgbd,
+			       GString *buffer);
+/* signature input string, must be g_free()'d */
 gchar*
 sipmsg_breakdown_get_string(int version,
-			    struct sipmsg_breakdown * msgbd);
-void sipmsg_breakdown_free(struct sipmsg_breakdown * msg);
+			    const struct sipmsg_breakdown * msgbd);
@@ -30,6 +30,7 @@
 #include <glib.h>
 
 #include "sipe-common.h"
+#define SIPE_DEBUG_CATEGORY SIPE_DEBUG_CATEGORY_PRESENCE
 #include "sipe-backend.h"
 #include "sipe-cal.h"
 #include "sipe-core.h"
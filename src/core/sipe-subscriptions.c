@@ -28,6 +28,7 @@
 #include "sipe-common.h"
 #include "sipmsg.h"
 #include "sip-transport.h"
+#define SIPE_DEBUG_CATEGORY SIPE_DEBUG_CATEGORY_PRESENCE
 #include "sipe-backend.h"
 #include "sipe-buddy.h"
 #include "sipe-core.h"
@@ -572,6 +573,46 @@ void sipe_subscribe_presence_single_cb(struct sipe_core_private *sipe_private,
 }
 
 
+/* estimated size of one <resource/> element, to presize the body buffer */
+#define PRESENCE_BATCH_RESOURCE_SIZE 64
+
+/**
+ * Start a batched SUBSCRIBE body. Add the resources with
+ * sipe_subscribe_presence_batch_add() and send the request with
+ * sipe_subscribe_presence_batched_to().
+ *
+ * @param count expected number of resources
+ */
+static GString *sipe_subscribe_presence_batch_start(struct sipe_core_private *sipe_private,
+						    guint count)
+{
+	GString *body = g_string_sized_new(count * PRESENCE_BATCH_RESOURCE_SIZE + 1024);
+
+	if (SIPE_CORE_PRIVATE_FLAG_IS(OCS2007))
+		g_string_append_printf(body,
+				       "<batchSub xmlns=\"http://schemas.microsoft.com/2006/01/sip/batch-subscribe\" uri=\"sip:%s\" name=\"\">\n"
+				       "<action name=\"subscribe\" id=\"63792024\">\n"
+				       "<adhocList>\n",
+				       sipe_private->username);
+	else
+		g_string_append_printf(body,
+				       "<adhoclist xmlns=\"urn:ietf:params:xml:ns:adrl\" uri=\"sip:%s\" name=\"sip:%s\">\n"
+				       "<create xmlns=\"\">\n",
+				       sipe_private->username,
+				       sipe_private->username);
+
+	return(body);
+}
+
+static void sipe_subscribe_presence_batch_add(GString *body,
+					      const gchar *uri,
+					      gboolean context)
+{
+	g_string_append(body, "<resource uri=\"");
+	g_string_append(body, uri);
+	g_string_append(body, context ? "\"><context/></resource>\n" : "\"/>\n");
+}
+
 /**
  *   Support for Batch Category SUBSCRIBE [MS-PRES] - msrtc-event-categories+xml  OCS 2007
  *   Support for Batch Category SUBSCRIBE [MS-SIP] - adrl+xml LCS 2005
@@ -580,12 +621,11 @@ void sipe_subscribe_presence_single_cb(struct sipe_core_private *sipe_private,
  *   This header will be send only if adhoclist there is a "Supported: adhoclist" in REGISTER answer else will be send a Single Category SUBSCRIBE
  */
 static void sipe_subscribe_presence_batched_to(struct sipe_core_private *sipe_private,
-					       gchar *resources_uri,
+					       GString *body,
 					       const gchar *to)
 {
 	gchar *contact = get_contact(sipe_private);
 	gchar *request;
-	gchar *content;
 	const gchar *require = "";
 	const gchar *accept = "";
 	const gchar *autoextend = "";
@@ -594,31 +634,24 @@ static void sipe_subscribe_presence_batched_to(struct sipe_core_private *sipe_pr
 	if (SIPE_CORE_PRIVATE_FLAG_IS(OCS2007)) {
 		require = ", categoryList";
 		accept = ", application/msrtc-event-categories+xml, application/xpidf+xml, application/pidf+xml";
-                content_type = "application/msrtc-adrl-categorylist+xml";
-                content = g_strdup_printf("<batchSub xmlns=\"http://schemas.microsoft.com/2006/01/sip/batch-subscribe\" uri=\"sip:%s\" name=\"\">\n"
-					  "<action name=\"subscribe\" id=\"63792024\">\n"
-					  "<adhocList>\n%s</adhocList>\n"
-					  "<categoryList xmlns=\"http://schemas.microsoft.com/2006/09/sip/categorylist\">\n"
-					  "<category name=\"calendarData\"/>\n"
-					  "<category name=\"contactCard\"/>\n"
-					  "<category name=\"note\"/>\n"
-					  "<category name=\"state\"/>\n"
-					  "</categoryList>\n"
-					  "</action>\n"
-					  "</batchSub>",
-					  sipe_private->username,
-					  resources_uri);
+		content_type = "application/msrtc-adrl-categorylist+xml";
+		g_string_append(body,
+				"</adhocList>\n"
+				"<categoryList xmlns=\"http://schemas.microsoft.com/2006/09/sip/categorylist\">\n"
+				"<category name=\"calendarData\"/>\n"
+				"<category name=\"contactCard\"/>\n"
+				"<category name=\"note\"/>\n"
+				"<category name=\"state\"/>\n"
+				"</categoryList>\n"
+				"</action>\n"
+				"</batchSub>");
 	} else {
-                autoextend =  "Supported: com.microsoft.autoextend\r\n";
+		autoextend =  "Supported: com.microsoft.autoextend\r\n";
 		content_type = "application/adrl+xml";
-        	content = g_strdup_printf("<adhoclist xmlns=\"urn:ietf:params:xml:ns:adrl\" uri=\"sip:%s\" name=\"sip:%s\">\n"
-					  "<create xmlns=\"\">\n%s</create>\n"
-					  "</adhoclist>\n",
-					  sipe_private->username,
-					  sipe_private->username,
-					  resources_uri);
+		g_string_append(body,
+				"</create>\n"
+				"</adhoclist>\n");
 	}
-	g_free(resources_uri);
 
 	request = g_strdup_printf("Require: adhoclist%s\r\n"
 				  "Supported: eventlist\r\n"
@@ -636,9 +669,9 @@ static void sipe_subscribe_presence_batched_to(struct sipe_core_private *sipe_pr
 				  contact);
 	g_free(contact);
 
-	sipe_subscribe_presence_buddy(sipe_private, to, request, content);
+	sipe_subscribe_presence_buddy(sipe_private, to, request, body->str);
 
-	g_free(content);
+	g_string_free(body, TRUE);
 	g_free(request);
 }
 
@@ -659,18 +692,22 @@ static void sipe_subscribe_presence_batched_routed(struct sipe_core_private *sip
 {
 	struct presence_batched_routed *data = payload;
 	const GSList *buddies = data->buddies;
-	gchar *resources_uri = g_strdup("");
+	GString *body = sipe_subscribe_presence_batch_start(sipe_private,
+							    g_slist_length((GSList *) buddies));
 	while (buddies) {
-		gchar *tmp = resources_uri;
-		resources_uri = g_strdup_printf("%s<resource uri=\"%s\"/>\n", tmp, (char *) buddies->data);
-		g_free(tmp);
+		sipe_subscribe_presence_batch_add(body, buddies->data, FALSE);
 		buddies = buddies->next;
 	}
 	sipe_subscribe_presence_batched_to(sipe_private,
-					   resources_uri,
+					   body,
 					   data->host);
 }
 
+static gboolean presence_uri_equal(gconstpointer a, gconstpointer b)
+{
+	return(g_ascii_strcasecmp(a, b) == 0);
+}
+
 static void sipe_subscribe_presence_batched_schedule(struct sipe_core_private *sipe_private,
 						     const gchar *action_name,
 						     const gchar *who,
@@ -682,16 +719,31 @@ static void sipe_subscribe_presence_batched_schedule(struct sipe_core_private *s
 	struct presence_batched_routed *payload = g_malloc(sizeof(struct presence_batched_routed));
 
 	if (subscription->buddies) {
-		/* merge old and new list */
-		GSList *entry = buddies;
-		while (entry) {
-			subscription->buddies = sipe_utils_slist_insert_unique_sorted(subscription->buddies,
-										      g_strdup(entry->data),
-										      (GCompareFunc) g_ascii_strcasecmp,
-										      g_free);
-			entry = entry->next;
+		/* merge old and new list, URIs are compared case-insensitive */
+		GHashTable *known = g_hash_table_new(sipe_utils_ascii_strcase_hash,
+						     presence_uri_equal);
+		GSList *added = NULL;
+		GSList *entry;
+
+		for (entry = subscription->buddies; entry; entry = entry->next)
+			g_hash_table_insert(known, entry->data, entry->data);
+
+		while (buddies) {
+			entry   = buddies;
+			buddies = g_slist_remove_link(buddies, entry);
+
+			if (g_hash_table_lookup(known, entry->data)) {
+				g_free(entry->data);
+				g_slist_free_1(entry);
+			} else {
+				g_hash_table_insert(known, entry->data, entry->data);
+				added = g_slist_concat(entry, added);
+			}
 		}
-		sipe_utils_slist_free_full(buddies, g_free);
+		g_hash_table_destroy(known);
+
+		subscription->buddies = g_slist_concat(subscription->buddies,
+						       g_slist_reverse(added));
 	} else {
 		/* no list yet, simply take ownership of whole list */
 		subscription->buddies = buddies;
@@ -710,27 +762,24 @@ static void sipe_subscribe_presence_batched_schedule(struct sipe_core_private *s
 
 static void sipe_subscribe_resource_uri_with_context(const gchar *name,
 						     gpointer value,
-						     gchar **resources_uri)
+						     GString *body)
 {
 	struct sipe_buddy *sbuddy = (struct sipe_buddy *)value;
-	gchar *context = sbuddy && sbuddy->just_added ? "><context/></resource>" : "/>";
-	gchar *tmp = *resources_uri;
+
+	sipe_subscribe_presence_batch_add(body,
+					  name,
+					  sbuddy && sbuddy->just_added);
 
 	/* should be enough to include context one time */
 	if (sbuddy)
 		sbuddy->just_added = FALSE;
-
-	*resources_uri = g_strdup_printf("%s<resource uri=\"%s\"%s\n", tmp, name, context);
-	g_free(tmp);
 }
 
 static void sipe_subscribe_resource_uri(const char *name,
 					SIPE_UNUSED_PARAMETER gpointer value,
-					gchar **resources_uri)
+					GString *body)
 {
-	gchar *tmp = *resources_uri;
-        *resources_uri = g_strdup_printf("%s<resource uri=\"%s\"/>\n", tmp, name);
-	g_free(tmp);
+	sipe_subscribe_presence_batch_add(body, name, FALSE);
 }
 
 /**
@@ -770,17 +819,18 @@ void sipe_subscribe_presence_initial(struct sipe_core_private *sipe_private)
 
 		if (SIPE_CORE_PRIVATE_FLAG_IS(BATCHED_SUPPORT)) {
 			gchar *to = sip_uri_self(sipe_private);
-			gchar *resources_uri = g_strdup("");
+			GString *body = sipe_subscribe_presence_batch_start(sipe_private,
+									    sipe_buddy_count(sipe_private));
 			if (SIPE_CORE_PRIVATE_FLAG_IS(OCS2007)) {
 				sipe_buddy_foreach(sipe_private,
 						   (GHFunc) sipe_subscribe_resource_uri_with_context,
-						   &resources_uri);
+						   body);
 			} else {
 				sipe_buddy_foreach(sipe_private,
 						   (GHFunc) sipe_subscribe_resource_uri,
-						   &resources_uri);
+						   body);
 			}
-			sipe_subscribe_presence_batched_to(sipe_private, resources_uri, to);
+			sipe_subscribe_presence_batched_to(sipe_private, body, to);
 			g_free(to);
 
 		} else {
@@ -35,6 +35,7 @@
 #include <glib.h>
 
 #include "sipe-common.h"
+#define SIPE_DEBUG_CATEGORY SIPE_DEBUG_CATEGORY_HTTP
 #include "sipe-backend.h"
 #include "sipe-core.h"
 #include "sipe-core-private.h"
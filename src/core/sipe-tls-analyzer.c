@@ -42,6 +42,8 @@
 #include "sipe-tls.c"
 
 /* stub functions */
+guint sipe_backend_debug_categories = SIPE_DEBUG_CATEGORY_ALL;
+
 void sipe_backend_debug_literal(SIPE_UNUSED_PARAMETER sipe_debug_level level,
 				const gchar *msg)
 {
@@ -43,6 +43,10 @@
  *    $ sipe_tls_tester
  *
  *   You can add <host>[:<port>] to connect to a server on another machine
+ *
+ * - Running the record protection benchmark (no server required):
+ *
+ *    $ sipe_tls_tester --benchmark
  */
 
 #include <stdlib.h>
@@ -63,11 +67,14 @@
 #include "sipe-backend.h"
 #include "sipe-cert-crypto.h"
 #include "sipe-crypt.h"
+#include "sipe-digest.h"
 #include "sipe-tls.h"
 
 /*
  * Stubs
  */
+guint sipe_backend_debug_categories = SIPE_DEBUG_CATEGORY_ALL;
+
 gboolean sipe_backend_debug_enabled(void)
 {
 	return(TRUE);
@@ -285,6 +292,211 @@ static int tls_connect(const gchar *param)
 	return(fd);
 }
 
+/*
+ * Record protection benchmark
+ */
+#define BENCHMARK_RECORD_TYPE 23 /* application_data */
+
+struct benchmark_suite {
+	const gchar *label;
+	enum sipe_tls_digest_algorithm algorithm;
+	gsize mac_length;
+	gsize key_length;
+	gboolean stream_cipher;
+};
+
+static const struct benchmark_suite benchmark_suites[] = {
+	{ "RC4-MD5",    SIPE_TLS_DIGEST_ALGORITHM_MD5,  16, 128 / 8, TRUE  },
+	{ "RC4-SHA",    SIPE_TLS_DIGEST_ALGORITHM_SHA1, 20, 128 / 8, TRUE  },
+	{ "AES128-SHA", SIPE_TLS_DIGEST_ALGORITHM_SHA1, 20, 128 / 8, FALSE },
+	{ "AES256-SHA", SIPE_TLS_DIGEST_ALGORITHM_SHA1, 20, 256 / 8, FALSE },
+	{ NULL,         SIPE_TLS_DIGEST_ALGORITHM_NONE,  0, 0,       FALSE }
+};
+
+/* previous implementation: one-shot HMAC & cipher, 4 buffers per record */
+static guchar *benchmark_legacy_record(const struct benchmark_suite *suite,
+				       const guchar *key_block,
+				       gpointer stream_context,
+				       guint64 sequence_number,
+				       const guchar *content,
+				       gsize length,
+				       gsize *record_length)
+{
+	const guchar *mac_secret = key_block;
+	const guchar *key        = key_block + suite->mac_length;
+	const guchar *iv         = key + suite->key_length;
+	gsize plaintext_length   = SIPE_TLS_RECORD_HEADER_LENGTH + length;
+	gsize message_length     = plaintext_length + suite->mac_length;
+	gsize padding_length     = 0;
+	gsize encrypted_length   = message_length;
+	guchar *plaintext, *mac, *message, *encrypted;
+	guint i;
+
+	if (!suite->stream_cipher) {
+		padding_length    = 16 - (message_length - SIPE_TLS_RECORD_HEADER_LENGTH + 1) % 16;
+		encrypted_length += padding_length + 1;
+	}
+
+	plaintext    = g_malloc(plaintext_length);
+	plaintext[0] = BENCHMARK_RECORD_TYPE;
+	plaintext[1] = 0x03;
+	plaintext[2] = 0x01;
+	plaintext[3] = (length >> 8) & 0xFF;
+	plaintext[4] =  length       & 0xFF;
+	memcpy(plaintext + SIPE_TLS_RECORD_HEADER_LENGTH, content, length);
+
+	message = g_malloc(message_length);
+	memcpy(message, plaintext, plaintext_length);
+	message[3] = ((encrypted_length - SIPE_TLS_RECORD_HEADER_LENGTH) >> 8) & 0xFF;
+	message[4] =  (encrypted_length - SIPE_TLS_RECORD_HEADER_LENGTH)       & 0xFF;
+
+	mac = g_malloc(sizeof(guint64) + plaintext_length);
+	for (i = 0; i < sizeof(guint64); i++)
+		mac[sizeof(guint64) - 1 - i] = (sequence_number >> (8 * i)) & 0xFF;
+	memcpy(mac + sizeof(guint64), plaintext, plaintext_length);
+	g_free(plaintext);
+	if (suite->algorithm == SIPE_TLS_DIGEST_ALGORITHM_MD5)
+		sipe_digest_hmac_md5(mac_secret, suite->mac_length,
+				     mac, sizeof(guint64) + plaintext_length,
+				     message + plaintext_length);
+	else
+		sipe_digest_hmac_sha1(mac_secret, suite->mac_length,
+				      mac, sizeof(guint64) + plaintext_length,
+				      message + plaintext_length);
+	g_free(mac);
+
+	encrypted = g_malloc(encrypted_length);
+	memcpy(encrypted, message, SIPE_TLS_RECORD_HEADER_LENGTH);
+	if (suite->stream_cipher) {
+		sipe_crypt_tls_stream(stream_context,
+				      message + SIPE_TLS_RECORD_HEADER_LENGTH,
+				      encrypted_length - SIPE_TLS_RECORD_HEADER_LENGTH,
+				      encrypted + SIPE_TLS_RECORD_HEADER_LENGTH);
+	} else {
+		memcpy(encrypted + SIPE_TLS_RECORD_HEADER_LENGTH,
+		       message + SIPE_TLS_RECORD_HEADER_LENGTH,
+		       message_length - SIPE_TLS_RECORD_HEADER_LENGTH);
+		memset(encrypted + message_length,
+		       padding_length,
+		       padding_length + 1);
+		sipe_crypt_tls_block(key, suite->key_length,
+				     iv, 16,
+				     encrypted + SIPE_TLS_RECORD_HEADER_LENGTH,
+				     encrypted_length - SIPE_TLS_RECORD_HEADER_LENGTH,
+				     encrypted + SIPE_TLS_RECORD_HEADER_LENGTH);
+	}
+	g_free(message);
+
+	*record_length = encrypted_length;
+	return(encrypted);
+}
+
+static guint benchmark_suite(const struct benchmark_suite *suite,
+			     gsize length,
+			     guint rounds)
+{
+	guchar key_block[20 + 32 + 16];
+	guchar *content = g_malloc(length);
+	const guchar *key = key_block + suite->mac_length;
+	struct sipe_tls_record_layer *layer;
+	gpointer stream_context = NULL;
+	GTimer *timer = g_timer_new();
+	gdouble elapsed_legacy, elapsed_layer;
+	gsize record_length;
+	guchar *record;
+	guint failed = 0;
+	guint i;
+
+	for (i = 0; i < sizeof(key_block); i++)
+		key_block[i] = i * 7 + 1;
+	for (i = 0; i < length; i++)
+		content[i] = rand() & 0xFF;
+
+	/* output must be identical (CBC: previous code only handled 1 record) */
+	if (suite->stream_cipher)
+		stream_context = sipe_crypt_tls_start(key, suite->key_length);
+	layer = sipe_tls_record_layer_new(suite->algorithm,
+					  key_block,
+					  key,
+					  suite->key_length,
+					  suite->stream_cipher ? NULL : key + suite->key_length);
+	record_length = sipe_tls_record_layer_size(layer, length);
+	record        = g_malloc(record_length);
+	for (i = 0; i < (suite->stream_cipher ? 3 : 1); i++) {
+		gsize legacy_length;
+		guchar *legacy = benchmark_legacy_record(suite, key_block,
+							 stream_context, i,
+							 content, length,
+							 &legacy_length);
+
+		memcpy(record + SIPE_TLS_RECORD_HEADER_LENGTH, content, length);
+		sipe_tls_record_layer_protect(layer, BENCHMARK_RECORD_TYPE,
+					      record, length);
+		if ((legacy_length != record_length) ||
+		    memcmp(legacy, record, record_length)) {
+			printf("FAILED %s record %u (%" G_GSIZE_FORMAT " bytes)\n",
+			       suite->label, i, length);
+			failed++;
+		}
+		g_free(legacy);
+	}
+
+	g_timer_start(timer);
+	for (i = 0; i < rounds; i++) {
+		gsize legacy_length;
+		g_free(benchmark_legacy_record(suite, key_block,
+					       stream_context, i,
+					       content, length,
+					       &legacy_length));
+	}
+	elapsed_legacy = g_timer_elapsed(timer, NULL);
+
+	g_timer_start(timer);
+	for (i = 0; i < rounds; i++) {
+		memcpy(record + SIPE_TLS_RECORD_HEADER_LENGTH, content, length);
+		sipe_tls_record_layer_protect(layer, BENCHMARK_RECORD_TYPE,
+					      record, length);
+	}
+	elapsed_layer = g_timer_elapsed(timer, NULL);
+
+	printf("%-10s %5" G_GSIZE_FORMAT " bytes %-12s %8.3f ms %10.1f MB/s\n",
+	       suite->label, length, "(one-shot)",
+	       elapsed_legacy * 1000,
+	       elapsed_legacy > 0 ? rounds * length / elapsed_legacy / 1e6 : 0);
+	printf("%-10s %5" G_GSIZE_FORMAT " bytes %-12s %8.3f ms %10.1f MB/s\n",
+	       suite->label, length, "(persistent)",
+	       elapsed_layer * 1000,
+	       elapsed_layer > 0 ? rounds * length / elapsed_layer / 1e6 : 0);
+
+	g_free(record);
+	sipe_tls_record_layer_free(layer);
+	if (stream_context)
+		sipe_crypt_tls_destroy(stream_context);
+	g_timer_destroy(timer);
+	g_free(content);
+
+	return(failed);
+}
+
+static void tls_benchmark(void)
+{
+	static const gsize lengths[] = { 64, 1024, 16384, 0 };
+	const struct benchmark_suite *suite;
+	guint failed = 0;
+
+	printf("TLS record protection benchmark...\n");
+
+	for (suite = benchmark_suites; suite->label; suite++) {
+		const gsize *length;
+		for (length = lengths; *length; length++)
+			failed += benchmark_suite(suite, *length,
+						  (16 * 1024 * 1024) / *length);
+	}
+
+	printf("TLS record protection benchmark %s.\n",
+	       failed ? "FAILED" : "SUCCESSFUL");
+}
+
 int main(int argc, char *argv[])
 {
 	struct sipe_cert_crypto *scc;
@@ -292,6 +504,12 @@ int main(int argc, char *argv[])
 	sipe_crypto_init(FALSE);
 	srand(time(NULL));
 
+	if ((argc > 1) && !strcmp(argv[1], "--benchmark")) {
+		tls_benchmark();
+		sipe_crypto_shutdown();
+		return(0);
+	}
+
 	scc = sipe_cert_crypto_init();
 	if (scc) {
 		gpointer certificate;
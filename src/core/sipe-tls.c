@@ -41,6 +41,7 @@
 #include <glib.h>
 
 #include "sipe-common.h"
+#define SIPE_DEBUG_CATEGORY SIPE_DEBUG_CATEGORY_TRANSPORT
 #include "sipe-backend.h"
 #include "sipe-cert-crypto.h"
 #include "sipe-crypt.h"
@@ -84,11 +85,7 @@ struct tls_internal_state {
 	const guchar *server_write_secret;
 	const guchar *client_write_iv;
 	const guchar *server_write_iv;
-	void (*mac_func)(const guchar *key, gsize key_length,
-			 const guchar *data, gsize data_length,
-			 guchar *digest);
-	gpointer cipher_context;
-	guint64 sequence_number;
+	struct sipe_tls_record_layer *client_write;
 	gboolean stream_cipher;
 	gboolean encrypted;
 	gboolean expected;
@@ -124,7 +121,7 @@ struct tls_internal_state {
 #define TLS_ARRAY_MASTER_SECRET_LENGTH 48
 #define TLS_ARRAY_VERIFY_LENGTH        12
 
-#define TLS_RECORD_HEADER_LENGTH            5
+#define TLS_RECORD_HEADER_LENGTH            SIPE_TLS_RECORD_HEADER_LENGTH
 #define TLS_RECORD_OFFSET_TYPE              0
 #define TLS_RECORD_TYPE_CHANGE_CIPHER_SPEC 20
 #define TLS_RECORD_TYPE_HANDSHAKE          22
@@ -1061,98 +1058,176 @@ static void compile_tls_record(struct tls_internal_state *state,
 	va_end(ap);
 }
 
-static void compile_encrypted_tls_record(struct tls_internal_state *state,
-					 const struct tls_compiled_message *msg)
-{
-	guchar *plaintext;
-	gsize plaintext_length; /* header + content        */
-	guchar *mac;
+/*
+ * TLS record layer protection
+ */
+struct sipe_tls_record_layer {
+	gpointer mac_context;
+	gpointer cipher_context;
 	gsize mac_length;
-	guchar *message;
-	guchar *encrypted;
-	gsize message_length;   /* header + content + MAC  */
-	gsize padding_length;   /* for block cipher        */
-	gsize encrypted_length; /* header + encrypted data */
-
-	/* Create plaintext TLS record */
-	compile_tls_record(state, msg, NULL);
-	plaintext        = state->common.out_buffer;
-	plaintext_length = state->common.out_length;
-	if (plaintext_length == 0) /* make Coverity happy */
-		return;
+	gboolean stream_cipher;
+	guint64 sequence_number;
+};
+
+struct sipe_tls_record_layer *sipe_tls_record_layer_new(enum sipe_tls_digest_algorithm algorithm,
+							const guchar *mac_secret,
+							const guchar *key,
+							gsize key_length,
+							const guchar *iv)
+{
+	struct sipe_tls_record_layer *layer = g_new0(struct sipe_tls_record_layer, 1);
 
-	/* Prepare encryption buffer */
-	message_length = plaintext_length + state->mac_length;
-	if (state->stream_cipher) {
-		padding_length   = 0;
-		encrypted_length = message_length;
+	switch (algorithm) {
+	case SIPE_TLS_DIGEST_ALGORITHM_MD5:
+		layer->mac_length  = SIPE_DIGEST_HMAC_MD5_LENGTH;
+		layer->mac_context = sipe_digest_hmac_md5_start(mac_secret,
+								layer->mac_length);
+		break;
+	case SIPE_TLS_DIGEST_ALGORITHM_SHA1:
+		layer->mac_length  = SIPE_DIGEST_HMAC_SHA1_LENGTH;
+		layer->mac_context = sipe_digest_hmac_sha1_start(mac_secret,
+								 layer->mac_length);
+		break;
+	default:
+		SIPE_DEBUG_ERROR("sipe_tls_record_layer_new: unsupported MAC algorithm %d",
+				 algorithm);
+		break;
+	}
+
+	if (iv) {
+		layer->cipher_context = sipe_crypt_tls_block_start(key,
+								   key_length,
+								   iv,
+								   TLS_AES_CBC_BLOCK_LENGTH);
 	} else {
-		padding_length   = TLS_AES_CBC_BLOCK_LENGTH - (message_length - TLS_RECORD_HEADER_LENGTH + 1) % TLS_AES_CBC_BLOCK_LENGTH;
-		encrypted_length = message_length + padding_length + 1;
+		layer->stream_cipher  = TRUE;
+		layer->cipher_context = sipe_crypt_tls_start(key, key_length);
 	}
-	SIPE_DEBUG_INFO("compile_encrypted_tls_record: total size %" G_GSIZE_FORMAT,
-			encrypted_length - TLS_RECORD_HEADER_LENGTH);
-	message = g_malloc(message_length);
-	memcpy(message, plaintext, plaintext_length);
-	lowlevel_integer_to_tls(message + TLS_RECORD_OFFSET_LENGTH, 2,
-				encrypted_length - TLS_RECORD_HEADER_LENGTH);
+
+	if (!layer->mac_context || !layer->cipher_context) {
+		sipe_tls_record_layer_free(layer);
+		return(NULL);
+	}
+
+	return(layer);
+}
+
+gsize sipe_tls_record_layer_size(const struct sipe_tls_record_layer *layer,
+				 gsize length)
+{
+	gsize message_length = length + layer->mac_length;
+
+	if (!layer->stream_cipher) {
+		/* TLS 1.0 GenericBlockCipher: padding + padding_length */
+		gsize padding_length = TLS_AES_CBC_BLOCK_LENGTH -
+			(message_length + 1) % TLS_AES_CBC_BLOCK_LENGTH;
+		message_length += padding_length + 1;
+	}
+
+	return(TLS_RECORD_HEADER_LENGTH + message_length);
+}
+
+void sipe_tls_record_layer_protect(struct sipe_tls_record_layer *layer,
+				   guint type,
+				   guchar *record,
+				   gsize length)
+{
+	gsize record_length = sipe_tls_record_layer_size(layer, length);
+	guchar *mac         = record + TLS_RECORD_HEADER_LENGTH + length;
+	guchar sequence_number[sizeof(guint64)];
+
+	/* plaintext TLS record header */
+	record[TLS_RECORD_OFFSET_TYPE] = type;
+	lowlevel_integer_to_tls(record + TLS_RECORD_OFFSET_VERSION, 2,
+				TLS_PROTOCOL_VERSION_1_0);
+	lowlevel_integer_to_tls(record + TLS_RECORD_OFFSET_LENGTH, 2,
+				length);
 
 	/*
-	 * Calculate MAC and append to message
+	 * Calculate MAC and append to content
 	 *
-	 * HMAC_hash(client_write_mac_secret,
+	 * HMAC_hash(MAC_write_secret,
 	 *           sequence_number + type + version + length + fragment)
-	 *                             \---  == original TLS record  ---/
+	 *                             \---  == plaintext TLS record  ---/
 	 */
-	mac_length = sizeof(guint64) + plaintext_length;
-	mac        = g_malloc(mac_length);
-	lowlevel_integer_to_tls(mac,
-				sizeof(guint64),
-				state->sequence_number++);
-	memcpy(mac + sizeof(guint64), plaintext, plaintext_length);
-	g_free(plaintext);
-	state->mac_func(state->client_write_mac_secret,
-			state->mac_length,
-			mac,
-			mac_length,
-			message + plaintext_length);
-	g_free(mac);
-
-	encrypted = g_malloc(encrypted_length);
-	/* header (unencrypted) */
-	memcpy(encrypted, message, TLS_RECORD_HEADER_LENGTH);
-	if (state->stream_cipher) {
+	lowlevel_integer_to_tls(sequence_number, 4,
+				layer->sequence_number >> 32);
+	lowlevel_integer_to_tls(sequence_number + 4, 4,
+				layer->sequence_number & 0xFFFFFFFF);
+	layer->sequence_number++;
+	sipe_digest_hmac_update(layer->mac_context,
+				sequence_number,
+				sizeof(sequence_number));
+	sipe_digest_hmac_update(layer->mac_context,
+				record,
+				TLS_RECORD_HEADER_LENGTH + length);
+	sipe_digest_hmac_end(layer->mac_context, mac);
+
+	/* header stays unencrypted */
+	lowlevel_integer_to_tls(record + TLS_RECORD_OFFSET_LENGTH, 2,
+				record_length - TLS_RECORD_HEADER_LENGTH);
+
+	if (layer->stream_cipher) {
 		/* ENCRYPT(content + MAC) */
-		sipe_crypt_tls_stream(state->cipher_context,
-				      message + TLS_RECORD_HEADER_LENGTH,
-				      encrypted_length - TLS_RECORD_HEADER_LENGTH,
-				      encrypted + TLS_RECORD_HEADER_LENGTH);
+		sipe_crypt_tls_stream(layer->cipher_context,
+				      record + TLS_RECORD_HEADER_LENGTH,
+				      record_length - TLS_RECORD_HEADER_LENGTH,
+				      record + TLS_RECORD_HEADER_LENGTH);
 	} else {
-		/* TLS 1.0 GenericBlockCipher */
-		/* content + MAC */
-		memcpy(encrypted + TLS_RECORD_HEADER_LENGTH,
-		       message + TLS_RECORD_HEADER_LENGTH,
-		       message_length - TLS_RECORD_HEADER_LENGTH);
+		gsize padding_length = record_length - TLS_RECORD_HEADER_LENGTH -
+			length - layer->mac_length - 1;
 
 		/* padding + padding_length */
-		memset(encrypted + message_length,
+		memset(mac + layer->mac_length,
 		       padding_length,
 		       padding_length + 1);
 
 		/* ENCRYPT(content + MAC + padding + padding_length) */
-		sipe_crypt_tls_block(state->client_write_secret,
-				     state->key_length,
-				     state->client_write_iv,
-				     TLS_AES_CBC_BLOCK_LENGTH,
-				     encrypted + TLS_RECORD_HEADER_LENGTH,
-				     encrypted_length - TLS_RECORD_HEADER_LENGTH,
-				     encrypted + TLS_RECORD_HEADER_LENGTH);
+		sipe_crypt_tls_block_encrypt(layer->cipher_context,
+					     record + TLS_RECORD_HEADER_LENGTH,
+					     record_length - TLS_RECORD_HEADER_LENGTH,
+					     record + TLS_RECORD_HEADER_LENGTH);
 	}
-	g_free(message);
+}
 
-	/* swap buffers */
-	state->common.out_buffer = encrypted;
-	state->common.out_length = encrypted_length;
+void sipe_tls_record_layer_free(struct sipe_tls_record_layer *layer)
+{
+	if (layer) {
+		if (layer->cipher_context) {
+			if (layer->stream_cipher)
+				sipe_crypt_tls_destroy(layer->cipher_context);
+			else
+				sipe_crypt_tls_block_destroy(layer->cipher_context);
+		}
+		if (layer->mac_context)
+			sipe_digest_hmac_destroy(layer->mac_context);
+		g_free(layer);
+	}
+}
+
+static void compile_encrypted_tls_record(struct tls_internal_state *state,
+					 const struct tls_compiled_message *msg)
+{
+	gsize length;
+	guchar *record;
+
+	if (!state->client_write)
+		return;
+
+	/* content is protected in place */
+	length = sipe_tls_record_layer_size(state->client_write, msg->size);
+	record = g_malloc(length);
+	memcpy(record + TLS_RECORD_HEADER_LENGTH, msg->data, msg->size);
+
+	SIPE_DEBUG_INFO("compile_encrypted_tls_record: total size %" G_GSIZE_FORMAT,
+			length - TLS_RECORD_HEADER_LENGTH);
+	sipe_tls_record_layer_protect(state->client_write,
+				      TLS_RECORD_TYPE_HANDSHAKE,
+				      record,
+				      msg->size);
+
+	state->common.out_buffer = record;
+	state->common.out_length = length;
 }
 
 static struct tls_compiled_message *compile_handshake_msg(struct tls_internal_state *state,
@@ -1256,7 +1331,6 @@ static gboolean check_cipher_suite(struct tls_internal_state *state)
 	case TLS_RSA_EXPORT_WITH_RC4_40_MD5:
 		state->mac_length       = SIPE_DIGEST_HMAC_MD5_LENGTH;
 		state->key_length       = 40 / 8;
-		state->mac_func         = sipe_digest_hmac_md5;
 		state->stream_cipher    = TRUE;
 		label_mac               = "MD5";
 		label_cipher            = "RC4 stream";
@@ -1266,7 +1340,6 @@ static gboolean check_cipher_suite(struct tls_internal_state *state)
 	case TLS_RSA_WITH_RC4_128_MD5:
 		state->mac_length       = SIPE_DIGEST_HMAC_MD5_LENGTH;
 		state->key_length       = 128 / 8;
-		state->mac_func         = sipe_digest_hmac_md5;
 		state->stream_cipher    = TRUE;
 		label_mac               = "MD5";
 		label_cipher            = "RC4 stream";
@@ -1276,7 +1349,6 @@ static gboolean check_cipher_suite(struct tls_internal_state *state)
 	case TLS_RSA_WITH_RC4_128_SHA:
 		state->mac_length       = SIPE_DIGEST_HMAC_SHA1_LENGTH;
 		state->key_length       = 128 / 8;
-		state->mac_func         = sipe_digest_hmac_sha1;
 		state->stream_cipher    = TRUE;
 		label_mac               = "SHA-1";
 		label_cipher            = "RC4 stream";
@@ -1286,7 +1358,6 @@ static gboolean check_cipher_suite(struct tls_internal_state *state)
 	case TLS_RSA_WITH_AES_128_CBC_SHA:
 		state->mac_length       = SIPE_DIGEST_HMAC_SHA1_LENGTH;
 		state->key_length       = 128 / 8;
-		state->mac_func         = sipe_digest_hmac_sha1;
 		state->stream_cipher    = FALSE;
 		label_mac               = "SHA-1";
 		label_cipher            = "AES-CBC block";
@@ -1296,7 +1367,6 @@ static gboolean check_cipher_suite(struct tls_internal_state *state)
 	case TLS_RSA_WITH_AES_256_CBC_SHA:
 		state->mac_length       = SIPE_DIGEST_HMAC_SHA1_LENGTH;
 		state->key_length       = 256 / 8;
-		state->mac_func         = sipe_digest_hmac_sha1;
 		state->stream_cipher    = FALSE;
 		label_mac               = "SHA-1";
 		label_cipher            = "AES-CBC block";
@@ -1391,14 +1461,17 @@ static void tls_calculate_secrets(struct tls_internal_state *state)
 	state->client_write_secret     = state->key_block + 2 * state->mac_length;
 	state->server_write_secret     = state->key_block + 2 * state->mac_length + state->key_length;
 
-	/* initialize stream cipher context */
-	if (state->stream_cipher) {
-		state->cipher_context = sipe_crypt_tls_start(state->client_write_secret,
-							     state->key_length);
-	} else {
+	if (!state->stream_cipher) {
 		state->client_write_iv = state->key_block + 2 * (state->mac_length + state->key_length);
 		state->server_write_iv = state->key_block + 2 * (state->mac_length + state->key_length) + TLS_AES_CBC_BLOCK_LENGTH;
 	}
+
+	/* keyed once, re-used for all records */
+	state->client_write = sipe_tls_record_layer_new(state->common.algorithm,
+							state->client_write_mac_secret,
+							state->client_write_secret,
+							state->key_length,
+							state->client_write_iv);
 }
 
 #if 0 /* NOT NEEDED? */
@@ -1673,7 +1746,7 @@ static gboolean tls_client_hello(struct tls_internal_state *state)
         compile_tls_record(state, cmsg, NULL);
 	g_free(cmsg);
 
-	if (sipe_backend_debug_enabled())
+	if (SIPE_DEBUG_IS_ENABLED(SIPE_DEBUG_CATEGORY))
 		state->debug = g_string_new("");
 
 	state->state = TLS_HANDSHAKE_STATE_SERVER_HELLO;
@@ -1896,8 +1969,7 @@ void sipe_tls_free(struct sipe_tls_state *state)
 		sipe_tls_free_random(&internal->pre_master_secret);
 		sipe_tls_free_random(&internal->client_random);
 		sipe_tls_free_random(&internal->server_random);
-		if (internal->cipher_context)
-			sipe_crypt_tls_destroy(internal->cipher_context);
+		sipe_tls_record_layer_free(internal->client_write);
 		if (internal->md5_context)
 			sipe_digest_md5_destroy(internal->md5_context);
 		if (internal->sha1_context)
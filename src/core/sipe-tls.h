@@ -125,3 +125,64 @@ guint sipe_tls_expires(struct sipe_tls_state *state);
  * @param state pointer to TLS state structure
  */
 void sipe_tls_free(struct sipe_tls_state *state);
+
+/**
+ * TLS record layer protection for one direction of a connection
+ *
+ * Cipher and HMAC contexts are keyed once and re-used for all records.
+ */
+struct sipe_tls_record_layer;
+
+#define SIPE_TLS_RECORD_HEADER_LENGTH 5
+
+/**
+ * Initialize TLS record layer protection
+ *
+ * @param algorithm  MAC algorithm (MD5 or SHA-1)
+ * @param mac_secret MAC write secret (digest length)
+ * @param key        write key
+ * @param key_length length of key in bytes
+ * @param iv         AES-CBC write IV, NULL for RC4 stream cipher
+ *
+ * @return record layer or @c NULL. Must be freed with sipe_tls_record_layer_free()
+ */
+struct sipe_tls_record_layer *sipe_tls_record_layer_new(enum sipe_tls_digest_algorithm algorithm,
+							const guchar *mac_secret,
+							const guchar *key,
+							gsize key_length,
+							const guchar *iv);
+
+/**
+ * Size of protected TLS record
+ *
+ * @param layer  record layer
+ * @param length length of record content
+ *
+ * @return record length including header, MAC & padding
+ */
+gsize sipe_tls_record_layer_size(const struct sipe_tls_record_layer *layer,
+				 gsize length);
+
+/**
+ * Protect TLS record in place
+ *
+ * Content must be stored at offset @c SIPE_TLS_RECORD_HEADER_LENGTH in a
+ * buffer of sipe_tls_record_layer_size() bytes. Header, MAC & padding
+ * are added and everything after the header is encrypted.
+ *
+ * @param layer  record layer
+ * @param type   TLS record content type, Ex.: 22 (handshake)
+ * @param record record buffer
+ * @param length length of record content
+ */
+void sipe_tls_record_layer_protect(struct sipe_tls_record_layer *layer,
+				   guint type,
+				   guchar *record,
+				   gsize length);
+
+/**
+ * Free TLS record layer protection
+ *
+ * @param layer record layer (may be @c NULL)
+ */
+void sipe_tls_record_layer_free(struct sipe_tls_record_layer *layer);
@@ -0,0 +1,264 @@
+/**
+ * @file sipe-tz-tests.c
+ *
+ * pidgin-sipe
+ *
+ * Copyright (C) 2015 SIPE Project <http://sipe.sourceforge.net/>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* Tests & micro benchmarks for sipe-tz.c */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <glib.h>
+
+#include "sipe-common.h"
+#include "sipe-tz.h"
+
+/*
+ * Tester code
+ */
+static guint succeeded = 0;
+static guint failed    = 0;
+
+#define ENVIRONMENT_TIMEZONE "TZ"
+
+struct test_zone {
+	const gchar *label;
+	const gchar *posix;  /* same rules for the C library */
+	int bias;
+	struct sipe_tz_rule std;
+	struct sipe_tz_rule dst;
+};
+
+static const struct test_zone test_zones[] = {
+	{ "Pacific",   "PST8PDT,M3.2.0/2,M11.1.0/2",    480,
+	  {   0, 2 * 3600, 1, 11, 0, 0 }, { -60, 2 * 3600, 2,  3, 0, 0 } },
+	{ "Central Europe", "CET-1CEST,M3.5.0/2,M10.5.0/3", -60,
+	  {   0, 3 * 3600, 5, 10, 0, 0 }, { -60, 2 * 3600, 5,  3, 0, 0 } },
+	{ "Sydney",    "AEST-10AEDT,M10.1.0/2,M4.1.0/3", -600,
+	  {   0, 3 * 3600, 1,  4, 0, 0 }, { -60, 2 * 3600, 1, 10, 0, 0 } },
+	{ "India",     "IST-5:30",                      -330,
+	  {   0, 0,        0,  0, 0, 0 }, {   0, 0,        0,  0, 0, 0 } },
+	{ NULL, NULL, 0, { 0, 0, 0, 0, 0, 0 }, { 0, 0, 0, 0, 0, 0 } }
+};
+
+/* previous implementation: switch TZ for every conversion */
+static void test_legacy_localtime(const gchar *posix,
+				  time_t time,
+				  struct tm *tm)
+{
+	gchar *tz_orig = g_strdup(g_getenv(ENVIRONMENT_TIMEZONE));
+
+	g_setenv(ENVIRONMENT_TIMEZONE, posix, TRUE);
+	tzset();
+	*tm = *localtime(&time);
+
+	if (tz_orig) {
+		g_setenv(ENVIRONMENT_TIMEZONE, tz_orig, TRUE);
+		g_free(tz_orig);
+	} else {
+		g_unsetenv(ENVIRONMENT_TIMEZONE);
+	}
+	tzset();
+}
+
+static gboolean test_tm_equal(const struct tm *a,
+			      const struct tm *b)
+{
+	return((a->tm_sec   == b->tm_sec)  &&
+	       (a->tm_min   == b->tm_min)  &&
+	       (a->tm_hour  == b->tm_hour) &&
+	       (a->tm_mday  == b->tm_mday) &&
+	       (a->tm_mon   == b->tm_mon)  &&
+	       (a->tm_year  == b->tm_year) &&
+	       (a->tm_wday  == b->tm_wday) &&
+	       (a->tm_yday  == b->tm_yday) &&
+	       (a->tm_isdst == b->tm_isdst));
+}
+
+static void test_failed(const gchar *label,
+			const gchar *zone,
+			time_t time,
+			const struct tm *value,
+			const struct tm *expected)
+{
+	printf("FAILED %s %s at %ld: %04d-%02d-%02d %02d:%02d:%02d dst %d (expected %04d-%02d-%02d %02d:%02d:%02d dst %d)\n",
+	       label, zone, (long) time,
+	       value->tm_year + 1900, value->tm_mon + 1, value->tm_mday,
+	       value->tm_hour, value->tm_min, value->tm_sec, value->tm_isdst,
+	       expected->tm_year + 1900, expected->tm_mon + 1, expected->tm_mday,
+	       expected->tm_hour, expected->tm_min, expected->tm_sec, expected->tm_isdst);
+	failed++;
+}
+
+static void test_zone(const struct test_zone *zone)
+{
+	struct sipe_tz *tz = sipe_tz_get(zone->bias, &zone->std, &zone->dst);
+	guint errors = failed;
+	time_t time;
+
+	/* every ~11 hours, i.e. hits all hours of day */
+	for (time = 0; time < 0x7FFF0000; time += 11 * 3600 + 61) {
+		struct tm value, expected, roundtrip;
+		time_t converted;
+
+		sipe_tz_localtime(tz, time, &value);
+		test_legacy_localtime(zone->posix, time, &expected);
+		if (test_tm_equal(&value, &expected))
+			succeeded++;
+		else
+			test_failed("localtime", zone->label, time, &value, &expected);
+
+		/* local -> UTC is ambiguous in the repeated hour */
+		roundtrip = value;
+		converted = sipe_tz_mktime(tz, &roundtrip);
+		sipe_tz_localtime(tz, converted, &roundtrip);
+		roundtrip.tm_isdst = value.tm_isdst;
+		if (test_tm_equal(&roundtrip, &value))
+			succeeded++;
+		else
+			test_failed("mktime", zone->label, time, &roundtrip, &value);
+
+		sipe_tz_gmtime(time, &value);
+		expected = *gmtime(&time);
+		expected.tm_isdst = 0;
+		if (test_tm_equal(&value, &expected) &&
+		    (sipe_tz_timegm(&value) == time))
+			succeeded++;
+		else
+			test_failed("gmtime", zone->label, time, &value, &expected);
+
+		/* only report first few errors */
+		if (failed - errors > 10)
+			break;
+	}
+
+	sipe_tz_release(tz);
+}
+
+static void test_normalize(void)
+{
+	struct tm tm;
+
+	/* 2015-01-32 -> 2015-02-01 (Sunday) */
+	memset(&tm, 0, sizeof(tm));
+	tm.tm_year = 115;
+	tm.tm_mday = 32;
+	if ((sipe_tz_timegm(&tm) == 1422748800) &&
+	    (tm.tm_mon == 1) && (tm.tm_mday == 1) && (tm.tm_wday == 0)) {
+		succeeded++;
+	} else {
+		printf("FAILED normalize: %d-%d wday %d\n",
+		       tm.tm_mon + 1, tm.tm_mday, tm.tm_wday);
+		failed++;
+	}
+}
+
+static void test_shared(void)
+{
+	const struct test_zone *zone = &test_zones[0];
+	struct sipe_tz *tz1 = sipe_tz_get(zone->bias, &zone->std, &zone->dst);
+	struct sipe_tz *tz2 = sipe_tz_get(zone->bias, &zone->std, &zone->dst);
+	struct sipe_tz *tz3 = sipe_tz_get(zone->bias + 60, &zone->std, &zone->dst);
+
+	if ((tz1 == tz2) && (tz1 != tz3) &&
+	    !strcmp(sipe_tz_name(tz1), "UTC-08:00/UTC-07:00")) {
+		succeeded++;
+	} else {
+		printf("FAILED shared timezone: %p %p %p %s\n",
+		       (void *) tz1, (void *) tz2, (void *) tz3, sipe_tz_name(tz1));
+		failed++;
+	}
+
+	sipe_tz_release(tz3);
+	sipe_tz_release(tz2);
+	sipe_tz_release(tz1);
+}
+
+static void test_benchmark(guint rounds)
+{
+	const struct test_zone *zone = &test_zones[1];
+	struct sipe_tz *tz = sipe_tz_get(zone->bias, &zone->std, &zone->dst);
+	GTimer *timer = g_timer_new();
+	time_t now = time(NULL);
+	gdouble elapsed_legacy, elapsed_tz;
+	guint legacy = 0, compiled = 0;
+	guint round;
+
+	g_timer_start(timer);
+	for (round = 0; round < rounds; round++) {
+		struct tm tm;
+		test_legacy_localtime(zone->posix, now + round * 60, &tm);
+		legacy += tm.tm_hour;
+	}
+	elapsed_legacy = g_timer_elapsed(timer, NULL);
+
+	g_timer_start(timer);
+	for (round = 0; round < rounds; round++) {
+		struct tm tm;
+		sipe_tz_localtime(tz, now + round * 60, &tm);
+		compiled += tm.tm_hour;
+	}
+	elapsed_tz = g_timer_elapsed(timer, NULL);
+
+	if (legacy == compiled) {
+		succeeded++;
+	} else {
+		printf("FAILED benchmark: %u (expected %u)\n", compiled, legacy);
+		failed++;
+	}
+
+	printf("%-32s %8.3f ms %12.1f conversions/s\n",
+	       "localtime (switch TZ)",
+	       elapsed_legacy * 1000,
+	       elapsed_legacy > 0 ? rounds / elapsed_legacy : 0);
+	printf("%-32s %8.3f ms %12.1f conversions/s\n",
+	       "localtime (compiled timezone)",
+	       elapsed_tz * 1000,
+	       elapsed_tz > 0 ? rounds / elapsed_tz : 0);
+
+	g_timer_destroy(timer);
+	sipe_tz_release(tz);
+}
+
+int main(SIPE_UNUSED_PARAMETER int argc, SIPE_UNUSED_PARAMETER char *argv[])
+{
+	const struct test_zone *zone;
+
+	for (zone = test_zones; zone->label; zone++)
+		test_zone(zone);
+
+	test_normalize();
+	test_shared();
+	test_benchmark(100000);
+
+	printf("Result: %u PASSED %u FAILED\n", succeeded, failed);
+	return(failed);
+}
+
+/*
+  Local Variables:
+  mode: c
+  c-file-style: "bsd"
+  indent-tabs-mode: t
+  tab-width: 8
+  End:
+*/
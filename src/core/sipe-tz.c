@@ -0,0 +1,381 @@
+/**
+ * @file sipe-tz.c
+ *
+ * pidgin-sipe
+ *
+ * Copyright (C) 2015 SIPE Project <http://sipe.sourceforge.net/>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Timezones as published in Exchange WorkingHours, i.e. one bias plus
+ * a StandardTime and a DaylightTime rule.
+ *
+ * The transitions are calculated once per year when the timezone is
+ * compiled. The previous implementation switched the TZ environment
+ * variable of the whole process for every conversion.
+ *
+ * Date calculations: http://howardhinnant.github.io/date_algorithms.html
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include <glib.h>
+
+#include "sipe-tz.h"
+
+/* transition table covers the 32-bit time_t range */
+#define TZ_FIRST_YEAR 1970
+#define TZ_LAST_YEAR  2037
+#define TZ_YEARS      (TZ_LAST_YEAR - TZ_FIRST_YEAR + 1)
+
+#define SECONDS_PER_DAY (24 * 60 * 60)
+
+struct sipe_tz_transitions {
+	time_t dst_start;
+	time_t std_start;
+};
+
+struct sipe_tz {
+	gchar *key;
+	gchar *name;
+	guint references;
+	int std_offset;     /* seconds */
+	int dst_offset;     /* seconds */
+	struct sipe_tz_rule std;
+	struct sipe_tz_rule dst;
+	int bias;
+	gboolean has_dst;
+	struct sipe_tz_transitions table[TZ_YEARS];
+};
+
+/* shared timezones, key is the rule description */
+G_LOCK_DEFINE_STATIC(tz_cache);
+static GHashTable *tz_cache = NULL;
+
+static gint64 days_from_civil(gint64 year, int month, int day)
+{
+	gint64 era;
+	int yoe, doy, doe;
+
+	year -= month <= 2;
+	era   = (year >= 0 ? year : year - 399) / 400;
+	yoe   = (int) (year - era * 400);
+	doy   = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+	doe   = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+	return(era * 146097 + doe - 719468);
+}
+
+static void civil_from_days(gint64 days,
+			    int *year,
+			    int *month,
+			    int *day)
+{
+	gint64 era;
+	int doe, yoe, doy, mp;
+
+	days += 719468;
+	era   = (days >= 0 ? days : days - 146096) / 146097;
+	doe   = (int) (days - era * 146097);
+	yoe   = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	doy   = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	mp    = (5 * doy + 2) / 153;
+	*day   = doy - (153 * mp + 2) / 5 + 1;
+	*month = mp + (mp < 10 ? 3 : -9);
+	*year  = (int) (yoe + era * 400 + (*month <= 2));
+}
+
+/* 0 = Sunday, 1970-01-01 was a Thursday */
+static int weekday(gint64 days)
+{
+	return((int) (((days + 4) % 7 + 7) % 7));
+}
+
+static gint64 floor_div(gint64 a, gint64 b)
+{
+	return((a >= 0) ? a / b : -((-a - 1) / b) - 1);
+}
+
+void sipe_tz_gmtime(time_t time,
+		    struct tm *tm)
+{
+	gint64 days    = floor_div(time, SECONDS_PER_DAY);
+	int seconds    = (int) (time - days * SECONDS_PER_DAY);
+	int year, month, day;
+
+	civil_from_days(days, &year, &month, &day);
+
+	memset(tm, 0, sizeof(*tm));
+	tm->tm_sec   = seconds % 60;
+	tm->tm_min   = (seconds / 60) % 60;
+	tm->tm_hour  = seconds / 3600;
+	tm->tm_mday  = day;
+	tm->tm_mon   = month - 1;
+	tm->tm_year  = year - 1900;
+	tm->tm_wday  = weekday(days);
+	tm->tm_yday  = (int) (days - days_from_civil(year, 1, 1));
+}
+
+time_t sipe_tz_timegm(struct tm *tm)
+{
+	gint64 year  = tm->tm_year + 1900 + floor_div(tm->tm_mon, 12);
+	int month    = (int) (tm->tm_mon - floor_div(tm->tm_mon, 12) * 12);
+	gint64 days  = days_from_civil(year, month + 1, 1) + tm->tm_mday - 1;
+	time_t time  = (time_t) (days * SECONDS_PER_DAY +
+				 tm->tm_hour * 3600 +
+				 tm->tm_min  * 60 +
+				 tm->tm_sec);
+
+	sipe_tz_gmtime(time, tm);
+	return(time);
+}
+
+/* UTC time of the switch to "rule" in "year" */
+static time_t rule_transition(int year,
+			      int bias,
+			      const struct sipe_tz_rule *rule,
+			      const struct sipe_tz_rule *previous)
+{
+	gint64 first = days_from_civil(year, rule->month, 1);
+	int day;
+
+	if (rule->year) {
+		/* dynamic rule: exact date */
+		day = rule->day_order;
+	} else {
+		gint64 next = (rule->month == 12) ?
+			days_from_civil(year + 1, 1, 1) :
+			days_from_civil(year, rule->month + 1, 1);
+
+		/* n-th weekday in month, 5 = last */
+		day = 1 + (rule->day_of_week - weekday(first) + 7) % 7 +
+			(rule->day_order - 1) * 7;
+		while (day > next - first)
+			day -= 7;
+		while (day < 1)
+			day += 7;
+	}
+
+	/* local time of the switch is given in the previous offset */
+	return((time_t) ((first + day - 1) * SECONDS_PER_DAY +
+			 rule->time +
+			 (bias + previous->bias) * 60));
+}
+
+static void year_transitions(const struct sipe_tz *tz,
+			     int year,
+			     struct sipe_tz_transitions *transitions)
+{
+	transitions->dst_start = rule_transition(year, tz->bias, &tz->dst, &tz->std);
+	transitions->std_start = rule_transition(year, tz->bias, &tz->std, &tz->dst);
+}
+
+static const struct sipe_tz_transitions *lookup_transitions(const struct sipe_tz *tz,
+							     time_t time,
+							     struct sipe_tz_transitions *buffer)
+{
+	int year, month, day;
+
+	civil_from_days(floor_div(time, SECONDS_PER_DAY), &year, &month, &day);
+	if ((year >= TZ_FIRST_YEAR) && (year <= TZ_LAST_YEAR))
+		return(&tz->table[year - TZ_FIRST_YEAR]);
+
+	year_transitions(tz, year, buffer);
+	return(buffer);
+}
+
+static gchar *tz_offset_name(int offset)
+{
+	int minutes = (offset < 0 ? -offset : offset) / 60;
+	return(g_strdup_printf("UTC%c%02d:%02d",
+			       offset < 0 ? '-' : '+',
+			       minutes / 60,
+			       minutes % 60));
+}
+
+static gchar *tz_key(int bias,
+		     const struct sipe_tz_rule *std,
+		     const struct sipe_tz_rule *dst)
+{
+	return(g_strdup_printf("%d/%d,%d,%d,%d,%d,%d/%d,%d,%d,%d,%d,%d",
+			       bias,
+			       std->bias, std->time, std->day_order,
+			       std->month, std->day_of_week, std->year,
+			       dst->bias, dst->time, dst->day_order,
+			       dst->month, dst->day_of_week, dst->year));
+}
+
+static struct sipe_tz *tz_compile(int bias,
+				  const struct sipe_tz_rule *std,
+				  const struct sipe_tz_rule *dst)
+{
+	struct sipe_tz *tz = g_new0(struct sipe_tz, 1);
+	gchar *std_name, *dst_name;
+
+	tz->key        = tz_key(bias, std, dst);
+	tz->bias       = bias;
+	tz->std        = *std;
+	tz->dst        = *dst;
+	tz->std_offset = -(bias + std->bias) * 60;
+	tz->dst_offset = -(bias + dst->bias) * 60;
+	tz->has_dst    = (std->month > 0) && (dst->month > 0);
+
+	std_name = tz_offset_name(tz->std_offset);
+	if (tz->has_dst) {
+		int year;
+
+		for (year = TZ_FIRST_YEAR; year <= TZ_LAST_YEAR; year++)
+			year_transitions(tz, year, &tz->table[year - TZ_FIRST_YEAR]);
+
+		dst_name = tz_offset_name(tz->dst_offset);
+		tz->name = g_strdup_printf("%s/%s", std_name, dst_name);
+		g_free(dst_name);
+		g_free(std_name);
+	} else {
+		tz->name = std_name;
+	}
+
+	return(tz);
+}
+
+struct sipe_tz *sipe_tz_get(int bias,
+			    const struct sipe_tz_rule *std,
+			    const struct sipe_tz_rule *dst)
+{
+	gchar *key = tz_key(bias, std, dst);
+	struct sipe_tz *tz;
+
+	G_LOCK(tz_cache);
+
+	if (!tz_cache)
+		tz_cache = g_hash_table_new(g_str_hash,
+					    g_str_equal);
+
+	tz = g_hash_table_lookup(tz_cache, key);
+	if (!tz) {
+		tz = tz_compile(bias, std, dst);
+		g_hash_table_insert(tz_cache, tz->key, tz);
+	}
+	tz->references++;
+
+	G_UNLOCK(tz_cache);
+
+	g_free(key);
+	return(tz);
+}
+
+void sipe_tz_release(struct sipe_tz *tz)
+{
+	if (!tz)
+		return;
+
+	G_LOCK(tz_cache);
+
+	if (--tz->references == 0) {
+		g_hash_table_remove(tz_cache, tz->key);
+		g_free(tz->key);
+		g_free(tz->name);
+		g_free(tz);
+
+		if (g_hash_table_size(tz_cache) == 0) {
+			g_hash_table_destroy(tz_cache);
+			tz_cache = NULL;
+		}
+	}
+
+	G_UNLOCK(tz_cache);
+}
+
+const gchar *sipe_tz_name(const struct sipe_tz *tz)
+{
+	return(tz->name);
+}
+
+gboolean sipe_tz_transitions(const struct sipe_tz *tz,
+			     time_t time,
+			     time_t *dst_start,
+			     time_t *std_start)
+{
+	struct sipe_tz_transitions buffer;
+	const struct sipe_tz_transitions *transitions;
+
+	if (!tz->has_dst)
+		return(FALSE);
+
+	transitions = lookup_transitions(tz, time, &buffer);
+	*dst_start  = transitions->dst_start;
+	*std_start  = transitions->std_start;
+	return(TRUE);
+}
+
+static gboolean tz_is_dst(const struct sipe_tz *tz,
+			  time_t time)
+{
+	struct sipe_tz_transitions buffer;
+	const struct sipe_tz_transitions *transitions;
+
+	if (!tz->has_dst)
+		return(FALSE);
+
+	transitions = lookup_transitions(tz, time, &buffer);
+	if (transitions->dst_start < transitions->std_start)
+		/* northern hemisphere - Europe, US */
+		return((time >= transitions->dst_start) &&
+		       (time <  transitions->std_start));
+	else
+		/* southern hemisphere - Australia */
+		return((time >= transitions->dst_start) ||
+		       (time <  transitions->std_start));
+}
+
+int sipe_tz_offset(const struct sipe_tz *tz,
+		   time_t time)
+{
+	return(tz_is_dst(tz, time) ? tz->dst_offset : tz->std_offset);
+}
+
+void sipe_tz_localtime(const struct sipe_tz *tz,
+		       time_t time,
+		       struct tm *tm)
+{
+	gboolean is_dst = tz_is_dst(tz, time);
+
+	sipe_tz_gmtime(time + (is_dst ? tz->dst_offset : tz->std_offset), tm);
+	tm->tm_isdst = is_dst;
+}
+
+time_t sipe_tz_mktime(const struct sipe_tz *tz,
+		      struct tm *tm)
+{
+	time_t local = sipe_tz_timegm(tm);
+	/* offset valid at the resulting UTC time */
+	time_t time  = local - sipe_tz_offset(tz, local - tz->std_offset);
+
+	time = local - sipe_tz_offset(tz, time);
+	sipe_tz_localtime(tz, time, tm);
+	return(time);
+}
+
+/*
+  Local Variables:
+  mode: c
+  c-file-style: "bsd"
+  indent-tabs-mode: t
+  tab-width: 8
+  End:
+*/
@@ -0,0 +1,145 @@
+/**
+ * @file sipe-tz.h
+ *
+ * pidgin-sipe
+ *
+ * Copyright (C) 2015 SIPE Project <http://sipe.sourceforge.net/>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Interface dependencies:
+ *
+ * <time.h>
+ * <glib.h>
+ */
+
+/**
+ * Timezone rule, i.e. contents of <StandardTime> or <DaylightTime>
+ *
+ * Biases are in minutes with Windows semantics: UTC = local time + bias
+ */
+struct sipe_tz_rule {
+	int bias;        /* added to the timezone bias, Ex.: -60         */
+	int time;        /* seconds after local midnight, Ex.: 7200      */
+	int day_order;   /* 1..5, 5 = last. Day of month if year != 0    */
+	int month;       /* 1..12, 0 = no daylight savings time          */
+	int day_of_week; /* 0 = Sunday .. 6 = Saturday                   */
+	int year;        /* 0 = recurring rule                           */
+};
+
+/** Compiled timezone */
+struct sipe_tz;
+
+/**
+ * Get compiled timezone
+ *
+ * Timezones with identical rules are shared. Conversions don't modify
+ * any global state, i.e. they are thread-safe.
+ *
+ * @param bias timezone bias in minutes, Ex.: 480
+ * @param std  StandardTime rule
+ * @param dst  DaylightTime rule
+ *
+ * @return timezone. Must be released with sipe_tz_release().
+ */
+struct sipe_tz *sipe_tz_get(int bias,
+			    const struct sipe_tz_rule *std,
+			    const struct sipe_tz_rule *dst);
+
+/**
+ * Release compiled timezone
+ *
+ * @param tz timezone (may be @c NULL)
+ */
+void sipe_tz_release(struct sipe_tz *tz);
+
+/**
+ * Timezone description for debugging, Ex.: UTC-08:00/UTC-07:00
+ *
+ * @param tz timezone
+ */
+const gchar *sipe_tz_name(const struct sipe_tz *tz);
+
+/**
+ * Daylight savings time transitions
+ *
+ * @param tz        timezone
+ * @param time      any time in the year in question
+ * @param dst_start [out] start of daylight savings time
+ * @param std_start [out] start of standard time
+ *
+ * @return @c FALSE if timezone has no daylight savings time
+ */
+gboolean sipe_tz_transitions(const struct sipe_tz *tz,
+			     time_t time,
+			     time_t *dst_start,
+			     time_t *std_start);
+
+/**
+ * Offset of local time to UTC
+ *
+ * @param tz   timezone
+ * @param time UTC time
+ *
+ * @return seconds, Ex.: -28800 for UTC-08:00
+ */
+int sipe_tz_offset(const struct sipe_tz *tz,
+		   time_t time);
+
+/**
+ * Same as localtime_r() in a given timezone
+ *
+ * @param tz   timezone
+ * @param time UTC time
+ * @param tm   [out] local time
+ */
+void sipe_tz_localtime(const struct sipe_tz *tz,
+		       time_t time,
+		       struct tm *tm);
+
+/**
+ * Same as mktime() in a given timezone
+ *
+ * Ignores tm_isdst. Fields of @c tm are normalized.
+ *
+ * @param tz timezone
+ * @param tm local time
+ *
+ * @return UTC time
+ */
+time_t sipe_tz_mktime(const struct sipe_tz *tz,
+		      struct tm *tm);
+
+/**
+ * Same as gmtime_r()
+ *
+ * @param time UTC time
+ * @param tm   [out] broken down UTC time
+ */
+void sipe_tz_gmtime(time_t time,
+		    struct tm *tm);
+
+/**
+ * Same as timegm(), which is not available on all platforms
+ *
+ * Fields of @c tm are normalized.
+ *
+ * @param tm broken down UTC time
+ *
+ * @return UTC time
+ */
+time_t sipe_tz_timegm(struct tm *tm);
@@ -0,0 +1,240 @@
+/**
+ * @file sipe-utils-tests.c
+ *
+ * pidgin-sipe
+ *
+ * Copyright (C) 2015 SIPE Project <http://sipe.sourceforge.net/>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* Tests & micro benchmarks for sipe-utils.c */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "sipe-common.h"
+#include "sipe-backend.h"
+#include "sipe-core.h"
+#include "sipe-utils.h"
+
+/*
+ * Tester code
+ */
+static guint succeeded = 0;
+static guint failed    = 0;
+
+static void test_normalize(const gchar *uri,
+			   const gchar *expected)
+{
+	gchar *normalized = sipe_utils_uri_normalize(uri);
+
+	if (sipe_strequal(normalized, expected)) {
+		succeeded++;
+	} else {
+		printf("FAILED normalize '%s': '%s' (expected '%s')\n",
+		       uri,
+		       normalized ? normalized : "<NULL>",
+		       expected   ? expected   : "<NULL>");
+		failed++;
+	}
+
+	g_free(normalized);
+}
+
+/* must match g_str_hash() on the lower case string */
+static void test_strcase_hash(const gchar *string)
+{
+	gchar *lower = g_ascii_strdown(string, -1);
+	gsize split  = strlen(string) / 2;
+	guint hash   = sipe_utils_ascii_strcase_hash_add(SIPE_UTILS_ASCII_STRCASE_HASH_INIT,
+							 string,
+							 split);
+	hash = sipe_utils_ascii_strcase_hash_add(hash,
+						 string + split,
+						 strlen(string) - split);
+
+	if ((sipe_utils_ascii_strcase_hash(string) == g_str_hash(lower)) &&
+	    (hash == g_str_hash(lower))) {
+		succeeded++;
+	} else {
+		printf("FAILED strcase hash '%s'\n", string);
+		failed++;
+	}
+
+	g_free(lower);
+}
+
+/* previous implementation of the buddy URI hash table */
+static guint test_hash_nick(const char *nick)
+{
+	char *lc = g_utf8_strdown(nick, -1);
+	guint bucket = g_str_hash(lc);
+	g_free(lc);
+
+	return bucket;
+}
+
+static gboolean test_equals_nick(const char *nick1, const char *nick2)
+{
+	char *nick1_norm = NULL;
+	char *nick2_norm = NULL;
+	gboolean equal;
+
+	if (nick1 == NULL && nick2 == NULL) return TRUE;
+	if (nick1 == NULL || nick2 == NULL    ||
+	    !g_utf8_validate(nick1, -1, NULL) ||
+	    !g_utf8_validate(nick2, -1, NULL)) return FALSE;
+
+	nick1_norm = g_utf8_casefold(nick1, -1);
+	nick2_norm = g_utf8_casefold(nick2, -1);
+	equal = g_utf8_collate(nick1_norm, nick2_norm) == 0;
+	g_free(nick2_norm);
+	g_free(nick1_norm);
+
+	return equal;
+}
+
+/* same as sipe_buddy_find_by_uri() */
+static gpointer test_find_by_uri(GHashTable *table,
+				 const gchar *uri)
+{
+	gchar *normalized = sipe_utils_uri_normalize(uri);
+	gpointer value = g_hash_table_lookup(table,
+					     normalized ? normalized : uri);
+	g_free(normalized);
+	return(value);
+}
+
+static void test_find_benchmark(guint buddies, guint rounds)
+{
+	GHashTable *nick = g_hash_table_new_full((GHashFunc)  test_hash_nick,
+						 (GEqualFunc) test_equals_nick,
+						 g_free,
+						 NULL);
+	GHashTable *normalized = g_hash_table_new_full(g_str_hash,
+						       g_str_equal,
+						       g_free,
+						       NULL);
+	gchar **lookup = g_new(gchar *, buddies);
+	gchar **mixed  = g_new(gchar *, buddies);
+	GTimer *timer  = g_timer_new();
+	guint found_nick = 0, found_normalized = 0, found_mixed = 0;
+	gdouble elapsed_nick, elapsed_normalized, elapsed_mixed;
+	guint i, round;
+
+	for (i = 0; i < buddies; i++) {
+		gchar *uri = g_strdup_printf("sip:user%05u@example.com", i);
+		g_hash_table_insert(nick,       g_strdup(uri), GUINT_TO_POINTER(i + 1));
+		g_hash_table_insert(normalized, g_strdup(uri), GUINT_TO_POINTER(i + 1));
+		lookup[i] = uri;
+		mixed[i]  = g_strdup_printf("sip:User%05u@Example.COM", i);
+	}
+
+	g_timer_start(timer);
+	for (round = 0; round < rounds; round++)
+		for (i = 0; i < buddies; i++)
+			if (g_hash_table_lookup(nick, lookup[i]))
+				found_nick++;
+	elapsed_nick = g_timer_elapsed(timer, NULL);
+
+	g_timer_start(timer);
+	for (round = 0; round < rounds; round++)
+		for (i = 0; i < buddies; i++)
+			if (test_find_by_uri(normalized, lookup[i]))
+				found_normalized++;
+	elapsed_normalized = g_timer_elapsed(timer, NULL);
+
+	g_timer_start(timer);
+	for (round = 0; round < rounds; round++)
+		for (i = 0; i < buddies; i++)
+			if (test_find_by_uri(normalized, mixed[i]))
+				found_mixed++;
+	elapsed_mixed = g_timer_elapsed(timer, NULL);
+
+	if ((found_nick       == buddies * rounds) &&
+	    (found_normalized == buddies * rounds) &&
+	    (found_mixed      == buddies * rounds)) {
+		succeeded++;
+	} else {
+		printf("FAILED find benchmark: %u/%u/%u found (expected %u)\n",
+		       found_nick, found_normalized, found_mixed,
+		       buddies * rounds);
+		failed++;
+	}
+
+	printf("%-32s %8.3f ms %12.1f lookups/s\n",
+	       "find by URI (casefold hash)",
+	       elapsed_nick * 1000,
+	       elapsed_nick > 0 ? buddies * rounds / elapsed_nick : 0);
+	printf("%-32s %8.3f ms %12.1f lookups/s\n",
+	       "find by URI (normalized)",
+	       elapsed_normalized * 1000,
+	       elapsed_normalized > 0 ? buddies * rounds / elapsed_normalized : 0);
+	printf("%-32s %8.3f ms %12.1f lookups/s\n",
+	       "find by URI (mixed case input)",
+	       elapsed_mixed * 1000,
+	       elapsed_mixed > 0 ? buddies * rounds / elapsed_mixed : 0);
+
+	g_timer_destroy(timer);
+	for (i = 0; i < buddies; i++) {
+		g_free(mixed[i]);
+		g_free(lookup[i]);
+	}
+	g_free(mixed);
+	g_free(lookup);
+	g_hash_table_destroy(normalized);
+	g_hash_table_destroy(nick);
+}
+
+int main(SIPE_UNUSED_PARAMETER int argc, SIPE_UNUSED_PARAMETER char *argv[])
+{
+	/* already normalized */
+	test_normalize("sip:user@example.com",          NULL);
+	test_normalize("",                              NULL);
+	test_normalize("sip:j\xc3\xb6rg@example.com",   NULL);
+	/* ASCII */
+	test_normalize("sip:User@Example.COM",          "sip:user@example.com");
+	test_normalize("SIP:USER@EXAMPLE.COM",          "sip:user@example.com");
+	/* UTF-8 */
+	test_normalize("sip:J\xc3\x96RG@example.com",   "sip:j\xc3\xb6rg@example.com");
+	test_normalize("sip:J\xc3\xb6rg@example.com",   "sip:j\xc3\xb6rg@example.com");
+	/* invalid UTF-8 */
+	test_normalize("sip:J\xc3@example.com",         "sip:j\xc3@example.com");
+	test_normalize("sip:j\xc3@Example.com",         "sip:j\xc3@example.com");
+	test_normalize("sip:j\xc3@example.com",         NULL);
+
+	test_strcase_hash("");
+	test_strcase_hash("sip:user@example.com");
+	test_strcase_hash("SIP:User@Example.COM");
+	test_strcase_hash("3 INVITE");
+
+	test_find_benchmark(10000, 20);
+
+	printf("Result: %u PASSED %u FAILED\n", succeeded, failed);
+	return(failed);
+}
+
+/*
+  Local Variables:
+  mode: c
+  c-file-style: "bsd"
+  indent-tabs-mode: t
+  tab-width: 8
+  End:
+*/
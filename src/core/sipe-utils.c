@@ -299,7 +299,11 @@ void sipe_utils_message_debug(const gchar *type,
 			      const gchar *body,
 			      gboolean sending)
 {
-	if (sipe_backend_debug_enabled()) {
+	guint category = sipe_strequal(type, "HTTP") ?
+		SIPE_DEBUG_CATEGORY_HTTP :
+		SIPE_DEBUG_CATEGORY_TRANSPORT;
+
+	if (SIPE_DEBUG_IS_ENABLED(category)) {
 		GString *str         = g_string_new("");
 		GTimeVal currtime;
 		gchar *time_str;
@@ -321,7 +325,7 @@ void sipe_utils_message_debug(const gchar *type,
 		}
 		g_string_append_printf(str, "MESSAGE END %s %s - %s", marker, type, time_str);
 		g_free(time_str);
-		SIPE_DEBUG_INFO_NOFORMAT(str->str);
+		sipe_backend_debug_literal(SIPE_DEBUG_LEVEL_INFO, str->str);
 		g_string_free(str, TRUE);
 	}
 }
@@ -557,12 +561,128 @@ gchar *sipe_utils_str_replace(const gchar *string,
 	return result;
 }
 
+/* smallest receive buffer allocation */
+#define TRANSPORT_BUFFER_MINIMUM 4096
+
+static void transport_buffer_replace(struct sipe_transport_connection *conn,
+				     gsize allocate)
+{
+	gchar *start = g_malloc(allocate);
+
+	/* only the unread data is carried over */
+	if (conn->buffer_used)
+		memcpy(start, conn->buffer, conn->buffer_used);
+	start[conn->buffer_used] = '\0';
+
+	g_free(conn->buffer_start);
+	conn->buffer_start  = start;
+	conn->buffer        = start;
+	conn->buffer_length = allocate;
+}
+
+void sipe_core_transport_buffer_reserve(struct sipe_transport_connection *conn,
+					gsize size)
+{
+	/* string terminator is not included in buffer_used */
+	gsize needed = conn->buffer_used + size + 1;
+	gsize consumed, allocated;
+
+	if (conn->buffer_length >= needed)
+		return;
+
+	consumed  = conn->buffer - conn->buffer_start;
+	allocated = consumed + conn->buffer_length;
+
+	/*
+	 * Reclaim consumed space only if it is at least as large as the data
+	 * to move. Each byte is therefore moved at most once on average.
+	 */
+	if ((allocated >= needed) && (consumed >= conn->buffer_used)) {
+		memmove(conn->buffer_start, conn->buffer, conn->buffer_used + 1);
+		conn->buffer        = conn->buffer_start;
+		conn->buffer_length = allocated;
+		return;
+	}
+
+	/* grow geometrically */
+	if (allocated < TRANSPORT_BUFFER_MINIMUM)
+		allocated = TRANSPORT_BUFFER_MINIMUM;
+	while (allocated < needed)
+		allocated *= 2;
+	transport_buffer_replace(conn, allocated);
+	SIPE_DEBUG_INFO("sipe_core_transport_buffer_reserve: new buffer length %" G_GSIZE_FORMAT,
+			allocated);
+}
+
+void sipe_core_transport_buffer_free(struct sipe_transport_connection *conn)
+{
+	g_free(conn->buffer_start);
+	conn->buffer_start  = NULL;
+	conn->buffer        = NULL;
+	conn->buffer_used   = 0;
+	conn->buffer_length = 0;
+}
+
 void sipe_utils_shrink_buffer(struct sipe_transport_connection *conn,
 			      const gchar *unread)
 {
-	conn->buffer_used -= unread - conn->buffer;
-	/* string terminator is not included in buffer_used */
-	memmove(conn->buffer, unread, conn->buffer_used + 1);
+	gsize consumed = unread - conn->buffer;
+
+	conn->buffer_used -= consumed;
+	if (conn->buffer_used == 0) {
+		/* buffer empty: rewind without moving anything */
+		conn->buffer_length += conn->buffer - conn->buffer_start;
+		conn->buffer         = conn->buffer_start;
+		conn->buffer[0]      = '\0';
+	} else {
+		conn->buffer        += consumed;
+		conn->buffer_length -= consumed;
+	}
+}
+
+void sipe_utils_realign_buffer(struct sipe_transport_connection *conn,
+			       gsize length)
+{
+	if (conn->buffer != conn->buffer_start) {
+		gsize consumed = conn->buffer - conn->buffer_start;
+		/* string terminator is not included in buffer_used */
+		memmove(conn->buffer_start, conn->buffer, conn->buffer_used + 1);
+		conn->buffer         = conn->buffer_start;
+		conn->buffer_length += consumed;
+	}
+
+	if (length > conn->buffer_used)
+		sipe_core_transport_buffer_reserve(conn,
+						   length - conn->buffer_used);
+}
+
+gchar *sipe_utils_take_buffer(struct sipe_transport_connection *conn,
+			      gsize length)
+{
+	gchar *block;
+
+	if (conn->buffer != conn->buffer_start) {
+		block = g_malloc(length + 1);
+		memcpy(block, conn->buffer, length);
+		block[length] = '\0';
+		sipe_utils_shrink_buffer(conn, conn->buffer + length);
+		return(block);
+	}
+
+	/* hand over allocation, continue with a copy of the remaining data */
+	block               = conn->buffer_start;
+	conn->buffer_start  = NULL;
+	conn->buffer       += length;
+	conn->buffer_used  -= length;
+	transport_buffer_replace(conn,
+				 MAX(conn->buffer_used + 1,
+				     TRANSPORT_BUFFER_MINIMUM));
+
+	/* overwrites the first byte of the remaining data */
+	block[length] = '\0';
+
+	/* release unused space at the end, usually without copying */
+	return(g_realloc(block, length + 1));
 }
 
 gboolean sipe_utils_ip_is_private(const char *ip)
@@ -577,6 +697,50 @@ gchar *sipe_utils_presence_key(const gchar *uri)
 	return g_strdup_printf("<presence><%s>", uri);
 }
 
+gchar *sipe_utils_uri_normalize(const gchar *uri)
+{
+	const guchar *p;
+	gboolean upper = FALSE;
+	gboolean checked = FALSE;
+
+	for (p = (const guchar *) uri; *p; p++) {
+		if (*p & 0x80) {
+			/* non-ASCII: slow path */
+			if (!checked) {
+				checked = TRUE;
+				if (g_utf8_validate(uri, -1, NULL)) {
+					gchar *normalized = g_utf8_strdown(uri, -1);
+					if (strcmp(uri, normalized))
+						return(normalized);
+					g_free(normalized);
+					return(NULL);
+				}
+			}
+			/* invalid UTF-8: ASCII characters only */
+		} else if (g_ascii_isupper(*p)) {
+			upper = TRUE;
+		}
+	}
+
+	return(upper ? g_ascii_strdown(uri, -1) : NULL);
+}
+
+guint sipe_utils_ascii_strcase_hash_add(guint hash,
+					const gchar *string,
+					gsize length)
+{
+	while (length--)
+		hash = (hash << 5) + hash + g_ascii_tolower(*string++);
+	return(hash);
+}
+
+guint sipe_utils_ascii_strcase_hash(gconstpointer key)
+{
+	return(sipe_utils_ascii_strcase_hash_add(SIPE_UTILS_ASCII_STRCASE_HASH_INIT,
+						 key,
+						 strlen(key)));
+}
+
 gchar *
 sipe_utils_uri_unescape(const gchar *string)
 {
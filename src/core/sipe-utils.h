@@ -443,11 +443,41 @@ gchar *sipe_utils_str_replace(const gchar *string,
 /**
  * Remove read characters from transport buffer
  *
+ * Only advances the read position, i.e. the remaining data is not moved.
+ *
  * @param conn   the transport connection
  * @param unread pointer to the first character in the buffer
  */
 void sipe_utils_shrink_buffer(struct sipe_transport_connection *conn,
 			      const gchar *unread);
+
+/**
+ * Prepare transport buffer for receiving a large block in place
+ *
+ * Moves the unread data to the start of the allocation and makes room for
+ * @c length bytes of unread data, so that sipe_utils_take_buffer() can
+ * later hand over the block without copying it.
+ *
+ * @param conn   the transport connection
+ * @param length expected length of the block
+ */
+void sipe_utils_realign_buffer(struct sipe_transport_connection *conn,
+			       gsize length);
+
+/**
+ * Take block from the start of the transport buffer
+ *
+ * If the block starts at the beginning of the allocation, e.g. after
+ * sipe_utils_realign_buffer(), the allocation itself is returned and only
+ * the data following the block is copied to a new buffer.
+ *
+ * @param conn   the transport connection
+ * @param length length of the block, must not exceed @c conn->buffer_used
+ *
+ * @return zero-terminated block. Must be g_free()'d after use.
+ */
+gchar *sipe_utils_take_buffer(struct sipe_transport_connection *conn,
+			      gsize length);
 /**
  * Checks whether given IP address belongs to private block as defined in RFC1918
  *
@@ -465,6 +495,43 @@ gboolean sipe_utils_ip_is_private(const char *ip);
  */
 gchar *sipe_utils_presence_key(const gchar *uri);
 
+/**
+ * Normalize URI for case-insensitive comparison: lower case for pure
+ * ASCII URIs, UTF-8 lower case if the URI contains non-ASCII characters.
+ *
+ * @param uri URI (must not be @c NULL)
+ *
+ * @return @c NULL if @c uri is already normalized, otherwise the normalized
+ *         URI. Must be g_free()'d after use.
+ */
+gchar *sipe_utils_uri_normalize(const gchar *uri);
+
+/**
+ * Case-insensitive variant of g_str_hash() for ASCII strings.
+ * Can be used as @c GHashFunc together with g_ascii_strcasecmp().
+ *
+ * @param key string (must not be @c NULL)
+ *
+ * @return hash value
+ */
+guint sipe_utils_ascii_strcase_hash(gconstpointer key);
+
+/**
+ * Continue sipe_utils_ascii_strcase_hash() with @c length bytes from
+ * @c string, e.g. to hash a key made of several strings. Start with
+ * @c hash = @c SIPE_UTILS_ASCII_STRCASE_HASH_INIT.
+ *
+ * @param hash   hash value of previous data
+ * @param string data to add (need not be NUL-terminated)
+ * @param length number of bytes in @c string
+ *
+ * @return hash value
+ */
+#define SIPE_UTILS_ASCII_STRCASE_HASH_INIT 5381
+guint sipe_utils_ascii_strcase_hash_add(guint hash,
+					const gchar *string,
+					gsize length);
+
 /**
  * Decodes a URI into a plain string.
  *
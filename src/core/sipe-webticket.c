@@ -28,15 +28,28 @@
  *     http://ecn.channel9.msdn.com/o9/te/Europe/2010/pptx/unc310.pptx
  */
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
 #include <string.h>
 #include <time.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
 
 #include <glib.h>
+#include <glib/gstdio.h>
 
 #include "sipe-common.h"
+#define SIPE_DEBUG_CATEGORY SIPE_DEBUG_CATEGORY_HTTP
 #include "sipe-backend.h"
 #include "sipe-core.h"
 #include "sipe-core-private.h"
+#include "sipe-crypt.h"
 #include "sipe-digest.h"
 #include "sipe-svc.h"
 #include "sipe-tls.h"
@@ -44,6 +57,35 @@
 #include "sipe-utils.h"
 #include "sipe-xml.h"
 
+/*
+ * Persistent token cache, enabled by the user with an account option
+ *
+ * One file per account in the user cache directory:
+ *
+ *   magic | salt | nonce | AES-128-CTR encrypted GKeyFile | HMAC-SHA1
+ *
+ * Keys are derived from the password with PBKDF2-HMAC-SHA1 and a random
+ * salt per file, i.e. the cache can't be used with Single Sign-On and
+ * becomes invalid when the password changes. The high iteration count
+ * slows down offline password guessing against a stolen cache file.
+ * The file is only accessible by the user.
+ */
+#define WEBTICKET_CACHE_MAGIC        "SIPEWT02"
+#define WEBTICKET_CACHE_MAGIC_LENGTH 8
+#define WEBTICKET_CACHE_SALT_LENGTH  16
+#define WEBTICKET_CACHE_NONCE_LENGTH 16
+#define WEBTICKET_CACHE_HEADER_LENGTH (WEBTICKET_CACHE_MAGIC_LENGTH + \
+				       WEBTICKET_CACHE_SALT_LENGTH  + \
+				       WEBTICKET_CACHE_NONCE_LENGTH)
+#define WEBTICKET_CACHE_ITERATIONS   100000
+#define WEBTICKET_CACHE_BLOCK_LENGTH 16 /* AES */
+#define WEBTICKET_CACHE_KEY_LENGTH   16 /* AES-128 */
+#define WEBTICKET_CACHE_GROUP_ADFS   "ADFS"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
 struct webticket_queued_data {
 	sipe_webticket_callback *callback;
 	gpointer callback_data;
@@ -90,6 +132,18 @@ struct sipe_webticket {
 	gchar *adfs_token;
 	time_t adfs_token_expires;
 
+	/* persistent cache, cache_file is NULL if disabled */
+	gboolean cache_initialized;
+	gchar *cache_file;
+	guchar cache_salt[WEBTICKET_CACHE_SALT_LENGTH];
+	guchar cache_encrypt_key[SIPE_DIGEST_HMAC_SHA1_LENGTH];
+	guchar cache_mac_key[SIPE_DIGEST_HMAC_SHA1_LENGTH];
+
+	/* statistics */
+	guint cache_hits;
+	guint cache_misses;
+	guint cache_loaded;
+
 	gboolean retrieved_realminfo;
 	gboolean shutting_down;
 };
@@ -103,6 +157,14 @@ void sipe_webticket_free(struct sipe_core_private *sipe_private)
 	/* Web Ticket stack is shutting down: reject all new requests */
 	webticket->shutting_down = TRUE;
 
+	SIPE_DEBUG_INFO("sipe_webticket_free: cache hits %u misses %u, %u tokens loaded from disk",
+			webticket->cache_hits,
+			webticket->cache_misses,
+			webticket->cache_loaded);
+
+	memset(webticket->cache_encrypt_key, 0, sizeof(webticket->cache_encrypt_key));
+	memset(webticket->cache_mac_key,     0, sizeof(webticket->cache_mac_key));
+	g_free(webticket->cache_file);
 	g_free(webticket->webticket_adfs_uri);
 	g_free(webticket->adfs_token);
 	if (webticket->pending)
@@ -157,10 +219,11 @@ static void cache_token(struct sipe_core_private *sipe_private,
 static const struct webticket_token *cache_hit(struct sipe_core_private *sipe_private,
 					       const gchar *service_uri)
 {
+	struct sipe_webticket *webticket = sipe_private->webticket;
 	const struct webticket_token *wt;
 
 	/* make sure a cached Web Ticket is still valid for 60 seconds */
-	wt = g_hash_table_lookup(sipe_private->webticket->cache,
+	wt = g_hash_table_lookup(webticket->cache,
 				 service_uri);
 	if (wt && (wt->expires < time(NULL) + 60)) {
 		SIPE_DEBUG_INFO("cache_hit: cached token for URI %s has expired",
@@ -168,9 +231,394 @@ static const struct webticket_token *cache_hit(struct sipe_core_private *sipe_pr
 		wt = NULL;
 	}
 
+	if (wt)
+		webticket->cache_hits++;
+	else
+		webticket->cache_misses++;
+
 	return(wt);
 }
 
+/* AES-128-CTR: encryption and decryption are the same operation */
+static void cache_crypt(struct sipe_webticket *webticket,
+			const guchar *nonce,
+			const guchar *in,
+			gsize length,
+			guchar *out)
+{
+	guchar counter[WEBTICKET_CACHE_BLOCK_LENGTH];
+	guchar stream[WEBTICKET_CACHE_BLOCK_LENGTH];
+	guchar iv[WEBTICKET_CACHE_BLOCK_LENGTH];
+	guint32 block = 0;
+	gsize offset;
+
+	/* CBC with zero IV on a single block is the plain block cipher */
+	memset(iv, 0, sizeof(iv));
+	memcpy(counter, nonce, sizeof(counter));
+
+	for (offset = 0; offset < length; offset += sizeof(stream), block++) {
+		gsize i, n = MIN(sizeof(stream), length - offset);
+
+		counter[12] = nonce[12] ^ (block >> 24);
+		counter[13] = nonce[13] ^ (block >> 16);
+		counter[14] = nonce[14] ^ (block >>  8);
+		counter[15] = nonce[15] ^  block;
+		sipe_crypt_tls_block(webticket->cache_encrypt_key,
+				     WEBTICKET_CACHE_KEY_LENGTH,
+				     iv, sizeof(iv),
+				     counter, sizeof(counter),
+				     stream);
+
+		for (i = 0; i < n; i++)
+			out[offset + i] = in[offset + i] ^ stream[i];
+	}
+}
+
+static void cache_save_token(const gchar *service_uri,
+			     struct webticket_token *wt,
+			     GKeyFile *keyfile)
+{
+	/* no need to save tokens that can't be used anymore */
+	if (wt->expires >= time(NULL) + 60) {
+		gchar *expires = sipe_utils_time_to_str(wt->expires);
+		g_key_file_set_string(keyfile, service_uri, "auth_uri", wt->auth_uri);
+		g_key_file_set_string(keyfile, service_uri, "token",    wt->token);
+		g_key_file_set_string(keyfile, service_uri, "expires",  expires);
+		g_free(expires);
+	}
+}
+
+/*
+ * Write via temporary file with restricted permissions. g_file_set_contents()
+ * would create the file with the default permissions from the umask.
+ */
+static gboolean cache_write(const gchar *file,
+			    const guchar *buffer,
+			    gsize length)
+{
+	gchar *dir = g_path_get_dirname(file);
+	gchar *tmp = g_strdup_printf("%s.tmp", file);
+	gboolean ok = FALSE;
+	int fd;
+
+	/* directory is only accessible by the user, even if it already existed */
+	g_mkdir_with_parents(dir, 0700);
+	g_chmod(dir, 0700);
+	g_free(dir);
+
+	/* never reuse a left-over temporary file with other permissions */
+	g_unlink(tmp);
+	fd = g_open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_BINARY, 0600);
+	if (fd >= 0) {
+		FILE *stream = fdopen(fd, "wb");
+
+		if (stream) {
+			ok = (fwrite(buffer, 1, length, stream) == length);
+			ok = (fclose(stream) == 0) && ok;
+		} else {
+			close(fd);
+		}
+
+		if (ok)
+			ok = (g_rename(tmp, file) == 0);
+		if (!ok)
+			g_unlink(tmp);
+	}
+
+	if (!ok)
+		SIPE_DEBUG_ERROR("cache_write: can't write %s: %s",
+				 file, g_strerror(errno));
+
+	g_free(tmp);
+	return(ok);
+}
+
+static void cache_save(struct sipe_webticket *webticket)
+{
+	GKeyFile *keyfile;
+	gchar *data;
+	gsize length;
+
+	if (!webticket->cache_file)
+		return;
+
+	keyfile = g_key_file_new();
+	g_hash_table_foreach(webticket->cache,
+			     (GHFunc) cache_save_token,
+			     keyfile);
+	if (webticket->adfs_token &&
+	    webticket->webticket_adfs_uri &&
+	    (webticket->adfs_token_expires >= time(NULL) + 60)) {
+		gchar *expires = sipe_utils_time_to_str(webticket->adfs_token_expires);
+		g_key_file_set_string(keyfile, WEBTICKET_CACHE_GROUP_ADFS, "uri",     webticket->webticket_adfs_uri);
+		g_key_file_set_string(keyfile, WEBTICKET_CACHE_GROUP_ADFS, "token",   webticket->adfs_token);
+		g_key_file_set_string(keyfile, WEBTICKET_CACHE_GROUP_ADFS, "expires", expires);
+		g_free(expires);
+	}
+	data = g_key_file_to_data(keyfile, &length, NULL);
+	g_key_file_free(keyfile);
+
+	if (data) {
+		gsize header   = WEBTICKET_CACHE_HEADER_LENGTH;
+		gsize total    = header + length + SIPE_DIGEST_HMAC_SHA1_LENGTH;
+		guchar *buffer = g_malloc(total);
+		guchar *nonce  = buffer + WEBTICKET_CACHE_MAGIC_LENGTH + WEBTICKET_CACHE_SALT_LENGTH;
+
+		memcpy(buffer, WEBTICKET_CACHE_MAGIC, WEBTICKET_CACHE_MAGIC_LENGTH);
+		memcpy(buffer + WEBTICKET_CACHE_MAGIC_LENGTH,
+		       webticket->cache_salt,
+		       WEBTICKET_CACHE_SALT_LENGTH);
+		if (sipe_crypt_random(nonce, WEBTICKET_CACHE_NONCE_LENGTH)) {
+			cache_crypt(webticket,
+				    nonce,
+				    (guchar *) data,
+				    length,
+				    buffer + header);
+			sipe_digest_hmac_sha1(webticket->cache_mac_key,
+					      SIPE_DIGEST_HMAC_SHA1_LENGTH,
+					      buffer,
+					      header + length,
+					      buffer + header + length);
+
+			if (cache_write(webticket->cache_file, buffer, total))
+				SIPE_DEBUG_INFO("cache_save: saved %u tokens to %s",
+						g_hash_table_size(webticket->cache),
+						webticket->cache_file);
+		} else {
+			SIPE_DEBUG_ERROR_NOFORMAT("cache_save: can't generate nonce");
+		}
+
+		memset(data, 0, length);
+		g_free(buffer);
+		g_free(data);
+	}
+}
+
+/* buffer has been checked by cache_read() and is owned by the caller */
+static void cache_load(struct sipe_core_private *sipe_private,
+		       const gchar *buffer,
+		       gsize total)
+{
+	struct sipe_webticket *webticket = sipe_private->webticket;
+	gsize header = WEBTICKET_CACHE_HEADER_LENGTH;
+	guchar mac[SIPE_DIGEST_HMAC_SHA1_LENGTH];
+	GKeyFile *keyfile;
+	gchar *data;
+	gchar **groups, **group;
+	gsize length;
+	time_t valid = time(NULL) + 60;
+
+	length = total - header - SIPE_DIGEST_HMAC_SHA1_LENGTH;
+	sipe_digest_hmac_sha1(webticket->cache_mac_key,
+			      SIPE_DIGEST_HMAC_SHA1_LENGTH,
+			      (guchar *) buffer,
+			      header + length,
+			      mac);
+	if (memcmp(mac, buffer + header + length, sizeof(mac))) {
+		/* password has changed or file was tampered with */
+		SIPE_DEBUG_INFO("cache_load: discarding %s",
+				webticket->cache_file);
+		return;
+	}
+
+	data = g_malloc(length + 1);
+	cache_crypt(webticket,
+		    (guchar *) buffer + WEBTICKET_CACHE_MAGIC_LENGTH + WEBTICKET_CACHE_SALT_LENGTH,
+		    (guchar *) buffer + header,
+		    length,
+		    (guchar *) data);
+	data[length] = '\0';
+
+	keyfile = g_key_file_new();
+	if (g_key_file_load_from_data(keyfile, data, length, G_KEY_FILE_NONE, NULL)) {
+		groups = g_key_file_get_groups(keyfile, NULL);
+		for (group = groups; *group; group++) {
+			gchar *uri     = g_key_file_get_string(keyfile, *group, "auth_uri", NULL);
+			gchar *token   = g_key_file_get_string(keyfile, *group, "token",    NULL);
+			gchar *expires = g_key_file_get_string(keyfile, *group, "expires",  NULL);
+			time_t timeout = expires ? sipe_utils_str_to_time(expires) : 0;
+
+			if (sipe_strequal(*group, WEBTICKET_CACHE_GROUP_ADFS)) {
+				g_free(uri);
+				uri = g_key_file_get_string(keyfile, *group, "uri", NULL);
+				if (uri && token && (timeout >= valid)) {
+					SIPE_DEBUG_INFO("cache_load: ADFS token for %s",
+							uri);
+					webticket->webticket_adfs_uri  = uri;
+					webticket->adfs_token          = token;
+					webticket->adfs_token_expires  = timeout;
+					webticket->retrieved_realminfo = TRUE;
+					uri = token = NULL;
+				}
+			} else if (uri && token && (timeout >= valid)) {
+				SIPE_DEBUG_INFO("cache_load: token for URI %s",
+						*group);
+				/* cache takes ownership of token */
+				cache_token(sipe_private,
+					    *group,
+					    uri,
+					    token,
+					    timeout);
+				webticket->cache_loaded++;
+				token = NULL;
+			}
+
+			g_free(expires);
+			g_free(token);
+			g_free(uri);
+		}
+		g_strfreev(groups);
+	}
+	g_key_file_free(keyfile);
+
+	memset(data, 0, length);
+	g_free(data);
+}
+
+/* returns file contents if it is a token cache, NULL otherwise */
+static gchar *cache_read(const gchar *file,
+			 gsize *total)
+{
+	gchar *buffer;
+
+	if (!g_file_get_contents(file, &buffer, total, NULL))
+		return(NULL);
+
+	if ((*total < WEBTICKET_CACHE_HEADER_LENGTH + SIPE_DIGEST_HMAC_SHA1_LENGTH) ||
+	    memcmp(buffer, WEBTICKET_CACHE_MAGIC, WEBTICKET_CACHE_MAGIC_LENGTH)) {
+		SIPE_DEBUG_ERROR("cache_read: %s is not a token cache",
+				 file);
+		g_free(buffer);
+		return(NULL);
+	}
+
+	return(buffer);
+}
+
+/* PBKDF2-HMAC-SHA1 (RFC 2898), one output block */
+static void cache_pbkdf2_block(gpointer hmac,
+			       const guchar *salt,
+			       gsize salt_length,
+			       guint iterations,
+			       guint32 index,
+			       guchar *block)
+{
+	guchar u[SIPE_DIGEST_HMAC_SHA1_LENGTH];
+	guchar counter[4];
+	guint i, j;
+
+	counter[0] = index >> 24;
+	counter[1] = index >> 16;
+	counter[2] = index >>  8;
+	counter[3] = index;
+
+	sipe_digest_hmac_update(hmac, salt, salt_length);
+	sipe_digest_hmac_update(hmac, counter, sizeof(counter));
+	sipe_digest_hmac_end(hmac, u);
+	memcpy(block, u, sizeof(u));
+
+	for (i = 1; i < iterations; i++) {
+		sipe_digest_hmac_update(hmac, u, sizeof(u));
+		sipe_digest_hmac_end(hmac, u);
+		for (j = 0; j < sizeof(u); j++)
+			block[j] ^= u[j];
+	}
+
+	memset(u, 0, sizeof(u));
+}
+
+static void cache_derive_keys(struct sipe_webticket *webticket,
+			      const gchar *password)
+{
+	/* 2 blocks: encryption key (16 bytes) | MAC key (20 bytes) */
+	guchar key[2 * SIPE_DIGEST_HMAC_SHA1_LENGTH];
+	gpointer hmac = sipe_digest_hmac_sha1_start((const guchar *) password,
+						    strlen(password));
+
+	cache_pbkdf2_block(hmac,
+			   webticket->cache_salt,
+			   WEBTICKET_CACHE_SALT_LENGTH,
+			   WEBTICKET_CACHE_ITERATIONS,
+			   1,
+			   key);
+	cache_pbkdf2_block(hmac,
+			   webticket->cache_salt,
+			   WEBTICKET_CACHE_SALT_LENGTH,
+			   WEBTICKET_CACHE_ITERATIONS,
+			   2,
+			   key + SIPE_DIGEST_HMAC_SHA1_LENGTH);
+	sipe_digest_hmac_destroy(hmac);
+
+	memcpy(webticket->cache_encrypt_key,
+	       key,
+	       WEBTICKET_CACHE_KEY_LENGTH);
+	memcpy(webticket->cache_mac_key,
+	       key + WEBTICKET_CACHE_KEY_LENGTH,
+	       SIPE_DIGEST_HMAC_SHA1_LENGTH);
+	memset(key, 0, sizeof(key));
+}
+
+/*
+ * Called on first Web Ticket request, not at login: key derivation is
+ * deliberately slow and would otherwise delay the sign-in.
+ */
+static void cache_init(struct sipe_core_private *sipe_private)
+{
+	struct sipe_webticket *webticket = sipe_private->webticket;
+	guchar digest[SIPE_DIGEST_SHA1_LENGTH];
+	gchar *hex, *name, *buffer;
+	gsize total;
+
+	webticket->cache_initialized = TRUE;
+
+	if (!SIPE_CORE_PUBLIC_FLAG_IS(WEBTICKET_CACHE))
+		return;
+
+	if (is_empty(sipe_private->password)) {
+		SIPE_DEBUG_INFO_NOFORMAT("cache_init: persistent cache not supported with Single Sign-On");
+		return;
+	}
+
+	/* file name must not reveal account */
+	name = g_strdup_printf("%s:%s",
+			       sipe_private->username,
+			       sipe_private->authuser);
+	sipe_digest_sha1((const guchar *) name, strlen(name), digest);
+	g_free(name);
+	hex  = buff_to_hex_str(digest, sizeof(digest));
+	name = g_strdup_printf("webticket-%s.cache", hex);
+	g_free(hex);
+	webticket->cache_file = g_build_filename(g_get_user_cache_dir(),
+						 "sipe",
+						 name,
+						 NULL);
+	g_free(name);
+
+	SIPE_DEBUG_INFO("cache_init: %s",
+			webticket->cache_file);
+
+	/* existing file: keys depend on its salt */
+	buffer = cache_read(webticket->cache_file, &total);
+	if (buffer) {
+		memcpy(webticket->cache_salt,
+		       buffer + WEBTICKET_CACHE_MAGIC_LENGTH,
+		       WEBTICKET_CACHE_SALT_LENGTH);
+	} else if (!sipe_crypt_random(webticket->cache_salt,
+				      WEBTICKET_CACHE_SALT_LENGTH)) {
+		SIPE_DEBUG_ERROR_NOFORMAT("cache_init: can't generate salt, persistent cache disabled");
+		g_free(webticket->cache_file);
+		webticket->cache_file = NULL;
+		return;
+	}
+
+	cache_derive_keys(webticket, sipe_private->password);
+
+	if (buffer) {
+		cache_load(sipe_private, buffer, total);
+		g_free(buffer);
+	}
+}
+
 /* frees just the main request data, when this is called "queued" is cleared */
 static void callback_data_free(struct webticket_callback_data *wcd)
 {
@@ -487,6 +935,7 @@ static void webticket_token(struct sipe_core_private *sipe_private,
 					    wcd->service_auth_uri,
 					    wsse_security,
 					    expires);
+				cache_save(sipe_private->webticket);
 				callback_execute(sipe_private,
 						 wcd,
 						 wcd->service_auth_uri,
@@ -503,6 +952,7 @@ static void webticket_token(struct sipe_core_private *sipe_private,
 						 raw);
 
 			if (sipe_private->webticket->adfs_token) {
+				cache_save(sipe_private->webticket);
 
 				SIPE_DEBUG_INFO("webticket_token: received valid SOAP message from ADFS %s",
 						uri);
@@ -897,6 +1347,8 @@ gboolean sipe_webticket_request(struct sipe_core_private *sipe_private,
 
 	sipe_webticket_init(sipe_private);
 	webticket = sipe_private->webticket;
+	if (!webticket->cache_initialized)
+		cache_init(sipe_private);
 
 	if (webticket->shutting_down) {
 		SIPE_DEBUG_ERROR("sipe_webticket_request: new Web Ticket request during shutdown: THIS SHOULD NOT HAPPEN! Debugging information:\n"
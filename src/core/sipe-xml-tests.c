@@ -37,6 +37,8 @@
 #include "sipe-utils.h"
 
 /* stub functions for backend API */
+guint sipe_backend_debug_categories = SIPE_DEBUG_CATEGORY_ALL;
+
 void sipe_backend_debug_literal(sipe_debug_level level,
 				const gchar *msg)
 {
@@ -114,6 +116,20 @@ static const sipe_xml *assert_child(const sipe_xml *xml, const gchar *s, gboolea
 	return(child);
 }
 
+static const sipe_xml *assert_select(const sipe_xml *xml, sipe_xml_selector *selector, gboolean ok)
+{
+	const sipe_xml *child = sipe_xml_select(xml, selector);
+
+	if ((ok && child) || (!ok && !child)) {
+		succeeded++;
+	} else {
+		printf("[%s]\nXML select FAILED: %p '%s'\n",
+		       teststring, xml, selector->path);
+		failed++;
+	}
+	return(child);
+}
+
 static void assert_data(const sipe_xml *xml, const gchar *s)
 {
 	gchar *data = sipe_xml_data(xml);
@@ -220,6 +236,174 @@ static void assert_raw(const gchar *raw,
 }
 
 
+/* streaming mode */
+struct stream_counts {
+	guint lists;
+	guint groups;
+	guint contacts;
+	guint notes;
+	guint errors;
+};
+
+static void stream_list(gpointer user_data, const sipe_xml *node)
+{
+	struct stream_counts *counts = user_data;
+	/* called at start tag: attributes only */
+	if (sipe_xml_int_attribute(node, "deltaNum", 0) != 42 ||
+	    sipe_xml_child(node, "group"))
+		counts->errors++;
+	counts->lists++;
+}
+
+static void stream_group(gpointer user_data, const sipe_xml *node)
+{
+	struct stream_counts *counts = user_data;
+	if (!sipe_xml_attribute(node, "name"))
+		counts->errors++;
+	counts->groups++;
+}
+
+static void stream_contact(gpointer user_data, const sipe_xml *node)
+{
+	static sipe_xml_selector select_note = SIPE_XML_SELECTOR("contactExtension/contactSettings/note");
+	struct stream_counts *counts = user_data;
+	gchar *note = sipe_xml_data(sipe_xml_select(node, &select_note));
+
+	if (!sipe_xml_attribute(node, "uri") ||
+	    sipe_xml_twin(node))
+		counts->errors++;
+	if (note)
+		counts->notes++;
+	g_free(note);
+	counts->contacts++;
+}
+
+static const struct sipe_xml_stream_handler stream_handlers[] = {
+	{ "contactList",         stream_list },
+	{ "contactList/group",   stream_group },
+	{ "contactList/contact", stream_contact },
+	{ NULL,                  NULL }
+};
+
+static void assert_stream(const gchar *s,
+			  gboolean ok,
+			  guint groups,
+			  guint contacts,
+			  guint notes)
+{
+	struct stream_counts counts;
+	gboolean result;
+
+	memset(&counts, 0, sizeof(counts));
+	result = sipe_xml_parse_stream(s, strlen(s), stream_handlers, &counts);
+	teststring = s;
+
+	if ((result == ok)                &&
+	    (counts.lists == 1)           &&
+	    (counts.groups == groups)     &&
+	    (counts.contacts == contacts) &&
+	    (counts.notes == notes)       &&
+	    (counts.errors == 0)) {
+		succeeded++;
+	} else {
+		printf("[%s]\nXML stream FAILED: %d %u lists %u groups %u contacts %u notes %u errors\n",
+		       teststring, result,
+		       counts.lists, counts.groups, counts.contacts,
+		       counts.notes, counts.errors);
+		failed++;
+	}
+}
+
+/* representative large roaming contacts document */
+static GString *benchmark_contact_list(guint groups, guint contacts)
+{
+	GString *xml = g_string_new("<contactList deltaNum=\"42\" xmlns=\"http://schemas.microsoft.com/2006/09/sip/roaming-contacts\">");
+	guint i;
+
+	for (i = 0; i < groups; i++)
+		g_string_append_printf(xml,
+				       "<group id=\"%u\" name=\"Group &amp; Team %u\" externalURI=\"\"/>",
+				       i + 1, i + 1);
+	for (i = 0; i < contacts; i++)
+		g_string_append_printf(xml,
+				       "<contact uri=\"user%u@example.com\" name=\"User %u\" groups=\"%u %u\" subscribed=\"true\" externalURI=\"\">"
+				       "<contactExtension><contactSettings contactId=\"%08x-0000-0000-0000-000000000000\">"
+				       "<encryption>false</encryption><note>Some notes for user %u</note>"
+				       "</contactSettings></contactExtension></contact>",
+				       i, i, (i % groups) + 1, ((i + 1) % groups) + 1, i, i);
+	g_string_append(xml, "</contactList>");
+
+	return(xml);
+}
+
+static void benchmark_parse(guint rounds)
+{
+	static sipe_xml_selector select_note = SIPE_XML_SELECTOR("contactExtension/contactSettings/note");
+	GString *data = benchmark_contact_list(20, 5000);
+	GTimer *timer = g_timer_new();
+	guint contacts = 0;
+	gdouble elapsed;
+	guint round;
+
+	for (round = 0; round < rounds; round++) {
+		sipe_xml *xml = sipe_xml_parse(data->str, data->len);
+		const sipe_xml *node;
+
+		/* same access pattern as sipe_process_roaming_contacts() */
+		for (node = sipe_xml_child(xml, "contact");
+		     node;
+		     node = sipe_xml_twin(node))
+			if (sipe_xml_attribute(node, "uri") &&
+			    sipe_xml_attribute(node, "groups") &&
+			    sipe_xml_select(node, &select_note))
+				contacts++;
+		sipe_xml_free(xml);
+	}
+
+	elapsed = g_timer_elapsed(timer, NULL);
+	g_timer_destroy(timer);
+
+	if (contacts == 5000 * rounds) {
+		succeeded++;
+	} else {
+		printf("XML benchmark FAILED: %u contacts found, expected %u\n",
+		       contacts, 5000 * rounds);
+		failed++;
+	}
+
+	printf("XML benchmark: %" G_GSIZE_FORMAT " bytes, %u rounds: %.3f ms per document, %.1f MB/s\n",
+	       data->len, rounds,
+	       elapsed * 1000 / rounds,
+	       elapsed > 0 ? (data->len * rounds) / (elapsed * 1024 * 1024) : 0);
+
+	timer = g_timer_new();
+	for (round = 0; round < rounds; round++) {
+		struct stream_counts counts;
+
+		memset(&counts, 0, sizeof(counts));
+		sipe_xml_parse_stream(data->str, data->len,
+				      stream_handlers, &counts);
+		contacts -= counts.notes;
+	}
+	elapsed = g_timer_elapsed(timer, NULL);
+	g_timer_destroy(timer);
+
+	if (contacts == 0) {
+		succeeded++;
+	} else {
+		printf("XML stream benchmark FAILED: %u contacts left\n",
+		       contacts);
+		failed++;
+	}
+
+	printf("XML stream benchmark: %" G_GSIZE_FORMAT " bytes, %u rounds: %.3f ms per document, %.1f MB/s\n",
+	       data->len, rounds,
+	       elapsed * 1000 / rounds,
+	       elapsed > 0 ? (data->len * rounds) / (elapsed * 1024 * 1024) : 0);
+
+	g_string_free(data, TRUE);
+}
+
 /* memory leak check */
 static gsize allocated = 0;
 
@@ -265,6 +449,9 @@ static GMemVTable memory_leak_check = {
 
 int main(SIPE_UNUSED_PARAMETER int argc, SIPE_UNUSED_PARAMETER char **argv)
 {
+	static sipe_xml_selector select_inner    = SIPE_XML_SELECTOR("child/inner/innerinner");
+	static sipe_xml_selector select_missing  = SIPE_XML_SELECTOR("child/inner/missing");
+	static sipe_xml_selector select_too_long = SIPE_XML_SELECTOR("a/b/c/d/e/f/g/h/i");
 	sipe_xml *xml;
 	const sipe_xml *child1, *child2;
 
@@ -369,6 +556,15 @@ int main(SIPE_UNUSED_PARAMETER int argc, SIPE_UNUSED_PARAMETER char **argv)
 	child1 = assert_child(xml, "child/inner/innerinner", TRUE);
 	assert_name(child1, "innerinner");
 	assert_data(child1, "d");
+	child1 = assert_child(xml, "child/inne", FALSE);
+	child1 = assert_child(xml, "child/innerinner", FALSE);
+	child1 = assert_child(xml, "child//inner", FALSE);
+	child1 = assert_select(xml, &select_inner, TRUE);
+	assert_name(child1, "innerinner");
+	child1 = assert_select(xml, &select_inner, TRUE);
+	assert_data(child1, "d");
+	child1 = assert_select(xml, &select_missing, FALSE);
+	child1 = assert_select(xml, &select_too_long, FALSE);
 	assert_stringify(xml, 1, teststring);
 	sipe_xml_free(xml);
 
@@ -390,8 +586,16 @@ int main(SIPE_UNUSED_PARAMETER int argc, SIPE_UNUSED_PARAMETER char **argv)
 	assert_attribute(xml, "b", "abc");
 	assert_attribute(xml, "c", NULL);
 	assert_int_attribute(xml, "d", 100, 200);
-	/* the attribute order depends on glib hashing :-( */
-	assert_stringify(xml, 2, teststring, "<test b=\"abc\" a=\"1\">a</test>");
+	assert_stringify(xml, 1, teststring);
+	sipe_xml_free(xml);
+
+	/* attribute names are case insensitive */
+	xml = assert_parse("<test Name=\"a\" OTHER=\"b\" value=\"x&amp;y&#38;z\"/>", TRUE);
+	assert_attribute(xml, "name", "a");
+	assert_attribute(xml, "NAME", "a");
+	assert_attribute(xml, "Other", "b");
+	assert_attribute(xml, "value", "x&y&z");
+	assert_attribute(xml, "nam", NULL);
 	sipe_xml_free(xml);
 
 	/* attributes with namespace */
@@ -422,6 +626,22 @@ int main(SIPE_UNUSED_PARAMETER int argc, SIPE_UNUSED_PARAMETER char **argv)
 	assert_data(child1, "15500");
 	sipe_xml_free(xml);
 
+	/* duplicates after namespace stripping: last one wins */
+	xml = assert_parse("<t a:x=\"1\" b:X=\"2\" xmlns:a=\"http://a\" xmlns:b=\"http://b\"/>", TRUE);
+	assert_attribute(xml, "x", "2");
+	sipe_xml_free(xml);
+
+	/* partial delete: subtree is detached from its parent */
+	xml = assert_parse("<test><a/><b><c/></b><d/></test>", TRUE);
+	sipe_xml_free((sipe_xml *) assert_child(xml, "b", TRUE));
+	assert_stringify(xml, 1, "<test><a/><d/></test>");
+	sipe_xml_free((sipe_xml *) assert_child(xml, "d", TRUE));
+	assert_stringify(xml, 1, "<test><a/></test>");
+	child1 = assert_child(xml, "a", TRUE);
+	sipe_xml_free((sipe_xml *) child1);
+	assert_stringify(xml, 1, "<test/>");
+	sipe_xml_free(xml);
+
 	/* broken XML */
 	xml = assert_parse("t", FALSE);
 	sipe_xml_free(xml);
@@ -473,6 +693,18 @@ int main(SIPE_UNUSED_PARAMETER int argc, SIPE_UNUSED_PARAMETER char **argv)
 	assert_raw("<ns:tag>data</tag1>",    "tag",     FALSE, NULL);
 	assert_raw("<ns:tag>data</ns:tag1>", "tag",     FALSE, NULL);
 
+	/* streaming mode */
+	assert_stream("<contactList deltaNum=\"42\"/>", TRUE, 0, 0, 0);
+	assert_stream("<contactList deltaNum=\"42\"><group id=\"1\" name=\"a\"/><contact uri=\"b\"/>"
+		      "<unknown><contact uri=\"c\"/></unknown>"
+		      "<contact uri=\"d\"><contactExtension><contactSettings><note>e</note></contactSettings></contactExtension></contact>"
+		      "text<group id=\"2\" name=\"f\"><group/></group></contactList>",
+		      TRUE, 2, 2, 1);
+	assert_stream("<ns:contactList xmlns:ns=\"x\" deltaNum=\"42\"><ns:contact uri=\"b\"/></ns:contactList>", TRUE, 0, 1, 0);
+	assert_stream("<contactList deltaNum=\"42\"><contact uri=\"b\"/><contact>", FALSE, 0, 1, 0);
+
+	benchmark_parse(20);
+
 	if (allocated) {
 		printf("MEMORY LEAK: %" G_GSIZE_FORMAT " still allocated\n", allocated);
 		failed++;
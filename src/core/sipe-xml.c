@@ -34,54 +34,296 @@
 
 #include "glib.h"
 
+#define SIPE_DEBUG_CATEGORY SIPE_DEBUG_CATEGORY_XML
 #include "sipe-backend.h"
 #include "sipe-utils.h"
 #include "sipe-xml.h"
 
+struct _sipe_xml_attribute {
+	const gchar *name;      /* interned */
+	const gchar *value;
+};
+
 struct _sipe_xml {
-	gchar *name;
+	const gchar *name;      /* interned */
 	sipe_xml *parent;
 	sipe_xml *sibling;
 	sipe_xml *first;
 	sipe_xml *last;
-	GString *data;
-	GHashTable *attributes;
+	gchar *data;
+	gsize data_length;
+	/* stored in the same allocation as the node */
+	struct _sipe_xml_attribute *attributes;
+	guint attribute_count;
+};
+
+/*
+ * All nodes, names, attributes and data of a parsed document are
+ * allocated from a bump arena, i.e. the whole tree is released at once.
+ */
+struct _sipe_xml_arena_block {
+	struct _sipe_xml_arena_block *next;
+	gsize size;             /* bytes available after the header */
+	gsize used;
+};
+
+#define ARENA_ALIGN(n)      (((n) + G_MEM_ALIGN - 1) & ~((gsize) G_MEM_ALIGN - 1))
+#define ARENA_HEADER        ARENA_ALIGN(sizeof(struct _sipe_xml_arena_block))
+#define ARENA_BLOCK_MINIMUM 4096
+#define ARENA_BLOCK_MAXIMUM 65536
+#define ARENA_TOP(block)    ((gchar *) (block) + ARENA_HEADER + (block)->used)
+
+struct _sipe_xml_arena {
+	struct _sipe_xml_arena_block *blocks; /* current block first */
+	gchar *last;                          /* most recent allocation */
+};
+
+/* the root node is embedded in the document */
+struct _sipe_xml_document {
+	struct _sipe_xml_arena_block *blocks;
+	sipe_xml root;          /* must be last: attributes follow it */
+};
+#define XML_DOCUMENT(node) ((struct _sipe_xml_document *) ((gchar *) (node) - G_STRUCT_OFFSET(struct _sipe_xml_document, root)))
+
+struct _sipe_xml_arena_mark {
+	struct _sipe_xml_arena_block *block;
+	gsize used;
+	gchar *last;
 };
 
 struct _parser_data {
 	sipe_xml *root;
 	sipe_xml *current;
+	struct _sipe_xml_arena arena;
+	struct _sipe_xml_arena *name_arena;
+	GHashTable *names;      /* string pool for element & attribute names */
 	gboolean error;
+
+	/* streaming mode, see sipe_xml_parse_stream() */
+	const struct sipe_xml_stream_handler *handlers;
+	gpointer user_data;
+	GString *path;          /* path of the current element outside records */
+	const struct sipe_xml_stream_handler *match;
+	sipe_xml *record;       /* element to release when it ends */
+	sipe_xml *record_previous;
+	const struct sipe_xml_stream_handler *record_handler;
+	struct _sipe_xml_arena_mark record_mark;
+	struct _sipe_xml_arena stream_names;
 };
 
-/* our string equal function is case insensitive -> hash must be too! */
-static guint sipe_ascii_strdown_hash(gconstpointer key)
+/* allocates @size bytes with at least @reserve bytes available at the top */
+static gpointer arena_alloc_reserve(struct _sipe_xml_arena *arena,
+				    gsize size,
+				    gsize reserve)
+{
+	struct _sipe_xml_arena_block *block = arena->blocks;
+	gchar *memory;
+
+	size    = ARENA_ALIGN(size);
+	reserve = ARENA_ALIGN(MAX(size, reserve));
+
+	if (!block || (block->size - block->used < reserve)) {
+		gsize block_size = block ?
+			MIN(block->size * 2, ARENA_BLOCK_MAXIMUM) :
+			ARENA_BLOCK_MINIMUM;
+
+		if (block_size < reserve)
+			block_size = reserve;
+		block = g_malloc(ARENA_HEADER + block_size);
+		block->next   = arena->blocks;
+		block->size   = block_size;
+		block->used   = 0;
+		arena->blocks = block;
+	}
+
+	memory       = ARENA_TOP(block);
+	block->used += size;
+	arena->last  = memory;
+	return(memory);
+}
+
+static gpointer arena_alloc(struct _sipe_xml_arena *arena, gsize size)
+{
+	return(arena_alloc_reserve(arena, size, size));
+}
+
+/* appends @text to the zero-terminated string @data of @length bytes */
+static gchar *arena_append(struct _sipe_xml_arena *arena,
+			   gchar *data,
+			   gsize length,
+			   const gchar *text,
+			   gsize text_length)
+{
+	struct _sipe_xml_arena_block *block = arena->blocks;
+	gsize old_size = data ? ARENA_ALIGN(length + 1) : 0;
+	gsize new_size = ARENA_ALIGN(length + text_length + 1);
+
+	/* most recent allocation: try to extend it in place */
+	if (data &&
+	    (data == arena->last) &&
+	    (data + old_size == ARENA_TOP(block)) &&
+	    (block->size - block->used >= new_size - old_size)) {
+		block->used += new_size - old_size;
+	} else {
+		/* leave room for further appends to avoid quadratic copying */
+		gchar *copy = arena_alloc_reserve(arena, new_size, 2 * old_size);
+		if (length)
+			memcpy(copy, data, length);
+		data = copy;
+	}
+
+	memcpy(data + length, text, text_length);
+	data[length + text_length] = '\0';
+	return(data);
+}
+
+static void arena_free(struct _sipe_xml_arena_block *block)
+{
+	while (block) {
+		struct _sipe_xml_arena_block *next = block->next;
+		g_free(block);
+		block = next;
+	}
+}
+
+static void arena_mark(struct _sipe_xml_arena *arena,
+		       struct _sipe_xml_arena_mark *mark)
 {
-	gchar *lc = g_ascii_strdown((const gchar *) key, -1);
-	guint bucket = g_str_hash(lc);
-	g_free(lc);
+	mark->block = arena->blocks;
+	mark->used  = arena->blocks ? arena->blocks->used : 0;
+	mark->last  = arena->last;
+}
 
-	return(bucket);
+/* releases everything allocated after the mark */
+static void arena_reset(struct _sipe_xml_arena *arena,
+			const struct _sipe_xml_arena_mark *mark)
+{
+	while (arena->blocks != mark->block) {
+		struct _sipe_xml_arena_block *next = arena->blocks->next;
+		g_free(arena->blocks);
+		arena->blocks = next;
+	}
+	if (arena->blocks)
+		arena->blocks->used = mark->used;
+	arena->last = mark->last;
+}
+
+static const gchar *strip_namespace(const xmlChar *name)
+{
+	const gchar *tmp = strchr((const gchar *) name, ':');
+	return(tmp ? tmp + 1 : (const gchar *) name);
+}
+
+static const gchar *intern_name(struct _parser_data *pd, const gchar *name)
+{
+	gchar *interned = g_hash_table_lookup(pd->names, name);
+
+	if (!interned) {
+		gsize length = strlen(name) + 1;
+		interned = arena_alloc(pd->name_arena, length);
+		memcpy(interned, name, length);
+		g_hash_table_insert(pd->names, interned, interned);
+	}
+
+	return(interned);
+}
+
+/* libxml2 decodes all entities except &amp; which is replaced by &#38; */
+static gchar *copy_attribute_value(gchar *dest, const gchar *value)
+{
+	while (*value) {
+		if ((value[0] == '&') &&
+		    (value[1] == '#') &&
+		    (value[2] == '3') &&
+		    (value[3] == '8') &&
+		    (value[4] == ';')) {
+			*dest++ = '&';
+			value += 5;
+		} else {
+			*dest++ = *value++;
+		}
+	}
+	*dest++ = '\0';
+
+	return(dest);
+}
+
+/*
+ * Streaming mode: called for each element outside a record. Returns TRUE
+ * if the element starts a new record, i.e. is not an ancestor of any
+ * handler path. pd->match is set to the handler for the element path.
+ */
+static gboolean stream_start_element(struct _parser_data *pd,
+				     const gchar *name)
+{
+	const struct sipe_xml_stream_handler *handler;
+	gboolean ancestor = FALSE;
+
+	if (pd->path->len)
+		g_string_append_c(pd->path, '/');
+	g_string_append(pd->path, name);
+
+	pd->match = NULL;
+	for (handler = pd->handlers; handler->path; handler++) {
+		if (strcmp(handler->path, pd->path->str) == 0)
+			pd->match = handler;
+		else if (g_str_has_prefix(handler->path, pd->path->str) &&
+			 (handler->path[pd->path->len] == '/'))
+			ancestor = TRUE;
+	}
+
+	return(!ancestor);
+}
+
+static void stream_end_element(struct _parser_data *pd)
+{
+	gchar *slash = strrchr(pd->path->str, '/');
+	g_string_truncate(pd->path, slash ? (gsize) (slash - pd->path->str) : 0);
 }
 
 static void callback_start_element(void *user_data, const xmlChar *name, const xmlChar **attrs)
 {
 	struct _parser_data *pd = user_data;
-	const char *tmp;
+	gboolean streaming      = pd->handlers && !pd->record;
+	gboolean new_record     = FALSE;
+	guint count = 0;
+	gsize size  = sizeof(sipe_xml);
 	sipe_xml *node;
 
 	if (!name || pd->error) return;
 
-	node = g_new0(sipe_xml, 1);
-
-	if ((tmp = strchr((char *)name, ':')) != NULL) {
-		name = (xmlChar *)tmp + 1;
+	/* a new record is released as a whole: mark before allocating it */
+	if (streaming &&
+	    stream_start_element(pd, strip_namespace(name))) {
+		new_record          = TRUE;
+		pd->record_handler  = pd->match;
+		pd->record_previous = pd->current ? pd->current->last : NULL;
+		arena_mark(&pd->arena, &pd->record_mark);
 	}
-	node->name = g_strdup((gchar *)name);
 
+	/* node, attributes and attribute values are allocated in one block */
+	if (attrs) {
+		const xmlChar **attr;
+
+		for (attr = attrs; *attr; attr += 2) {
+			size += sizeof(struct _sipe_xml_attribute) +
+				strlen((const gchar *) attr[1]) + 1;
+			count++;
+		}
+	}
 	if (!pd->root) {
+		struct _sipe_xml_document *doc = arena_alloc(&pd->arena,
+							     G_STRUCT_OFFSET(struct _sipe_xml_document, root) + size);
+		node = &doc->root;
+		memset(node, 0, sizeof(sipe_xml));
 		pd->root = node;
 	} else {
+		node = arena_alloc(&pd->arena, size);
+		memset(node, 0, sizeof(sipe_xml));
+	}
+	node->name = intern_name(pd, strip_namespace(name));
+
+	if (node != pd->root) {
 		sipe_xml *current = pd->current;
 
 		node->parent = current;
@@ -93,35 +335,65 @@ static void callback_start_element(void *user_data, const xmlChar *name, const x
 		current->last = node;
 	}
 
-	if (attrs) {
-		const xmlChar *key;
-
-		node->attributes = g_hash_table_new_full(sipe_ascii_strdown_hash,
-							 (GEqualFunc) sipe_strcase_equal,
-							 g_free, g_free);
-		while ((key = *attrs++) != NULL) {
-			if ((tmp = strchr((char *)key, ':')) != NULL) {
-				key = (xmlChar *)tmp + 1;
-			}
-			/* libxml2 decodes all entities except &amp;.
-			   &amp; is replaced by the equivalent &#38; */
-			g_hash_table_insert(node->attributes,
-					    g_strdup((gchar *) key),
-					    sipe_utils_str_replace((gchar *) *attrs++, "&#38;", "&"));
+	if (count) {
+		struct _sipe_xml_attribute *attribute = (gpointer) (node + 1);
+		gchar *value                          = (gchar *) (attribute + count);
+
+		node->attributes      = attribute;
+		node->attribute_count = count;
+		for (; *attrs; attrs += 2, attribute++) {
+			attribute->name  = intern_name(pd, strip_namespace(attrs[0]));
+			attribute->value = value;
+			value = copy_attribute_value(value,
+						     (const gchar *) attrs[1]);
 		}
 	}
 
 	pd->current = node;
+
+	if (new_record)
+		pd->record = node;
+	/* ancestor with handler: node has attributes but no content yet */
+	else if (streaming && pd->match)
+		(*pd->match->callback)(pd->user_data, node);
 }
 
 static void callback_end_element(void *user_data, const xmlChar *name)
 {
 	struct _parser_data *pd = user_data;
+	sipe_xml *node, *parent;
 
 	if (!name || !pd->current || pd->error) return;
 
-	if (pd->current->parent)
-		pd->current = pd->current->parent;
+	node   = pd->current;
+	parent = node->parent;
+
+	if (pd->handlers && !(pd->record && (node != pd->record))) {
+		stream_end_element(pd);
+
+		if (node == pd->record) {
+			if (pd->record_handler)
+				(*pd->record_handler->callback)(pd->user_data, node);
+
+			/* unlink record from tree and release it */
+			if (parent) {
+				parent->last = pd->record_previous;
+				if (pd->record_previous)
+					pd->record_previous->sibling = NULL;
+				else
+					parent->first = NULL;
+			} else {
+				pd->root = NULL;
+			}
+			arena_reset(&pd->arena, &pd->record_mark);
+			pd->record  = NULL;
+			pd->current = parent;
+			return;
+		}
+	}
+
+	if (parent)
+		pd->current = parent;
 }
 
 static void callback_characters(void *user_data, const xmlChar *text, int text_len)
@@ -132,10 +404,12 @@ static void callback_characters(void *user_data, const xmlChar *text, int text_l
 	if (!pd->current || pd->error || !text || !text_len) return;
 
 	node = pd->current;
-	if (node->data)
-		node->data = g_string_append_len(node->data, (gchar *)text, text_len);
-	else
-		node->data = g_string_new_len((gchar *)text, text_len);
+	node->data = arena_append(&pd->arena,
+				  node->data,
+				  node->data_length,
+				  (const gchar *) text,
+				  text_len);
+	node->data_length += text_len;
 }
 
 static void callback_error(void *user_data, const char *msg, ...)
@@ -217,70 +491,107 @@ sipe_xml *sipe_xml_parse(const gchar *string, gsize length)
 	if (string && length) {
 		struct _parser_data *pd = g_new0(struct _parser_data, 1);
 
+		pd->names      = g_hash_table_new(g_str_hash, g_str_equal);
+		pd->name_arena = &pd->arena;
+
 		if (xmlSAXUserParseMemory(&parser, pd, string, length))
 			pd->error = TRUE;
 
-		if (pd->error) {
-			sipe_xml_free(pd->root);
+		if (pd->error || !pd->root) {
+			arena_free(pd->arena.blocks);
 		} else {
+			XML_DOCUMENT(pd->root)->blocks = pd->arena.blocks;
 			result = pd->root;
 		}
 
+		g_hash_table_destroy(pd->names);
 		g_free(pd);
 	}
 
 	return result;
 }
 
-void sipe_xml_free(sipe_xml *node)
+gboolean sipe_xml_parse_stream(const gchar *string, gsize length,
+			       const struct sipe_xml_stream_handler *handlers,
+			       gpointer user_data)
 {
-	sipe_xml *child;
+	gboolean result = FALSE;
 
-	if (!node) return;
+	if (string && length && handlers) {
+		struct _parser_data *pd = g_new0(struct _parser_data, 1);
 
-	/* we don't support partial tree deletion */
-	if (node->parent != NULL) {
-		SIPE_DEBUG_ERROR_NOFORMAT("sipe_xml_free: partial delete attempt! Expect crash or memory leaks...");
-	}
+		pd->names      = g_hash_table_new(g_str_hash, g_str_equal);
+		pd->name_arena = &pd->stream_names;
+		pd->handlers   = handlers;
+		pd->user_data  = user_data;
+		pd->path       = g_string_new("");
 
-	/* free children */
-	child = node->first;
-	while (child) {
-		sipe_xml *tmp = child->sibling;
-		child->parent = NULL; /* detach from tree, see above */
-		sipe_xml_free(child);
-		child = tmp;
+		if (xmlSAXUserParseMemory(&parser, pd, string, length))
+			pd->error = TRUE;
+		result = !pd->error;
+
+		arena_free(pd->arena.blocks);
+		arena_free(pd->stream_names.blocks);
+		g_hash_table_destroy(pd->names);
+		g_string_free(pd->path, TRUE);
+		g_free(pd);
 	}
 
-	/* free node */
-	g_free(node->name);
-	if (node->data)       g_string_free(node->data, TRUE);
-	if (node->attributes) g_hash_table_destroy(node->attributes);
-	g_free(node);
+	return result;
 }
 
-static void sipe_xml_stringify_attribute(gpointer key, gpointer value,
-					 gpointer user_data)
+void sipe_xml_free(sipe_xml *node)
 {
-	g_string_append_printf(user_data, " %s=\"%s\"",
-			       (const gchar *) key, (const gchar *) value);
+	if (!node) return;
+
+	/*
+	 * partial tree deletion: detach the subtree from its parent. Its
+	 * memory belongs to the arena and is released with the document.
+	 */
+	if (node->parent != NULL) {
+		sipe_xml *parent = node->parent;
+		sipe_xml *previous = NULL;
+		sipe_xml *child;
+
+		SIPE_DEBUG_WARNING_NOFORMAT("sipe_xml_free: partial delete, subtree released with document");
+
+		for (child = parent->first; child; child = child->sibling) {
+			if (child == node) {
+				if (previous)
+					previous->sibling = node->sibling;
+				else
+					parent->first = node->sibling;
+				if (parent->last == node)
+					parent->last = previous;
+				break;
+			}
+			previous = child;
+		}
+		node->parent  = NULL;
+		node->sibling = NULL;
+		return;
+	}
+
+	/* releases the whole tree, including the document itself */
+	arena_free(XML_DOCUMENT(node)->blocks);
 }
 
 static void sipe_xml_stringify_node(GString *s, const sipe_xml *node)
 {
+	guint i;
+
 	g_string_append_printf(s, "<%s", node->name);
 
-	if (node->attributes) {
-		g_hash_table_foreach(node->attributes,
-				     (GHFunc) sipe_xml_stringify_attribute,
-				     s);
-	}
+	for (i = 0; i < node->attribute_count; i++)
+		g_string_append_printf(s, " %s=\"%s\"",
+				       node->attributes[i].name,
+				       node->attributes[i].value);
 
 	if (node->data || node->first) {
 		const sipe_xml *child;
 
 		g_string_append_printf(s, ">%s",
-				       node->data ? node->data->str : "");
+				       node->data ? node->data : "");
 
 		for (child = node->first; child; child = child->sibling)
 			sipe_xml_stringify_node(s, child);
@@ -302,38 +613,90 @@ gchar *sipe_xml_stringify(const sipe_xml *node)
 	return g_string_free(s, FALSE);
 }
 
+static const sipe_xml *sipe_xml_child_step(const sipe_xml *parent,
+					   const gchar *name,
+					   gsize length)
+{
+	const sipe_xml *child;
+
+	for (child = parent->first; child; child = child->sibling) {
+		if ((strncmp(child->name, name, length) == 0) &&
+		    (child->name[length] == '\0'))
+			break;
+	}
+
+	return(child);
+}
+
 const sipe_xml *sipe_xml_child(const sipe_xml *parent, const gchar *name)
 {
-	gchar **names;
-	const sipe_xml *child = NULL;
+	const sipe_xml *child = parent;
 
 	if (!parent || !name) return NULL;
 
-	/* 0: child name */
-	/* 1: trailing path (optional) */
-	names = g_strsplit(name, "/", 2);
+	/* walk the path in place, one child name at a time */
+	while (child) {
+		const gchar *end = strchr(name, '/');
 
-	for (child = parent->first; child; child = child->sibling) {
-		if (sipe_strequal(names[0], child->name))
+		if (!end) {
+			child = sipe_xml_child_step(child, name, strlen(name));
 			break;
+		}
+		child = sipe_xml_child_step(child, name, end - name);
+		name  = end + 1;
 	}
 
-	/* recurse into path */
-	if (child && names[1])
-		child = sipe_xml_child(child, names[1]);
-
-	g_strfreev(names);
 	return child;
 }
 
+const sipe_xml *sipe_xml_select(const sipe_xml *parent,
+				sipe_xml_selector *selector)
+{
+	guint i;
+
+	if (!parent || !selector) return NULL;
+
+	if (selector->steps == 0) {
+		const gchar *name = selector->path;
+
+		while (TRUE) {
+			const gchar *end = strchr(name, '/');
+
+			if (selector->steps == SIPE_XML_SELECTOR_MAX_STEPS) {
+				SIPE_DEBUG_ERROR("sipe_xml_select: path '%s' has too many steps",
+						 selector->path);
+				/* an empty name never matches */
+				selector->steps          = 1;
+				selector->step[0].length = 0;
+				break;
+			}
+
+			selector->step[selector->steps].name   = name;
+			selector->step[selector->steps].length = end ? (gsize) (end - name) : strlen(name);
+			selector->steps++;
+			if (!end)
+				break;
+			name = end + 1;
+		}
+	}
+
+	for (i = 0; parent && (i < selector->steps); i++)
+		parent = sipe_xml_child_step(parent,
+					     selector->step[i].name,
+					     selector->step[i].length);
+
+	return parent;
+}
+
 const sipe_xml *sipe_xml_twin(const sipe_xml *node)
 {
 	sipe_xml *sibling;
 
 	if (!node) return NULL;
 
+	/* names are interned per document */
 	for (sibling = node->sibling; sibling; sibling = sibling->sibling) {
-		if (sipe_strequal(node->name, sibling->name))
+		if (node->name == sibling->name)
 			return sibling;
 	}
 	return NULL;
@@ -346,8 +709,19 @@ const gchar *sipe_xml_name(const sipe_xml *node)
 
 const gchar *sipe_xml_attribute(const sipe_xml *node, const gchar *attr)
 {
-	if (!node || !attr || !node->attributes) return NULL;
-	return(g_hash_table_lookup(node->attributes, attr));
+	guint i;
+
+	if (!node || !attr) return NULL;
+
+	/*
+	 * attribute names are case insensitive. Scan from the end, i.e. the
+	 * last of duplicate attributes wins as with the old hash table.
+	 */
+	for (i = node->attribute_count; i > 0; i--)
+		if (g_ascii_strcasecmp(node->attributes[i - 1].name, attr) == 0)
+			return(node->attributes[i - 1].value);
+
+	return(NULL);
 }
 
 guint sipe_xml_int_attribute(const sipe_xml *node, const gchar *attr,
@@ -359,8 +733,8 @@ guint sipe_xml_int_attribute(const sipe_xml *node, const gchar *attr,
 
 gchar *sipe_xml_data(const sipe_xml *node)
 {
-	if (!node || !node->data || !node->data->str) return NULL;
-	return g_strdup(node->data->str);
+	if (!node || !node->data) return NULL;
+	return g_strdup(node->data);
 }
 
 /**
@@ -375,17 +749,13 @@ void sipe_xml_dump(const sipe_xml *node, const gchar *path)
 	gchar *new_path;
 	if (!node) return;
 	new_path = g_strdup_printf("%s/%s", path ? path : "", node->name);
-	if (node->attributes) {
-		GList *attrs = g_hash_table_get_keys(node->attributes);
+	if (node->attribute_count) {
 		GString *buf = g_string_new("");
-		GList *entry = attrs;
-		while (entry) {
-			g_string_append_printf(buf, "%s ", (gchar *)entry->data);
-			entry = entry->next;
-		}
+		guint i;
+		for (i = 0; i < node->attribute_count; i++)
+			g_string_append_printf(buf, "%s ", node->attributes[i].name);
 		SIPE_DEBUG_INFO("%s [%s]", new_path, buf->str);
 		g_string_free(buf, TRUE);
-		g_list_free(attrs);
 	} else {
 		SIPE_DEBUG_INFO_NOFORMAT(new_path);
 	}
@@ -32,9 +32,48 @@ typedef struct _sipe_xml sipe_xml;
  */
 sipe_xml *sipe_xml_parse(const gchar *string, gsize length);
 
+/**
+ * Callback for sipe_xml_parse_stream()
+ *
+ * @param user_data user data passed to sipe_xml_parse_stream()
+ * @param node      matching node. Only valid during the callback.
+ */
+typedef void (*sipe_xml_stream_cb)(gpointer user_data,
+				   const sipe_xml *node);
+
+struct sipe_xml_stream_handler {
+	const gchar *path; /* absolute path, e.g. "contactList/contact" */
+	sipe_xml_stream_cb callback;
+};
+
+/**
+ * Parse XML from a string and process it while parsing.
+ *
+ * Only the elements on the paths to the handlers are kept. Every other
+ * element is released as soon as its end tag has been seen. If it matches
+ * a handler path, the handler is called with the complete element first.
+ * For a path that is also a prefix of another handler path the handler is
+ * called at the start tag instead, i.e. the node only has its attributes.
+ *
+ * @param string    String with the XML to be parsed.
+ * @param length    Length of the string.
+ * @param handlers  Array of handlers, terminated by an entry with
+ *                  @c NULL path.
+ * @param user_data passed to the handlers.
+ *
+ * @return @c FALSE if the XML was invalid. Handlers may have been called
+ *         for the part before the error.
+ */
+gboolean sipe_xml_parse_stream(const gchar *string, gsize length,
+			       const struct sipe_xml_stream_handler *handlers,
+			       gpointer user_data);
+
 /**
  * Free XML information.
  *
+ * A non-root node is only detached from its parent. Its memory is
+ * released together with the document.
+ *
  * @param string XML information to be freed.
  */
 void sipe_xml_free(sipe_xml *xml);
@@ -58,6 +97,36 @@ gchar *sipe_xml_stringify(const sipe_xml *xml);
  */
 const sipe_xml *sipe_xml_child(const sipe_xml *parent, const gchar *name);
 
+/**
+ * Precompiled relative XPATH for sipe_xml_select()
+ *
+ * Declare with SIPE_XML_SELECTOR(), preferably as static variable. The
+ * path is split into steps on first use, so each further lookup is only
+ * a walk over the children without any allocation or string parsing.
+ */
+#define SIPE_XML_SELECTOR_MAX_STEPS 8
+typedef struct {
+	const gchar *path;
+	guint steps;          /* 0: not compiled yet */
+	struct {
+		const gchar *name;
+		gsize length;
+	} step[SIPE_XML_SELECTOR_MAX_STEPS];
+} sipe_xml_selector;
+
+#define SIPE_XML_SELECTOR(path) { (path), 0, { { NULL, 0 } } }
+
+/**
+ * Gets a child node using a precompiled path.
+ *
+ * @param parent   The parent node.
+ * @param selector relative XPATH of the child, see SIPE_XML_SELECTOR().
+ *
+ * @return The child or @c NULL. Never try to @c sipe_xml_free() it!
+ */
+const sipe_xml *sipe_xml_select(const sipe_xml *parent,
+				sipe_xml_selector *selector);
+
 /**
  * Gets the next node with the same name as node.
  *
@@ -0,0 +1,388 @@
+/**
+ * @file sipmsg-tests.c
+ *
+ * pidgin-sipe
+ *
+ * Copyright (C) 2015 SIPE Project <http://sipe.sourceforge.net/>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* Tests & micro benchmarks for sipmsg.c */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "sipe-common.h"
+#include "sipe-backend.h"
+#include "sipe-core.h"
+#include "sipmsg.h"
+#include "sipe-utils.h"
+
+/*
+ * Tester code
+ */
+static guint succeeded = 0;
+static guint failed    = 0;
+
+/* bodies of at least this size are received in place */
+#define TEST_LARGE_BODY 16384
+
+/* drives the receive buffer of a sipe_transport_connection */
+struct test_stream {
+	struct sipmsg_framer framer;
+	struct sipe_transport_connection conn;
+	guint messages;
+	guint in_place;
+	gsize body_bytes;
+};
+
+static gchar *test_message(guint index, gsize bodylen)
+{
+	gchar *body = g_strnfill(bodylen, 'a' + (index % 26));
+	gchar *msg  = g_strdup_printf("NOTIFY sip:user@test.com SIP/2.0\r\n"
+				      "Via: SIP/2.0/TLS 10.0.0.1:5061;branch=z9hG4bK%08X\r\n"
+				      "From: <sip:user@test.com>;tag=1234\r\n"
+				      "To: <sip:user@test.com>;tag=5678\r\n"
+				      "Call-ID: %08X\r\n"
+				      "CSeq: %u NOTIFY\r\n"
+				      "Event: presence\r\n"
+				      "Content-Type: application/rlmi+xml\r\n"
+				      "Content-Length: %" G_GSIZE_FORMAT "\r\n"
+				      "\r\n"
+				      "%s",
+				      index, index, index + 1, bodylen, body);
+	g_free(body);
+	return(msg);
+}
+
+static GString *test_stream_data(guint count, gsize bodylen)
+{
+	GString *data = g_string_new("");
+	guint i;
+
+	for (i = 0; i < count; i++) {
+		gchar *msg = test_message(i, bodylen);
+		/* sprinkle in some keep-alives */
+		if ((i % 7) == 0)
+			g_string_append(data, "\r\n\r\n");
+		g_string_append(data, msg);
+		g_free(msg);
+	}
+
+	return(data);
+}
+
+static void test_stream_input(struct test_stream *stream,
+			      const gchar *data,
+			      gsize length)
+{
+	struct sipe_transport_connection *conn = &stream->conn;
+	struct sipmsg_framer *framer           = &stream->framer;
+	struct sipmsg *msg;
+	gsize consumed;
+
+	/* backend */
+	sipe_core_transport_buffer_reserve(conn, length);
+	memcpy(conn->buffer + conn->buffer_used, data, length);
+	conn->buffer_used += length;
+	conn->buffer[conn->buffer_used] = '\0';
+
+	/* same steps as sip_transport_input() */
+	do {
+		if (framer->msg &&
+		    (framer->header_length == 0) &&
+		    (conn->buffer_used >= (gsize) framer->msg->bodylen)) {
+			const gchar *start = conn->buffer_start;
+			gchar *body = sipe_utils_take_buffer(conn,
+							     framer->msg->bodylen);
+			if (body == start)
+				stream->in_place++;
+			msg = sipmsg_framer_complete(framer, body);
+			consumed = 0;
+		} else {
+			msg = sipmsg_framer_next(framer,
+						 conn->buffer,
+						 conn->buffer_used,
+						 &consumed);
+		}
+
+		if (consumed)
+			sipe_utils_shrink_buffer(conn, conn->buffer + consumed);
+
+		if (msg) {
+			stream->messages++;
+			stream->body_bytes += strlen(msg->body);
+			sipmsg_free(msg);
+		} else if (framer->msg &&
+			   framer->header_length &&
+			   (framer->msg->bodylen >= TEST_LARGE_BODY)) {
+			sipe_utils_shrink_buffer(conn,
+						 conn->buffer + framer->header_length);
+			framer->header_length = 0;
+			sipe_utils_realign_buffer(conn, framer->msg->bodylen);
+		}
+	} while (msg);
+}
+
+static void test_stream_run(const gchar *label,
+			    const GString *data,
+			    gsize chunk,
+			    guint expected_messages,
+			    gsize expected_bytes,
+			    guint rounds)
+{
+	struct test_stream stream;
+	GTimer *timer = g_timer_new();
+	gdouble elapsed;
+	guint round;
+
+	memset(&stream, 0, sizeof(stream));
+
+	for (round = 0; round < rounds; round++) {
+		gsize offset = 0;
+
+		stream.messages   = 0;
+		stream.in_place   = 0;
+		stream.body_bytes = 0;
+		while (offset < data->len) {
+			gsize length = MIN(chunk, data->len - offset);
+			test_stream_input(&stream, data->str + offset, length);
+			offset += length;
+		}
+	}
+
+	elapsed = g_timer_elapsed(timer, NULL);
+	g_timer_destroy(timer);
+
+	if ((stream.messages   == expected_messages) &&
+	    (stream.body_bytes == expected_bytes)    &&
+	    (stream.conn.buffer_used == 0)) {
+		succeeded++;
+	} else {
+		printf("FAILED %s: %u messages (expected %u), %" G_GSIZE_FORMAT " body bytes (expected %" G_GSIZE_FORMAT "), %" G_GSIZE_FORMAT " left over\n",
+		       label,
+		       stream.messages, expected_messages,
+		       stream.body_bytes, expected_bytes,
+		       stream.conn.buffer_used);
+		failed++;
+	}
+
+	printf("%-32s %8.3f ms %10.1f MB/s %3u in place\n",
+	       label,
+	       elapsed * 1000,
+	       elapsed > 0 ? (data->len * rounds) / (elapsed * 1024 * 1024) : 0,
+	       stream.in_place);
+
+	sipmsg_framer_reset(&stream.framer);
+	sipe_core_transport_buffer_free(&stream.conn);
+}
+
+static void test_header(const gchar *label,
+			const gchar *value,
+			const gchar *expected)
+{
+	if (sipe_strequal(value, expected)) {
+		succeeded++;
+	} else {
+		printf("FAILED %s: '%s' (expected '%s')\n",
+		       label,
+		       value ? value : "(null)",
+		       expected ? expected : "(null)");
+		failed++;
+	}
+}
+
+static void test_headers(void)
+{
+	static const gchar *keepers[] = { "Via", "From", "To", "Call-ID", "CSeq", NULL };
+	struct sipmsg *msg = sipmsg_parse_msg("SIP/2.0 200 OK\r\n"
+					      "Via: SIP/2.0/TLS 10.0.0.1:5061\r\n"
+					      "FROM:\t<sip:user@test.com>;tag=1234\r\n"
+					      "To: <sip:user@test.com>\r\n"
+					      "Call-ID: 0123456789\r\n"
+					      "CSeq: 17 SUBSCRIBE\r\n"
+					      "Supported: first\r\n"
+					      "Supported: second,\r\n"
+					      "  folded\r\n"
+					      "\tline\r\n"
+					      "Content-Length: 4\r\n"
+					      "\r\n"
+					      "body");
+	struct sipmsg *copy;
+
+	if (!msg) {
+		printf("FAILED parse headers\n");
+		failed++;
+		return;
+	}
+
+	test_header("response text", msg->responsestr, "OK");
+	test_header("method from CSeq", msg->method, "SUBSCRIBE");
+	test_header("body", msg->body, "body");
+	test_header("well-known", sipmsg_find_header(msg, "Call-ID"), "0123456789");
+	test_header("case-insensitive", sipmsg_find_header(msg, "from"), "<sip:user@test.com>;tag=1234");
+	test_header("other header", sipmsg_find_header(msg, "supported"), "first");
+	test_header("folded line", sipmsg_find_header_instance(msg, "Supported", 1), "second, folded line");
+	test_header("missing header", sipmsg_find_header(msg, "Event"), NULL);
+	if (msg->bodylen == 4) {
+		succeeded++;
+	} else {
+		printf("FAILED Content-Length: %d\n", msg->bodylen);
+		failed++;
+	}
+
+	/* modifying a parsed message */
+	sipmsg_remove_header_now(msg, "To");
+	sipmsg_add_header_now(msg, "To", "<sip:other@test.com>;tag=5678");
+	test_header("replaced header", sipmsg_find_header(msg, "To"), "<sip:other@test.com>;tag=5678");
+	test_header("after replace", sipmsg_find_header(msg, "Call-ID"), "0123456789");
+
+	copy = sipmsg_copy(msg);
+	sipmsg_add_header(copy, "Content-Length", "0");
+	sipmsg_strip_headers(copy, keepers);
+	sipmsg_merge_new_headers(copy);
+	test_header("stripped header", sipmsg_find_header(copy, "Supported"), NULL);
+	test_header("kept header", sipmsg_find_header(copy, "CSeq"), "17 SUBSCRIBE");
+	test_header("merged header", sipmsg_find_header(copy, "Content-Length"), "0");
+	sipmsg_free(copy);
+	sipmsg_free(msg);
+
+	/* corrupted header lines */
+	msg = sipmsg_parse_header("INVITE sip:user@test.com SIP/2.0\r\n"
+				  "no delimiter\r\n");
+	if (msg) {
+		printf("FAILED corrupted header line\n");
+		failed++;
+		sipmsg_free(msg);
+	} else {
+		succeeded++;
+	}
+}
+
+static void test_serialize(void)
+{
+	static const gchar *request = "INFO sip:user@test.com SIP/2.0\r\n"
+		"Via: SIP/2.0/TLS 10.0.0.1:5061\r\n"
+		"From: <sip:user@test.com>;tag=1234\r\n"
+		"Call-ID: 0123456789\r\n"
+		"CSeq: 3 INFO\r\n"
+		"Content-Length: 4\r\n"
+		"\r\n"
+		"body";
+	struct sipmsg *msg = sipmsg_parse_msg(request);
+	struct sipmsg_vector vector;
+	gchar *string;
+
+	string = sipmsg_to_string(msg);
+	test_header("serialize request", string, request);
+	g_free(string);
+
+	sipmsg_to_vector(&vector, msg);
+	if (vector.length == strlen(request)) {
+		succeeded++;
+	} else {
+		printf("FAILED vector length: %" G_GSIZE_FORMAT " (expected %" G_GSIZE_FORMAT ")\n",
+		       vector.length, strlen(request));
+		failed++;
+	}
+	sipmsg_vector_clear(&vector);
+	sipmsg_free(msg);
+}
+
+static void test_header_benchmark(guint rounds)
+{
+	gchar *data = test_message(0, 0);
+	GTimer *timer = g_timer_new();
+	gdouble elapsed;
+	guint found = 0;
+	guint round;
+
+	for (round = 0; round < rounds; round++) {
+		struct sipmsg *msg = sipmsg_parse_msg(data);
+		if (sipmsg_find_header(msg, "Call-ID"))        found++;
+		if (sipmsg_find_header(msg, "CSeq"))           found++;
+		if (sipmsg_find_header(msg, "From"))           found++;
+		if (sipmsg_find_header(msg, "To"))             found++;
+		if (sipmsg_find_header(msg, "Event"))          found++;
+		if (sipmsg_find_header(msg, "Content-Type"))   found++;
+		sipmsg_free(msg);
+	}
+
+	elapsed = g_timer_elapsed(timer, NULL);
+	g_timer_destroy(timer);
+	g_free(data);
+
+	if (found == 6 * rounds) {
+		succeeded++;
+	} else {
+		printf("FAILED header benchmark: %u headers found (expected %u)\n",
+		       found, 6 * rounds);
+		failed++;
+	}
+
+	printf("%-32s %8.3f ms %10.1f msg/s\n",
+	       "parse & find headers",
+	       elapsed * 1000,
+	       elapsed > 0 ? rounds / elapsed : 0);
+}
+
+int main(SIPE_UNUSED_PARAMETER int argc, SIPE_UNUSED_PARAMETER char *argv[])
+{
+	GString *data;
+
+	/* small messages, e.g. presence NOTIFYs */
+	data = test_stream_data(100, 300);
+	test_stream_run("small, coalesced",         data, data->len, 100, 100 * 300, 100);
+	test_stream_run("small, byte-by-byte",      data,         1, 100, 100 * 300,   5);
+	test_stream_run("small, 16K TLS records",   data,     16384, 100, 100 * 300, 100);
+	g_string_free(data, TRUE);
+
+	/* large messages, e.g. roaming contacts */
+	data = test_stream_data(4, 2 * 1024 * 1024);
+	test_stream_run("large, coalesced",         data, data->len, 4, 4 * 2 * 1024 * 1024, 5);
+	test_stream_run("large, 1400 byte segments", data,     1400, 4, 4 * 2 * 1024 * 1024, 5);
+	test_stream_run("large, 16K TLS records",   data,     16384, 4, 4 * 2 * 1024 * 1024, 5);
+	g_string_free(data, TRUE);
+
+	/* corrupted header is skipped */
+	data = g_string_new("garbage\r\n\r\n");
+	{
+		gchar *msg = test_message(0, 10);
+		g_string_append(data, msg);
+		g_free(msg);
+	}
+	test_stream_run("corrupted header",         data,         3, 1, 10, 1);
+	g_string_free(data, TRUE);
+
+	test_headers();
+	test_serialize();
+	test_header_benchmark(100000);
+
+	printf("Result: %u PASSED %u FAILED\n", succeeded, failed);
+	return(failed);
+}
+
+/*
+  Local Variables:
+  mode: c
+  c-file-style: "bsd"
+  indent-tabs-mode: t
+  tab-width: 8
+  End:
+*/
@@ -3,7 +3,7 @@
  *
  * pidgin-sipe
  *
- * Copyright (C) 2010-2014 SIPE Project <http://sipe.sourceforge.net/>
+ * Copyright (C) 2010-2015 SIPE Project <http://sipe.sourceforge.net/>
  * Copyright (C) 2008 Novell, Inc.
  * Copyright (C) 2005 Thomas Butter <butter@uni-mannheim.de>
  *
@@ -30,67 +30,237 @@
 #include <glib.h>
 
 #include "sipmsg.h"
+#define SIPE_DEBUG_CATEGORY SIPE_DEBUG_CATEGORY_TRANSPORT
 #include "sipe-backend.h"
 #include "sipe-mime.h"
 #include "sipe-utils.h"
 
-struct sipmsg *sipmsg_parse_msg(const gchar *msg) {
-	const char *tmp = strstr(msg, "\r\n\r\n");
-	char *line;
-	struct sipmsg *smsg;
+/* keep in sync with enum sipmsg_header_id */
+static const struct {
+	const gchar *name;
+	gsize length;
+} sipmsg_well_known_headers[SIPMSG_HEADER_MAX] = {
+	{ "Call-ID",            7 },
+	{ "CSeq",               4 },
+	{ "From",               4 },
+	{ "To",                 2 },
+	{ "Via",                3 },
+	{ "Contact",            7 },
+	{ "Content-Length",    14 },
+	{ "Content-Type",      12 },
+	{ "Event",              5 },
+	{ "Expires",            7 },
+	{ "Transfer-Encoding", 17 },
+};
 
-	if(!tmp) return NULL;
+/* one entry per header in sipmsg->header_block */
+struct sipmsg_header {
+	GSList link;
+	struct sipnameval nameval;
+};
 
-	line = g_strndup(msg, tmp - msg);
+static gint sipmsg_header_id(const gchar *name, gsize length)
+{
+	guint i;
 
-	smsg = sipmsg_parse_header(line);
-	smsg->body = g_strdup(tmp + 4);
+	for (i = 0; i < SIPMSG_HEADER_MAX; i++)
+		if ((sipmsg_well_known_headers[i].length == length) &&
+		    !g_ascii_strncasecmp(sipmsg_well_known_headers[i].name,
+					 name,
+					 length))
+			return(i);
 
-	g_free(line);
-	return smsg;
+	return(-1);
 }
 
-struct sipmsg *sipmsg_parse_header(const gchar *header) {
+static void sipmsg_index_header(struct sipmsg *msg,
+				const struct sipnameval *elem)
+{
+	gint id = sipmsg_header_id(elem->name, strlen(elem->name));
+
+	if ((id >= 0) && !msg->known_headers[id])
+		msg->known_headers[id] = elem->value;
+}
+
+static void sipmsg_index_headers(struct sipmsg *msg)
+{
+	GSList *entry;
+
+	memset(msg->known_headers, 0, sizeof(msg->known_headers));
+	for (entry = msg->headers; entry; entry = entry->next)
+		sipmsg_index_header(msg, entry->data);
+}
+
+/*
+ * Move headers from the parsed header block to separate allocations
+ * before the header list is modified. Only needed for received messages
+ * that are reused to generate a response, i.e. once per message at most.
+ */
+static void sipmsg_headers_thaw(struct sipmsg *msg)
+{
+	GSList *entry;
+	GSList *headers = NULL;
+
+	if (!msg->header_block)
+		return;
+
+	for (entry = msg->headers; entry; entry = entry->next) {
+		struct sipnameval *elem = entry->data;
+		struct sipnameval *copy = g_new(struct sipnameval, 1);
+		copy->name  = g_strdup(elem->name);
+		copy->value = g_strdup(elem->value);
+		headers = g_slist_prepend(headers, copy);
+	}
+
+	g_free(msg->header_block);
+	msg->header_block = NULL;
+	msg->headers      = g_slist_reverse(headers);
+	sipmsg_index_headers(msg);
+}
+
+/*
+ * Parses the header lines into one allocation: an array of list nodes
+ * with name/value pairs, followed by a copy of the header text. Names
+ * and values are terminated in-place, folded lines are joined in-place.
+ *
+ * Same rules as sipe_utils_parse_lines(): a line with less than three
+ * characters ends the header, a line without ':' is an error, leading
+ * white space is removed from values and continuation lines.
+ */
+static gboolean sipmsg_parse_header_lines(struct sipmsg *msg,
+					  const gchar *header,
+					  gsize length,
+					  gchar **first_line)
+{
+	struct sipmsg_header *entries;
+	struct sipmsg_header *previous = NULL;
+	guint count = 1;
+	guint used  = 0;
+	const gchar *p;
+	gchar *line;
+	gchar *eol;
+
+	/* upper bound for number of headers */
+	for (p = header; (p = memchr(p, '\n', header + length - p)) != NULL; p++)
+		count++;
+
+	msg->header_block = g_malloc(count * sizeof(struct sipmsg_header) + length + 1);
+	entries = msg->header_block;
+	line = (gchar *) (entries + count);
+	memcpy(line, header, length);
+	line[length] = '\0';
+
+	/* request or status line */
+	*first_line = line;
+	eol = strstr(line, "\r\n");
+	if (eol) {
+		*eol = '\0';
+		line = eol + 2;
+	} else {
+		line = NULL;
+	}
+
+	while (line) {
+		gsize line_length;
+		gchar *colon;
+		gchar *value;
+		gchar *end;
+		gchar *next;
+
+		eol         = strstr(line, "\r\n");
+		line_length = eol ? (gsize) (eol - line) : strlen(line);
+		if (line_length <= 2)
+			break;
+
+		colon = memchr(line, ':', line_length);
+		if (!colon)
+			return(FALSE);
+		*colon = '\0';
+
+		end   = line + line_length;
+		value = colon + 1;
+		while ((value < end) && ((*value == ' ') || (*value == '\t')))
+			value++;
+
+		/* join folded lines with a single space */
+		next = eol ? eol + 2 : NULL;
+		while (next && ((*next == ' ') || (*next == '\t'))) {
+			gchar *continuation = next;
+			gsize continuation_length;
+
+			while ((*continuation == ' ') || (*continuation == '\t'))
+				continuation++;
+			eol = strstr(continuation, "\r\n");
+			continuation_length = eol ?
+				(gsize) (eol - continuation) :
+				strlen(continuation);
+
+			*end++ = ' ';
+			memmove(end, continuation, continuation_length);
+			end  += continuation_length;
+			next  = eol ? eol + 2 : NULL;
+		}
+		*end = '\0';
+
+		entries[used].nameval.name  = line;
+		entries[used].nameval.value = value;
+		entries[used].link.data     = &entries[used].nameval;
+		entries[used].link.next     = NULL;
+		if (previous)
+			previous->link.next = &entries[used].link;
+		else
+			msg->headers = &entries[used].link;
+		previous = &entries[used];
+		used++;
+
+		line = next;
+	}
+
+	sipmsg_index_headers(msg);
+	return(TRUE);
+}
+
+static struct sipmsg *sipmsg_parse_header_length(const gchar *header,
+						 gsize length)
+{
 	struct sipmsg *msg = g_new0(struct sipmsg,1);
-	gchar **lines = g_strsplit(header,"\r\n",0);
-	gchar **parts;
+	gchar *first_line;
+	gchar *part1;
+	gchar *part2;
 	const gchar *contentlength;
-	if(!lines[0]) {
-		g_strfreev(lines);
-		g_free(msg);
+
+	if (!sipmsg_parse_header_lines(msg, header, length, &first_line)) {
+		sipmsg_free(msg);
 		return NULL;
 	}
-	parts = g_strsplit(lines[0], " ", 3);
-	if(!parts[0] || !parts[1] || !parts[2]) {
-		g_strfreev(parts);
-		g_strfreev(lines);
-		g_free(msg);
+
+	/* "<part0> <part1> <part2...>" */
+	part1 = strchr(first_line, ' ');
+	part2 = part1 ? strchr(part1 + 1, ' ') : NULL;
+	if (!part2) {
+		sipmsg_free(msg);
 		return NULL;
 	}
-	if(strstr(parts[0],"SIP") || strstr(parts[0],"HTTP")) { /* numeric response */
-		msg->responsestr = g_strdup(parts[2]);
-		msg->response = strtol(parts[1],NULL,10);
+	*part1++ = '\0';
+	*part2++ = '\0';
+	if(strstr(first_line,"SIP") || strstr(first_line,"HTTP")) { /* numeric response */
+		msg->responsestr = g_strdup(part2);
+		msg->response = strtol(part1,NULL,10);
 	} else { /* request */
-		msg->method = g_strdup(parts[0]);
-		msg->target = g_strdup(parts[1]);
+		msg->method = g_strdup(first_line);
+		msg->target = g_strdup(part1);
 		msg->response = 0;
 	}
-	g_strfreev(parts);
-	if (sipe_utils_parse_lines(&msg->headers, lines + 1, ":") == FALSE) {
-		g_strfreev(lines);
-		sipmsg_free(msg);
-		return NULL;
-	}
-	g_strfreev(lines);
-	contentlength = sipmsg_find_header(msg, "Content-Length");
+
+	contentlength = msg->known_headers[SIPMSG_HEADER_CONTENT_LENGTH];
 	if (contentlength) {
 		msg->bodylen = strtol(contentlength,NULL,10);
 	} else {
-		const gchar *tmp = sipmsg_find_header(msg, "Transfer-Encoding");
+		const gchar *tmp = msg->known_headers[SIPMSG_HEADER_TRANSFER_ENCODING];
 		if (tmp && sipe_strcase_equal(tmp, "chunked")) {
 			msg->bodylen = SIPMSG_BODYLEN_CHUNKED;
 		} else {
-			tmp = sipmsg_find_header(msg, "Content-Type");
+			tmp = msg->known_headers[SIPMSG_HEADER_CONTENT_TYPE];
 			if (tmp) {
 				/*
 				 * This is a fatal error situation: the message
@@ -107,20 +277,125 @@ struct sipmsg *sipmsg_parse_header(const gchar *header) {
 		}
 	}
 	if(msg->response) {
-		const gchar *tmp;
-		tmp = sipmsg_find_header(msg, "CSeq");
+		const gchar *tmp = msg->known_headers[SIPMSG_HEADER_CSEQ];
 		if(!tmp) {
 			/* SHOULD NOT HAPPEN */
 			msg->method = 0;
 		} else {
-			parts = g_strsplit(tmp, " ", 2);
-			msg->method = g_strdup(parts[1]);
-			g_strfreev(parts);
+			tmp = strchr(tmp, ' ');
+			msg->method = tmp ? g_strdup(tmp + 1) : NULL;
 		}
 	}
 	return msg;
 }
 
+struct sipmsg *sipmsg_parse_msg(const gchar *msg) {
+	const char *tmp = strstr(msg, "\r\n\r\n");
+	struct sipmsg *smsg;
+
+	if(!tmp) return NULL;
+
+	smsg = sipmsg_parse_header_length(msg, tmp - msg);
+	if (smsg)
+		smsg->body = g_strdup(tmp + 4);
+
+	return smsg;
+}
+
+struct sipmsg *sipmsg_parse_header(const gchar *header) {
+	return(sipmsg_parse_header_length(header, strlen(header)));
+}
+
+struct sipmsg *sipmsg_framer_next(struct sipmsg_framer *framer,
+				  const gchar *buffer,
+				  gsize length,
+				  gsize *consumed)
+{
+	*consumed = 0;
+
+	while (!framer->msg) {
+		gsize scan = framer->scanned;
+		const gchar *end = NULL;
+
+		/* according to the RFC remove CRLF at the beginning */
+		if (scan == 0) {
+			while ((length > 0) &&
+			       ((*buffer == '\r') || (*buffer == '\n'))) {
+				buffer++;
+				length--;
+				(*consumed)++;
+			}
+		}
+
+		/* search for end of header, continuing where we left off */
+		if (scan < 3)
+			scan = 3;
+		while (scan < length) {
+			const gchar *lf = memchr(buffer + scan, '\n', length - scan);
+			if (!lf)
+				break;
+			if ((lf[-1] == '\r') && (lf[-2] == '\n') && (lf[-3] == '\r')) {
+				end = lf + 1;
+				break;
+			}
+			scan = lf - buffer + 1;
+		}
+
+		/* Received a full header? */
+		if (!end) {
+			framer->scanned = length;
+			return(NULL);
+		}
+
+		/* parse header once, excluding the empty line */
+		framer->header_length = end - buffer;
+		framer->msg = sipmsg_parse_header_length(buffer,
+							 framer->header_length - 2);
+
+		if (!framer->msg) {
+			SIPE_DEBUG_ERROR("sipmsg_framer_next: dropping corrupted header (%" G_GSIZE_FORMAT " bytes)",
+					 framer->header_length);
+			buffer          += framer->header_length;
+			length          -= framer->header_length;
+			*consumed       += framer->header_length;
+			framer->scanned  = 0;
+		}
+	}
+
+	/* Received the complete body? */
+	if (length - framer->header_length >= (gsize) framer->msg->bodylen) {
+		gsize bodylen = framer->msg->bodylen;
+		gchar *body   = g_malloc(bodylen + 1);
+
+		memcpy(body, buffer + framer->header_length, bodylen);
+		body[bodylen] = '\0';
+
+		*consumed += framer->header_length + bodylen;
+		return(sipmsg_framer_complete(framer, body));
+	}
+
+	return(NULL);
+}
+
+struct sipmsg *sipmsg_framer_complete(struct sipmsg_framer *framer,
+				      gchar *body)
+{
+	struct sipmsg *msg = framer->msg;
+
+	msg->body       = body;
+	framer->msg     = NULL;
+	framer->scanned = 0;
+	return(msg);
+}
+
+void sipmsg_framer_reset(struct sipmsg_framer *framer)
+{
+	sipmsg_free(framer->msg);
+	framer->msg           = NULL;
+	framer->scanned       = 0;
+	framer->header_length = 0;
+}
+
 struct sipmsg *sipmsg_copy(const struct sipmsg *other) {
 	struct sipmsg *msg = g_new0(struct sipmsg, 1);
 	GSList *list;
@@ -153,34 +428,106 @@ struct sipmsg *sipmsg_copy(const struct sipmsg *other) {
 	return msg;
 }
 
-char *sipmsg_to_string(const struct sipmsg *msg) {
+void sipmsg_vector_init(struct sipmsg_vector *vector, guint reserve)
+{
+	vector->fragments = g_array_sized_new(FALSE,
+					      FALSE,
+					      sizeof(struct sipe_transport_vector),
+					      reserve);
+	vector->length    = 0;
+	vector->status[0] = '\0';
+}
+
+void sipmsg_vector_append(struct sipmsg_vector *vector,
+			  const gchar *data,
+			  gsize length)
+{
+	struct sipe_transport_vector fragment;
+
+	if (!length)
+		return;
+
+	fragment.data   = data;
+	fragment.length = length;
+	g_array_append_val(vector->fragments, fragment);
+	vector->length += length;
+}
+
+#define SIPMSG_VECTOR_APPEND_STATIC(vector, s) \
+	sipmsg_vector_append(vector, s, sizeof(s) - 1)
+
+void sipmsg_vector_append_headers(struct sipmsg_vector *vector,
+				  const struct sipmsg *msg)
+{
 	GSList *cur;
-	GString *outstr = g_string_new("");
-	struct sipnameval *elem;
 
-	if(msg->response)
-		g_string_append_printf(outstr, "SIP/2.0 %d Unknown\r\n",
-			msg->response);
-	else
-		g_string_append_printf(outstr, "%s %s SIP/2.0\r\n",
-			msg->method, msg->target);
-
-	cur = msg->headers;
-	while(cur) {
-		elem = cur->data;
-                /*Todo: remove the LFCR in a good way*/
-                /*if(sipe_strequal(elem->name,"Proxy-Authorization"))
-                  g_string_append_printf(outstr, "%s: %s", elem->name,
-			elem->value);
-                else     */
-		   g_string_append_printf(outstr, "%s: %s\r\n", elem->name,
-			elem->value);
-		cur = g_slist_next(cur);
+	for (cur = msg->headers; cur; cur = g_slist_next(cur)) {
+		const struct sipnameval *elem = cur->data;
+		sipmsg_vector_append(vector, elem->name, strlen(elem->name));
+		SIPMSG_VECTOR_APPEND_STATIC(vector, ": ");
+		sipmsg_vector_append(vector, elem->value, strlen(elem->value));
+		SIPMSG_VECTOR_APPEND_STATIC(vector, "\r\n");
+	}
+}
+
+void sipmsg_to_vector(struct sipmsg_vector *vector, const struct sipmsg *msg)
+{
+	sipmsg_vector_init(vector, 4 * g_slist_length(msg->headers) + 6);
+
+	if (msg->response) {
+		g_snprintf(vector->status, sizeof(vector->status),
+			   "SIP/2.0 %d Unknown\r\n", msg->response);
+		sipmsg_vector_append(vector, vector->status, strlen(vector->status));
+	} else {
+		sipmsg_vector_append(vector, msg->method, strlen(msg->method));
+		SIPMSG_VECTOR_APPEND_STATIC(vector, " ");
+		sipmsg_vector_append(vector, msg->target, strlen(msg->target));
+		SIPMSG_VECTOR_APPEND_STATIC(vector, " SIP/2.0\r\n");
+	}
+
+	sipmsg_vector_append_headers(vector, msg);
+
+	SIPMSG_VECTOR_APPEND_STATIC(vector, "\r\n");
+	if (msg->bodylen && msg->body)
+		sipmsg_vector_append(vector, msg->body, strlen(msg->body));
+}
+
+gchar *sipmsg_vector_to_string(const struct sipmsg_vector *vector)
+{
+	gchar *string = g_malloc(vector->length + 1);
+	gchar *p = string;
+	guint i;
+
+	for (i = 0; i < vector->fragments->len; i++) {
+		const struct sipe_transport_vector *fragment =
+			&g_array_index(vector->fragments,
+				       struct sipe_transport_vector,
+				       i);
+		memcpy(p, fragment->data, fragment->length);
+		p += fragment->length;
 	}
+	*p = '\0';
 
-	g_string_append_printf(outstr, "\r\n%s", msg->bodylen ? msg->body : "");
+	return(string);
+}
 
-	return g_string_free(outstr, FALSE);
+void sipmsg_vector_clear(struct sipmsg_vector *vector)
+{
+	if (vector->fragments)
+		g_array_free(vector->fragments, TRUE);
+	vector->fragments = NULL;
+	vector->length    = 0;
+}
+
+char *sipmsg_to_string(const struct sipmsg *msg) {
+	struct sipmsg_vector vector;
+	gchar *string;
+
+	sipmsg_to_vector(&vector, msg);
+	string = sipmsg_vector_to_string(&vector);
+	sipmsg_vector_clear(&vector);
+
+	return(string);
 }
 
 /**
@@ -198,7 +545,9 @@ void sipmsg_add_header_now(struct sipmsg *msg, const gchar *name, const gchar *v
 
 	element->name = g_strdup(name);
 	element->value = g_strdup(value);
+	sipmsg_headers_thaw(msg);
 	msg->headers = g_slist_append(msg->headers, element);
+	sipmsg_index_header(msg, element);
 }
 
 /**
@@ -225,6 +574,7 @@ void sipmsg_strip_headers(struct sipmsg *msg, const gchar *keepers[]) {
 	GSList *entry;
 	struct sipnameval *elem;
 
+	sipmsg_headers_thaw(msg);
 	entry = msg->headers;
 	while(entry) {
 		int i = 0;
@@ -251,13 +601,17 @@ void sipmsg_strip_headers(struct sipmsg *msg, const gchar *keepers[]) {
 			entry = g_slist_next(entry);
 		}
 	}
+	sipmsg_index_headers(msg);
 }
 
 /**
  * Merges newly added headers to message
  */
 void sipmsg_merge_new_headers(struct sipmsg *msg) {
+	if (msg->new_headers)
+		sipmsg_headers_thaw(msg);
 	while(msg->new_headers) {
+		sipmsg_index_header(msg, msg->new_headers->data);
 		msg->headers = g_slist_append(msg->headers, msg->new_headers->data);
 		msg->new_headers = g_slist_remove(msg->new_headers, msg->new_headers->data);
 	}
@@ -265,7 +619,10 @@ void sipmsg_merge_new_headers(struct sipmsg *msg) {
 
 void sipmsg_free(struct sipmsg *msg) {
 	if (msg) {
-		sipe_utils_nameval_free(msg->headers);
+		if (msg->header_block)
+			g_free(msg->header_block);
+		else
+			sipe_utils_nameval_free(msg->headers);
 		sipe_utils_nameval_free(msg->new_headers);
 		g_free(msg->signature);
 		g_free(msg->rand);
@@ -280,7 +637,10 @@ void sipmsg_free(struct sipmsg *msg) {
 
 void sipmsg_remove_header_now(struct sipmsg *msg, const gchar *name) {
 	struct sipnameval *elem;
-	GSList *tmp = msg->headers;
+	GSList *tmp;
+
+	sipmsg_headers_thaw(msg);
+	tmp = msg->headers;
 	while(tmp) {
 		elem = tmp->data;
 		// OCS2005 can send the same header in either all caps or mixed case
@@ -289,6 +649,7 @@ void sipmsg_remove_header_now(struct sipmsg *msg, const gchar *name) {
 			g_free(elem->name);
 			g_free(elem->value);
 			g_free(elem);
+			sipmsg_index_headers(msg);
 			return;
 		}
 		tmp = g_slist_next(tmp);
@@ -297,10 +658,15 @@ void sipmsg_remove_header_now(struct sipmsg *msg, const gchar *name) {
 }
 
 const gchar *sipmsg_find_header(const struct sipmsg *msg, const gchar *name) {
-	return sipe_utils_nameval_find_instance (msg->headers, name, 0);
+	return sipmsg_find_header_instance(msg, name, 0);
 }
 
 const gchar *sipmsg_find_header_instance(const struct sipmsg *msg, const gchar *name, int which) {
+	if (name && (which == 0)) {
+		gint id = sipmsg_header_id(name, strlen(name));
+		if (id >= 0)
+			return msg->known_headers[id];
+	}
 	return sipe_utils_nameval_find_instance(msg->headers, name, which);
 }
 
@@ -3,7 +3,7 @@
  *
  * pidgin-sipe
  *
- * Copyright (C) 2010-2014 SIPE Project <http://sipe.sourceforge.net/>
+ * Copyright (C) 2010-2015 SIPE Project <http://sipe.sourceforge.net/>
  * Copyright (C) 2008 Novell, Inc.
  * Copyright (C) 2005, Thomas Butter <butter@uni-mannheim.de>
  *
@@ -31,6 +31,27 @@
 #define SIPMSG_RESPONSE_FATAL_ERROR -1
 #define SIPMSG_BODYLEN_CHUNKED      -1
 
+/**
+ * Well-known headers
+ *
+ * sipmsg_find_header() resolves these in O(1) instead of scanning the
+ * header list. Update the name table in sipmsg.c when adding new ones.
+ */
+enum sipmsg_header_id {
+	SIPMSG_HEADER_CALL_ID = 0,
+	SIPMSG_HEADER_CSEQ,
+	SIPMSG_HEADER_FROM,
+	SIPMSG_HEADER_TO,
+	SIPMSG_HEADER_VIA,
+	SIPMSG_HEADER_CONTACT,
+	SIPMSG_HEADER_CONTENT_LENGTH,
+	SIPMSG_HEADER_CONTENT_TYPE,
+	SIPMSG_HEADER_EVENT,
+	SIPMSG_HEADER_EXPIRES,
+	SIPMSG_HEADER_TRANSFER_ENCODING,
+	SIPMSG_HEADER_MAX /* must be last */
+};
+
 struct sipmsg {
 	int response; /* 0 means request, otherwise response code */
 	gchar *responsestr;
@@ -43,6 +64,27 @@ struct sipmsg {
 	gchar *signature;
 	gchar *rand;
 	gchar *num;
+
+	/*
+	 * private: for a parsed message the list nodes, names & values in
+	 * "headers" all live in this one block. Use only the sipmsg_*()
+	 * functions to modify "headers".
+	 */
+	gpointer header_block;
+	/* first instance of each well-known header or NULL */
+	const gchar *known_headers[SIPMSG_HEADER_MAX];
+};
+
+/**
+ * Scatter/gather list of message fragments
+ *
+ * Fragments are not copied, i.e. the list is only valid as long as the
+ * strings it was built from, e.g. the message, are unchanged.
+ */
+struct sipmsg_vector {
+	GArray *fragments;  /* struct sipe_transport_vector */
+	gsize length;       /* sum of all fragment lengths */
+	gchar status[32];   /* storage for generated status line */
 };
 
 struct sipendpoint {
@@ -50,10 +92,73 @@ struct sipendpoint {
 	gchar *epid;
 };
 
+/**
+ * Incremental SIP stream framer
+ *
+ * Keeps the state of a partially received message between transport
+ * input callbacks: the end-of-header scan position and, once the header
+ * is complete, the parsed header with the expected body length. Each
+ * received byte is therefore only examined once. Initialize to all zeros.
+ */
+struct sipmsg_framer {
+	struct sipmsg *msg;    /* parsed header while waiting for the body */
+	gsize scanned;         /* bytes already searched for end of header */
+	gsize header_length;   /* header length incl. empty line */
+};
+
 
 struct sipmsg *sipmsg_parse_msg(const gchar *msg);
 struct sipmsg *sipmsg_parse_header(const gchar *header);
 struct sipmsg *sipmsg_copy(const struct sipmsg *other);
+
+/**
+ * Extract next complete message from received stream data
+ *
+ * All offsets kept in the framer are relative to @c buffer, i.e. the
+ * caller must discard exactly @c consumed bytes from the start of its
+ * buffer before calling this function again.
+ *
+ * After a message has been returned @c framer->header_length holds the
+ * length of its header at the start of @c buffer.
+ *
+ * @param framer   (in/out) framer state
+ * @param buffer   (in)     unconsumed received data
+ * @param length   (in)     number of bytes in @c buffer
+ * @param consumed (out)    number of bytes to discard from @c buffer. Can
+ *                          be non-zero even if no message was returned.
+ *
+ * @return complete message or @c NULL if more data is needed.
+ *         Must be freed with sipmsg_free()
+ */
+struct sipmsg *sipmsg_framer_next(struct sipmsg_framer *framer,
+				  const gchar *buffer,
+				  gsize length,
+				  gsize *consumed);
+
+/**
+ * Complete pending message with a body received by the caller
+ *
+ * For a large body the caller can discard the header from its buffer as
+ * soon as the framer has parsed it, i.e. @c framer->msg is set. It then
+ * sets @c framer->header_length to 0, receives the body in place and hands
+ * it over with this function instead of letting sipmsg_framer_next() copy
+ * it.
+ *
+ * @param framer (in/out) framer state
+ * @param body   (in)     zero-terminated body of @c framer->msg->bodylen
+ *                        bytes. Ownership is transferred to the message.
+ *
+ * @return complete message. Must be freed with sipmsg_free()
+ */
+struct sipmsg *sipmsg_framer_complete(struct sipmsg_framer *framer,
+				      gchar *body);
+
+/**
+ * Discard partially received message in framer
+ *
+ * @param framer framer state
+ */
+void sipmsg_framer_reset(struct sipmsg_framer *framer);
 void sipmsg_add_header_now(struct sipmsg *msg, const gchar *name, const gchar *value);
 void sipmsg_add_header(struct sipmsg *msg, const gchar *name, const gchar *value);
 void sipmsg_strip_headers(struct sipmsg *msg, const gchar *keepers[]);
@@ -92,6 +197,59 @@ const gchar *sipmsg_find_auth_header(struct sipmsg *msg, const gchar *name);
 void sipmsg_remove_header_now(struct sipmsg *msg, const gchar *name);
 char *sipmsg_to_string(const struct sipmsg *msg);
 
+/**
+ * Initialize empty scatter/gather list
+ *
+ * @param vector   scatter/gather list
+ * @param reserve  expected number of fragments
+ */
+void sipmsg_vector_init(struct sipmsg_vector *vector, guint reserve);
+
+/**
+ * Add fragment to scatter/gather list. Data is not copied!
+ *
+ * @param vector scatter/gather list
+ * @param data   fragment data
+ * @param length fragment length
+ */
+void sipmsg_vector_append(struct sipmsg_vector *vector,
+			  const gchar *data,
+			  gsize length);
+
+/**
+ * Add all headers of a message as "name: value" lines
+ *
+ * @param vector scatter/gather list
+ * @param msg    SIP message
+ */
+void sipmsg_vector_append_headers(struct sipmsg_vector *vector,
+				  const struct sipmsg *msg);
+
+/**
+ * Scatter/gather version of sipmsg_to_string()
+ *
+ * @param vector (out) scatter/gather list. Must be released with
+ *                     sipmsg_vector_clear()
+ * @param msg    (in)  SIP message
+ */
+void sipmsg_to_vector(struct sipmsg_vector *vector, const struct sipmsg *msg);
+
+/**
+ * Join fragments of scatter/gather list
+ *
+ * @param vector scatter/gather list
+ *
+ * @return joined string. Must be g_free()'d after use.
+ */
+gchar *sipmsg_vector_to_string(const struct sipmsg_vector *vector);
+
+/**
+ * Release scatter/gather list
+ *
+ * @param vector scatter/gather list
+ */
+void sipmsg_vector_clear(struct sipmsg_vector *vector);
+
 /**
  * Formats message to html if not yet.
  * Either - keep as is if text/html, or escape text, or escape text and apply format string if any
@@ -37,6 +37,9 @@
 extern HANDLE sipe_miranda_incoming_netlibuser;
 extern CRITICAL_SECTION sipe_miranda_debug_CriticalSection;
 
+/* sipe_backend_debug_enabled() is always TRUE */
+guint sipe_backend_debug_categories = SIPE_DEBUG_CATEGORY_ALL;
+
 void sipe_backend_debug_literal(sipe_debug_level level,
 				const gchar *message)
 {
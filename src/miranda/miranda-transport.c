@@ -101,12 +101,7 @@ miranda_sipe_input_cb(gpointer data,
 
 	do {
 		/* Increase input buffer size as needed */
-		if (conn->buffer_length < conn->buffer_used + BUFFER_SIZE_INCREMENT) {
-			conn->buffer_length += BUFFER_SIZE_INCREMENT;
-			conn->buffer = g_realloc(conn->buffer, conn->buffer_length);
-			SIPE_DEBUG_INFO("miranda_sipe_input_cb: new buffer length %" G_GSIZE_FORMAT,
-					conn->buffer_length);
-		}
+		sipe_core_transport_buffer_reserve(conn, BUFFER_SIZE_INCREMENT);
 
 		/* Try to read as much as there is space left in the buffer */
 		/* minus 1 for the string terminator */
@@ -199,28 +194,48 @@ void sipe_backend_transport_disconnect(struct sipe_transport_connection *conn)
 	if (transport->inputhandler)
 		sipe_miranda_input_remove(transport->inputhandler);
 
-	g_free(transport->public.buffer);
+	sipe_core_transport_buffer_free(&transport->public);
 	g_free(transport);
 }
 
-void sipe_backend_transport_message(struct sipe_transport_connection *conn,
-				    const gchar *buffer)
+static gboolean transport_send(struct sipe_transport_miranda *transport,
+			       const gchar *buffer,
+			       gsize length)
 {
-	struct sipe_transport_miranda *transport = MIRANDA_TRANSPORT;
-	guint written = 0;
+	gsize written = 0;
 
-	do {
-		int len = Netlib_Send(transport->fd, buffer + written, strlen(buffer + written), MSG_NODUMP);
+	while (written < length) {
+		int len = Netlib_Send(transport->fd, buffer + written, length - written, MSG_NODUMP);
 
 		if (len == SOCKET_ERROR) {
 			SIPE_DEBUG_INFO_NOFORMAT("sipe_backend_transport_message: error, exiting");
 			transport->error(SIPE_TRANSPORT_CONNECTION,
 					 "Write error");
-			return;
+			return(FALSE);
 		}
 
 		written += len;
-	} while (written < strlen(buffer));
+	}
+
+	return(TRUE);
+}
+
+void sipe_backend_transport_message(struct sipe_transport_connection *conn,
+				    const gchar *buffer)
+{
+	transport_send(MIRANDA_TRANSPORT, buffer, strlen(buffer));
+}
+
+void sipe_backend_transport_message_vector(struct sipe_transport_connection *conn,
+					   const struct sipe_transport_vector *vector,
+					   guint count)
+{
+	struct sipe_transport_miranda *transport = MIRANDA_TRANSPORT;
+	guint i;
+
+	for (i = 0; i < count; i++)
+		if (!transport_send(transport, vector[i].data, vector[i].length))
+			return;
 }
 
 void sipe_backend_transport_flush(struct sipe_transport_connection *conn)
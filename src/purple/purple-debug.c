@@ -23,9 +23,15 @@
 #include <stdarg.h>
 
 #include "glib.h"
+#include "connection.h"
 #include "debug.h"
+#include "prefs.h"
 
 #include "sipe-backend.h"
+#include "sipe-common.h"
+#include "sipe-core.h"
+
+#include "purple-private.h"
 
 #ifdef ADIUM
 /*
@@ -40,6 +46,69 @@ gboolean AIDebugLoggingIsEnabled(void);
 #define SIPE_PURPLE_DEBUG_IS_ENABLED purple_debug_is_enabled()
 #endif
 
+/*
+ * "transport http ..." limits output to these categories. The preference
+ * can be changed at runtime, e.g. with "/pref set" or over D-Bus. The
+ * SIPE_DEBUG environment variable is used when the preference is empty.
+ */
+#define SIPE_PURPLE_PREFS                  "/plugins/prpl/sipe"
+#define SIPE_PURPLE_PREF_DEBUG_CATEGORIES  SIPE_PURPLE_PREFS "/debug_categories"
+
+guint sipe_backend_debug_categories = 0;
+static guint debug_categories = 0;
+
+static void debug_categories_set(const gchar *names)
+{
+	debug_categories = sipe_core_debug_categories(names);
+	if (!debug_categories)
+		debug_categories = sipe_core_debug_categories(g_getenv("SIPE_DEBUG"));
+	if (!debug_categories)
+		debug_categories = SIPE_DEBUG_CATEGORY_ALL;
+}
+
+static void debug_categories_changed_cb(SIPE_UNUSED_PARAMETER const char *name,
+					SIPE_UNUSED_PARAMETER PurplePrefType type,
+					gconstpointer value,
+					SIPE_UNUSED_PARAMETER gpointer data)
+{
+	debug_categories_set(value);
+	sipe_purple_debug_update();
+}
+
+void sipe_purple_debug_init(PurplePlugin *plugin)
+{
+	purple_prefs_add_none(SIPE_PURPLE_PREFS);
+	purple_prefs_add_string(SIPE_PURPLE_PREF_DEBUG_CATEGORIES, "");
+	purple_prefs_connect_callback(plugin,
+				      SIPE_PURPLE_PREF_DEBUG_CATEGORIES,
+				      debug_categories_changed_cb,
+				      NULL);
+
+	debug_categories_set(purple_prefs_get_string(SIPE_PURPLE_PREF_DEBUG_CATEGORIES));
+	sipe_purple_debug_update();
+}
+
+void sipe_purple_debug_shutdown(PurplePlugin *plugin)
+{
+	purple_prefs_disconnect_by_handle(plugin);
+}
+
+/*
+ * libpurple has no notification when debugging is switched on or off.
+ * Therefore the cached status is refreshed on plugin load, login, when
+ * network data is received and when the categories preference changes.
+ */
+void sipe_purple_debug_update(void)
+{
+	/* e.g. tests, where the plugin isn't loaded */
+	if (!debug_categories)
+		debug_categories_set(NULL);
+
+	sipe_backend_debug_categories = SIPE_PURPLE_DEBUG_IS_ENABLED ?
+		debug_categories :
+		0;
+}
+
 void sipe_backend_debug_literal(sipe_debug_level level,
 				const gchar *msg)
 {
@@ -42,6 +42,7 @@
 #include "win32/win32dep.h"
 #endif
 
+#define SIPE_DEBUG_CATEGORY SIPE_DEBUG_CATEGORY_MEDIA
 #include "sipe-backend.h"
 #include "sipe-core.h"
 
@@ -363,6 +363,12 @@ static gboolean get_dont_publish_flag(PurpleAccount *account)
 	return(purple_account_get_bool(account, "dont-publish", FALSE));
 }
 
+static gboolean get_webticket_cache_flag(PurpleAccount *account)
+{
+	/* default is to keep Web Tickets only in memory */
+	return(purple_account_get_bool(account, "webticket-cache", FALSE));
+}
+
 static void connect_to_core(PurpleConnection *gc,
 			    PurpleAccount *account,
 			    const gchar *password)
@@ -408,6 +414,10 @@ static void connect_to_core(PurpleConnection *gc,
 	if (get_dont_publish_flag(account))
 		SIPE_CORE_FLAG_SET(DONT_PUBLISH);
 
+	SIPE_CORE_FLAG_UNSET(WEBTICKET_CACHE);
+	if (get_webticket_cache_flag(account))
+		SIPE_CORE_FLAG_SET(WEBTICKET_CACHE);
+
 	purple_connection_set_protocol_data(gc, sipe_public);
 	purple_connection_set_flags(gc,
 				    purple_connection_get_flags(gc) |
@@ -488,6 +498,8 @@ void sipe_purple_login(PurpleAccount *account)
 	PurpleConnection *gc = purple_account_get_connection(account);
 	const gchar *password = purple_connection_get_password(gc);
 
+	sipe_purple_debug_update();
+
 	/* Password required? */
 	if (sipe_core_transport_sip_requires_password(get_authentication_type(account),
 						      get_sso_flag(account)) &&
@@ -642,7 +654,7 @@ PurpleMediaCaps sipe_purple_get_media_caps(SIPE_UNUSED_PARAMETER PurpleAccount *
 #endif
 
 /* PurplePluginInfo function calls & data structure */
-gboolean sipe_purple_plugin_load(SIPE_UNUSED_PARAMETER PurplePlugin *plugin)
+gboolean sipe_purple_plugin_load(PurplePlugin *plugin)
 {
 #ifdef HAVE_VV
 	struct sigaction action;
@@ -652,11 +664,12 @@ gboolean sipe_purple_plugin_load(SIPE_UNUSED_PARAMETER PurplePlugin *plugin)
 #endif
 
 	sipe_purple_activity_init();
+	sipe_purple_debug_init(plugin);
 
 	return TRUE;
 }
 
-gboolean sipe_purple_plugin_unload(SIPE_UNUSED_PARAMETER PurplePlugin *plugin)
+gboolean sipe_purple_plugin_unload(PurplePlugin *plugin)
 {
 #ifdef HAVE_VV
 	struct sigaction action;
@@ -665,6 +678,7 @@ gboolean sipe_purple_plugin_unload(SIPE_UNUSED_PARAMETER PurplePlugin *plugin)
 	sigaction(SIGUSR1, &action, NULL);
 #endif
 
+	sipe_purple_debug_shutdown(plugin);
 	sipe_purple_activity_shutdown();
 
 	return TRUE;
@@ -907,6 +921,13 @@ GList * sipe_purple_account_options()
 	option = purple_account_option_bool_new(_("Don't publish my calendar information"), "dont-publish", FALSE);
 	options = g_list_append(options, option);
 
+	/*
+	 * Web Tickets are encrypted with a key derived from the password,
+	 * i.e. this isn't supported with Single Sign-On.
+	 */
+	option = purple_account_option_bool_new(_("Cache Web Tickets on disk"), "webticket-cache", FALSE);
+	options = g_list_append(options, option);
+
 	option = purple_account_option_string_new(_("Email services URL\n(leave empty for auto-discovery)"), "email_url", "");
 	options = g_list_append(options, option);
 
@@ -170,6 +170,11 @@ void sipe_purple_set_status(struct _PurpleAccount *account,
 void sipe_purple_set_idle(struct _PurpleConnection *gc,
 			  int interval);
 
+/* debug */
+void sipe_purple_debug_init(PurplePlugin *plugin);
+void sipe_purple_debug_shutdown(PurplePlugin *plugin);
+void sipe_purple_debug_update(void);
+
 /* media */
 void capture_pipeline(const gchar *label);
 
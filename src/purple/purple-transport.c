@@ -103,15 +103,13 @@ static void transport_common_input(struct sipe_transport_purple *transport)
 	gssize readlen, len;
 	gboolean firstread = TRUE;
 
+	/* pick up changes of the debugging status */
+	sipe_purple_debug_update();
+
 	/* Read all available data from the connection */
 	do {
 		/* Increase input buffer size as needed */
-		if (conn->buffer_length < conn->buffer_used + BUFFER_SIZE_INCREMENT) {
-			conn->buffer_length += BUFFER_SIZE_INCREMENT;
-			conn->buffer = g_realloc(conn->buffer, conn->buffer_length);
-			SIPE_DEBUG_INFO("transport_input_common: new buffer length %" G_GSIZE_FORMAT,
-					conn->buffer_length);
-		}
+		sipe_core_transport_buffer_reserve(conn, BUFFER_SIZE_INCREMENT);
 
 		/* Try to read as much as there is space left in the buffer */
 		/* minus 1 for the string terminator */
@@ -343,7 +341,7 @@ void sipe_backend_transport_disconnect(struct sipe_transport_connection *conn)
 #else
 		purple_circ_buffer_destroy(transport->transmit_buffer);
 #endif
-	g_free(transport->public.buffer);
+	sipe_core_transport_buffer_free(SIPE_TRANSPORT_CONNECTION);
 
 	/* defer deletion of transport data structure to idle callback */
 	transport->is_valid = FALSE;
@@ -408,12 +406,26 @@ static void transport_canwrite_cb(gpointer data,
 
 void sipe_backend_transport_message(struct sipe_transport_connection *conn,
 				    const gchar *buffer)
+{
+	struct sipe_transport_vector vector;
+
+	vector.data   = buffer;
+	vector.length = strlen(buffer);
+	sipe_backend_transport_message_vector(conn, &vector, 1);
+}
+
+void sipe_backend_transport_message_vector(struct sipe_transport_connection *conn,
+					   const struct sipe_transport_vector *vector,
+					   guint count)
 {
 	struct sipe_transport_purple *transport = PURPLE_TRANSPORT;
+	guint i;
 
-	/* add packet to circular buffer */
-	purple_circular_buffer_append(transport->transmit_buffer,
-				      buffer, strlen(buffer));
+	/* add packet fragments to circular buffer */
+	for (i = 0; i < count; i++)
+		purple_circular_buffer_append(transport->transmit_buffer,
+					      vector[i].data,
+					      vector[i].length);
 
 	/* initiate transmission */
 	if (!transport->transmit_handler) {
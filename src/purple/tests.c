@@ -49,6 +49,7 @@ void sipe_core_user_ask_cb(SIPE_UNUSED_PARAMETER gpointer key,
 }
 
 gboolean sip_sec_ntlm_tests(void);
+void sipe_purple_debug_update(void);
 
 int main()
 {
@@ -56,6 +57,7 @@ int main()
 	purple_signals_init();
 	purple_debug_init();
 	purple_debug_set_enabled(TRUE);
+	sipe_purple_debug_update();
 #if !PURPLE_VERSION_CHECK(3,0,0)
 	purple_ciphers_init();
 #endif
@@ -76,6 +76,7 @@ typedef struct _SipeConnection {
 	gchar *authentication;
 	gboolean sso;
 	gboolean dont_publish;
+	gboolean webticket_cache;
 	gboolean is_disconnecting;
 
 	GPtrArray *contact_info_fields;
@@ -190,6 +191,10 @@ static gboolean connect_to_core(SipeConnection *self,
 		if (self->dont_publish)
 			SIPE_CORE_FLAG_SET(DONT_PUBLISH);
 
+		SIPE_CORE_FLAG_UNSET(WEBTICKET_CACHE);
+		if (self->webticket_cache)
+			SIPE_CORE_FLAG_SET(WEBTICKET_CACHE);
+
 		sipe_core_transport_sip_connect(sipe_public,
 						self->transport,
 						self->authentication_type,
@@ -775,6 +780,13 @@ TpBaseConnection *sipe_telepathy_connection_new(TpBaseProtocol *protocol,
 	else
 		conn->dont_publish = FALSE;
 
+	/* Cache Web Tickets on disk */
+	boolean_value = tp_asv_get_boolean(params, "webticket-cache", &valid);
+	if (valid)
+		conn->webticket_cache = boolean_value;
+	else
+		conn->webticket_cache = FALSE;
+
 	return(TP_BASE_CONNECTION(conn));
 }
 
@@ -40,6 +40,8 @@
  *    all        - enable all sipe & telepathy-glib messages
  *    sipe       - enable only sipe messages
  *    "sipe ..." - enable sipe and some telepathy-glib messages
+ *    "sipe transport http xml presence media core"
+ *               - enable only sipe messages from these categories
  *
  * SIPE_TIMING=1       : enable time stamps
  *                       [recommeded for any usable log file]
@@ -57,6 +59,7 @@
 #include <telepathy-glib/telepathy-glib.h>
 
 #include "sipe-backend.h"
+#include "sipe-core.h"
 
 #include "telepathy-private.h"
 
@@ -65,6 +68,8 @@
 static TpDebugSender *debug;
 static guint          flags = 0;
 
+guint sipe_backend_debug_categories = 0;
+
 void sipe_telepathy_debug_init(void)
 {
 	static const GDebugKey const keys[] = {
@@ -87,6 +92,11 @@ void sipe_telepathy_debug_init(void)
 	/* sipe & telepathy-glib debugging flags */
 	if (env_flags) flags |= g_parse_debug_string(env_flags, keys, 1);
 	tp_debug_set_flags(env_flags);
+	if (flags & SIPE_TELEPATHY_DEBUG) {
+		sipe_backend_debug_categories = sipe_core_debug_categories(env_flags);
+		if (!sipe_backend_debug_categories)
+			sipe_backend_debug_categories = SIPE_DEBUG_CATEGORY_ALL;
+	}
 
 	/* add time stamps to debug output */
 	if (g_getenv("SIPE_TIMING"))
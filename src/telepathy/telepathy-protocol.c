@@ -171,6 +171,12 @@ static const TpCMParamSpec *get_parameters(SIPE_UNUSED_PARAMETER TpBaseProtocol
 					TP_CONN_MGR_PARAM_FLAG_HAS_DEFAULT,
 					GINT_TO_POINTER(FALSE),
 					NULL),
+		SIPE_PROTOCOL_PARAMETER("webticket-cache",
+					DBUS_TYPE_BOOLEAN_AS_STRING,
+					G_TYPE_BOOLEAN,
+					TP_CONN_MGR_PARAM_FLAG_HAS_DEFAULT,
+					GINT_TO_POINTER(FALSE),
+					NULL),
 		SIPE_PROTOCOL_PARAMETER(NULL, NULL, 0, 0, NULL, NULL)
 	};
 
@@ -70,12 +70,7 @@ static void read_completed(GObject *stream,
 	struct sipe_transport_connection *conn = SIPE_TRANSPORT_CONNECTION;
 
 	do {
-		if (conn->buffer_length < conn->buffer_used + BUFFER_SIZE_INCREMENT) {
-			conn->buffer_length += BUFFER_SIZE_INCREMENT;
-			conn->buffer = g_realloc(conn->buffer, conn->buffer_length);
-			SIPE_DEBUG_INFO("read_completed: new buffer length %" G_GSIZE_FORMAT,
-					conn->buffer_length);
-		}
+		sipe_core_transport_buffer_reserve(conn, BUFFER_SIZE_INCREMENT);
 
 		/* callback result is valid */
 		if (result) {
@@ -327,6 +322,8 @@ static gboolean free_transport(gpointer data)
 		g_free(entry->data);
 	g_slist_free(transport->buffers);
 
+	sipe_core_transport_buffer_free(SIPE_TRANSPORT_CONNECTION);
+
 	if (transport->cancel)
 		g_object_unref(transport->cancel);
 
@@ -469,6 +466,20 @@ void sipe_backend_transport_message(struct sipe_transport_connection *conn,
 		do_write(transport, buffer);
 }
 
+void sipe_backend_transport_message_vector(struct sipe_transport_connection *conn,
+					   const struct sipe_transport_vector *vector,
+					   guint count)
+{
+	/* GIO writes one buffer at a time: join fragments */
+	GString *buffer = g_string_new("");
+	guint i;
+
+	for (i = 0; i < count; i++)
+		g_string_append_len(buffer, vector[i].data, vector[i].length);
+	sipe_backend_transport_message(conn, buffer->str);
+	g_string_free(buffer, TRUE);
+}
+
 void sipe_backend_transport_flush(struct sipe_transport_connection *conn)
 {
 	struct sipe_transport_telepathy *transport = TELEPATHY_TRANSPORT;